@@ -0,0 +1,776 @@
+#include "Animation.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CPU.h"
+#include "EasyAvatar.h"
+#include "ImageIO.h"
+#include "ImageProbe.h"
+#include "Resample.h"
+#include "ThreadPool.h"
+#include "Worker.h"
+
+// What happens to a frame's area before the next frame gets drawn
+#define EASYAVATAR_GIF_DISPOSAL_UNSPECIFIED 0
+#define EASYAVATAR_GIF_DISPOSAL_LEAVE 1
+#define EASYAVATAR_GIF_DISPOSAL_BACKGROUND 2
+#define EASYAVATAR_GIF_DISPOSAL_PREVIOUS 3
+// Palette index reserved for transparent pixels
+#define EASYAVATAR_GIF_TRANSPARENT_INDEX 255
+// Bits per channel of the color to palette index lookup table
+#define EASYAVATAR_GIF_LOOKUP_BITS 6
+#define EASYAVATAR_GIF_LOOKUP_SIZE (1 << (3 * EASYAVATAR_GIF_LOOKUP_BITS))
+// Pixels per row of the image the shared palette gets quantized from
+#define EASYAVATAR_GIF_SAMPLE_WIDTH 1024
+// Largest summed difference per pixel, accumulated since the last shown frame, up to which frames get merged.
+// Every attempt that doesn't fit the budget moves on to the next level, the first one only merges exact duplicates
+static const unsigned int EASYAVATAR_GIF_MERGE_LEVELS[] = { 0, 2, 4, 8, 16, 32 };
+
+struct EasyAvatar_AnimationFrame
+{
+	// Played back frame at the original size, freed once it has been resized
+	BYTE* canvas;
+	// Resized 32 bit pixels with binary alpha, freed once they have been indexed
+	BYTE* pixels;
+	// Palette indices of pixels
+	BYTE* indices;
+	// Sum of absolute differences of pixels to the previous frame
+	UINT64 difference;
+	DWORD delay;
+};
+
+/*
+	A frame that ends up in the output, cropped to what changed since the previous output frame.
+*/
+struct EasyAvatar_OutputFrame
+{
+	unsigned int frame;
+	// Delays of every frame merged into this one
+	DWORD delay;
+	FIBITMAP* dib;
+	unsigned int left;
+	unsigned int top;
+};
+
+struct EasyAvatar_Animation
+{
+	// Logical screen size of the original and the resized animation
+	unsigned int width;
+	unsigned int height;
+	unsigned int targetW;
+	unsigned int targetH;
+	DWORD loop;
+	unsigned int frameCount;
+	struct EasyAvatar_AnimationFrame* frames;
+	// First frame of the batch that's being resized
+	unsigned int batchStart;
+	// Set by the parallel tasks
+	volatile LONG transparent;
+	volatile LONG failed;
+	RGBQUAD palette[256];
+	unsigned int paletteSize;
+	BYTE* lookup;
+	struct EasyAvatar_OutputFrame* output;
+	unsigned int outputCount;
+};
+
+static BOOL EasyAvatar_ParseAnimationHeader(const BYTE* header, unsigned int* width, unsigned int* height)
+{
+	if (memcmp(header, "GIF87a", 6) != 0 && memcmp(header, "GIF89a", 6) != 0)
+		return FALSE;
+
+	*width = header[6] | (header[7] << 8);
+	*height = header[8] | (header[9] << 8);
+	return *width > 0 && *height > 0;
+}
+
+static DWORD EasyAvatar_GetAnimationValue(FIBITMAP* dib, const char* key, DWORD fallback)
+{
+	FITAG* tag = NULL;
+	if (!FreeImage_GetMetadata(FIMD_ANIMATION, dib, key, &tag) || !tag || !FreeImage_GetTagValue(tag))
+		return fallback;
+
+	const void* value = FreeImage_GetTagValue(tag);
+	switch (FreeImage_GetTagType(tag))
+	{
+	case FIDT_BYTE: return *(const BYTE*)value;
+	case FIDT_SHORT: return *(const WORD*)value;
+	case FIDT_LONG: return *(const DWORD*)value;
+	default: return fallback;
+	}
+}
+
+static BOOL EasyAvatar_SetAnimationValue(FIBITMAP* dib, const char* key, FREE_IMAGE_MDTYPE type, DWORD count, const void* value)
+{
+	FITAG* tag = FreeImage_CreateTag();
+	if (!tag)
+		return FALSE;
+
+	DWORD elementSize = type == FIDT_BYTE ? 1 : (type == FIDT_SHORT ? 2 : 4);
+	BOOL stored = FreeImage_SetTagKey(tag, key)
+		&& FreeImage_SetTagType(tag, type)
+		&& FreeImage_SetTagCount(tag, count)
+		&& FreeImage_SetTagLength(tag, count * elementSize)
+		&& FreeImage_SetTagValue(tag, value)
+		&& FreeImage_SetMetadata(FIMD_ANIMATION, dib, key, tag);
+
+	// SetMetadata keeps its own copy
+	FreeImage_DeleteTag(tag);
+	return stored;
+}
+
+static void EasyAvatar_DrawFrame(struct EasyAvatar_Animation* animation, BYTE* canvas, FIBITMAP* frame, unsigned int left, unsigned int top)
+{
+	unsigned int frameW = FreeImage_GetWidth(frame);
+	unsigned int frameH = FreeImage_GetHeight(frame);
+
+	// FreeImage stores rows bottom up, the canvas does the same, frame offsets count from the top
+	for (unsigned int row = 0; row < frameH && top + row < animation->height; row++)
+	{
+		const BYTE* source = FreeImage_GetScanLine(frame, frameH - 1 - row);
+		BYTE* target = canvas + (size_t)(animation->height - 1 - top - row) * animation->width * 4;
+		for (unsigned int x = 0; x < frameW && left + x < animation->width; x++)
+		{
+			if (source[x * 4 + FI_RGBA_ALPHA])
+				memcpy(target + (size_t)(left + x) * 4, source + x * 4, 4);
+		}
+	}
+}
+
+static void EasyAvatar_ClearRect(struct EasyAvatar_Animation* animation, BYTE* canvas, unsigned int left, unsigned int top, unsigned int width, unsigned int height)
+{
+	if (left >= animation->width)
+		return;
+	if (width > animation->width - left)
+		width = animation->width - left;
+
+	for (unsigned int row = 0; row < height && top + row < animation->height; row++)
+		memset(canvas + ((size_t)(animation->height - 1 - top - row) * animation->width + left) * 4, 0, (size_t)width * 4);
+}
+
+static void EasyAvatar_ResizeFrame(unsigned int index, void* context)
+{
+	struct EasyAvatar_Animation* animation = (struct EasyAvatar_Animation*)context;
+	struct EasyAvatar_AnimationFrame* frame = &animation->frames[animation->batchStart + index];
+	size_t pixelCount = (size_t)animation->targetW * animation->targetH;
+
+	if (animation->targetW == animation->width && animation->targetH == animation->height)
+	{
+		// Already small enough, only too large a file brought us here. The played back frame is used as it is
+		frame->pixels = frame->canvas;
+		frame->canvas = NULL;
+	}
+	else
+	{
+		frame->pixels = (BYTE*)malloc(pixelCount * 4);
+		if (!frame->pixels || !EasyAvatar_ResamplePixels(frame->canvas, animation->width, animation->height, (size_t)animation->width * 4,
+			frame->pixels, animation->targetW, animation->targetH, (size_t)animation->targetW * 4, 4, EASYAVATAR_FILTER_LANCZOS3))
+		{
+			InterlockedExchange(&animation->failed, TRUE);
+			return;
+		}
+
+		free(frame->canvas);
+		frame->canvas = NULL;
+	}
+
+	// Transparent pixels are all zero, so the resampled colors come out premultiplied.
+	// Undo that and make alpha binary again, GIF only knows fully transparent pixels
+	BOOL transparent = FALSE;
+	for (size_t i = 0; i < pixelCount; i++)
+	{
+		BYTE* pixel = frame->pixels + i * 4;
+		unsigned int alpha = pixel[FI_RGBA_ALPHA];
+		if (alpha < 128)
+		{
+			memset(pixel, 0, 4);
+			transparent = TRUE;
+		}
+		else if (alpha < 255)
+		{
+			for (unsigned int channel = 0; channel < 4; channel++)
+			{
+				if (channel == FI_RGBA_ALPHA)
+					continue;
+				unsigned int value = pixel[channel] * 255 / alpha;
+				pixel[channel] = (BYTE)(value > 255 ? 255 : value);
+			}
+			pixel[FI_RGBA_ALPHA] = 255;
+		}
+	}
+
+	if (transparent)
+		InterlockedExchange(&animation->transparent, TRUE);
+}
+
+static BOOL EasyAvatar_ResizeBatch(struct EasyAvatar_Animation* animation, unsigned int end)
+{
+	EasyAvatar_ParallelFor(end - animation->batchStart, EasyAvatar_ResizeFrame, animation);
+	animation->batchStart = end;
+	return !animation->failed;
+}
+
+/*
+	Plays the animation back frame by frame, which can't be parallelized as every frame builds on the previous ones.
+	Played back frames get resized in parallel batches so only a few of them are kept around at full size,
+	as many as fit into EASYAVATAR_GIF_BATCH_PIXELS but no more than the pool can keep busy.
+*/
+static BOOL EasyAvatar_PlayAnimation(struct EasyAvatar_Animation* animation, FIMULTIBITMAP* multiBitmap)
+{
+	size_t canvasSize = (size_t)animation->width * animation->height * 4;
+	BYTE* canvas = (BYTE*)calloc(canvasSize, 1);
+	BYTE* previous = (BYTE*)malloc(canvasSize);
+	UINT64 batchFrames = EASYAVATAR_GIF_BATCH_PIXELS / ((UINT64)animation->width * animation->height);
+	unsigned int batchSize = EasyAvatar_GetParallelism() * 2;
+	if (batchFrames < batchSize)
+		batchSize = batchFrames > 0 ? (unsigned int)batchFrames : 1;
+	BOOL played = canvas && previous;
+
+	for (unsigned int i = 0; played && i < animation->frameCount; i++)
+	{
+		if (EasyAvatar_IsJobCancelled())
+		{
+			played = FALSE;
+			break;
+		}
+
+		FIBITMAP* page = FreeImage_LockPage(multiBitmap, (int)i);
+		if (!page)
+		{
+			played = FALSE;
+			break;
+		}
+
+		unsigned int left = EasyAvatar_GetAnimationValue(page, "FrameLeft", 0);
+		unsigned int top = EasyAvatar_GetAnimationValue(page, "FrameTop", 0);
+		DWORD disposal = EasyAvatar_GetAnimationValue(page, "DisposalMethod", EASYAVATAR_GIF_DISPOSAL_LEAVE);
+		animation->frames[i].delay = EasyAvatar_GetAnimationValue(page, "FrameTime", EASYAVATAR_GIF_DEFAULT_DELAY);
+		// Expands the palette, transparent pixels get an alpha of 0
+		FIBITMAP* frame = FreeImage_ConvertTo32Bits(page);
+		FreeImage_UnlockPage(multiBitmap, page, FALSE);
+		if (!frame)
+		{
+			played = FALSE;
+			break;
+		}
+
+		if (disposal == EASYAVATAR_GIF_DISPOSAL_PREVIOUS)
+			memcpy(previous, canvas, canvasSize);
+
+		EasyAvatar_DrawFrame(animation, canvas, frame, left, top);
+		animation->frames[i].canvas = (BYTE*)malloc(canvasSize);
+		if (animation->frames[i].canvas)
+			memcpy(animation->frames[i].canvas, canvas, canvasSize);
+		else
+			played = FALSE;
+
+		if (disposal == EASYAVATAR_GIF_DISPOSAL_BACKGROUND)
+			EasyAvatar_ClearRect(animation, canvas, left, top, FreeImage_GetWidth(frame), FreeImage_GetHeight(frame));
+		else if (disposal == EASYAVATAR_GIF_DISPOSAL_PREVIOUS)
+			memcpy(canvas, previous, canvasSize);
+		FreeImage_Unload(frame);
+
+		if (played && (i + 1 - animation->batchStart == batchSize || i + 1 == animation->frameCount))
+			played = EasyAvatar_ResizeBatch(animation, i + 1);
+	}
+
+	free(canvas);
+	free(previous);
+	return played;
+}
+
+static BOOL EasyAvatar_BuildPalette(struct EasyAvatar_Animation* animation)
+{
+	unsigned int samples = animation->frameCount < EASYAVATAR_GIF_PALETTE_SAMPLES ? animation->frameCount : EASYAVATAR_GIF_PALETTE_SAMPLES;
+	size_t pixelCount = (size_t)animation->targetW * animation->targetH;
+	// One index is always left free, delta frames mark unchanged pixels transparent even if the animation isn't
+	unsigned int colors = 255;
+
+	// Collect the opaque pixels of frames spread over the whole animation
+	size_t opaque = 0;
+	for (unsigned int sample = 0; sample < samples; sample++)
+	{
+		const BYTE* pixels = animation->frames[sample * animation->frameCount / samples].pixels;
+		for (size_t i = 0; i < pixelCount; i++)
+			opaque += pixels[i * 4 + FI_RGBA_ALPHA] != 0;
+	}
+
+	if (opaque == 0)
+	{
+		animation->paletteSize = 1;
+		return TRUE;
+	}
+
+	unsigned int sampleW = opaque < EASYAVATAR_GIF_SAMPLE_WIDTH ? (unsigned int)opaque : EASYAVATAR_GIF_SAMPLE_WIDTH;
+	unsigned int sampleH = (unsigned int)((opaque + sampleW - 1) / sampleW);
+	FIBITMAP* sampleImage = FreeImage_Allocate(sampleW, sampleH, 24, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+	if (!sampleImage)
+		return FALSE;
+
+	unsigned int x = 0;
+	unsigned int y = 0;
+	const BYTE* last = NULL;
+	for (unsigned int sample = 0; sample < samples; sample++)
+	{
+		const BYTE* pixels = animation->frames[sample * animation->frameCount / samples].pixels;
+		for (size_t i = 0; i < pixelCount; i++)
+		{
+			if (!pixels[i * 4 + FI_RGBA_ALPHA])
+				continue;
+
+			last = pixels + i * 4;
+			memcpy(FreeImage_GetScanLine(sampleImage, y) + x * 3, last, 3);
+			if (++x == sampleW)
+			{
+				x = 0;
+				y++;
+			}
+		}
+	}
+
+	// Pad the last row with a color we already have
+	for (; y < sampleH && x < sampleW; x++)
+		memcpy(FreeImage_GetScanLine(sampleImage, y) + x * 3, last, 3);
+
+	FIBITMAP* quantized = FreeImage_ColorQuantizeEx(sampleImage, FIQ_WUQUANT, colors, 0, NULL);
+	FreeImage_Unload(sampleImage);
+	if (!quantized)
+		return FALSE;
+
+	memcpy(animation->palette, FreeImage_GetPalette(quantized), colors * sizeof(RGBQUAD));
+	animation->paletteSize = colors;
+	FreeImage_Unload(quantized);
+	return TRUE;
+}
+
+static void EasyAvatar_BuildLookupSlice(unsigned int red, void* context)
+{
+	struct EasyAvatar_Animation* animation = (struct EasyAvatar_Animation*)context;
+	const int shift = 8 - EASYAVATAR_GIF_LOOKUP_BITS;
+	const unsigned int levels = 1 << EASYAVATAR_GIF_LOOKUP_BITS;
+	// Every cell maps the color in its center to the closest palette entry
+	int r = (int)(red << shift) + (1 << (shift - 1));
+
+	for (unsigned int green = 0; green < levels; green++)
+	{
+		int g = (int)(green << shift) + (1 << (shift - 1));
+		for (unsigned int blue = 0; blue < levels; blue++)
+		{
+			int b = (int)(blue << shift) + (1 << (shift - 1));
+			int bestDistance = INT_MAX;
+			unsigned int best = 0;
+			for (unsigned int i = 0; i < animation->paletteSize && bestDistance > 0; i++)
+			{
+				const RGBQUAD* color = &animation->palette[i];
+				int dr = r - color->rgbRed;
+				int dg = g - color->rgbGreen;
+				int db = b - color->rgbBlue;
+				int distance = dr * dr + dg * dg + db * db;
+				if (distance < bestDistance)
+				{
+					bestDistance = distance;
+					best = i;
+				}
+			}
+
+			animation->lookup[(red << (2 * EASYAVATAR_GIF_LOOKUP_BITS)) | (green << EASYAVATAR_GIF_LOOKUP_BITS) | blue] = (BYTE)best;
+		}
+	}
+}
+
+static void EasyAvatar_IndexFrame(unsigned int index, void* context)
+{
+	struct EasyAvatar_Animation* animation = (struct EasyAvatar_Animation*)context;
+	struct EasyAvatar_AnimationFrame* frame = &animation->frames[index];
+	const int shift = 8 - EASYAVATAR_GIF_LOOKUP_BITS;
+	size_t pixelCount = (size_t)animation->targetW * animation->targetH;
+
+	frame->indices = (BYTE*)malloc(pixelCount);
+	if (!frame->indices)
+	{
+		InterlockedExchange(&animation->failed, TRUE);
+		return;
+	}
+
+	const BYTE* pixel = frame->pixels;
+	for (size_t i = 0; i < pixelCount; i++, pixel += 4)
+	{
+		if (!pixel[FI_RGBA_ALPHA])
+		{
+			frame->indices[i] = EASYAVATAR_GIF_TRANSPARENT_INDEX;
+			continue;
+		}
+
+		frame->indices[i] = animation->lookup[((pixel[FI_RGBA_RED] >> shift) << (2 * EASYAVATAR_GIF_LOOKUP_BITS))
+			| ((pixel[FI_RGBA_GREEN] >> shift) << EASYAVATAR_GIF_LOOKUP_BITS)
+			| (pixel[FI_RGBA_BLUE] >> shift)];
+	}
+
+	// Only the indices are needed from here on
+	free(frame->pixels);
+	frame->pixels = NULL;
+}
+
+static UINT64 EasyAvatar_SumAbsoluteDifferences(const BYTE* a, const BYTE* b, size_t length)
+{
+	UINT64 sum = 0;
+	size_t i = 0;
+#if defined(EASYAVATAR_X86)
+	// SSE2 is part of every x64 CPU and the x86 baseline of every compiler we support
+	__m128i sums = _mm_setzero_si128();
+	for (; i + 16 <= length; i += 16)
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+
+	UINT64 halves[2];
+	_mm_storeu_si128((__m128i*)halves, sums);
+	sum = halves[0] + halves[1];
+#elif defined(EASYAVATAR_NEON)
+	uint64x2_t sums = vdupq_n_u64(0);
+	for (; i + 16 <= length; i += 16)
+		sums = vpadalq_u32(sums, vpaddlq_u16(vpaddlq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)))));
+	sum = vgetq_lane_u64(sums, 0) + vgetq_lane_u64(sums, 1);
+#endif
+	for (; i < length; i++)
+		sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+
+	return sum;
+}
+
+/*
+	Finds the first and last position in which the rows a and b differ.
+	Returns FALSE if they are equal.
+*/
+static BOOL EasyAvatar_FindRowChange(const BYTE* a, const BYTE* b, unsigned int length, unsigned int* first, unsigned int* last)
+{
+	unsigned int start = 0;
+	unsigned int end = length;
+#if defined(EASYAVATAR_X86)
+	// Skip equal blocks from both ends, the rest is done byte by byte
+	while (start + 16 <= end && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + start)), _mm_loadu_si128((const __m128i*)(b + start)))) == 0xFFFF)
+		start += 16;
+	while (end >= start + 16 && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + end - 16)), _mm_loadu_si128((const __m128i*)(b + end - 16)))) == 0xFFFF)
+		end -= 16;
+#elif defined(EASYAVATAR_NEON)
+	while (start + 16 <= end && vminvq_u8(vceqq_u8(vld1q_u8(a + start), vld1q_u8(b + start))) == 0xFF)
+		start += 16;
+	while (end >= start + 16 && vminvq_u8(vceqq_u8(vld1q_u8(a + end - 16), vld1q_u8(b + end - 16))) == 0xFF)
+		end -= 16;
+#endif
+	while (start < end && a[start] == b[start])
+		start++;
+	while (end > start && a[end - 1] == b[end - 1])
+		end--;
+
+	if (start == end)
+		return FALSE;
+
+	*first = start;
+	*last = end - 1;
+	return TRUE;
+}
+
+/*
+	Replaces every byte of current that equals the byte in previous with the transparent index.
+*/
+static void EasyAvatar_MaskUnchanged(BYTE* current, const BYTE* previous, unsigned int length)
+{
+	unsigned int i = 0;
+#if defined(EASYAVATAR_X86)
+	const __m128i transparent = _mm_set1_epi8((char)EASYAVATAR_GIF_TRANSPARENT_INDEX);
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i*)(current + i));
+		__m128i equal = _mm_cmpeq_epi8(pixels, _mm_loadu_si128((const __m128i*)(previous + i)));
+		_mm_storeu_si128((__m128i*)(current + i), _mm_or_si128(_mm_and_si128(equal, transparent), _mm_andnot_si128(equal, pixels)));
+	}
+#elif defined(EASYAVATAR_NEON)
+	const uint8x16_t transparent = vdupq_n_u8(EASYAVATAR_GIF_TRANSPARENT_INDEX);
+	for (; i + 16 <= length; i += 16)
+	{
+		uint8x16_t pixels = vld1q_u8(current + i);
+		vst1q_u8(current + i, vbslq_u8(vceqq_u8(pixels, vld1q_u8(previous + i)), transparent, pixels));
+	}
+#endif
+	for (; i < length; i++)
+	{
+		if (current[i] == previous[i])
+			current[i] = EASYAVATAR_GIF_TRANSPARENT_INDEX;
+	}
+}
+
+static void EasyAvatar_MeasureFrame(unsigned int index, void* context)
+{
+	struct EasyAvatar_Animation* animation = (struct EasyAvatar_Animation*)context;
+	// Frame pairs are independent, index 0 compares frames 0 and 1
+	struct EasyAvatar_AnimationFrame* frame = &animation->frames[index + 1];
+
+	frame->difference = EasyAvatar_SumAbsoluteDifferences(frame->pixels, animation->frames[index].pixels, (size_t)animation->targetW * animation->targetH * 4);
+}
+
+/*
+	Picks the frames that get shown, merging every frame into the previous shown one while the differences accumulated
+	since then stay within level. The sum of neighbouring differences is an upper bound of the difference to the shown frame.
+*/
+static void EasyAvatar_SelectFrames(struct EasyAvatar_Animation* animation, unsigned int level)
+{
+	UINT64 limit = (UINT64)level * animation->targetW * animation->targetH;
+	UINT64 drift = 0;
+
+	animation->outputCount = 0;
+	for (unsigned int i = 0; i < animation->frameCount; i++)
+	{
+		struct EasyAvatar_OutputFrame* shown = animation->outputCount ? &animation->output[animation->outputCount - 1] : NULL;
+		drift += animation->frames[i].difference;
+		if (shown && drift <= limit)
+		{
+			shown->delay += animation->frames[i].delay;
+			continue;
+		}
+
+		shown = &animation->output[animation->outputCount++];
+		memset(shown, 0, sizeof(*shown));
+		shown->frame = i;
+		shown->delay = animation->frames[i].delay;
+		drift = 0;
+	}
+}
+
+static void EasyAvatar_BuildOutputFrame(unsigned int index, void* context)
+{
+	struct EasyAvatar_Animation* animation = (struct EasyAvatar_Animation*)context;
+	struct EasyAvatar_OutputFrame* output = &animation->output[index];
+	const BYTE* current = animation->frames[output->frame].indices;
+	const BYTE* previous = index > 0 ? animation->frames[animation->output[index - 1].frame].indices : NULL;
+	unsigned int width = animation->targetW;
+	unsigned int height = animation->targetH;
+	unsigned int left = 0;
+	unsigned int right = width - 1;
+	unsigned int top = 0;
+	unsigned int bottom = height - 1;
+
+	// Transparent animations are cleared after every frame, so their frames always have to be complete
+	if (previous && !animation->transparent)
+	{
+		BOOL changed = FALSE;
+		left = width;
+		right = 0;
+		top = height;
+		bottom = 0;
+
+		// Rows run top down here, the bitmap gets flipped when it's filled
+		for (unsigned int y = 0; y < height; y++)
+		{
+			unsigned int first;
+			unsigned int last;
+			if (!EasyAvatar_FindRowChange(current + (size_t)y * width, previous + (size_t)y * width, width, &first, &last))
+				continue;
+
+			changed = TRUE;
+			left = first < left ? first : left;
+			right = last > right ? last : right;
+			top = y < top ? y : top;
+			bottom = y;
+		}
+
+		// Merged duplicates only leave a single pixel behind to carry the delay
+		if (!changed)
+			left = right = top = bottom = 0;
+	}
+
+	unsigned int cropW = right - left + 1;
+	unsigned int cropH = bottom - top + 1;
+	output->dib = FreeImage_Allocate(cropW, cropH, 8, 0, 0, 0);
+	if (!output->dib)
+	{
+		InterlockedExchange(&animation->failed, TRUE);
+		return;
+	}
+
+	memcpy(FreeImage_GetPalette(output->dib), animation->palette, sizeof(animation->palette));
+	output->left = left;
+	output->top = top;
+
+	// The pixel buffers follow FreeImage's bottom up row order, so row y of the crop is buffer row (height - 1 - top - y)
+	for (unsigned int y = 0; y < cropH; y++)
+	{
+		size_t row = (size_t)(height - 1 - top - y) * width + left;
+		BYTE* target = FreeImage_GetScanLine(output->dib, cropH - 1 - y);
+		memcpy(target, current + row, cropW);
+		if (previous && !animation->transparent)
+			EasyAvatar_MaskUnchanged(target, previous + row, cropW);
+	}
+
+	if (previous || animation->transparent)
+		FreeImage_SetTransparentIndex(output->dib, EASYAVATAR_GIF_TRANSPARENT_INDEX);
+}
+
+static BOOL EasyAvatar_SetFrameMetadata(struct EasyAvatar_Animation* animation, unsigned int index)
+{
+	struct EasyAvatar_OutputFrame* output = &animation->output[index];
+	FIBITMAP* dib = output->dib;
+	WORD left = (WORD)output->left;
+	WORD top = (WORD)output->top;
+	BYTE noLocalPalette = 1;
+	// Delta frames build on what's already there, with transparency the screen has to be cleared so old pixels don't shine through
+	BYTE disposal = animation->transparent ? EASYAVATAR_GIF_DISPOSAL_BACKGROUND : EASYAVATAR_GIF_DISPOSAL_LEAVE;
+
+	BOOL stored = EasyAvatar_SetAnimationValue(dib, "FrameLeft", FIDT_SHORT, 1, &left)
+		&& EasyAvatar_SetAnimationValue(dib, "FrameTop", FIDT_SHORT, 1, &top)
+		&& EasyAvatar_SetAnimationValue(dib, "NoLocalPalette", FIDT_BYTE, 1, &noLocalPalette)
+		&& EasyAvatar_SetAnimationValue(dib, "DisposalMethod", FIDT_BYTE, 1, &disposal)
+		&& EasyAvatar_SetAnimationValue(dib, "FrameTime", FIDT_LONG, 1, &output->delay);
+	if (!stored || index != 0)
+		return stored;
+
+	// The first frame carries everything that applies to the whole animation
+	WORD width = (WORD)animation->targetW;
+	WORD height = (WORD)animation->targetH;
+	return EasyAvatar_SetAnimationValue(dib, "LogicalWidth", FIDT_SHORT, 1, &width)
+		&& EasyAvatar_SetAnimationValue(dib, "LogicalHeight", FIDT_SHORT, 1, &height)
+		&& EasyAvatar_SetAnimationValue(dib, "Loop", FIDT_LONG, 1, &animation->loop)
+		&& EasyAvatar_SetAnimationValue(dib, "GlobalPalette", FIDT_PALETTE, 256, animation->palette);
+}
+
+static void EasyAvatar_FreeOutput(struct EasyAvatar_Animation* animation)
+{
+	for (unsigned int i = 0; i < animation->outputCount; i++)
+	{
+		if (animation->output[i].dib)
+			FreeImage_Unload(animation->output[i].dib);
+		animation->output[i].dib = NULL;
+	}
+}
+
+static void EasyAvatar_FreeAnimation(struct EasyAvatar_Animation* animation)
+{
+	EasyAvatar_FreeOutput(animation);
+	for (unsigned int i = 0; animation->frames && i < animation->frameCount; i++)
+	{
+		free(animation->frames[i].canvas);
+		free(animation->frames[i].pixels);
+		free(animation->frames[i].indices);
+	}
+
+	free(animation->frames);
+	free(animation->output);
+	free(animation->lookup);
+}
+
+/*
+	Builds the output frames for the current selection, replaces the pages of multiBitmap with them
+	and encodes it into a budget limited sink.
+*/
+static BYTE* EasyAvatar_SaveAnimation(struct EasyAvatar_Animation* animation, FIMULTIBITMAP* multiBitmap, size_t budget, size_t* resultSize, BYTE digest[16])
+{
+	int previousPages = FreeImage_GetPageCount(multiBitmap);
+	BYTE* result = NULL;
+
+	EasyAvatar_ParallelFor(animation->outputCount, EasyAvatar_BuildOutputFrame, animation);
+	if (animation->failed)
+	{
+		EasyAvatar_FreeOutput(animation);
+		return NULL;
+	}
+
+	for (unsigned int i = 0; i < animation->outputCount; i++)
+	{
+		if (!EasyAvatar_SetFrameMetadata(animation, i))
+		{
+			EasyAvatar_FreeOutput(animation);
+			return NULL;
+		}
+
+		FreeImage_AppendPage(multiBitmap, animation->output[i].dib);
+	}
+	EasyAvatar_FreeOutput(animation);
+
+	// FreeImage never deletes the last page, which is why ours were appended first
+	for (int i = 0; i < previousPages; i++)
+		FreeImage_DeletePage(multiBitmap, 0);
+	if (FreeImage_GetPageCount(multiBitmap) != (int)animation->outputCount)
+		return NULL;
+
+	FreeImageIO io;
+	struct EasyAvatar_EncodeSink sink;
+	EasyAvatar_OpenEncodeSink(&sink, &io, budget);
+	BOOL saved = FreeImage_SaveMultiBitmapToHandle(FIF_GIF, multiBitmap, &io, &sink, 0);
+	result = EasyAvatar_CloseEncodeSink(&sink, resultSize, digest);
+	if (saved)
+		return result;
+
+	free(result);
+	return NULL;
+}
+
+BYTE* EasyAvatar_ResizeAnimation(BYTE* data, size_t size, size_t budget, size_t* resultSize, BYTE digest[16])
+{
+	struct EasyAvatar_Animation animation;
+	memset(&animation, 0, sizeof(animation));
+	if (size < 10 || size > MAXDWORD || !EasyAvatar_ParseAnimationHeader(data, &animation.width, &animation.height))
+		return NULL;
+
+	EasyAvatar_GetTargetSize(animation.width, animation.height, &animation.targetW, &animation.targetH);
+	if (animation.targetW == 0 || animation.targetH == 0)
+		return NULL;
+
+	// Every frame gets played back at full size and kept until it's indexed, count them before FreeImage decodes anything
+	FreeImageIO io;
+	struct EasyAvatar_MemoryReader reader;
+	struct EasyAvatar_ImageInfo info;
+	EasyAvatar_OpenMemoryReader(&reader, &io, data, size);
+	if (!EasyAvatar_ProbeImage(&io, &reader, &info) || (UINT64)info.width * info.height * info.frameCount > EASYAVATAR_MAX_ANIMATION_PIXELS)
+		return NULL;
+
+	FIMEMORY* memory = FreeImage_OpenMemory(data, (DWORD)size);
+	if (!memory)
+		return NULL;
+
+	BYTE* result = NULL;
+	FIMULTIBITMAP* multiBitmap = FreeImage_LoadMultiBitmapFromMemory(FIF_GIF, memory, GIF_DEFAULT);
+	if (multiBitmap)
+	{
+		int pages = FreeImage_GetPageCount(multiBitmap);
+		animation.frameCount = pages > 0 ? (unsigned int)pages : 0;
+		animation.frames = (struct EasyAvatar_AnimationFrame*)calloc(animation.frameCount, sizeof(struct EasyAvatar_AnimationFrame));
+		animation.output = (struct EasyAvatar_OutputFrame*)calloc(animation.frameCount, sizeof(struct EasyAvatar_OutputFrame));
+		animation.lookup = (BYTE*)malloc(EASYAVATAR_GIF_LOOKUP_SIZE);
+
+		FIBITMAP* firstPage = animation.frameCount ? FreeImage_LockPage(multiBitmap, 0) : NULL;
+		if (firstPage)
+		{
+			animation.loop = EasyAvatar_GetAnimationValue(firstPage, "Loop", 0);
+			FreeImage_UnlockPage(multiBitmap, firstPage, FALSE);
+		}
+
+		if (firstPage && animation.frames && animation.output && animation.lookup
+			&& EasyAvatar_PlayAnimation(&animation, multiBitmap)
+			&& EasyAvatar_BuildPalette(&animation))
+		{
+			// Measuring needs the pixels that indexing frees
+			EasyAvatar_ParallelFor(animation.frameCount - 1, EasyAvatar_MeasureFrame, &animation);
+			EasyAvatar_ParallelFor(1 << EASYAVATAR_GIF_LOOKUP_BITS, EasyAvatar_BuildLookupSlice, &animation);
+			EasyAvatar_ParallelFor(animation.frameCount, EasyAvatar_IndexFrame, &animation);
+
+			// Merge more and more similar frames until the animation fits
+			unsigned int levels = sizeof(EASYAVATAR_GIF_MERGE_LEVELS) / sizeof(EASYAVATAR_GIF_MERGE_LEVELS[0]);
+			for (unsigned int level = 0; !result && level < levels && !animation.failed && !EasyAvatar_IsJobCancelled(); level++)
+			{
+				unsigned int previousCount = animation.outputCount;
+				EasyAvatar_SelectFrames(&animation, EASYAVATAR_GIF_MERGE_LEVELS[level]);
+				// A level that merges nothing new can't produce a smaller file
+				if (level > 0 && animation.outputCount == previousCount)
+					continue;
+
+				result = EasyAvatar_SaveAnimation(&animation, multiBitmap, budget, resultSize, digest);
+			}
+		}
+
+		FreeImage_CloseMultiBitmap(multiBitmap, 0);
+	}
+
+	EasyAvatar_FreeAnimation(&animation);
+	FreeImage_CloseMemory(memory);
+	return result;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+// Delay in ms used for frames that don't specify one
+#define EASYAVATAR_GIF_DEFAULT_DELAY 100
+// Number of frames, spread over the animation, whose colors go into the shared palette
+#define EASYAVATAR_GIF_PALETTE_SAMPLES 16
+// Pixels of the played back frames kept at full size until a batch of them gets resized, override it at build time if needed
+#ifndef EASYAVATAR_GIF_BATCH_PIXELS
+#define EASYAVATAR_GIF_BATCH_PIXELS (16u * 1000u * 1000u)
+#endif
+
+/*
+	Resizes every frame of the GIF in data to the avatar size and encodes the result as a GIF no larger than budget,
+	the 16 byte MD5 of it is written to digest. Animations already within the avatar size aren't resampled, only re-encoded.
+	Frames are played back in order honoring their disposal methods, resized in parallel and mapped onto one shared global palette.
+	Frame delays and the loop count are kept. Opaque animations store every frame after the first as the rectangle
+	that changed since the previous one, with unchanged pixels left transparent.
+	If the result doesn't fit, frames that barely differ from the previously shown one are merged into it with increasing tolerance.
+	GIFs whose frames add up to more than EASYAVATAR_MAX_ANIMATION_PIXELS are refused before anything gets decoded.
+	The caller owns the returned buffer. Returns NULL if the result doesn't fit, the job got cancelled or anything fails.
+*/
+BYTE* EasyAvatar_ResizeAnimation(BYTE* data, size_t size, size_t budget, size_t* resultSize, BYTE digest[16]);
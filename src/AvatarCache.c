@@ -0,0 +1,318 @@
+#include "AvatarCache.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Animation.h"
+#include "Encoder.h"
+#include "Hash.h"
+#include "ImageProbe.h"
+#include "PNGStream.h"
+
+// "EAAC" in a little endian file
+#define EASYAVATAR_AVATAR_CACHE_MAGIC 0x43414145
+// Bump whenever the layout of the index changes, the old index is then wiped
+#define EASYAVATAR_AVATAR_CACHE_VERSION 1
+#define EASYAVATAR_AVATAR_CACHE_INDEX "index.bin"
+
+/*
+	Start of the index file, followed by EASYAVATAR_AVATAR_CACHE_SLOTS slots.
+	Only fixed size little endian fields, the file is mapped and used in place.
+*/
+struct EasyAvatar_AvatarCacheHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 slotCount;
+	UINT32 reserved;
+	// Fingerprint of the pipeline settings the avatars were made with
+	UINT64 settings;
+	// Advanced on every use, the slots remember it as their LRU timestamp
+	UINT64 clock;
+	UINT64 padding[4];
+};
+
+/*
+	One cached avatar, its bytes live in slot_<index>.avatar next to the index.
+*/
+struct EasyAvatar_AvatarCacheSlot
+{
+	UINT64 sourceDigest;
+	UINT64 sourceSize;
+	UINT64 lastUsed;
+	// Fingerprint of the avatar file, checked on every hit
+	UINT64 dataDigest;
+	// 0 marks an empty slot
+	UINT32 dataSize;
+	UINT32 reserved;
+	BYTE md5[MD5LEN];
+	// Fingerprint of everything above, a slot torn by a crash never matches it
+	UINT64 checksum;
+};
+
+// The mapped index, only touched by the worker thread
+static HANDLE cacheFile = NULL;
+static HANDLE cacheMapping = NULL;
+static struct EasyAvatar_AvatarCacheHeader* cacheHeader = NULL;
+static struct EasyAvatar_AvatarCacheSlot* cacheSlots = NULL;
+// Opening the index is only tried once, without it the cache stays disabled
+static BOOL cacheOpened = FALSE;
+
+static volatile LONG EasyAvatar_AvatarCacheHits = 0;
+static volatile LONG EasyAvatar_AvatarCacheMisses = 0;
+
+/*
+	Everything that changes the bytes the pipeline produces for a source.
+*/
+static UINT64 EasyAvatar_GetPipelineSettings(void)
+{
+	const UINT64 settings[] =
+	{
+		EASYAVATAR_PIPELINE_VERSION, EASYAVATAR_MAX_DIMENSION, EASYAVATAR_MAX_FILESIZE, EASYAVATAR_MAX_PIXELS,
+		EASYAVATAR_STREAM_PIXELS, EASYAVATAR_STREAM_OVERSAMPLING, EASYAVATAR_JPEG_QUALITY, EASYAVATAR_BUDGET_TOLERANCE,
+		(UINT64)(EASYAVATAR_MIN_PSNR * 100), EASYAVATAR_GIF_DEFAULT_DELAY, EASYAVATAR_GIF_PALETTE_SAMPLES
+	};
+	return EasyAvatar_Fingerprint(settings, sizeof(settings));
+}
+
+static UINT64 EasyAvatar_GetSlotChecksum(const struct EasyAvatar_AvatarCacheSlot* slot)
+{
+	return EasyAvatar_Fingerprint(slot, offsetof(struct EasyAvatar_AvatarCacheSlot, checksum));
+}
+
+static BOOL EasyAvatar_IsSlotValid(const struct EasyAvatar_AvatarCacheSlot* slot)
+{
+	return slot->dataSize > 0 && slot->dataSize <= EASYAVATAR_MAX_FILESIZE && slot->checksum == EasyAvatar_GetSlotChecksum(slot);
+}
+
+static BOOL EasyAvatar_GetSlotPath(UINT32 index, char* path, size_t size)
+{
+	int length = snprintf(path, size, "%s\\%s\\slot_%03u.avatar", EASYAVATAR_FILEPATH, EASYAVATAR_AVATAR_CACHE_DIR, index);
+	return length > 0 && (size_t)length < size;
+}
+
+static void EasyAvatar_ClearSlot(UINT32 index)
+{
+	char path[PATH_BUFSIZE];
+	memset(&cacheSlots[index], 0, sizeof(cacheSlots[index]));
+	if (EasyAvatar_GetSlotPath(index, path, sizeof(path)))
+		DeleteFileA(path);
+}
+
+static BOOL EasyAvatar_OpenAvatarCache(void)
+{
+	if (cacheOpened)
+		return cacheSlots != NULL;
+	cacheOpened = TRUE;
+
+	// Fails harmlessly if the directory already exists
+	char path[PATH_BUFSIZE];
+	snprintf(path, sizeof(path), "%s\\%s", EASYAVATAR_FILEPATH, EASYAVATAR_AVATAR_CACHE_DIR);
+	CreateDirectoryA(path, NULL);
+
+	int length = snprintf(path, sizeof(path), "%s\\%s\\%s", EASYAVATAR_FILEPATH, EASYAVATAR_AVATAR_CACHE_DIR, EASYAVATAR_AVATAR_CACHE_INDEX);
+	if (length <= 0 || (size_t)length >= sizeof(path))
+		return FALSE;
+
+	cacheFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (cacheFile == INVALID_HANDLE_VALUE)
+	{
+		cacheFile = NULL;
+		return FALSE;
+	}
+
+	// Mapping a new or truncated index grows it to its full size, filled with zeros
+	DWORD indexSize = sizeof(struct EasyAvatar_AvatarCacheHeader) + EASYAVATAR_AVATAR_CACHE_SLOTS * sizeof(struct EasyAvatar_AvatarCacheSlot);
+	cacheMapping = CreateFileMappingA(cacheFile, NULL, PAGE_READWRITE, 0, indexSize, NULL);
+	BYTE* view = cacheMapping ? (BYTE*)MapViewOfFile(cacheMapping, FILE_MAP_WRITE, 0, 0, indexSize) : NULL;
+	if (!view)
+	{
+		EasyAvatar_CloseAvatarCache();
+		return FALSE;
+	}
+
+	cacheHeader = (struct EasyAvatar_AvatarCacheHeader*)view;
+	cacheSlots = (struct EasyAvatar_AvatarCacheSlot*)(view + sizeof(struct EasyAvatar_AvatarCacheHeader));
+
+	// Avatars made with other settings or an index we can't read are of no use, start over
+	UINT64 settings = EasyAvatar_GetPipelineSettings();
+	if (cacheHeader->magic != EASYAVATAR_AVATAR_CACHE_MAGIC || cacheHeader->version != EASYAVATAR_AVATAR_CACHE_VERSION
+		|| cacheHeader->slotCount != EASYAVATAR_AVATAR_CACHE_SLOTS || cacheHeader->settings != settings)
+	{
+		for (UINT32 i = 0; i < EASYAVATAR_AVATAR_CACHE_SLOTS; i++)
+			EasyAvatar_ClearSlot(i);
+
+		memset(cacheHeader, 0, sizeof(*cacheHeader));
+		cacheHeader->magic = EASYAVATAR_AVATAR_CACHE_MAGIC;
+		cacheHeader->version = EASYAVATAR_AVATAR_CACHE_VERSION;
+		cacheHeader->slotCount = EASYAVATAR_AVATAR_CACHE_SLOTS;
+		cacheHeader->settings = settings;
+	}
+
+	return TRUE;
+}
+
+/*
+	Reads the avatar file of the slot into image, FALSE if it's missing or doesn't match the slot.
+*/
+static BOOL EasyAvatar_ReadSlot(UINT32 index, struct EasyAvatar_Image* image)
+{
+	const struct EasyAvatar_AvatarCacheSlot* slot = &cacheSlots[index];
+	char path[PATH_BUFSIZE];
+	FILE* fp = NULL;
+	if (!EasyAvatar_GetSlotPath(index, path, sizeof(path)) || fopen_s(&fp, path, "rb") != 0 || !fp)
+		return FALSE;
+
+	// Reading one byte past the expected size tells us whether the file is longer than the slot says
+	BYTE* data = (BYTE*)malloc((size_t)slot->dataSize + 1);
+	BOOL read = data && fread(data, 1, (size_t)slot->dataSize + 1, fp) == slot->dataSize;
+	fclose(fp);
+
+	if (!read || EasyAvatar_Fingerprint(data, slot->dataSize) != slot->dataDigest)
+	{
+		free(data);
+		return FALSE;
+	}
+
+	EasyAvatar_ReleaseImage(image);
+	image->data = data;
+	image->size = slot->dataSize;
+	memcpy(image->md5, slot->md5, MD5LEN);
+	image->hasMD5 = TRUE;
+	return TRUE;
+}
+
+BOOL EasyAvatar_LookupCachedAvatar(UINT64 sourceDigest, UINT64 sourceSize, struct EasyAvatar_Image* image)
+{
+	if (EasyAvatar_OpenAvatarCache())
+	{
+		for (UINT32 i = 0; i < EASYAVATAR_AVATAR_CACHE_SLOTS; i++)
+		{
+			struct EasyAvatar_AvatarCacheSlot* slot = &cacheSlots[i];
+			if (slot->sourceDigest != sourceDigest || slot->sourceSize != sourceSize || !EasyAvatar_IsSlotValid(slot))
+				continue;
+
+			if (!EasyAvatar_ReadSlot(i, image))
+			{
+				// Deleted or damaged behind our back
+				EasyAvatar_ClearSlot(i);
+				break;
+			}
+
+			slot->lastUsed = ++cacheHeader->clock;
+			slot->checksum = EasyAvatar_GetSlotChecksum(slot);
+			InterlockedIncrement(&EasyAvatar_AvatarCacheHits);
+			return TRUE;
+		}
+	}
+
+	InterlockedIncrement(&EasyAvatar_AvatarCacheMisses);
+	return FALSE;
+}
+
+/*
+	Returns an empty slot with room for size more bytes in the cache, evicting the least recently used avatars as needed.
+	Returns EASYAVATAR_AVATAR_CACHE_SLOTS if that's impossible.
+*/
+static UINT32 EasyAvatar_ReserveSlot(size_t size)
+{
+	for (;;)
+	{
+		UINT32 empty = EASYAVATAR_AVATAR_CACHE_SLOTS;
+		UINT32 oldest = EASYAVATAR_AVATAR_CACHE_SLOTS;
+		UINT64 total = 0;
+		for (UINT32 i = 0; i < EASYAVATAR_AVATAR_CACHE_SLOTS; i++)
+		{
+			if (!EasyAvatar_IsSlotValid(&cacheSlots[i]))
+			{
+				if (empty == EASYAVATAR_AVATAR_CACHE_SLOTS)
+					empty = i;
+				continue;
+			}
+
+			total += cacheSlots[i].dataSize;
+			if (oldest == EASYAVATAR_AVATAR_CACHE_SLOTS || cacheSlots[i].lastUsed < cacheSlots[oldest].lastUsed)
+				oldest = i;
+		}
+
+		if (empty != EASYAVATAR_AVATAR_CACHE_SLOTS && total + size <= EASYAVATAR_AVATAR_CACHE_MAX_SIZE)
+			return empty;
+		if (oldest == EASYAVATAR_AVATAR_CACHE_SLOTS)
+			return EASYAVATAR_AVATAR_CACHE_SLOTS;
+
+		EasyAvatar_ClearSlot(oldest);
+	}
+}
+
+void EasyAvatar_StoreCachedAvatar(UINT64 sourceDigest, UINT64 sourceSize, const struct EasyAvatar_Image* image)
+{
+	if (!image->hasMD5 || image->size == 0 || image->size > EASYAVATAR_MAX_FILESIZE || !EasyAvatar_OpenAvatarCache())
+		return;
+
+	// An older avatar of the same source is replaced, not kept twice
+	for (UINT32 i = 0; i < EASYAVATAR_AVATAR_CACHE_SLOTS; i++)
+	{
+		if (cacheSlots[i].sourceDigest == sourceDigest && cacheSlots[i].sourceSize == sourceSize && EasyAvatar_IsSlotValid(&cacheSlots[i]))
+			EasyAvatar_ClearSlot(i);
+	}
+
+	UINT32 index = EasyAvatar_ReserveSlot(image->size);
+	char path[PATH_BUFSIZE];
+	char temporary[PATH_BUFSIZE];
+	if (index == EASYAVATAR_AVATAR_CACHE_SLOTS || !EasyAvatar_GetSlotPath(index, path, sizeof(path)))
+		return;
+
+	int length = snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+	if (length <= 0 || (size_t)length >= sizeof(temporary))
+		return;
+
+	FILE* fp = NULL;
+	if (fopen_s(&fp, temporary, "wb") != 0 || !fp)
+		return;
+
+	BOOL written = fwrite(image->data, 1, image->size, fp) == image->size;
+	if (fclose(fp) != 0)
+		written = FALSE;
+
+	// The slot stays empty until its file is complete
+	if (!written || !MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(temporary);
+		return;
+	}
+
+	struct EasyAvatar_AvatarCacheSlot* slot = &cacheSlots[index];
+	slot->sourceDigest = sourceDigest;
+	slot->sourceSize = sourceSize;
+	slot->lastUsed = ++cacheHeader->clock;
+	slot->dataDigest = EasyAvatar_Fingerprint(image->data, image->size);
+	slot->dataSize = (UINT32)image->size;
+	slot->reserved = 0;
+	memcpy(slot->md5, image->md5, MD5LEN);
+	slot->checksum = EasyAvatar_GetSlotChecksum(slot);
+}
+
+void EasyAvatar_CloseAvatarCache(void)
+{
+	if (cacheHeader)
+		UnmapViewOfFile(cacheHeader);
+	if (cacheMapping)
+		CloseHandle(cacheMapping);
+	if (cacheFile)
+		CloseHandle(cacheFile);
+
+	cacheHeader = NULL;
+	cacheSlots = NULL;
+	cacheMapping = NULL;
+	cacheFile = NULL;
+	// The plugin may be started again without being unloaded, the next lookup opens the index again
+	cacheOpened = FALSE;
+}
+
+void EasyAvatar_GetAvatarCacheStats(LONG* hits, LONG* misses)
+{
+	*hits = EasyAvatar_AvatarCacheHits;
+	*misses = EasyAvatar_AvatarCacheMisses;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <Windows.h>
+
+#include "EasyAvatar.h"
+
+// Sub-directory of EASYAVATAR_FILEPATH holding the processed avatars and their index
+#define EASYAVATAR_AVATAR_CACHE_DIR "avatar_cache"
+// Least recently used avatars are evicted once the cache grows beyond this
+#ifndef EASYAVATAR_AVATAR_CACHE_MAX_SIZE
+#define EASYAVATAR_AVATAR_CACHE_MAX_SIZE (16u * 1024u * 1024u)
+#endif
+// Slots in the index, the cache never holds more avatars than this
+#define EASYAVATAR_AVATAR_CACHE_SLOTS 128
+// Bump whenever the pipeline turns the same source into different bytes, every cached avatar is dropped then
+#define EASYAVATAR_PIPELINE_VERSION 1
+
+/*
+	Worker thread only.
+	If the avatar processed from a source with the given digest and size is cached, reads it into image and returns TRUE.
+	image comes with its MD5, so it can be uploaded right away. Cached avatars failing their checks are dropped.
+*/
+BOOL EasyAvatar_LookupCachedAvatar(UINT64 sourceDigest, UINT64 sourceSize, struct EasyAvatar_Image* image);
+
+/*
+	Worker thread only.
+	Remembers the finished avatar processed from a source with the given digest and size, image must carry its MD5.
+	Failing to store it is silently ignored, the next lookup just misses.
+*/
+void EasyAvatar_StoreCachedAvatar(UINT64 sourceDigest, UINT64 sourceSize, const struct EasyAvatar_Image* image);
+
+/*
+	Unmaps the index, called on shutdown after the worker has stopped.
+*/
+void EasyAvatar_CloseAvatarCache(void);
+
+/*
+	Number of avatars served from the cache and avatars that had to be processed since the plugin was loaded.
+*/
+void EasyAvatar_GetAvatarCacheStats(LONG* hits, LONG* misses);
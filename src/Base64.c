@@ -0,0 +1,293 @@
+#include "Base64.h"
+
+#include <stdlib.h>
+
+#include "CPU.h"
+
+static const char encoding_table[] = {
+			'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
+			'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+			'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
+			'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+			'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
+			'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+			'w', 'x', 'y', 'z', '0', '1', '2', '3',
+			'4', '5', '6', '7', '8', '9', '+', '/' };
+
+// 0xFF marks characters outside the alphabet, so OR-ing four lookups tells us if a group is valid
+static const unsigned char decoding_table[256] = {
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3e, 0xFF, 0xFF, 0xFF, 0x3f,
+			0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+			0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+			0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+			0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+// Taken from https://stackoverflow.com/a/48818578
+
+char* EasyAvatar_b64encode(const unsigned char* data, size_t input_length)
+{
+	const int mod_table[] = { 0, 2, 1 };
+
+	size_t output_length = 4 * ((input_length + 2) / 3);
+
+	// One extra character for correct null termination
+	char* encoded_data = (char*)malloc(output_length + 1);
+
+	if (encoded_data == NULL)
+		return NULL;
+
+	for (int i = 0, j = 0; i < input_length;)
+	{
+		unsigned int octet_a = i < input_length ? (unsigned char)data[i++] : 0;
+		unsigned int octet_b = i < input_length ? (unsigned char)data[i++] : 0;
+		unsigned int octet_c = i < input_length ? (unsigned char)data[i++] : 0;
+
+		unsigned int triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
+
+		encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
+		encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
+		encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
+		encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+
+	}
+
+	for (int i = 0; i < mod_table[input_length % 3]; i++)
+		encoded_data[output_length - 1 - i] = '=';
+
+	// Null terminate
+	encoded_data[output_length] = 0;
+
+
+	return encoded_data;
+}
+
+static size_t EasyAvatar_b64decodeBlocksScalar(const char* data, size_t input_length, BYTE* output)
+{
+	const unsigned char* in = (const unsigned char*)data;
+	size_t i = 0;
+
+	for (; i + 4 <= input_length; i += 4)
+	{
+		unsigned int sextet_a = decoding_table[in[i]];
+		unsigned int sextet_b = decoding_table[in[i + 1]];
+		unsigned int sextet_c = decoding_table[in[i + 2]];
+		unsigned int sextet_d = decoding_table[in[i + 3]];
+
+		// One branch per group instead of one per character
+		if ((sextet_a | sextet_b | sextet_c | sextet_d) & 0x80)
+			break;
+
+		unsigned int triple = (sextet_a << 3 * 6)
+			+ (sextet_b << 2 * 6)
+			+ (sextet_c << 1 * 6)
+			+ (sextet_d << 0 * 6);
+
+		*output++ = (triple >> 2 * 8) & 0xFF;
+		*output++ = (triple >> 1 * 8) & 0xFF;
+		*output++ = (triple >> 0 * 8) & 0xFF;
+	}
+
+	return i;
+}
+
+#ifdef EASYAVATAR_X86
+
+// Vectorized decoding as described by Wojciech Mula and Daniel Lemire in "Faster Base64 Encoding and Decoding using AVX2 Instructions"
+// The high nibble of each character selects a bit, the low nibble a mask of valid high nibbles, a zero AND marks an invalid character
+
+EASYAVATAR_TARGET("ssse3")
+static size_t EasyAvatar_b64decodeBlocksSSSE3(const char* data, size_t input_length, BYTE* output)
+{
+	const __m128i shiftLUT = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i maskLUT = _mm_setr_epi8((char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+		(char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+	const __m128i bitposLUT = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i nibbleMask = _mm_set1_epi8(0x0f);
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i slashFix = _mm_set1_epi8(3);
+	const __m128i mergeBytes = _mm_set1_epi32(0x01400140);
+	const __m128i mergeWords = _mm_set1_epi32(0x00011000);
+	const __m128i packBytes = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	size_t i = 0;
+
+	// Every iteration stores 16 bytes but only advances by 12, stay far enough from the end of output
+	for (; i + 24 <= input_length; i += 16)
+	{
+		__m128i input = _mm_loadu_si128((const __m128i*)(data + i));
+		__m128i higherNibble = _mm_and_si128(_mm_srli_epi32(input, 4), nibbleMask);
+		__m128i lowerNibble = _mm_and_si128(input, nibbleMask);
+
+		__m128i mask = _mm_shuffle_epi8(maskLUT, lowerNibble);
+		__m128i bit = _mm_shuffle_epi8(bitposLUT, higherNibble);
+		__m128i invalid = _mm_cmpeq_epi8(_mm_and_si128(mask, bit), _mm_setzero_si128());
+		if (_mm_movemask_epi8(invalid))
+			break;
+
+		// '+' and '/' share a high nibble, '/' needs 3 less than the shift for '+'
+		__m128i shift = _mm_shuffle_epi8(shiftLUT, higherNibble);
+		shift = _mm_sub_epi8(shift, _mm_and_si128(_mm_cmpeq_epi8(input, slash), slashFix));
+		__m128i sextets = _mm_add_epi8(input, shift);
+
+		__m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(sextets, mergeBytes), mergeWords);
+		_mm_storeu_si128((__m128i*)output, _mm_shuffle_epi8(merged, packBytes));
+		output += 12;
+	}
+
+	return i + EasyAvatar_b64decodeBlocksScalar(data + i, input_length - i, output);
+}
+
+EASYAVATAR_TARGET("avx2")
+static size_t EasyAvatar_b64decodeBlocksAVX2(const char* data, size_t input_length, BYTE* output)
+{
+	const __m256i shiftLUT = _mm256_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i maskLUT = _mm256_setr_epi8((char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+		(char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54,
+		(char)0xa8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8, (char)0xf8,
+		(char)0xf8, (char)0xf8, (char)0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+	const __m256i bitposLUT = _mm256_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0,
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i nibbleMask = _mm256_set1_epi8(0x0f);
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i slashFix = _mm256_set1_epi8(3);
+	const __m256i mergeBytes = _mm256_set1_epi32(0x01400140);
+	const __m256i mergeWords = _mm256_set1_epi32(0x00011000);
+	const __m256i packBytes = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i packLanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	size_t i = 0;
+
+	// Every iteration stores 32 bytes but only advances by 24, stay far enough from the end of output
+	for (; i + 44 <= input_length; i += 32)
+	{
+		__m256i input = _mm256_loadu_si256((const __m256i*)(data + i));
+		__m256i higherNibble = _mm256_and_si256(_mm256_srli_epi32(input, 4), nibbleMask);
+		__m256i lowerNibble = _mm256_and_si256(input, nibbleMask);
+
+		__m256i mask = _mm256_shuffle_epi8(maskLUT, lowerNibble);
+		__m256i bit = _mm256_shuffle_epi8(bitposLUT, higherNibble);
+		__m256i invalid = _mm256_cmpeq_epi8(_mm256_and_si256(mask, bit), _mm256_setzero_si256());
+		if (_mm256_movemask_epi8(invalid))
+			break;
+
+		__m256i shift = _mm256_shuffle_epi8(shiftLUT, higherNibble);
+		shift = _mm256_sub_epi8(shift, _mm256_and_si256(_mm256_cmpeq_epi8(input, slash), slashFix));
+		__m256i sextets = _mm256_add_epi8(input, shift);
+
+		__m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(sextets, mergeBytes), mergeWords);
+		// Each lane holds 12 bytes, move them next to each other
+		__m256i packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, packBytes), packLanes);
+		_mm256_storeu_si256((__m256i*)output, packed);
+		output += 24;
+	}
+
+	// Whatever is left is shorter than one AVX2 block or starts with an invalid character
+	return i + EasyAvatar_b64decodeBlocksSSSE3(data + i, input_length - i, output);
+}
+
+#endif // EASYAVATAR_X86
+
+typedef size_t(*EasyAvatar_b64decodeBlocksFunc)(const char*, size_t, BYTE*);
+
+// Picked on first use, every thread computes the same value so the race is harmless
+static EasyAvatar_b64decodeBlocksFunc decodeBlocksImpl = NULL;
+
+static EasyAvatar_b64decodeBlocksFunc EasyAvatar_Selectb64decoder(void)
+{
+#ifdef EASYAVATAR_X86
+	if (EasyAvatar_CPUHasAVX2())
+		return EasyAvatar_b64decodeBlocksAVX2;
+	if (EasyAvatar_CPUHasSSSE3())
+		return EasyAvatar_b64decodeBlocksSSSE3;
+#endif
+	return EasyAvatar_b64decodeBlocksScalar;
+}
+
+size_t EasyAvatar_b64decodeBlocks(const char* data, size_t input_length, BYTE* output)
+{
+	EasyAvatar_b64decodeBlocksFunc impl = decodeBlocksImpl;
+	if (!impl)
+	{
+		impl = EasyAvatar_Selectb64decoder();
+		decodeBlocksImpl = impl;
+	}
+
+	return impl(data, input_length, output);
+}
+
+size_t EasyAvatar_b64decodeText(const char* text, size_t max_length, BYTE* output)
+{
+	const unsigned char* in = (const unsigned char*)text;
+	size_t position = 0;
+	size_t decoded = 0;
+
+	for (;;)
+	{
+		// Fast path for long runs without line breaks, which is what browsers put into data URIs
+		size_t consumed = EasyAvatar_b64decodeBlocks(text + position, (max_length - position) & ~(size_t)3, output + decoded);
+		position += consumed;
+		decoded += consumed / 4 * 3;
+
+		// Collect the group the fast path stopped at one character at a time, across whitespace and up to the terminator
+		unsigned int sextets[4];
+		int count = 0;
+		int padding = 0;
+		while (count < 4 && position < max_length && in[position] != '\0')
+		{
+			unsigned char c = in[position++];
+			if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+				continue;
+
+			if (c == '=')
+			{
+				// Padding only completes a group that already has at least two characters
+				if (count < 2)
+					return 0;
+				padding++;
+				sextets[count++] = 0;
+				continue;
+			}
+
+			if ((decoding_table[c] & 0x80) || padding > 0)
+				return 0;
+			sextets[count++] = decoding_table[c];
+		}
+
+		if (count == 0)
+			return decoded;
+
+		// Missing padding at the very end is tolerated, a single dangling character is not
+		if (count < 4)
+		{
+			if (count < 2)
+				return 0;
+			padding += 4 - count;
+			while (count < 4)
+				sextets[count++] = 0;
+		}
+
+		unsigned int triple = (sextets[0] << 3 * 6)
+			+ (sextets[1] << 2 * 6)
+			+ (sextets[2] << 1 * 6)
+			+ (sextets[3] << 0 * 6);
+
+		output[decoded] = (triple >> 2 * 8) & 0xFF;
+		output[decoded + 1] = (triple >> 1 * 8) & 0xFF;
+		output[decoded + 2] = (triple >> 0 * 8) & 0xFF;
+		decoded += 3 - padding;
+
+		if (padding > 0)
+			return decoded;
+	}
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <Windows.h>
+
+/*
+	Returns a heap allocated string of the base64 encoded version of data.
+	Returns NULL if anything fails.
+*/
+char* EasyAvatar_b64encode(const unsigned char* data, size_t input_length);
+
+/*
+	Decodes complete groups of 4 characters from data into output until the first group that contains
+	anything but base64 alphabet characters (padding, whitespace, garbage) or until input_length is reached.
+	Uses AVX2 or SSSE3 when the CPU supports it. output must have room for input_length / 4 * 3 bytes.
+	Returns the number of characters consumed, always a multiple of 4.
+*/
+size_t EasyAvatar_b64decodeBlocks(const char* data, size_t input_length, BYTE* output);
+
+/*
+	Decodes base64 text in a single pass up to its terminating NUL or max_length characters, whichever comes first,
+	so text that lives in memory we don't own never has to be measured or copied first.
+	Whitespace is skipped and missing padding at the end is tolerated. Decoding stops after padding.
+	output must have room for max_length / 4 * 3 + 3 bytes.
+	Returns the number of decoded bytes, 0 if the text is empty or not valid base64.
+*/
+size_t EasyAvatar_b64decodeText(const char* text, size_t max_length, BYTE* output);
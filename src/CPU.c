@@ -0,0 +1,79 @@
+#include "CPU.h"
+
+#ifdef EASYAVATAR_X86
+
+#ifndef _MSC_VER
+#include <cpuid.h>
+#endif
+
+#define EASYAVATAR_CPU_SSSE3 0x1
+#define EASYAVATAR_CPU_SSE41 0x2
+#define EASYAVATAR_CPU_AVX2  0x4
+// Set once the features have been queried, kept clear of the sign bit of the LONG
+#define EASYAVATAR_CPU_KNOWN 0x40000000
+
+// Every thread computes the same value so the race is harmless
+static volatile LONG cpuFeatures = 0;
+
+static LONG EasyAvatar_QueryCPUFeatures(void)
+{
+	unsigned int leaf1[4] = { 0 };
+	unsigned int leaf7[4] = { 0 };
+#ifdef _MSC_VER
+	__cpuid((int*)leaf1, 1);
+	__cpuidex((int*)leaf7, 7, 0);
+#else
+	__cpuid(1, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+	__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+
+	LONG features = EASYAVATAR_CPU_KNOWN;
+	if (leaf1[2] & (1u << 9))
+		features |= EASYAVATAR_CPU_SSSE3;
+	if (leaf1[2] & (1u << 19))
+		features |= EASYAVATAR_CPU_SSE41;
+
+	// The OS has to save the YMM registers on context switches (OSXSAVE and XCR0 bits 1 and 2)
+	if (!(leaf1[2] & (1u << 27)))
+		return features;
+#ifdef _MSC_VER
+	unsigned long long xcr0 = _xgetbv(0);
+#else
+	unsigned int xcr0Low, xcr0High;
+	__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+	unsigned long long xcr0 = ((unsigned long long)xcr0High << 32) | xcr0Low;
+#endif
+	if ((xcr0 & 6) == 6 && (leaf7[1] & (1u << 5)))
+		features |= EASYAVATAR_CPU_AVX2;
+
+	return features;
+}
+
+static LONG EasyAvatar_GetCPUFeatures(void)
+{
+	LONG features = cpuFeatures;
+	if (!features)
+	{
+		features = EasyAvatar_QueryCPUFeatures();
+		cpuFeatures = features;
+	}
+
+	return features;
+}
+
+BOOL EasyAvatar_CPUHasSSSE3(void)
+{
+	return (EasyAvatar_GetCPUFeatures() & EASYAVATAR_CPU_SSSE3) != 0;
+}
+
+BOOL EasyAvatar_CPUHasSSE41(void)
+{
+	return (EasyAvatar_GetCPUFeatures() & EASYAVATAR_CPU_SSE41) != 0;
+}
+
+BOOL EasyAvatar_CPUHasAVX2(void)
+{
+	return (EasyAvatar_GetCPUFeatures() & EASYAVATAR_CPU_AVX2) != 0;
+}
+
+#endif // EASYAVATAR_X86
@@ -0,0 +1,30 @@
+#pragma once
+#include <Windows.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define EASYAVATAR_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets us use any intrinsic without enabling the instruction set for the whole file
+#define EASYAVATAR_TARGET(isa)
+#else
+#define EASYAVATAR_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+// NEON is mandatory on ARM64, no runtime check needed
+#define EASYAVATAR_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef EASYAVATAR_X86
+/*
+	Runtime checks for the instruction sets our vectorized code paths use.
+	The results are cached after the first call.
+*/
+BOOL EasyAvatar_CPUHasSSSE3(void);
+
+BOOL EasyAvatar_CPUHasSSE41(void);
+
+BOOL EasyAvatar_CPUHasAVX2(void);
+#endif
@@ -0,0 +1,110 @@
+#include "ClipboardListener.h"
+
+#define EASYAVATAR_LISTENER_CLASS "EasyAvatarClipboardListener"
+
+static HANDLE listenerThread = NULL;
+static HANDLE listenerReady = NULL;
+static HWND listenerWindow = NULL;
+static void (*listenerCallback)(void) = NULL;
+
+static LRESULT CALLBACK EasyAvatar_ListenerProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	switch (message)
+	{
+	case WM_CLIPBOARDUPDATE:
+		// Reading the clipboard right now would race its owner, the worker gets to it soon enough
+		listenerCallback();
+		return 0;
+	case WM_CLOSE:
+		DestroyWindow(window);
+		return 0;
+	case WM_DESTROY:
+		RemoveClipboardFormatListener(window);
+		PostQuitMessage(0);
+		return 0;
+	}
+
+	return DefWindowProcA(window, message, wParam, lParam);
+}
+
+static DWORD WINAPI EasyAvatar_ListenerMain(LPVOID parameter)
+{
+	(void)parameter;
+
+	HINSTANCE instance = GetModuleHandleA(NULL);
+	WNDCLASSEXA windowClass = { 0 };
+	windowClass.cbSize = sizeof(windowClass);
+	windowClass.lpfnWndProc = EasyAvatar_ListenerProc;
+	windowClass.hInstance = instance;
+	windowClass.lpszClassName = EASYAVATAR_LISTENER_CLASS;
+	RegisterClassExA(&windowClass);
+
+	// Message-only window, never shown but receives WM_CLIPBOARDUPDATE
+	HWND window = CreateWindowExA(0, EASYAVATAR_LISTENER_CLASS, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, instance, NULL);
+	if (window && !AddClipboardFormatListener(window))
+	{
+		DestroyWindow(window);
+		window = NULL;
+	}
+
+	listenerWindow = window;
+	SetEvent(listenerReady);
+
+	if (window)
+	{
+		MSG message;
+		while (GetMessageA(&message, NULL, 0, 0) > 0)
+		{
+			TranslateMessage(&message);
+			DispatchMessageA(&message);
+		}
+	}
+
+	UnregisterClassA(EASYAVATAR_LISTENER_CLASS, instance);
+	return 0;
+}
+
+static void EasyAvatar_StopWindowsListener(void)
+{
+	if (!listenerThread)
+		return;
+
+	// The window has to be destroyed by the thread that created it
+	if (listenerWindow)
+		PostMessageA(listenerWindow, WM_CLOSE, 0, 0);
+
+	WaitForSingleObject(listenerThread, INFINITE);
+	CloseHandle(listenerThread);
+	listenerThread = NULL;
+	listenerWindow = NULL;
+}
+
+static BOOL EasyAvatar_StartWindowsListener(void (*onChange)(void))
+{
+	listenerCallback = onChange;
+	listenerWindow = NULL;
+	listenerReady = CreateEventA(NULL, TRUE, FALSE, NULL);
+	if (listenerReady)
+	{
+		listenerThread = CreateThread(NULL, 0, EasyAvatar_ListenerMain, NULL, 0, NULL);
+		if (listenerThread)
+			WaitForSingleObject(listenerReady, INFINITE);
+		CloseHandle(listenerReady);
+		listenerReady = NULL;
+	}
+
+	if (!listenerWindow)
+	{
+		EasyAvatar_StopWindowsListener();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+const struct EasyAvatar_ClipboardProvider EasyAvatar_WindowsClipboard =
+{
+	EasyAvatar_StartWindowsListener,
+	EasyAvatar_StopWindowsListener,
+	EasyAvatar_GetClipboardContent
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <Windows.h>
+
+#include "Prefetch.h"
+
+/*
+	The clipboard of the Windows desktop: a message-only window on its own thread registered with AddClipboardFormatListener
+	reports changes, EasyAvatar_GetClipboardContent reads them.
+*/
+extern const struct EasyAvatar_ClipboardProvider EasyAvatar_WindowsClipboard;
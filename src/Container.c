@@ -0,0 +1,202 @@
+#include "Container.h"
+
+#include <string.h>
+
+#include "EasyAvatar.h"
+#include "ImageIO.h"
+#include "ImageProbe.h"
+
+struct EasyAvatar_Page
+{
+	// Page number, or offset of the icon data within an .icns
+	long index;
+	long size;
+	FREE_IMAGE_FORMAT format;
+	unsigned int width;
+	unsigned int height;
+	unsigned int bpp;
+};
+
+/*
+	Icon types of an .icns that may hold PNG or JPEG 2000 data, with their size in pixels.
+*/
+static const struct
+{
+	char type[5];
+	unsigned int size;
+} EASYAVATAR_ICNS_TYPES[] =
+{
+	{ "icp4", 16 }, { "icp5", 32 }, { "icp6", 64 }, { "ic07", 128 }, { "ic08", 256 }, { "ic09", 512 },
+	{ "ic10", 1024 }, { "ic11", 32 }, { "ic12", 64 }, { "ic13", 256 }, { "ic14", 512 }
+};
+
+static DWORD EasyAvatar_ReadBig32(const BYTE* data)
+{
+	return ((DWORD)data[0] << 24) | ((DWORD)data[1] << 16) | ((DWORD)data[2] << 8) | data[3];
+}
+
+/*
+	Returns TRUE if page is at least EASYAVATAR_MAX_DIMENSION pixels wide and at least EASYAVATAR_MAX_DIMENSION pixels high.
+*/
+static BOOL EasyAvatar_CoversAvatar(const struct EasyAvatar_Page* page)
+{
+	return page->width >= EASYAVATAR_MAX_DIMENSION && page->height >= EASYAVATAR_MAX_DIMENSION;
+}
+
+/*
+	Returns TRUE if page is a better pick than best.
+*/
+static BOOL EasyAvatar_IsBetterPage(const struct EasyAvatar_Page* page, const struct EasyAvatar_Page* best)
+{
+	// Too large to decode at all
+	if ((UINT64)page->width * page->height > EASYAVATAR_MAX_PIXELS || page->width == 0 || page->height == 0)
+		return FALSE;
+	if (best->width == 0)
+		return TRUE;
+
+	BOOL covers = EasyAvatar_CoversAvatar(page);
+	BOOL bestCovers = EasyAvatar_CoversAvatar(best);
+	if (covers != bestCovers)
+		return covers;
+
+	// Downscaling from the smallest page that's large enough is cheapest, otherwise upscale as little as possible
+	UINT64 pixels = (UINT64)page->width * page->height;
+	UINT64 bestPixels = (UINT64)best->width * best->height;
+	if (pixels != bestPixels)
+		return covers ? pixels < bestPixels : pixels > bestPixels;
+
+	return page->bpp > best->bpp;
+}
+
+BOOL EasyAvatar_IsICNS(FreeImageIO* io, fi_handle handle)
+{
+	BYTE header[4];
+	BOOL icns = io->seek_proc(handle, 0, SEEK_SET) == 0 && io->read_proc(header, 1, sizeof(header), handle) == sizeof(header)
+		&& memcmp(header, "icns", 4) == 0;
+
+	io->seek_proc(handle, 0, SEEK_SET);
+	return icns;
+}
+
+FIBITMAP* EasyAvatar_LoadBestPage(FreeImageIO* io, fi_handle handle, FREE_IMAGE_FORMAT format)
+{
+	struct EasyAvatar_Page best = { -1 };
+
+	// Plugins that support it only read the headers of every page
+	io->seek_proc(handle, 0, SEEK_SET);
+	FIMULTIBITMAP* headers = FreeImage_OpenMultiBitmapFromHandle(format, io, handle, FIF_LOAD_NOPIXELS);
+	if (!headers)
+		return NULL;
+
+	int pageCount = FreeImage_GetPageCount(headers);
+	for (int i = 0; i < pageCount; i++)
+	{
+		FIBITMAP* header = FreeImage_LockPage(headers, i);
+		if (!header)
+			continue;
+
+		struct EasyAvatar_Page page = { i, 0, format, FreeImage_GetWidth(header), FreeImage_GetHeight(header), FreeImage_GetBPP(header) };
+		FreeImage_UnlockPage(headers, header, FALSE);
+		if (EasyAvatar_IsBetterPage(&page, &best))
+			best = page;
+	}
+	FreeImage_CloseMultiBitmap(headers, 0);
+
+	if (best.index < 0)
+		return NULL;
+
+	io->seek_proc(handle, 0, SEEK_SET);
+	FIMULTIBITMAP* pages = FreeImage_OpenMultiBitmapFromHandle(format, io, handle, 0);
+	if (!pages)
+		return NULL;
+
+	// The locked page belongs to the multi-page bitmap, keep a copy of it
+	FIBITMAP* dib = NULL;
+	FIBITMAP* page = FreeImage_LockPage(pages, (int)best.index);
+	if (page)
+	{
+		dib = FreeImage_Clone(page);
+		FreeImage_UnlockPage(pages, page, FALSE);
+	}
+
+	FreeImage_CloseMultiBitmap(pages, 0);
+	return dib;
+}
+
+/*
+	Fills in format and size of the icon of the given type at offset, leaves page untouched if it isn't PNG or JPEG 2000.
+*/
+static void EasyAvatar_ProbeICNSIcon(FreeImageIO* io, fi_handle handle, const BYTE* type, struct EasyAvatar_Page* page)
+{
+	static const BYTE jpeg2000[12] = { 0, 0, 0, 0x0C, 'j', 'P', ' ', ' ', 0x0D, 0x0A, 0x87, 0x0A };
+	BYTE signature[12];
+
+	unsigned int size = 0;
+	for (unsigned int i = 0; i < sizeof(EASYAVATAR_ICNS_TYPES) / sizeof(EASYAVATAR_ICNS_TYPES[0]); i++)
+	{
+		if (memcmp(type, EASYAVATAR_ICNS_TYPES[i].type, 4) == 0)
+			size = EASYAVATAR_ICNS_TYPES[i].size;
+	}
+
+	if (size == 0 || page->size < (long)sizeof(signature) || io->seek_proc(handle, page->index, SEEK_SET) != 0
+		|| io->read_proc(signature, 1, sizeof(signature), handle) != sizeof(signature))
+	{
+		return;
+	}
+
+	if (memcmp(signature, jpeg2000, sizeof(jpeg2000)) == 0)
+	{
+		page->format = FIF_JP2;
+		page->width = page->height = size;
+		page->bpp = 32;
+		return;
+	}
+
+	// The PNG header knows better than the type, some tools store other sizes
+	struct EasyAvatar_SliceReader reader;
+	struct EasyAvatar_ImageInfo info;
+	FreeImageIO sliceIO;
+	EasyAvatar_OpenSliceReader(&reader, &sliceIO, io, handle, page->index, page->size);
+	if (EasyAvatar_ProbeImage(&sliceIO, &reader, &info) && info.format == FIF_PNG)
+	{
+		page->format = FIF_PNG;
+		page->width = info.width;
+		page->height = info.height;
+		page->bpp = info.bitDepth;
+	}
+}
+
+FIBITMAP* EasyAvatar_LoadBestICNS(FreeImageIO* io, fi_handle handle)
+{
+	struct EasyAvatar_Page best = { -1 };
+	BYTE header[8];
+
+	if (io->seek_proc(handle, 0, SEEK_SET) != 0 || io->read_proc(header, 1, sizeof(header), handle) != sizeof(header) || memcmp(header, "icns", 4) != 0)
+		return NULL;
+
+	// Every element is a type, its length including this header and the data
+	long fileSize = (long)EasyAvatar_ReadBig32(header + 4);
+	long offset = sizeof(header);
+	while (offset + (long)sizeof(header) <= fileSize && io->seek_proc(handle, offset, SEEK_SET) == 0
+		&& io->read_proc(header, 1, sizeof(header), handle) == sizeof(header))
+	{
+		DWORD length = EasyAvatar_ReadBig32(header + 4);
+		if (length < sizeof(header) || length > (DWORD)(fileSize - offset))
+			break;
+
+		struct EasyAvatar_Page page = { offset + (long)sizeof(header), (long)length - (long)sizeof(header), FIF_UNKNOWN, 0, 0, 0 };
+		EasyAvatar_ProbeICNSIcon(io, handle, header, &page);
+		if (page.format != FIF_UNKNOWN && EasyAvatar_IsBetterPage(&page, &best))
+			best = page;
+
+		offset += (long)length;
+	}
+
+	if (best.index < 0)
+		return NULL;
+
+	struct EasyAvatar_SliceReader reader;
+	FreeImageIO sliceIO;
+	EasyAvatar_OpenSliceReader(&reader, &sliceIO, io, handle, best.index, best.size);
+	return FreeImage_LoadFromHandle(best.format, &sliceIO, &reader, 0);
+}
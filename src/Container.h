@@ -0,0 +1,23 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+/*
+	Returns TRUE if the data behind handle is an Apple icon (.icns), which FreeImage can't read on its own.
+*/
+BOOL EasyAvatar_IsICNS(FreeImageIO* io, fi_handle handle);
+
+/*
+	Decodes the page of the ICO or multi-page TIFF behind handle that suits an avatar best:
+	the smallest one reaching EASYAVATAR_MAX_DIMENSION, or the largest one if none does.
+	Pages are compared by their headers only, just the chosen one gets decoded.
+	Returns NULL if no page can be decoded within EASYAVATAR_MAX_PIXELS.
+*/
+FIBITMAP* EasyAvatar_LoadBestPage(FreeImageIO* io, fi_handle handle, FREE_IMAGE_FORMAT format);
+
+/*
+	Same as EasyAvatar_LoadBestPage for the PNG and JPEG 2000 icons of an .icns file.
+	Older icon types with their own packbits encoding are skipped, every modern .icns has PNG versions as well.
+*/
+FIBITMAP* EasyAvatar_LoadBestICNS(FreeImageIO* io, fi_handle handle);
@@ -0,0 +1,254 @@
+#include "DIB.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ImageProbe.h"
+
+// biCompression values we can read, everything else is compressed
+#define EASYAVATAR_BI_RGB 0
+#define EASYAVATAR_BI_BITFIELDS 3
+#define EASYAVATAR_BI_ALPHABITFIELDS 6
+
+// Size of BITMAPINFOHEADER, every later header version starts with it
+#define EASYAVATAR_DIB_INFO_HEADER 40
+
+/*
+	Where a channel sits in a 16 or 32 bit pixel and how wide it is.
+*/
+struct EasyAvatar_DIBChannel
+{
+	DWORD mask;
+	unsigned int shift;
+	unsigned int bits;
+};
+
+static WORD EasyAvatar_ReadDIB16(const BYTE* data)
+{
+	return (WORD)(data[0] | (data[1] << 8));
+}
+
+static DWORD EasyAvatar_ReadDIB32(const BYTE* data)
+{
+	return (DWORD)data[0] | ((DWORD)data[1] << 8) | ((DWORD)data[2] << 16) | ((DWORD)data[3] << 24);
+}
+
+static void EasyAvatar_InitDIBChannel(struct EasyAvatar_DIBChannel* channel, DWORD mask)
+{
+	channel->mask = mask;
+	channel->shift = 0;
+	channel->bits = 0;
+	if (!mask)
+		return;
+
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		channel->shift++;
+	}
+	while (mask & 1)
+	{
+		mask >>= 1;
+		channel->bits++;
+	}
+}
+
+static BYTE EasyAvatar_ExtractDIBChannel(const struct EasyAvatar_DIBChannel* channel, DWORD pixel)
+{
+	if (channel->bits == 0)
+		return 0;
+
+	DWORD value = (pixel & channel->mask) >> channel->shift;
+	if (channel->bits >= 8)
+		return (BYTE)(value >> (channel->bits - 8));
+
+	// Widen e.g. 5 bit channels so their maximum becomes 255
+	DWORD maximum = (1u << channel->bits) - 1;
+	return (BYTE)((value * 255 + maximum / 2) / maximum);
+}
+
+FIBITMAP* EasyAvatar_LoadDIB(const BYTE* data, size_t size)
+{
+	if (size < EASYAVATAR_DIB_INFO_HEADER)
+		return NULL;
+
+	DWORD headerSize = EasyAvatar_ReadDIB32(data);
+	if (headerSize < EASYAVATAR_DIB_INFO_HEADER || headerSize > size)
+		return NULL;
+
+	INT64 width = (int32_t)EasyAvatar_ReadDIB32(data + 4);
+	INT64 height = (int32_t)EasyAvatar_ReadDIB32(data + 8);
+	unsigned int bitCount = EasyAvatar_ReadDIB16(data + 14);
+	DWORD compression = EasyAvatar_ReadDIB32(data + 16);
+	DWORD colorsUsed = EasyAvatar_ReadDIB32(data + 32);
+
+	// A negative height means the first row in memory is the top one
+	BOOL topDown = height < 0;
+	if (topDown)
+		height = -height;
+	if (width <= 0 || height <= 0 || (UINT64)width * (UINT64)height > EASYAVATAR_MAX_PIXELS)
+		return NULL;
+
+	size_t offset = headerSize;
+	DWORD masks[4] = { 0, 0, 0, 0 };
+	BOOL bitfields = compression == EASYAVATAR_BI_BITFIELDS || compression == EASYAVATAR_BI_ALPHABITFIELDS;
+	if (bitfields)
+	{
+		if (bitCount != 16 && bitCount != 32)
+			return NULL;
+
+		// BITMAPINFOHEADER is followed by the masks, later versions have them inside the header
+		size_t maskCount = compression == EASYAVATAR_BI_ALPHABITFIELDS ? 4 : 3;
+		if (headerSize == EASYAVATAR_DIB_INFO_HEADER)
+		{
+			if (size < EASYAVATAR_DIB_INFO_HEADER + maskCount * 4)
+				return NULL;
+			offset += maskCount * 4;
+		}
+		else
+		{
+			if (headerSize < EASYAVATAR_DIB_INFO_HEADER + maskCount * 4)
+				return NULL;
+			// BITMAPV3INFOHEADER and later always carry an alpha mask
+			if (headerSize >= EASYAVATAR_DIB_INFO_HEADER + 16)
+				maskCount = 4;
+		}
+
+		for (size_t i = 0; i < maskCount; i++)
+			masks[i] = EasyAvatar_ReadDIB32(data + EASYAVATAR_DIB_INFO_HEADER + i * 4);
+	}
+	else if (compression != EASYAVATAR_BI_RGB)
+	{
+		return NULL;
+	}
+	else if (bitCount == 16)
+	{
+		masks[0] = 0x7C00;
+		masks[1] = 0x03E0;
+		masks[2] = 0x001F;
+	}
+	else if (bitCount == 32)
+	{
+		// The fourth byte is officially unused, but plenty of applications put alpha there
+		masks[0] = 0x00FF0000;
+		masks[1] = 0x0000FF00;
+		masks[2] = 0x000000FF;
+		masks[3] = 0xFF000000;
+	}
+
+	RGBQUAD palette[256];
+	memset(palette, 0, sizeof(palette));
+	if (bitCount == 1 || bitCount == 4 || bitCount == 8)
+	{
+		size_t entries = colorsUsed ? colorsUsed : 1u << bitCount;
+		if (entries > 256 || size - offset < entries * 4)
+			return NULL;
+
+		for (size_t i = 0; i < entries; i++)
+		{
+			palette[i].rgbBlue = data[offset + i * 4];
+			palette[i].rgbGreen = data[offset + i * 4 + 1];
+			palette[i].rgbRed = data[offset + i * 4 + 2];
+		}
+		offset += entries * 4;
+	}
+	else if (bitCount == 16 || bitCount == 24 || bitCount == 32)
+	{
+		// True color DIBs may still come with a palette for display on old hardware
+		if (colorsUsed > 256 || size - offset < (size_t)colorsUsed * 4)
+			return NULL;
+		offset += (size_t)colorsUsed * 4;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	size_t stride = ((size_t)width * bitCount + 31) / 32 * 4;
+	size_t pixelBytes = stride * (size_t)height;
+	// Some applications put the masks behind a BITMAPV5HEADER as well
+	if (compression == EASYAVATAR_BI_BITFIELDS && headerSize > EASYAVATAR_DIB_INFO_HEADER && size - offset == pixelBytes + 12)
+		offset += 12;
+	if (size - offset < pixelBytes)
+		return NULL;
+
+	BOOL alpha = masks[3] != 0;
+	unsigned int bytesPerPixel = alpha ? 4 : 3;
+	FIBITMAP* dib = FreeImage_Allocate((int)width, (int)height, alpha ? 32 : 24, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+	if (!dib)
+		return NULL;
+
+	struct EasyAvatar_DIBChannel red;
+	struct EasyAvatar_DIBChannel green;
+	struct EasyAvatar_DIBChannel blue;
+	struct EasyAvatar_DIBChannel alphaChannel;
+	EasyAvatar_InitDIBChannel(&red, masks[0]);
+	EasyAvatar_InitDIBChannel(&green, masks[1]);
+	EasyAvatar_InitDIBChannel(&blue, masks[2]);
+	EasyAvatar_InitDIBChannel(&alphaChannel, masks[3]);
+
+	// Rows whose layout already matches FreeImage's are copied as they are
+#if FREEIMAGE_COLORORDER == FREEIMAGE_COLORORDER_BGR
+	BOOL nativeRows = bitCount == 24 || (bitCount == 32 && masks[0] == 0x00FF0000 && masks[1] == 0x0000FF00 && masks[2] == 0x000000FF && masks[3] == 0xFF000000);
+#else
+	BOOL nativeRows = FALSE;
+#endif
+
+	const BYTE* pixels = data + offset;
+	BYTE alphaSeen = 0;
+	for (unsigned int y = 0; y < (unsigned int)height; y++)
+	{
+		// FreeImage stores rows bottom-up like a regular DIB
+		const BYTE* row = pixels + (topDown ? (size_t)height - 1 - y : y) * stride;
+		BYTE* output = FreeImage_GetScanLine(dib, (int)y);
+
+		if (nativeRows)
+		{
+			memcpy(output, row, (size_t)width * bytesPerPixel);
+			if (alpha)
+			{
+				for (unsigned int x = 0; x < (unsigned int)width; x++)
+					alphaSeen |= row[x * 4 + 3];
+			}
+			continue;
+		}
+
+		for (unsigned int x = 0; x < (unsigned int)width; x++, output += bytesPerPixel)
+		{
+			if (bitCount <= 8)
+			{
+				size_t bit = (size_t)x * bitCount;
+				unsigned int index = (row[bit / 8] >> (8 - bitCount - bit % 8)) & ((1u << bitCount) - 1);
+				output[FI_RGBA_RED] = palette[index].rgbRed;
+				output[FI_RGBA_GREEN] = palette[index].rgbGreen;
+				output[FI_RGBA_BLUE] = palette[index].rgbBlue;
+				continue;
+			}
+
+			DWORD pixel = bitCount == 16 ? EasyAvatar_ReadDIB16(row + x * 2) : bitCount == 24
+				? (DWORD)row[x * 3] | ((DWORD)row[x * 3 + 1] << 8) | ((DWORD)row[x * 3 + 2] << 16)
+				: EasyAvatar_ReadDIB32(row + x * 4);
+			output[FI_RGBA_RED] = bitCount == 24 ? (BYTE)(pixel >> 16) : EasyAvatar_ExtractDIBChannel(&red, pixel);
+			output[FI_RGBA_GREEN] = bitCount == 24 ? (BYTE)(pixel >> 8) : EasyAvatar_ExtractDIBChannel(&green, pixel);
+			output[FI_RGBA_BLUE] = bitCount == 24 ? (BYTE)pixel : EasyAvatar_ExtractDIBChannel(&blue, pixel);
+			if (alpha)
+			{
+				output[FI_RGBA_ALPHA] = EasyAvatar_ExtractDIBChannel(&alphaChannel, pixel);
+				alphaSeen |= output[FI_RGBA_ALPHA];
+			}
+		}
+	}
+
+	// Nobody filled in the alpha channel, an invisible avatar is certainly not what was copied
+	if (alpha && alphaSeen == 0)
+	{
+		for (unsigned int y = 0; y < (unsigned int)height; y++)
+		{
+			BYTE* output = FreeImage_GetScanLine(dib, (int)y);
+			for (unsigned int x = 0; x < (unsigned int)width; x++)
+				output[x * 4 + FI_RGBA_ALPHA] = 0xFF;
+		}
+	}
+
+	return dib;
+}
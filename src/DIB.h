@@ -0,0 +1,13 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+/*
+	Converts a packed DIB, as found in the CF_DIB and CF_DIBV5 clipboard formats, into a new 24 or 32 bit bitmap in a single pass.
+	Understands BITMAPINFOHEADER up to BITMAPV5HEADER, bottom-up and top-down rows, 1/4/8 bit palettes and 16/24/32 bit pixels with or without bitfields.
+	data is only read, never kept, and is parsed byte by byte without relying on the Windows structures.
+	32 bit pixels whose alpha is zero everywhere are taken as opaque, most applications leave that byte unset.
+	Returns NULL for malformed or compressed DIBs and anything over EASYAVATAR_MAX_PIXELS.
+*/
+FIBITMAP* EasyAvatar_LoadDIB(const BYTE* data, size_t size);
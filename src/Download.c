@@ -0,0 +1,198 @@
+#include "Download.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winhttp.h>
+
+#include "DownloadResponse.h"
+#include "EasyAvatar.h"
+#include "Worker.h"
+
+static enum EasyAvatar_DownloadResult EasyAvatar_GetRequestError(void)
+{
+	return GetLastError() == ERROR_WINHTTP_TIMEOUT ? EASYAVATAR_DOWNLOAD_TIMEOUT : EASYAVATAR_DOWNLOAD_FAILED;
+}
+
+/*
+	Converts wide to UTF-8 into value, leaves value empty if it doesn't fit.
+*/
+static void EasyAvatar_StoreString(const wchar_t* wide, char* value, size_t size)
+{
+	if (WideCharToMultiByte(CP_UTF8, 0, wide, -1, value, (int)size, NULL, NULL) == 0)
+		value[0] = '\0';
+}
+
+static void EasyAvatar_QueryHeader(HINTERNET request, DWORD query, char* value, size_t size)
+{
+	wchar_t wide[EASYAVATAR_VALIDATOR_SIZE];
+	DWORD length = sizeof(wide);
+	value[0] = '\0';
+	if (WinHttpQueryHeaders(request, query, WINHTTP_HEADER_NAME_BY_INDEX, wide, &length, WINHTTP_NO_HEADER_INDEX))
+		EasyAvatar_StoreString(wide, value, size);
+}
+
+/*
+	Looks at every Cache-Control header, one too long to read counts as no-store to be safe.
+*/
+static BOOL EasyAvatar_QueryNoStore(HINTERNET request)
+{
+	wchar_t wide[EASYAVATAR_VALIDATOR_SIZE];
+	char value[EASYAVATAR_VALIDATOR_SIZE * 3];
+	DWORD index = 0;
+	for (;;)
+	{
+		DWORD length = sizeof(wide);
+		if (!WinHttpQueryHeaders(request, WINHTTP_QUERY_CACHE_CONTROL, WINHTTP_HEADER_NAME_BY_INDEX, wide, &length, &index))
+			return GetLastError() == ERROR_INSUFFICIENT_BUFFER;
+
+		EasyAvatar_StoreString(wide, value, sizeof(value));
+		if (EasyAvatar_HasNoStore(value))
+			return TRUE;
+	}
+}
+
+static void EasyAvatar_QueryResponseInfo(HINTERNET request, struct EasyAvatar_DownloadInfo* response)
+{
+	EasyAvatar_QueryHeader(request, WINHTTP_QUERY_ETAG, response->etag, sizeof(response->etag));
+	EasyAvatar_QueryHeader(request, WINHTTP_QUERY_LAST_MODIFIED, response->lastModified, sizeof(response->lastModified));
+	response->noStore = EasyAvatar_QueryNoStore(request);
+
+	wchar_t url[EASYAVATAR_URL_SIZE];
+	DWORD length = sizeof(url);
+	response->finalUrl[0] = '\0';
+	if (WinHttpQueryOption(request, WINHTTP_OPTION_URL, url, &length))
+		EasyAvatar_StoreString(url, response->finalUrl, sizeof(response->finalUrl));
+}
+
+/*
+	Adds If-None-Match and If-Modified-Since for whichever validators we have.
+*/
+static void EasyAvatar_AddConditionalHeaders(HINTERNET request, const struct EasyAvatar_DownloadInfo* validators)
+{
+	char headers[2 * EASYAVATAR_VALIDATOR_SIZE + 64];
+	int length = 0;
+	if (validators->etag[0])
+		length += snprintf(headers + length, sizeof(headers) - length, "If-None-Match: %s\r\n", validators->etag);
+	if (validators->lastModified[0])
+		length += snprintf(headers + length, sizeof(headers) - length, "If-Modified-Since: %s\r\n", validators->lastModified);
+	if (length == 0)
+		return;
+
+	wchar_t wide[sizeof(headers)];
+	if (MultiByteToWideChar(CP_UTF8, 0, headers, -1, wide, sizeof(wide) / sizeof(wide[0])) > 0)
+		WinHttpAddRequestHeaders(request, wide, (DWORD)-1, WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE);
+}
+
+// GetTickCount64 is WINAPI, which isn't the calling convention of the transport on x86
+static ULONGLONG EasyAvatar_GetMilliseconds(void)
+{
+	return GetTickCount64();
+}
+
+static BOOL EasyAvatar_GetStatus(void* context, DWORD* status)
+{
+	DWORD length = sizeof(*status);
+	return WinHttpQueryHeaders((HINTERNET)context, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, status, &length, WINHTTP_NO_HEADER_INDEX);
+}
+
+static BOOL EasyAvatar_GetContentLength(void* context, DWORD* contentLength)
+{
+	DWORD length = sizeof(*contentLength);
+	return WinHttpQueryHeaders((HINTERNET)context, WINHTTP_QUERY_CONTENT_LENGTH | WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, contentLength, &length, WINHTTP_NO_HEADER_INDEX);
+}
+
+static enum EasyAvatar_DownloadResult EasyAvatar_QueryAvailable(void* context, DWORD* available)
+{
+	return WinHttpQueryDataAvailable((HINTERNET)context, available) ? EASYAVATAR_DOWNLOAD_OK : EasyAvatar_GetRequestError();
+}
+
+static enum EasyAvatar_DownloadResult EasyAvatar_ReadData(void* context, BYTE* target, DWORD size, DWORD* read)
+{
+	return WinHttpReadData((HINTERNET)context, target, size, read) ? EASYAVATAR_DOWNLOAD_OK : EasyAvatar_GetRequestError();
+}
+
+enum EasyAvatar_DownloadResult EasyAvatar_Download(const char* url, const struct EasyAvatar_DownloadInfo* validators, struct EasyAvatar_DownloadInfo* response, BYTE** data, size_t* size)
+{
+	ULONGLONG deadline = EasyAvatar_GetMilliseconds() + EASYAVATAR_DOWNLOAD_TIMEOUT_MS;
+	enum EasyAvatar_DownloadResult result = EASYAVATAR_DOWNLOAD_FAILED;
+	struct EasyAvatar_DownloadBuffer buffer = { NULL, 0, 0, EASYAVATAR_DOWNLOAD_MAX_SIZE };
+	HINTERNET session = NULL;
+	HINTERNET connection = NULL;
+	HINTERNET request = NULL;
+	if (response)
+		memset(response, 0, sizeof(*response));
+
+	// WinHTTP only speaks UTF-16
+	int wideLength = MultiByteToWideChar(CP_UTF8, 0, url, -1, NULL, 0);
+	wchar_t* wideUrl = wideLength > 0 ? (wchar_t*)malloc(wideLength * sizeof(wchar_t)) : NULL;
+	if (!wideUrl || MultiByteToWideChar(CP_UTF8, 0, url, -1, wideUrl, wideLength) != wideLength)
+	{
+		free(wideUrl);
+		return EASYAVATAR_DOWNLOAD_FAILED;
+	}
+
+	wchar_t host[256];
+	URL_COMPONENTS components = { 0 };
+	components.dwStructSize = sizeof(components);
+	components.lpszHostName = host;
+	components.dwHostNameLength = sizeof(host) / sizeof(host[0]);
+	// Path and query stay pointers into wideUrl, they run up to its end
+	components.dwUrlPathLength = (DWORD)-1;
+	components.dwExtraInfoLength = (DWORD)-1;
+	if (!WinHttpCrackUrl(wideUrl, 0, 0, &components) || (components.nScheme != INTERNET_SCHEME_HTTP && components.nScheme != INTERNET_SCHEME_HTTPS))
+	{
+		free(wideUrl);
+		return EASYAVATAR_DOWNLOAD_FAILED;
+	}
+
+	session = WinHttpOpen(L"EasyAvatar/" L"" PLUGIN_VERSION, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+	if (session)
+	{
+		WinHttpSetTimeouts(session, EASYAVATAR_CONNECT_TIMEOUT_MS, EASYAVATAR_CONNECT_TIMEOUT_MS, EASYAVATAR_DOWNLOAD_TIMEOUT_MS, EASYAVATAR_DOWNLOAD_TIMEOUT_MS);
+		connection = WinHttpConnect(session, host, components.nPort, 0);
+	}
+
+	if (connection)
+	{
+		const wchar_t* path = components.lpszUrlPath && components.dwUrlPathLength ? components.lpszUrlPath : L"/";
+		request = WinHttpOpenRequest(connection, L"GET", path, NULL, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES,
+			components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0);
+	}
+
+	if (request)
+	{
+		if (validators)
+			EasyAvatar_AddConditionalHeaders(request, validators);
+
+		if (!WinHttpSendRequest(request, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0) || !WinHttpReceiveResponse(request, NULL))
+		{
+			result = EasyAvatar_GetRequestError();
+		}
+		else
+		{
+			if (response)
+				EasyAvatar_QueryResponseInfo(request, response);
+			struct EasyAvatar_DownloadTransport transport = { request, EasyAvatar_GetStatus, EasyAvatar_GetContentLength, EasyAvatar_QueryAvailable, EasyAvatar_ReadData, EasyAvatar_GetMilliseconds, EasyAvatar_IsJobCancelled };
+			result = EasyAvatar_ReadDownloadResponse(&transport, deadline, validators != NULL, &buffer);
+		}
+	}
+
+	if (request)
+		WinHttpCloseHandle(request);
+	if (connection)
+		WinHttpCloseHandle(connection);
+	if (session)
+		WinHttpCloseHandle(session);
+	free(wideUrl);
+
+	if (result != EASYAVATAR_DOWNLOAD_OK)
+	{
+		free(buffer.data);
+		return result;
+	}
+
+	*data = buffer.data;
+	*size = buffer.size;
+	return EASYAVATAR_DOWNLOAD_OK;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <Windows.h>
+
+// Downloads larger than this are aborted, no image we could turn into an avatar needs more
+#define EASYAVATAR_DOWNLOAD_MAX_SIZE (32u * 1024u * 1024u)
+// Time allowed for resolving the host and connecting to it
+#define EASYAVATAR_CONNECT_TIMEOUT_MS 5000
+// Time allowed for the whole download, a single blocking call never waits longer than this either
+#define EASYAVATAR_DOWNLOAD_TIMEOUT_MS 20000
+// Longest ETag or Last-Modified value we keep, longer ones are dropped rather than truncated
+#define EASYAVATAR_VALIDATOR_SIZE 256
+// Longest URL we remember after redirects
+#define EASYAVATAR_URL_SIZE 2048
+
+enum EasyAvatar_DownloadResult
+{
+	EASYAVATAR_DOWNLOAD_OK,
+	// The copy described by the validators we sent is still current, no body was transferred
+	EASYAVATAR_DOWNLOAD_NOT_MODIFIED,
+	EASYAVATAR_DOWNLOAD_FAILED,
+	// The server answered with something other than 2xx
+	EASYAVATAR_DOWNLOAD_HTTP_ERROR,
+	EASYAVATAR_DOWNLOAD_TOO_LARGE,
+	EASYAVATAR_DOWNLOAD_TIMEOUT,
+	EASYAVATAR_DOWNLOAD_CANCELLED
+};
+
+/*
+	What a response tells us about caching it, empty strings if the server didn't send the respective header.
+*/
+struct EasyAvatar_DownloadInfo
+{
+	char etag[EASYAVATAR_VALIDATOR_SIZE];
+	char lastModified[EASYAVATAR_VALIDATOR_SIZE];
+	// Where the response actually came from after following redirects
+	char finalUrl[EASYAVATAR_URL_SIZE];
+	// The server sent Cache-Control: no-store, the response must not be cached
+	BOOL noStore;
+};
+
+/*
+	Downloads url over HTTP(S) into memory, honoring the size cap, the timeouts and job cancellation.
+	If validators is not NULL its ETag and Last-Modified are sent along, EASYAVATAR_DOWNLOAD_NOT_MODIFIED is returned if they still match.
+	If response is not NULL it receives the validators and final URL of the response, also for a 304.
+	On success data receives the heap allocated body, which the caller has to free.
+*/
+enum EasyAvatar_DownloadResult EasyAvatar_Download(const char* url, const struct EasyAvatar_DownloadInfo* validators, struct EasyAvatar_DownloadInfo* response, BYTE** data, size_t* size);
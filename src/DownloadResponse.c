@@ -0,0 +1,121 @@
+#include "DownloadResponse.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Smallest allocation when the server doesn't tell us the size up front
+#define EASYAVATAR_DOWNLOAD_INITIAL_SIZE (64 * 1024)
+// Bytes read per call, also how often cancellation and the total timeout are checked
+#define EASYAVATAR_DOWNLOAD_CHUNK (64 * 1024)
+
+BYTE* EasyAvatar_ReserveDownload(struct EasyAvatar_DownloadBuffer* buffer, size_t wanted)
+{
+	if (wanted > buffer->limit - buffer->size)
+		return NULL;
+
+	if (buffer->capacity - buffer->size < wanted)
+	{
+		// Grow geometrically so large images don't cause lots of reallocations
+		size_t capacity = buffer->capacity ? buffer->capacity : EASYAVATAR_DOWNLOAD_INITIAL_SIZE;
+		while (capacity - buffer->size < wanted)
+			capacity *= 2;
+		if (capacity > buffer->limit)
+			capacity = buffer->limit;
+
+		BYTE* grown = (BYTE*)realloc(buffer->data, capacity);
+		if (!grown)
+			return NULL;
+		buffer->data = grown;
+		buffer->capacity = capacity;
+	}
+
+	return buffer->data + buffer->size;
+}
+
+BOOL EasyAvatar_HasNoStore(const char* cacheControl)
+{
+	static const char directive[] = "no-store";
+	const size_t directiveLength = sizeof(directive) - 1;
+
+	// Comma separated directives, names are case-insensitive and some carry an =argument
+	const char* position = cacheControl;
+	while (*position)
+	{
+		while (*position == ',' || isspace((unsigned char)*position))
+			position++;
+		size_t length = strcspn(position, ",= \t");
+
+		BOOL matches = length == directiveLength;
+		for (size_t i = 0; matches && i < length; i++)
+			matches = tolower((unsigned char)position[i]) == directive[i];
+		if (matches)
+			return TRUE;
+
+		// Skip the argument, a quoted one may contain commas
+		position += length;
+		BOOL quoted = FALSE;
+		while (*position && (quoted || *position != ','))
+		{
+			if (*position == '"')
+				quoted = !quoted;
+			else if (*position == '\\' && quoted && position[1])
+				position++;
+			position++;
+		}
+	}
+	return FALSE;
+}
+
+enum EasyAvatar_DownloadResult EasyAvatar_ReadDownloadResponse(const struct EasyAvatar_DownloadTransport* transport, ULONGLONG deadline, BOOL conditional, struct EasyAvatar_DownloadBuffer* buffer)
+{
+	DWORD status = 0;
+	if (!transport->getStatus(transport->context, &status))
+		return EASYAVATAR_DOWNLOAD_FAILED;
+	if (status == 304 && conditional)
+		return EASYAVATAR_DOWNLOAD_NOT_MODIFIED;
+	if (status < 200 || status >= 300)
+		return EASYAVATAR_DOWNLOAD_HTTP_ERROR;
+
+	// Reject oversized images before reading a single byte of them and allocate the rest once
+	DWORD contentLength = 0;
+	if (transport->getContentLength(transport->context, &contentLength))
+	{
+		if (contentLength > buffer->limit)
+			return EASYAVATAR_DOWNLOAD_TOO_LARGE;
+		if (contentLength > 0 && !EasyAvatar_ReserveDownload(buffer, contentLength))
+			return EASYAVATAR_DOWNLOAD_FAILED;
+	}
+
+	for (;;)
+	{
+		if (transport->isCancelled())
+			return EASYAVATAR_DOWNLOAD_CANCELLED;
+		if (transport->now() > deadline)
+			return EASYAVATAR_DOWNLOAD_TIMEOUT;
+
+		DWORD available = 0;
+		enum EasyAvatar_DownloadResult result = transport->queryAvailable(transport->context, &available);
+		if (result != EASYAVATAR_DOWNLOAD_OK)
+			return result;
+		if (available == 0)
+			break;
+
+		// The server may send more than it announced, the cap is what counts
+		if (available > EASYAVATAR_DOWNLOAD_CHUNK)
+			available = EASYAVATAR_DOWNLOAD_CHUNK;
+		BYTE* target = EasyAvatar_ReserveDownload(buffer, available);
+		if (!target)
+			return buffer->size + available > buffer->limit ? EASYAVATAR_DOWNLOAD_TOO_LARGE : EASYAVATAR_DOWNLOAD_FAILED;
+
+		DWORD read = 0;
+		result = transport->read(transport->context, target, available, &read);
+		if (result != EASYAVATAR_DOWNLOAD_OK)
+			return result;
+		if (read == 0)
+			break;
+		buffer->size += read;
+	}
+
+	return buffer->size > 0 ? EASYAVATAR_DOWNLOAD_OK : EASYAVATAR_DOWNLOAD_FAILED;
+}
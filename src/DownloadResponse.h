@@ -0,0 +1,52 @@
+#pragma once
+#include <Windows.h>
+
+#include "Download.h"
+
+/*
+	Growable buffer a download is streamed into, refusing to grow past limit.
+*/
+struct EasyAvatar_DownloadBuffer
+{
+	BYTE* data;
+	size_t size;
+	size_t capacity;
+	size_t limit;
+};
+
+/*
+	The parts of an HTTP response the reader below needs, Download.c implements them over WinHTTP.
+	Every function gets context as its first argument, except now and isCancelled, which aren't tied to a request.
+*/
+struct EasyAvatar_DownloadTransport
+{
+	void* context;
+	// Status code of the response, FALSE if it can't be read
+	BOOL (*getStatus)(void* context, DWORD* status);
+	// FALSE if the server didn't announce the size of the body
+	BOOL (*getContentLength)(void* context, DWORD* length);
+	// How much of the body can be read right away, 0 once it is complete
+	enum EasyAvatar_DownloadResult (*queryAvailable)(void* context, DWORD* available);
+	enum EasyAvatar_DownloadResult (*read)(void* context, BYTE* target, DWORD size, DWORD* read);
+	// Milliseconds on a clock that never goes backwards
+	ULONGLONG (*now)(void);
+	BOOL (*isCancelled)(void);
+};
+
+/*
+	Makes room for at least wanted more bytes and returns where they go, NULL if that would exceed the limit or memory runs out.
+	Call it with the Content-Length up front so the buffer is allocated once.
+*/
+BYTE* EasyAvatar_ReserveDownload(struct EasyAvatar_DownloadBuffer* buffer, size_t wanted);
+
+/*
+	TRUE if the value of a Cache-Control header has a no-store directive, which forbids keeping the response anywhere.
+*/
+BOOL EasyAvatar_HasNoStore(const char* cacheControl);
+
+/*
+	Checks the status of a received response and reads its body into buffer, within buffer->limit and until transport->now() passes deadline.
+	A 304 only counts as EASYAVATAR_DOWNLOAD_NOT_MODIFIED if the request was conditional.
+	The buffer is left to the caller in any case.
+*/
+enum EasyAvatar_DownloadResult EasyAvatar_ReadDownloadResponse(const struct EasyAvatar_DownloadTransport* transport, ULONGLONG deadline, BOOL conditional, struct EasyAvatar_DownloadBuffer* buffer);
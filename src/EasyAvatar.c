@@ -1,8 +1,25 @@
 #include "EasyAvatar.h"
 
 #include <stdio.h>
+#include <shellapi.h>
 
 #include "FreeImage.h"
+#include "Animation.h"
+#include "AvatarCache.h"
+#include "Base64.h"
+#include "Container.h"
+#include "DIB.h"
+#include "Download.h"
+#include "Encoder.h"
+#include "Hash.h"
+#include "HttpCache.h"
+#include "ImageProbe.h"
+#include "LocalFile.h"
+#include "PNGStream.h"
+#include "Prefetch.h"
+#include "Preview.h"
+#include "Resample.h"
+#include "Worker.h"
 #include "../TeamSpeakSDK/teamspeak/public_errors.h"
 #include "../TeamSpeakSDK/teamspeak/public_rare_definitions.h"
 #include "../TeamSpeakSDK/ts3_functions.h"
@@ -14,10 +31,66 @@
 #define _strcpy(dest, destSize, src) { strncpy(dest, src, destSize-1); (dest)[destSize-1] = '\0'; }
 #endif
 
-char lastAvatarHash[MD5LEN * 2 + 1];
+/*
+	The hash of the avatar we last uploaded to a server, only touched by the worker thread.
+	A slot with a serverConnectionHandlerID of 0 is free.
+*/
+struct EasyAvatar_LastAvatar
+{
+	uint64 serverConnectionHandlerID;
+	ULONGLONG tick;
+	char md5Hash[MD5LEN * 2 + 1];
+};
 
-BOOL EasyAvatar_SetAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+static struct EasyAvatar_LastAvatar lastAvatars[EASYAVATAR_LAST_AVATAR_SLOTS];
+
+/*
+	Everything the main thread needs to hand the written avatar file to the server.
+*/
+struct EasyAvatar_Upload
+{
+	uint64 serverConnectionHandlerID;
+	char fileName[128];
+	const char* md5Hash;
+	struct TS3Functions* ts3Functions;
+};
+
+static struct EasyAvatar_LastAvatar* EasyAvatar_FindLastAvatar(uint64 serverConnectionHandlerID)
+{
+	for (int i = 0; i < EASYAVATAR_LAST_AVATAR_SLOTS; i++)
+	{
+		if (lastAvatars[i].serverConnectionHandlerID == serverConnectionHandlerID)
+			return &lastAvatars[i];
+	}
+	return NULL;
+}
+
+static void EasyAvatar_RememberLastAvatar(uint64 serverConnectionHandlerID, const char* md5Hash)
 {
+	struct EasyAvatar_LastAvatar* slot = EasyAvatar_FindLastAvatar(serverConnectionHandlerID);
+	if (!slot)
+	{
+		// Take a free slot, or the one of the server we set an avatar on the longest time ago
+		slot = &lastAvatars[0];
+		for (int i = 1; i < EASYAVATAR_LAST_AVATAR_SLOTS && slot->serverConnectionHandlerID != 0; i++)
+		{
+			if (lastAvatars[i].serverConnectionHandlerID == 0 || lastAvatars[i].tick < slot->tick)
+				slot = &lastAvatars[i];
+		}
+	}
+
+	slot->serverConnectionHandlerID = serverConnectionHandlerID;
+	slot->tick = GetTickCount64();
+	_strcpy(slot->md5Hash, sizeof(slot->md5Hash), md5Hash);
+}
+
+// Main thread only, see EasyAvatar_RunOnMainThread
+static BOOL EasyAvatar_QueryAvatarFileName(void* context)
+{
+	struct EasyAvatar_Upload* upload = (struct EasyAvatar_Upload*)context;
+	struct TS3Functions* ts3Functions = upload->ts3Functions;
+	uint64 serverConnectionHandlerID = upload->serverConnectionHandlerID;
+
 	// Uniquely identifies our client on the server
 	anyID myID;
 	if (ts3Functions->getClientID(serverConnectionHandlerID, &myID) != ERROR_ok)
@@ -26,115 +99,220 @@ BOOL EasyAvatar_SetAvatar(uint64 serverConnectionHandlerID, struct TS3Functions*
 		return FALSE;
 	}
 
-	anyID transferID;
-	int channelID = 0;
 	// Avatar file must be named avatar_ followed by the base64 hash of "CLIENTID=" (note trailing '=') with CLIENTID being your clientID on the server, no extension
-	char* clientIDHash = NULL;
-	char* md5Hash = NULL;
-
 	// Client ID as a string to be passed to the base64 encode function
 	char clientID[64];
 	// Add trailing '=' to clientID
 	snprintf(clientID, sizeof(clientID), "%hu=", myID);
 	size_t clientIDHashLen = strnlen_s(clientID, sizeof(clientID));
 
-	clientIDHash = EasyAvatar_b64encode(clientID, clientIDHashLen);
+	char* clientIDHash = EasyAvatar_b64encode(clientID, clientIDHashLen);
 	if (!clientIDHash)
 	{
 		ts3Functions->logMessage("Failed to create base64 hash of clientID", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		return FALSE;
 	}
 
-	char fileName[128];
-	snprintf(fileName, sizeof(fileName), "avatar_%s", clientIDHash);
+	snprintf(upload->fileName, sizeof(upload->fileName), "avatar_%s", clientIDHash);
 	ts3Functions->freeMemory(clientIDHash);
+	return TRUE;
+}
 
-	// Get image URL from Clipboard, if that fails try to see if a file is copied
-	char* clipboardData = EasyAvatar_GetStringFromClipboard(serverConnectionHandlerID, ts3Functions);
-	if (!clipboardData)
+// Main thread only, see EasyAvatar_RunOnMainThread
+static BOOL EasyAvatar_UploadAvatar(void* context)
+{
+	const struct EasyAvatar_Upload* upload = (const struct EasyAvatar_Upload*)context;
+	struct TS3Functions* ts3Functions = upload->ts3Functions;
+	uint64 serverConnectionHandlerID = upload->serverConnectionHandlerID;
+	anyID transferID;
+	int channelID = 0;
+
+	// Upload the image to the virtual servers internal file repository (channel with ID 0)
+	// Apparently still returns ERROR_ok even if the path to the image is invalid
+	if (ts3Functions->sendFile(serverConnectionHandlerID, channelID, "", upload->fileName, 1, 0, EASYAVATAR_FILEPATH, &transferID, NULL) != ERROR_ok)
 	{
-		// Try to get a file from clipboard
-		// EasyAvatar_GetFileFromClipboard(serverConnectionHandlerID);
-		ts3Functions->logMessage("Failed to get Image URL from Clipboard", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		ts3Functions->logMessage("Failed to upload file.", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		return FALSE;
 	}
 
-	snprintf(EASYAVATAR_IMAGEPATH, sizeof(EASYAVATAR_IMAGEPATH), "%s\\%s", EASYAVATAR_FILEPATH, fileName);
-
-	if (!EasyAvatar_HandleClipboardContent(clipboardData, serverConnectionHandlerID, ts3Functions))
+	// Set the CLIENT_FLAG_AVATAR attribute of our client to the md5 hash of the image file in order to register it as our Avatar
+	if (ts3Functions->setClientSelfVariableAsString(serverConnectionHandlerID, CLIENT_FLAG_AVATAR, upload->md5Hash) != ERROR_ok)
 	{
-		ts3Functions->freeMemory(clipboardData);
+		ts3Functions->logMessage("Failed to set CLIENT_FLAG_AVATAR", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		return FALSE;
 	}
-	
-	ts3Functions->freeMemory(clipboardData);
 
-	// Failure in this function means the file isn't an image
-	// If this function returns true it doesn't indicate that we successfully resized
-	if (!EasyAvatar_ResizeAvatar(serverConnectionHandlerID, ts3Functions))
+	// Flush all changes to the server
+	if (ts3Functions->flushClientSelfUpdates(serverConnectionHandlerID, NULL) != ERROR_ok)
 	{
+		ts3Functions->logMessage("Failed to flush changes", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		return FALSE;
 	}
-	// Check file size after resizing
-	if (!EasyAvatar_CheckFileSize(serverConnectionHandlerID, ts3Functions))
+
+	ts3Functions->logMessage("Avatar set successfully!", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+	return TRUE;
+}
+
+BOOL EasyAvatar_SetAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	char* md5Hash = NULL;
+
+	// Get image URL, local file, data URI or a copied image from Clipboard
+	struct EasyAvatar_ClipboardContent content;
+	if (!EasyAvatar_GetClipboardContent(&content, serverConnectionHandlerID, ts3Functions))
 	{
+		ts3Functions->logMessage("Failed to get an image or image URL from Clipboard", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		return FALSE;
 	}
 
-	md5Hash = EasyAvatar_CreateMD5Hash(EASYAVATAR_IMAGEPATH, serverConnectionHandlerID, ts3Functions);
-	if (!md5Hash)
+	// The repeated hotkey trigger never gets here, EasyAvatar_QueueSetAvatar coalesces it by clipboard sequence number
+	struct EasyAvatar_Image image = { 0 };
+	// The clipboard listener may have done all the work while the user was reaching for the hotkey
+	if (EasyAvatar_TakePrefetchedAvatar(content.fingerprint, &image, &md5Hash))
 	{
-		ts3Functions->logMessage("Failed to create MD5 hash of file contents", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-		return FALSE;
+		ts3Functions->logMessage("Using the prefetched avatar", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		EasyAvatar_ReleaseClipboardContent(&content);
 	}
-
-	const int hashLength = MD5LEN * 2 + 1;
-	// For some reason, when using a hotkey to set the avatar the callback gets called twice, so that the second execution fails as the file is already uploaded to the TS server
-	// Check that we are not trying to upload the same file as last time
-	if (strncmp(md5Hash, lastAvatarHash, hashLength) == 0)
+	else
 	{
-		ts3Functions->logMessage("Skipping duplicate avatar", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-		ts3Functions->freeMemory(md5Hash);
-		return TRUE;
+		md5Hash = EasyAvatar_PrepareAvatar(&content, &image, serverConnectionHandlerID, ts3Functions);
+		EasyAvatar_ReleaseClipboardContent(&content);
+		if (!md5Hash)
+			return FALSE;
 	}
-	strncpy_s(lastAvatarHash, hashLength, md5Hash, hashLength-1);
 
-	// Upload the image to the virtual servers internal file repository (channel with ID 0)
-	// Apparently still returns ERROR_ok even if the path to the image is invalid
-	if (ts3Functions->sendFile(serverConnectionHandlerID, channelID, "", fileName, 1, 0, EASYAVATAR_FILEPATH, &transferID, NULL) != ERROR_ok)
+	LONG prefetchHits = 0;
+	LONG prefetchMisses = 0;
+	LONG prefetchDiscarded = 0;
+	char message[BUFSIZE];
+	EasyAvatar_GetPrefetchStats(&prefetchHits, &prefetchMisses, &prefetchDiscarded);
+	snprintf(message, sizeof(message), "Prefetch hits: %ld, misses: %ld, discarded: %ld", prefetchHits, prefetchMisses, prefetchDiscarded);
+	ts3Functions->logMessage(message, LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+
+	// Last chance to bail out before we start talking to the server
+	if (EasyAvatar_IsJobCancelled())
 	{
-		ts3Functions->logMessage("Failed to upload file.", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		ts3Functions->freeMemory(md5Hash);
+		EasyAvatar_ReleaseImage(&image);
 		return FALSE;
 	}
 
+	// Same content set again after the first trigger finished would fail as the file is already uploaded to the TS server
+	// Check that we are not trying to upload the same file as last time on this server
+	struct EasyAvatar_LastAvatar* lastAvatar = EasyAvatar_FindLastAvatar(serverConnectionHandlerID);
+	if (lastAvatar && strcmp(md5Hash, lastAvatar->md5Hash) == 0)
+	{
+		ts3Functions->logMessage("Skipping duplicate avatar", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		ts3Functions->freeMemory(md5Hash);
+		EasyAvatar_ReleaseImage(&image);
+		return TRUE;
+	}
 
-	// Set the CLIENT_FLAG_AVATAR attribute of our client to the md5 hash of the image file in order to register it as our Avatar
-	if (ts3Functions->setClientSelfVariableAsString(serverConnectionHandlerID, CLIENT_FLAG_AVATAR, md5Hash) != ERROR_ok)
+	// The client expects anything about our connection to be asked and changed from its main thread, the worker waits there
+	// The file has to be named after our client ID on this server
+	struct EasyAvatar_Upload upload = { serverConnectionHandlerID, "", md5Hash, ts3Functions };
+	if (!EasyAvatar_RunOnMainThread(EasyAvatar_QueryAvatarFileName, &upload))
 	{
-		ts3Functions->logMessage("Failed to set CLIENT_FLAG_AVATAR", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		ts3Functions->freeMemory(md5Hash);
+		EasyAvatar_ReleaseImage(&image);
 		return FALSE;
 	}
+	snprintf(EASYAVATAR_IMAGEPATH, sizeof(EASYAVATAR_IMAGEPATH), "%s\\%s", EASYAVATAR_FILEPATH, upload.fileName);
 
-	// Flush all changes to the server
-	if (ts3Functions->flushClientSelfUpdates(serverConnectionHandlerID, NULL) != ERROR_ok)
+	// This is the only time the avatar touches the disk
+	BOOL written = EasyAvatar_WriteAvatarFile(&image, serverConnectionHandlerID, ts3Functions);
+	EasyAvatar_ReleaseImage(&image);
+	if (!written)
 	{
-		ts3Functions->logMessage("Failed to flush changes", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		ts3Functions->freeMemory(md5Hash);
 		return FALSE;
 	}
 
+	// Waits until the upload is under way
+	BOOL uploaded = EasyAvatar_RunOnMainThread(EasyAvatar_UploadAvatar, &upload);
+	// Only an avatar the server has makes the next upload of the same one redundant
+	if (uploaded)
+		EasyAvatar_RememberLastAvatar(serverConnectionHandlerID, md5Hash);
 	ts3Functions->freeMemory(md5Hash);
-	ts3Functions->logMessage("Avatar set successfully!", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+	if (!uploaded)
+		return FALSE;
 
 	// Return true if everything worked as expected
 	return TRUE;
 }
 
-BOOL EasyAvatar_DeleteAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+char* EasyAvatar_PrepareAvatar(struct EasyAvatar_ClipboardContent* content, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
-	ts3Functions->logMessage("Something went wrong, deleting avatar", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+	// The original is only ever read through source, the encoded result lives in image
+	// Neither touches the disk, the file is only written right before uploading
+	struct EasyAvatar_Source source;
+	if (!EasyAvatar_HandleClipboardContent(content, &source, serverConnectionHandlerID, ts3Functions))
+		return NULL;
+
+	if (EasyAvatar_IsJobCancelled())
+	{
+		EasyAvatar_CloseSource(&source);
+		return NULL;
+	}
+
+	// Content that is the image itself was fingerprinted from its bytes already, downloads and files are done here
+	// Copied bitmaps have no encoded size, their digest covers the DIB in the clipboard
+	UINT64 sourceDigest = content->fingerprint;
+	UINT64 sourceSize = source.bitmap ? 0 : source.memoryReader.size;
+	if (content->url || content->path)
+		sourceDigest = EasyAvatar_Fingerprint(source.memoryReader.data, source.memoryReader.size);
+
+	// The pipeline always turns the same bytes into the same avatar, one we made before goes straight to the upload
+	BOOL cached = EasyAvatar_LookupCachedAvatar(sourceDigest, sourceSize, image);
+	LONG cacheHits = 0;
+	LONG cacheMisses = 0;
+	char message[BUFSIZE];
+	EasyAvatar_GetAvatarCacheStats(&cacheHits, &cacheMisses);
+	snprintf(message, sizeof(message), "Avatar cache hits: %ld, misses: %ld", cacheHits, cacheMisses);
+	ts3Functions->logMessage(message, LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+
+	// Failure in this function means the data isn't an image
+	// If this function returns true it doesn't indicate that we successfully resized
+	BOOL resized = cached || EasyAvatar_ResizeAvatar(&source, image, serverConnectionHandlerID, ts3Functions);
+	EasyAvatar_CloseSource(&source);
+	// Check file size after resizing
+	if (!resized || !EasyAvatar_CheckFileSize(image, serverConnectionHandlerID, ts3Functions) || EasyAvatar_IsJobCancelled())
+	{
+		EasyAvatar_ReleaseImage(image);
+		return NULL;
+	}
+
+	if (!cached)
+	{
+		// Images we upload unmodified still need a separate pass over their bytes, the cache keeps the result as well
+		if (!image->hasMD5)
+		{
+			struct EasyAvatar_MD5Context context;
+			EasyAvatar_MD5Init(&context);
+			EasyAvatar_MD5Update(&context, image->data, image->size);
+			EasyAvatar_MD5Final(&context, image->md5);
+			image->hasMD5 = TRUE;
+		}
+		EasyAvatar_StoreCachedAvatar(sourceDigest, sourceSize, image);
+	}
+
+	char* md5Hash = EasyAvatar_GetAvatarHash(image, serverConnectionHandlerID, ts3Functions);
+	if (!md5Hash)
+	{
+		ts3Functions->logMessage("Failed to create MD5 hash of file contents", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		EasyAvatar_ReleaseImage(image);
+		return NULL;
+	}
+
+	return md5Hash;
+}
+
+// Main thread only, see EasyAvatar_RunOnMainThread
+static BOOL EasyAvatar_ResetAvatar(void* context)
+{
+	const struct EasyAvatar_Upload* upload = (const struct EasyAvatar_Upload*)context;
+	struct TS3Functions* ts3Functions = upload->ts3Functions;
+	uint64 serverConnectionHandlerID = upload->serverConnectionHandlerID;
 
 	// Set the CLIENT_FLAG_AVATAR to an empty string to signal that we want to delete / reset it
 	if (ts3Functions->setClientSelfVariableAsString(serverConnectionHandlerID, CLIENT_FLAG_AVATAR, "") != ERROR_ok)
@@ -153,6 +331,19 @@ BOOL EasyAvatar_DeleteAvatar(uint64 serverConnectionHandlerID, struct TS3Functio
 	return TRUE;
 }
 
+BOOL EasyAvatar_DeleteAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	ts3Functions->logMessage("Something went wrong, deleting avatar", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+
+	// Whatever we uploaded last is gone from the server, the same avatar has to be uploaded again next time
+	struct EasyAvatar_LastAvatar* lastAvatar = EasyAvatar_FindLastAvatar(serverConnectionHandlerID);
+	if (lastAvatar)
+		lastAvatar->serverConnectionHandlerID = 0;
+
+	struct EasyAvatar_Upload reset = { serverConnectionHandlerID, "", "", ts3Functions };
+	return EasyAvatar_RunOnMainThread(EasyAvatar_ResetAvatar, &reset);
+}
+
 // If anything in this function fails, the plugin will be unloaded
 BOOL EasyAvatar_CreateDirectory(struct TS3Functions* ts3Functions, char* pluginID)
 {
@@ -189,381 +380,726 @@ BOOL EasyAvatar_CreateDirectory(struct TS3Functions* ts3Functions, char* pluginI
 	return TRUE;
 }
 
-char* EasyAvatar_GetStringFromClipboard(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+static void EasyAvatar_GetSettingsPath(char* path, size_t size)
 {
-	if (!OpenClipboard(NULL))
-		return NULL;
+	snprintf(path, size, "%s\\%s", EASYAVATAR_FILEPATH, EASYAVATAR_SETTINGS_FILE);
+}
 
-	if (!IsClipboardFormatAvailable(CF_TEXT))
+BOOL EasyAvatar_GetSetting(const char* key, BOOL defaultValue)
+{
+	char path[PATH_BUFSIZE];
+	EasyAvatar_GetSettingsPath(path, sizeof(path));
+	return GetPrivateProfileIntA(EASYAVATAR_NAME, key, defaultValue, path) != 0;
+}
+
+BOOL EasyAvatar_StoreSetting(const char* key, BOOL value)
+{
+	char path[PATH_BUFSIZE];
+	EasyAvatar_GetSettingsPath(path, sizeof(path));
+	return WritePrivateProfileStringA(EASYAVATAR_NAME, key, value ? "1" : "0", path);
+}
+
+/*
+	Turns the locked clipboard text into content, reading at most size bytes of it.
+*/
+static BOOL EasyAvatar_ReadClipboardText(const char* text, size_t size, struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	if (size > 11 && strncmp(text, "data:image/", 11U) == 0)
 	{
-		CloseClipboard();
-		return NULL;
+		// Only the header up to the comma is scanned, the payload is touched exactly once by the decoder
+		const char* header = text + 11;
+		size_t limit = size - 11 < EASYAVATAR_DATA_URI_MAX_HEADER ? size - 11 : EASYAVATAR_DATA_URI_MAX_HEADER;
+		size_t headerLength = 0;
+		while (headerLength < limit && header[headerLength] != ',' && header[headerLength] != '\0')
+			headerLength++;
+
+		BOOL base64 = FALSE;
+		for (size_t i = 0; i + 6 <= headerLength && !base64; i++)
+			base64 = memcmp(header + i, "base64", 6) == 0;
+
+		if (headerLength == limit || header[headerLength] != ',' || !base64)
+		{
+			ts3Functions->logMessage("Could not parse base64 encoded image", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+			return FALSE;
+		}
+
+		// The clipboard memory bounds the payload, the decoder stops at the terminator within it
+		const char* payload = header + headerLength + 1;
+		size_t payloadSize = size - (size_t)(payload - text);
+		// Decoding in full costs 3/4 of the text but lets the clipboard go right away, the pipeline reads the image long after it closed
+		BYTE* data = (BYTE*)malloc(payloadSize / 4 * 3 + 3);
+		if (!data)
+			return FALSE;
+
+		size_t decoded = EasyAvatar_b64decodeText(payload, payloadSize, data);
+		if (decoded == 0)
+		{
+			free(data);
+			ts3Functions->logMessage("Could not parse base64 encoded image", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+			return FALSE;
+		}
+
+		content->image.data = data;
+		content->image.size = decoded;
+		content->fingerprint = EasyAvatar_Fingerprint(data, decoded);
+		return TRUE;
 	}
 
-	// Allocate a global memory object for the text. +1 for null termination
-	HGLOBAL hGlobalMem = GetClipboardData(CF_TEXT);
-	// This can be an URL to an image or the whole image encoded as base64
-	const char* clipboardStr = (const char*)(GlobalLock(hGlobalMem));
-	size_t clipBoardDataLength = strnlen_s(clipboardStr, INT_MAX) + 1;
-	// Check that the clipboard wasn't empty
-	if (!hGlobalMem || !clipboardStr || !clipBoardDataLength)
+	// Anything else has to be an URL, don't look at more text than one can have
+	size_t limit = size < EASYAVATAR_URL_SIZE ? size : EASYAVATAR_URL_SIZE;
+	const char* end = (const char*)memchr(text, '\0', limit);
+	if (!end)
 	{
-		ts3Functions->logMessage("Failed to get Clipboard contents.", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-		GlobalUnlock(hGlobalMem);
-		CloseClipboard();
-		return NULL;
+		ts3Functions->logMessage("Clipboard text is too long for an URL", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
 	}
 
-	// Copy content into a heap allocated buffer
-	char* clipBoardContent = (char*)malloc(clipBoardDataLength * sizeof(char));
-	if (!clipBoardContent)
+	size_t length = (size_t)(end - text);
+	char* copy = (char*)malloc(length + 1);
+	if (!copy)
+		return FALSE;
+
+	// Local files are read where they are, not pushed through the download stack
+	if (EasyAvatar_GetLocalPath(text, length, copy))
 	{
-		GlobalUnlock(hGlobalMem);
-		CloseClipboard();
-		return NULL;
+		content->path = copy;
+		content->fingerprint = EasyAvatar_FingerprintFile(copy);
+		return TRUE;
 	}
 
-	errno_t retValue = _strcpy(clipBoardContent, clipBoardDataLength * sizeof(char), clipboardStr);
+	memcpy(copy, text, length + 1);
+	content->url = copy;
+	content->fingerprint = EasyAvatar_Fingerprint(text, length);
+	return TRUE;
+}
 
-	// Unlock GlobalMem handle, according to Documentation don't free it
-	GlobalUnlock(hGlobalMem);
-	CloseClipboard();
+/*
+	Locks the clipboard data in format, the clipboard has to be open.
+	On success memory points to size bytes and has to be unlocked with GlobalUnlock(*handle).
+*/
+static BOOL EasyAvatar_LockClipboardData(UINT format, HGLOBAL* handle, const BYTE** memory, size_t* size)
+{
+	*handle = GetClipboardData(format);
+	*memory = *handle ? (const BYTE*)GlobalLock(*handle) : NULL;
+	if (!*memory)
+		return FALSE;
 
-	if (retValue != 0)
+	*size = GlobalSize(*handle);
+	if (*size == 0)
 	{
-		free(clipBoardContent);
-		return NULL;
+		GlobalUnlock(*handle);
+		return FALSE;
 	}
-	else
+
+	return TRUE;
+}
+
+/*
+	Takes the first file copied in Explorer into content, the clipboard has to be open.
+*/
+static BOOL EasyAvatar_ReadClipboardFile(struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	HDROP drop = (HDROP)GetClipboardData(CF_HDROP);
+	UINT length = drop ? DragQueryFileA(drop, 0, NULL, 0) : 0;
+	if (length == 0)
 	{
-		return clipBoardContent;
+		ts3Functions->logMessage("Could not get the copied file", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
 	}
+
+	content->path = (char*)malloc((size_t)length + 1);
+	if (!content->path)
+		return FALSE;
+
+	if (DragQueryFileA(drop, 0, content->path, length + 1) != length)
+	{
+		free(content->path);
+		content->path = NULL;
+		return FALSE;
+	}
+
+	content->fingerprint = EasyAvatar_FingerprintFile(content->path);
+	return TRUE;
 }
 
-BOOL EasyAvatar_HandleClipboardContent(char* clipboardData, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+/*
+	Turns a copied image into content, preferring the PNG some applications put next to their bitmap.
+	The clipboard has to be open.
+*/
+static BOOL EasyAvatar_ReadClipboardImage(struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
-	if (strncmp(clipboardData, "data:image/", 11U) == 0 && strstr(clipboardData, "base64") != NULL)
+	HGLOBAL handle;
+	const BYTE* memory;
+	size_t size;
+
+	// Registered by browsers and the Snipping Tool, unlike the bitmap it keeps transparency reliably
+	UINT pngFormat = RegisterClipboardFormatA("PNG");
+	if (pngFormat && IsClipboardFormatAvailable(pngFormat) && EasyAvatar_LockClipboardData(pngFormat, &handle, &memory, &size))
 	{
-		// Clipboard data contains a base64 encoded image	
-		char* encodedImage = strstr(clipboardData, ",") + 1;
-		if (!encodedImage)
+		content->image.data = (BYTE*)malloc(size);
+		if (content->image.data)
 		{
-			ts3Functions->logMessage("Could not parse base64 encoded image", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-			return FALSE;
-		}
-		
-		size_t decodedLength = 0;
-		BYTE* decodedImage = EasyAvatar_b64decode(encodedImage, strlen(encodedImage), &decodedLength);
-		FIMEMORY* mem = FreeImage_OpenMemory(decodedImage, decodedLength);
-		FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeFromMemory(mem, 0);
-		FreeImage_CloseMemory(mem);
-		if (fif == FIF_UNKNOWN)
-		{
-			ts3Functions->logMessage("Invalid image from base64 decoding", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-			return FALSE;
+			memcpy(content->image.data, memory, size);
+			content->image.size = size;
+			content->fingerprint = EasyAvatar_Fingerprint(memory, size);
 		}
+		GlobalUnlock(handle);
+		return content->image.data != NULL;
+	}
 
-		FILE* fp;
-		errno_t result = fopen_s(&fp, EASYAVATAR_IMAGEPATH, "wb");
-		if (result != 0)
-		{
-			ts3Functions->logMessage("Failed to write decoded image to file", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-			return FALSE;
-		}
+	// Windows synthesizes either DIB format from the other, ask for the one that can carry alpha first
+	UINT format = IsClipboardFormatAvailable(CF_DIBV5) ? CF_DIBV5 : IsClipboardFormatAvailable(CF_DIB) ? CF_DIB : 0;
+	if (!format || !EasyAvatar_LockClipboardData(format, &handle, &memory, &size))
+		return FALSE;
 
-		fwrite(decodedImage, 1, decodedLength, fp);
-		fclose(fp);
-		ts3Functions->freeMemory(decodedImage);
-	} else // Treat clipboard data as an URL
+	// Wrapped into a bitmap in one pass straight out of the clipboard's memory, no file in between
+	content->bitmap = EasyAvatar_LoadDIB(memory, size);
+	if (content->bitmap)
+		content->fingerprint = EasyAvatar_Fingerprint(memory, size);
+	GlobalUnlock(handle);
+
+	if (!content->bitmap)
 	{
-		HRESULT downloadRes = URLDownloadToFileA(NULL, clipboardData, EASYAVATAR_IMAGEPATH, 0, NULL);
-		if (downloadRes != S_OK)
-		{
-			ts3Functions->logMessage("Download of image failed", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-			return FALSE;
-		}
+		ts3Functions->logMessage("Could not read the bitmap in the clipboard", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
 	}
-	
+
 	return TRUE;
 }
 
-BOOL EasyAvatar_GetFileFromClipboard(uint64 serverConnectionHandlerID)
+BOOL EasyAvatar_GetClipboardContent(struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
+	memset(content, 0, sizeof(*content));
+
 	if (!OpenClipboard(NULL))
 		return FALSE;
 
-	UINT format = EnumClipboardFormats(0);
+	if (!IsClipboardFormatAvailable(CF_TEXT))
+	{
+		// No text, maybe a file copied in Explorer, a screenshot or an image copied from a browser
+		BOOL result = IsClipboardFormatAvailable(CF_HDROP) ? EasyAvatar_ReadClipboardFile(content, serverConnectionHandlerID, ts3Functions)
+			: EasyAvatar_ReadClipboardImage(content, serverConnectionHandlerID, ts3Functions);
+		CloseClipboard();
+		return result;
+	}
 
-	// Never works
-	if (!IsClipboardFormatAvailable(CF_BITMAP))
+	// This can be an URL to an image or the whole image encoded as base64, read straight out of the clipboard's memory
+	HGLOBAL hGlobalMem;
+	const BYTE* clipboardData;
+	// Bounds everything we read, the text is terminated somewhere within it
+	size_t clipboardSize;
+	// Check that the clipboard wasn't empty
+	if (!EasyAvatar_LockClipboardData(CF_TEXT, &hGlobalMem, &clipboardData, &clipboardSize))
 	{
+		ts3Functions->logMessage("Failed to get Clipboard contents.", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		CloseClipboard();
 		return FALSE;
 	}
 
-	HGLOBAL hGlobalMem = GetClipboardData(CF_BITMAP);
-	BITMAPINFO* bitMapInfo = (BITMAPINFO*)GlobalLock(hGlobalMem);
+	const char* clipboardStr = (const char*)clipboardData;
+	BOOL result = clipboardStr[0] != '\0';
+	if (result)
+		result = EasyAvatar_ReadClipboardText(clipboardStr, clipboardSize, content, serverConnectionHandlerID, ts3Functions);
+	else
+		ts3Functions->logMessage("Failed to get Clipboard contents.", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 
+	// Unlock GlobalMem handle, according to Documentation don't free it
+	// Nothing points into it anymore, so other applications get the clipboard back right away
 	GlobalUnlock(hGlobalMem);
 	CloseClipboard();
-	return TRUE;
 
+	return result;
+}
 
+void EasyAvatar_ReleaseClipboardContent(struct EasyAvatar_ClipboardContent* content)
+{
+	free(content->url);
+	content->url = NULL;
+	free(content->path);
+	content->path = NULL;
+	EasyAvatar_ReleaseImage(&content->image);
+	if (content->bitmap)
+		FreeImage_Unload(content->bitmap);
+	content->bitmap = NULL;
 }
 
-// Taken from https://stackoverflow.com/a/48818578
+/*
+	Maps the image file at path into file, logging why if that fails.
+*/
+static BOOL EasyAvatar_MapLocalImage(const char* path, struct EasyAvatar_MappedFile* file, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	switch (EasyAvatar_MapImageFile(path, file))
+	{
+	case EASYAVATAR_MAP_OK:
+		return TRUE;
+	case EASYAVATAR_MAP_TOO_LARGE:
+		ts3Functions->logMessage("Image file is too large", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	case EASYAVATAR_MAP_TOO_MANY_PIXELS:
+		ts3Functions->logMessage("Image has too many pixels to be decoded", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	default:
+		ts3Functions->logMessage("Could not open the image file", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	}
+
+	return FALSE;
+}
 
-char* EasyAvatar_b64encode(const unsigned char* data, size_t input_length)
+BOOL EasyAvatar_HandleClipboardContent(struct EasyAvatar_ClipboardContent* content, struct EasyAvatar_Source* source, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
-	const int mod_table[] = { 0, 2, 1 };
+	memset(source, 0, sizeof(*source));
 
-	size_t output_length = 4 * ((input_length + 2) / 3);
+	if (content->bitmap)
+	{
+		// Nothing left to decode, the pipeline starts resizing right away
+		source->bitmap = content->bitmap;
+		content->bitmap = NULL;
+		return TRUE;
+	}
 
-	// One extra character for correct null termination
-	char* encoded_data = (char*)malloc(output_length + 1);
+	if (content->path)
+	{
+		if (!EasyAvatar_MapLocalImage(content->path, &source->mappedFile, serverConnectionHandlerID, ts3Functions))
+			return FALSE;
+	}
+	else if (!content->url)
+	{
+		// The data URI or PNG was already read while the clipboard was open, the source takes over its bytes
+		source->download = content->image;
+		memset(&content->image, 0, sizeof(content->image));
+	}
+	else // Treat clipboard data as an URL
+	{
+		if (!EasyAvatar_DownloadImage(content->url, &source->download, serverConnectionHandlerID, ts3Functions))
+			return FALSE;
+	}
 
-	if (encoded_data == NULL)
-		return NULL;
+	// A mapped file is decoded in place, without copying it into a buffer first
+	if (source->mappedFile.data)
+		EasyAvatar_OpenMemoryReader(&source->memoryReader, &source->io, source->mappedFile.data, source->mappedFile.size);
+	else
+		EasyAvatar_OpenMemoryReader(&source->memoryReader, &source->io, source->download.data, source->download.size);
+	source->handle = &source->memoryReader;
 
-	for (int i = 0, j = 0; i < input_length;)
+	if (!content->url && FreeImage_GetFileTypeFromHandle(&source->io, source->handle, 0) == FIF_UNKNOWN)
 	{
-		unsigned int octet_a = i < input_length ? (unsigned char)data[i++] : 0;
-		unsigned int octet_b = i < input_length ? (unsigned char)data[i++] : 0;
-		unsigned int octet_c = i < input_length ? (unsigned char)data[i++] : 0;
+		ts3Functions->logMessage("Invalid image in clipboard", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		EasyAvatar_CloseSource(source);
+		return FALSE;
+	}
 
-		unsigned int triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
+	return TRUE;
+}
 
-		encoded_data[j++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-		encoded_data[j++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-		encoded_data[j++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-		encoded_data[j++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+void EasyAvatar_CloseSource(struct EasyAvatar_Source* source)
+{
+	EasyAvatar_ReleaseImage(&source->download);
+	EasyAvatar_UnmapFile(&source->mappedFile);
+	if (source->bitmap)
+		FreeImage_Unload(source->bitmap);
+	source->bitmap = NULL;
+	source->handle = NULL;
+}
 
+BOOL EasyAvatar_CopySource(struct EasyAvatar_Source* source, struct EasyAvatar_Image* image)
+{
+	// A download already is the buffer we need, hand it over instead of copying
+	if (source->download.data)
+	{
+		EasyAvatar_ReleaseImage(image);
+		*image = source->download;
+		source->download.data = NULL;
+		source->download.size = 0;
+		return TRUE;
 	}
 
-	for (int i = 0; i < mod_table[input_length % 3]; i++)
-		encoded_data[output_length - 1 - i] = '=';
-
-	// Null terminate
-	encoded_data[output_length] = 0;
+	// A bitmap from the clipboard has no original bytes
+	if (!source->handle)
+		return FALSE;
 
+	size_t size = 0;
+	BYTE* data = EasyAvatar_ReadAll(&source->io, source->handle, &size);
+	if (!data)
+		return FALSE;
 
-	return encoded_data;
+	EasyAvatar_ReleaseImage(image);
+	image->data = data;
+	image->size = size;
+	return TRUE;
 }
 
-BYTE* EasyAvatar_b64decode(const char* data, size_t input_length, size_t* output_length)
+BOOL EasyAvatar_DownloadImage(const char* url, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
+	BYTE* data = NULL;
+	size_t size = 0;
+	LONG hits = 0;
+	LONG misses = 0;
+	char message[BUFSIZE];
+	switch (EasyAvatar_CachedDownload(url, &data, &size))
+	{
+	case EASYAVATAR_DOWNLOAD_OK:
+		EasyAvatar_GetHttpCacheStats(&hits, &misses);
+		snprintf(message, sizeof(message), "Downloaded image, HTTP cache hits: %ld, misses: %ld", hits, misses);
+		ts3Functions->logMessage(message, LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		image->data = data;
+		image->size = size;
+		return TRUE;
+	case EASYAVATAR_DOWNLOAD_HTTP_ERROR:
+		ts3Functions->logMessage("Server refused to send the image", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	case EASYAVATAR_DOWNLOAD_TOO_LARGE:
+		ts3Functions->logMessage("Image to download is too large", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	case EASYAVATAR_DOWNLOAD_TIMEOUT:
+		ts3Functions->logMessage("Download of image timed out", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	case EASYAVATAR_DOWNLOAD_CANCELLED:
+		break;
+	default:
+		ts3Functions->logMessage("Download of image failed", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		break;
+	}
 
-	if (input_length % 4 != 0)
+	return FALSE;
+}
+
+char* EasyAvatar_CreateMD5Hash(const BYTE* data, size_t size, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	// +1 for Null termination
+	char* imageMD5Hash = (char*)malloc(MD5LEN * 2 * sizeof(char) + 1);
+	if (!imageMD5Hash)
 		return NULL;
 
-	*output_length = input_length / 4 * 3;
+	struct EasyAvatar_MD5Context context;
+	BYTE digest[MD5LEN];
+	EasyAvatar_MD5Init(&context);
+	EasyAvatar_MD5Update(&context, data, size);
+	EasyAvatar_MD5Final(&context, digest);
+	EasyAvatar_MD5ToHex(digest, imageMD5Hash);
 
-	if (data[input_length - 1] == '=') (*output_length)--;
-	if (data[input_length - 2] == '=') (*output_length)--;
+	return imageMD5Hash;
+}
 
-	unsigned char* decoded_data = (unsigned char*)malloc(*output_length);
+char* EasyAvatar_GetAvatarHash(const struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	// Only images we upload unmodified still need a separate pass over their bytes
+	if (!image->hasMD5)
+		return EasyAvatar_CreateMD5Hash(image->data, image->size, serverConnectionHandlerID, ts3Functions);
 
-	if (decoded_data == NULL)
+	char* imageMD5Hash = (char*)malloc(MD5LEN * 2 * sizeof(char) + 1);
+	if (!imageMD5Hash)
 		return NULL;
 
-	for (int i = 0, j = 0; i < input_length;) {
-
-		unsigned int sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-		unsigned int sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-		unsigned int sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-		unsigned int sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[data[i++]];
-
-		unsigned int triple = (sextet_a << 3 * 6)
-			+ (sextet_b << 2 * 6)
-			+ (sextet_c << 1 * 6)
-			+ (sextet_d << 0 * 6);
+	EasyAvatar_MD5ToHex(image->md5, imageMD5Hash);
+	return imageMD5Hash;
+}
 
-		if (j < *output_length) decoded_data[j++] = (triple >> 2 * 8) & 0xFF;
-		if (j < *output_length) decoded_data[j++] = (triple >> 1 * 8) & 0xFF;
-		if (j < *output_length) decoded_data[j++] = (triple >> 0 * 8) & 0xFF;
+void EasyAvatar_GetTargetSize(unsigned int width, unsigned int height, unsigned int* targetW, unsigned int* targetH)
+{
+	float aspectRatio = (float)width / (float)height;
+	*targetW = width;
+	*targetH = height;
 
+	if (width > EASYAVATAR_MAX_DIMENSION)
+	{
+		*targetW = EASYAVATAR_MAX_DIMENSION;
+		*targetH = (unsigned int)(*targetW / aspectRatio);
 	}
+	else if (height > EASYAVATAR_MAX_DIMENSION)
+	{
+		*targetH = EASYAVATAR_MAX_DIMENSION;
+		*targetW = (unsigned int)(*targetH * aspectRatio);
+	}
+}
 
-	return decoded_data;
+static BOOL EasyAvatar_ProbeDimensions(struct EasyAvatar_Source* source, FREE_IMAGE_FORMAT imgFormat, unsigned int* width, unsigned int* height)
+{
+	// Only parses the header, no pixels get decoded
+	source->io.seek_proc(source->handle, 0, SEEK_SET);
+	FIBITMAP* header = FreeImage_LoadFromHandle(imgFormat, &source->io, source->handle, FIF_LOAD_NOPIXELS);
+	if (!header)
+		return FALSE;
 
+	*width = FreeImage_GetWidth(header);
+	*height = FreeImage_GetHeight(header);
+	FreeImage_Unload(header);
+	return *width > 0 && *height > 0;
 }
 
-// As specified by https://docs.microsoft.com/en-us/windows/win32/seccrypto/example-c-program--creating-an-md-5-hash-from-file-content
+/*
+	Turns dib the way the EXIF orientation says it should be displayed.
+*/
+static FIBITMAP* EasyAvatar_ApplyOrientation(FIBITMAP* dib, unsigned int orientation)
+{
+	// FreeImage rotates counterclockwise, orientations 5 and 7 are a rotation followed by a mirror
+	static const double angles[9] = { 0, 0, 0, 180, 0, 270, 270, 90, 90 };
+	if (orientation < 2 || orientation > 8)
+		return dib;
 
-char* EasyAvatar_CreateMD5Hash(const char* filePath, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+	if (angles[orientation] != 0)
+	{
+		FIBITMAP* rotated = FreeImage_Rotate(dib, angles[orientation], NULL);
+		if (!rotated)
+			return dib;
+		FreeImage_Unload(dib);
+		dib = rotated;
+	}
+
+	if (orientation == 2 || orientation == 5 || orientation == 7)
+		FreeImage_FlipHorizontal(dib);
+	else if (orientation == 4)
+		FreeImage_FlipVertical(dib);
+	return dib;
+}
+
+static BOOL EasyAvatar_ResizeGIF(struct EasyAvatar_Source* source, struct EasyAvatar_Image* image, const struct EasyAvatar_ImageInfo* info, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
-	DWORD dwStatus = 0;
-	BOOL bResult = FALSE;
-	HCRYPTPROV hProv = 0;
-	HCRYPTHASH hHash = 0;
-	HANDLE hFile = NULL;
-	BYTE rgbFile[BUFSIZE];
-	DWORD cbRead = 0;
-	BYTE rgbHash[MD5LEN];
-	DWORD cbHash = 0;
-	CHAR rgbDigits[] = "0123456789abcdef";
+	// The multi page loader works on the complete file in memory
+	if (!EasyAvatar_CopySource(source, image))
+		return FALSE;
 
-	hFile = CreateFileA(filePath,
-		GENERIC_READ,
-		FILE_SHARE_READ,
-		NULL,
-		OPEN_EXISTING,
-		FILE_FLAG_SEQUENTIAL_SCAN,
-		NULL);
+	// Small enough in every respect, the original goes up untouched
+	if (info->width <= EASYAVATAR_MAX_DIMENSION && info->height <= EASYAVATAR_MAX_DIMENSION && image->size <= EASYAVATAR_MAX_FILESIZE)
+		return TRUE;
 
-	if (INVALID_HANDLE_VALUE == hFile)
+	size_t resizedSize = 0;
+	BYTE digest[MD5LEN];
+	BYTE* resizedData = EasyAvatar_ResizeAnimation(image->data, image->size, EASYAVATAR_MAX_FILESIZE, &resizedSize, digest);
+	if (!resizedData)
 	{
-		char errorMessage[1024];
-		snprintf(errorMessage, sizeof(errorMessage), "Error opening file for hashing: Filepath: %s  Error Code: %d", filePath, GetLastError());
-		ts3Functions->logMessage(errorMessage, LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-		return NULL;
+		// Keep the original, it might still be small enough
+		ts3Functions->logMessage("Could not resize the GIF within 200KB", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return TRUE;
 	}
 
-	// Get handle to the crypto provider
-	if (!CryptAcquireContextA(&hProv, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT))
+	EasyAvatar_ReleaseImage(image);
+	image->data = resizedData;
+	image->size = resizedSize;
+	memcpy(image->md5, digest, MD5LEN);
+	image->hasMD5 = TRUE;
+	return TRUE;
+}
+
+/*
+	Orients, resizes and encodes a decoded image into image, taking ownership of avatarImage.
+	Falls back to the original bytes of source if that fails.
+*/
+static BOOL EasyAvatar_EncodeAvatar(struct EasyAvatar_Source* source, FIBITMAP* avatarImage, unsigned int originalW, unsigned int originalH, unsigned int orientation,
+	struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	// Base the target on the real dimensions if the probe couldn't tell, a scaled JPEG decode or a stream may have rounded them
+	if (originalW == 0 || originalH == 0)
 	{
-		CloseHandle(hFile);
-		return NULL;
+		originalW = FreeImage_GetWidth(avatarImage);
+		originalH = FreeImage_GetHeight(avatarImage);
 	}
 
-	if (!CryptCreateHash(hProv, CALG_MD5, 0, 0, &hHash))
+	// FreeImage ignores the EXIF orientation, turn the image upright before it loses its metadata
+	avatarImage = EasyAvatar_ApplyOrientation(avatarImage, orientation);
+	if (orientation >= 5)
 	{
-		CloseHandle(hFile);
-		CryptReleaseContext(hProv, 0);
-		return NULL;
+		unsigned int swap = originalW;
+		originalW = originalH;
+		originalH = swap;
 	}
 
-	while (bResult = ReadFile(hFile, rgbFile, BUFSIZE, &cbRead, NULL))
-	{
-		if (0 == cbRead)
-		{
-			break;
-		}
+	unsigned int targetW;
+	unsigned int targetH;
+	EasyAvatar_GetTargetSize(originalW, originalH, &targetW, &targetH);
 
-		if (!CryptHashData(hHash, rgbFile, cbRead, 0))
+	// Our resampler only blends true color and greyscale pixels, expand palettes and low bit depths first
+	unsigned int bpp = FreeImage_GetBPP(avatarImage);
+	if (FreeImage_GetImageType(avatarImage) == FIT_BITMAP && bpp < 24 && !(bpp == 8 && FreeImage_GetColorType(avatarImage) == FIC_MINISBLACK))
+	{
+		FIBITMAP* expandedImage = FreeImage_IsTransparent(avatarImage) ? FreeImage_ConvertTo32Bits(avatarImage) : FreeImage_ConvertTo24Bits(avatarImage);
+		if (expandedImage)
 		{
-			CryptReleaseContext(hProv, 0);
-			CryptDestroyHash(hHash);
-			CloseHandle(hFile);
-			return NULL;
+			FreeImage_Unload(avatarImage);
+			avatarImage = expandedImage;
 		}
 	}
 
-	if (!bResult)
+	// Resize our avatar, FreeImage handles whatever our resampler doesn't (16 bit channels, floats)
+	FIBITMAP* resizedImage = EasyAvatar_Resample(avatarImage, targetW, targetH, EASYAVATAR_FILTER_LANCZOS3);
+	if (!resizedImage)
+		resizedImage = FreeImage_Rescale(avatarImage, targetW, targetH, FILTER_BOX);
+	FreeImage_Unload(avatarImage);
+	if (!resizedImage)
 	{
-		CryptReleaseContext(hProv, 0);
-		CryptDestroyHash(hHash);
-		CloseHandle(hFile);
-		return NULL;
+		return EasyAvatar_CopySource(source, image);
 	}
 
-	cbHash = MD5LEN;
-	char* imageMD5Hash = NULL;
-	if (CryptGetHashParam(hHash, HP_HASHVAL, rgbHash, &cbHash, 0))
-	{
-		// +1 for Null termination
-		imageMD5Hash = (char*)malloc((unsigned long long)cbHash * 2 * sizeof(char) + 1);
-		if (!imageMD5Hash)
-		{
-			CryptDestroyHash(hHash);
-			CryptReleaseContext(hProv, 0);
-			CloseHandle(hFile);
-			return NULL;
-		}
+	// Encode, hash and size check in one pass, lowering the quality until the avatar fits
+	size_t encodedSize = 0;
+	BYTE digest[MD5LEN];
+	BYTE* encodedData = EasyAvatar_EncodeWithinBudget(resizedImage, EASYAVATAR_MAX_FILESIZE, &encodedSize, digest);
+	FreeImage_Unload(resizedImage);
 
-		// Create our hash
-		for (DWORD i = 0; i < cbHash; i++)
-		{
-			imageMD5Hash[i * 2] = rgbDigits[rgbHash[i] >> 4];
-			imageMD5Hash[i * 2 + 1] = rgbDigits[rgbHash[i] & 0xf];
-		}
-		// Null terminate
-		imageMD5Hash[cbHash * 2] = 0;
+	BOOL encoded = FALSE;
+	if (encodedData)
+	{
+		EasyAvatar_ReleaseImage(image);
+		image->data = encodedData;
+		image->size = encodedSize;
+		memcpy(image->md5, digest, MD5LEN);
+		image->hasMD5 = TRUE;
+		encoded = TRUE;
 	}
 	else
 	{
-		// Nothing to do, imageMD5Hash will be NULL which will be handled by caller
+		ts3Functions->logMessage("Could not encode the resized image within 200KB", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 	}
 
-	CryptDestroyHash(hHash);
-	CryptReleaseContext(hProv, 0);
-	CloseHandle(hFile);
+	// Fall back to the original bytes if encoding didn't work out, they might still be small enough
+	if (!encoded)
+		return EasyAvatar_CopySource(source, image);
 
-	return imageMD5Hash;
+	return TRUE;
 }
 
-BOOL EasyAvatar_ResizeAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+BOOL EasyAvatar_ResizeAvatar(struct EasyAvatar_Source* source, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
-	// Dynamically get the image type (png, jpg, etc...)
-	FREE_IMAGE_FORMAT imgFormat = FreeImage_GetFileType(EASYAVATAR_IMAGEPATH, 0);
-	if (imgFormat == FIF_UNKNOWN)
+	// Bitmaps from the clipboard are decoded already
+	if (source->bitmap)
 	{
-		ts3Functions->logMessage("Tried loading unknown image format", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-		return FALSE;
+		FIBITMAP* bitmap = source->bitmap;
+		source->bitmap = NULL;
+		return EasyAvatar_EncodeAvatar(source, bitmap, 0, 0, 1, image, serverConnectionHandlerID, ts3Functions);
 	}
 
-	// Skip resizing GIFs for now as they break while Saving
-	if (imgFormat == FIF_GIF)
-		return TRUE;
+	// Parse the header ourselves first, so we know what we're dealing with before any pixels get decoded
+	struct EasyAvatar_ImageInfo info;
+	BOOL icns = FALSE;
+	if (!EasyAvatar_ProbeImage(&source->io, source->handle, &info))
+	{
+		// Dynamically get the image type (tiff, ico, etc...) for everything our probe doesn't know
+		icns = EasyAvatar_IsICNS(&source->io, source->handle);
+		info.format = icns ? FIF_UNKNOWN : FreeImage_GetFileTypeFromHandle(&source->io, source->handle, 0);
+		if (info.format == FIF_UNKNOWN && !icns)
+		{
+			ts3Functions->logMessage("Tried loading unknown image format", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+			return FALSE;
+		}
 
-	FIBITMAP* avatarImage = FreeImage_Load(imgFormat, EASYAVATAR_IMAGEPATH, 0);
-	if (!avatarImage)
+		// The first page of a container says nothing about the others
+		if (icns || info.format == FIF_ICO || info.format == FIF_TIFF || !EasyAvatar_ProbeDimensions(source, info.format, &info.width, &info.height))
+			info.width = info.height = 0;
+	}
+
+	FREE_IMAGE_FORMAT imgFormat = info.format;
+	enum EasyAvatar_DecodeStrategy strategy = imgFormat == FIF_GIF ? EASYAVATAR_DECODE_ANIMATION : EASYAVATAR_DECODE_FULL;
+	if (icns || imgFormat == FIF_ICO || imgFormat == FIF_TIFF)
 	{
-		// At this point we know the file is an image, only the resize process failed which isn't fatal
-		return TRUE;
+		strategy = EASYAVATAR_DECODE_PAGE;
+	}
+	else if (info.width > 0 && info.height > 0)
+	{
+		unsigned int probedW;
+		unsigned int probedH;
+		EasyAvatar_GetTargetSize(info.width, info.height, &probedW, &probedH);
+		strategy = EasyAvatar_ChooseDecodeStrategy(&info, probedW, probedH);
 	}
 
-	unsigned int originalH = FreeImage_GetHeight(avatarImage);
-	unsigned int originalW = FreeImage_GetWidth(avatarImage);
-	unsigned int targetH = originalH;
-	unsigned int targetW = originalW;
-	float aspectRatio = (float)originalW / (float)originalH;
+	int loadFlags = 0;
+	unsigned int originalW = info.width;
+	unsigned int originalH = info.height;
+	unsigned int targetW;
+	unsigned int targetH;
+	switch (strategy)
+	{
+	case EASYAVATAR_DECODE_PASSTHROUGH:
+		// Decoding and encoding again could only cost quality and bytes
+		return EasyAvatar_CopySource(source, image);
+	case EASYAVATAR_DECODE_REJECT:
+		ts3Functions->logMessage("Image has too many pixels to be decoded", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
+	case EASYAVATAR_DECODE_ANIMATION:
+		// GIFs may be animated, every frame has to be resized
+		return EasyAvatar_ResizeGIF(source, image, &info, serverConnectionHandlerID, ts3Functions);
+	case EASYAVATAR_DECODE_SCALED:
+		loadFlags = EasyAvatar_GetJPEGScaleFlags(originalW, originalH);
+		break;
+	default:
+		break;
+	}
 
-	if (originalW > 300)
+	FIBITMAP* avatarImage = NULL;
+	if (imgFormat == FIF_JPEG && info.previewCount > 0)
 	{
-		targetW = 300;
-		targetH = (unsigned int)(targetW / aspectRatio);
+		// Cameras embed previews that are plenty for an avatar and a fraction of the size
+		EasyAvatar_GetTargetSize(originalW, originalH, &targetW, &targetH);
+		avatarImage = EasyAvatar_LoadPreview(&source->io, source->handle, &info, targetW, targetH, &originalW, &originalH);
 	}
-	else if (originalH > 300)
+
+	if (avatarImage)
+	{
+		ts3Functions->logMessage("Using the embedded preview", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+	}
+	else if (strategy == EASYAVATAR_DECODE_STREAM)
+	{
+		// Average down to a few times the target while decoding, the final resize starts from there
+		EasyAvatar_GetTargetSize(originalW, originalH, &targetW, &targetH);
+		unsigned int streamW = targetW * EASYAVATAR_STREAM_OVERSAMPLING < originalW ? targetW * EASYAVATAR_STREAM_OVERSAMPLING : originalW;
+		unsigned int streamH = targetH * EASYAVATAR_STREAM_OVERSAMPLING < originalH ? targetH * EASYAVATAR_STREAM_OVERSAMPLING : originalH;
+		avatarImage = EasyAvatar_DecodePNGStream(&source->io, source->handle, streamW, streamH);
+	}
+	else if (strategy == EASYAVATAR_DECODE_PAGE)
 	{
-		targetH = 300;
-		targetW = (unsigned int)(targetH * aspectRatio);
+		avatarImage = icns ? EasyAvatar_LoadBestICNS(&source->io, source->handle) : EasyAvatar_LoadBestPage(&source->io, source->handle, imgFormat);
+	}
+	else
+	{
+		source->io.seek_proc(source->handle, 0, SEEK_SET);
+		avatarImage = FreeImage_LoadFromHandle(imgFormat, &source->io, source->handle, loadFlags);
 	}
 
-	// Resize our avatar
-	FIBITMAP* resizedImage = FreeImage_Rescale(avatarImage, targetW, targetH, FILTER_BOX);
-	if (!resizedImage)
+	if (!avatarImage)
 	{
-		FreeImage_Unload(avatarImage);
-		return TRUE;
+		// At this point we know the data is an image, only the resize process failed which isn't fatal
+		return EasyAvatar_CopySource(source, image);
 	}
 
-	// FreeImage_Save overwriting old avatar file
-	FreeImage_Save(imgFormat, resizedImage, EASYAVATAR_IMAGEPATH, 0);
+	return EasyAvatar_EncodeAvatar(source, avatarImage, originalW, originalH, info.orientation, image, serverConnectionHandlerID, ts3Functions);
+}
 
-	FreeImage_Unload(avatarImage);
-	FreeImage_Unload(resizedImage);
+BOOL EasyAvatar_CheckFileSize(const struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	if (image->size > EASYAVATAR_MAX_FILESIZE)
+	{
+		ts3Functions->logMessage("Image is too large (> 200KB)", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
+	}
 
 	return TRUE;
 }
 
-BOOL EasyAvatar_CheckFileSize(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+BOOL EasyAvatar_WriteAvatarFile(const struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
 {
-	// Teamspeak only accepts avatars under 200KB
 	FILE* fp;
-	errno_t result = fopen_s(&fp, EASYAVATAR_IMAGEPATH, "rb");
-	if (fp)
+	errno_t result = fopen_s(&fp, EASYAVATAR_IMAGEPATH, "wb");
+	if (result != 0 || !fp)
 	{
-		fseek(fp, 0L, SEEK_END);
-		size_t fileSize = ftell(fp);
-		fclose(fp);
+		ts3Functions->logMessage("Failed to write avatar to file", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
+	}
 
-		if (fileSize > 200000)
-		{
-			ts3Functions->logMessage("Image is too large (> 200KB)", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
-			return FALSE;
-		}
+	size_t written = fwrite(image->data, 1, image->size, fp);
+	fclose(fp);
+
+	if (written != image->size)
+	{
+		ts3Functions->logMessage("Failed to write avatar to file", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		return FALSE;
 	}
 
 	return TRUE;
-}
\ No newline at end of file
+}
+
+void EasyAvatar_ReleaseImage(struct EasyAvatar_Image* image)
+{
+	free(image->data);
+	image->data = NULL;
+	image->size = 0;
+	image->hasMD5 = FALSE;
+}
@@ -2,18 +2,77 @@
 #include <Windows.h>
 
 #include "../TeamSpeakSDK/teamspeak/public_definitions.h"
+#include "ImageIO.h"
+#include "LocalFile.h"
 
 #define PATH_BUFSIZE 512
+#define MD5LEN  16
 
 struct TS3Functions;
+
+/*
+	An encoded avatar image held in memory while it moves through the pipeline.
+	The bytes are only written to disk once, right before we upload them.
+*/
+struct EasyAvatar_Image
+{
+	BYTE* data;
+	size_t size;
+	// Filled in by the encoder, which hashes the bytes while it writes them
+	BYTE md5[MD5LEN];
+	BOOL hasMD5;
+};
+
+/*
+	Where the pipeline reads the original image from: a finished download, a decoded data URI, a copied PNG or a mapped local file.
+	FreeImage pulls bytes through io and handle either way, a copied bitmap skips decoding and has neither.
+*/
+struct EasyAvatar_Source
+{
+	FreeImageIO io;
+	fi_handle handle;
+	// Owned download buffer, empty for streamed sources
+	struct EasyAvatar_Image download;
+	struct EasyAvatar_MemoryReader memoryReader;
+	// Local file the memory reader reads from in place, unmapped if there is none
+	struct EasyAvatar_MappedFile mappedFile;
+	// Owned, already decoded image, NULL unless the clipboard held a bitmap
+	FIBITMAP* bitmap;
+};
+
+/*
+	What the user copied: the URL or local path of an image or the image itself, decoded from a data URI, copied as PNG or as bitmap.
+*/
+struct EasyAvatar_ClipboardContent
+{
+	// Heap allocated, NULL unless the clipboard held text other than a data URI or local path
+	char* url;
+	// Heap allocated path of a file copied in Explorer or pasted as path or file:// URL, NULL otherwise
+	char* path;
+	// Decoded data URI or copied PNG
+	struct EasyAvatar_Image image;
+	// Owned copy of a CF_DIBV5 or CF_DIB bitmap
+	FIBITMAP* bitmap;
+	// Cheap identity of the content, used to drop repeated triggers and to match prefetched avatars
+	UINT64 fingerprint;
+};
+
 /*
-	Main function. Gets the URL from our clipboard and downloads the image to our plugin's directory.
-	Performs some necessary hashing and passes all the data including the avatar image to the server.
+	Main function. Gets the URL from our clipboard and downloads the image into memory.
+	Resizes and hashes it there, writes it to our plugin's directory once and passes all the data including the avatar image to the server.
+	Runs on the worker thread, only the calls to the server are made on the client's main thread through EasyAvatar_RunOnMainThread.
+	If the clipboard listener already prepared an avatar from the same clipboard content, that one goes straight to the server.
 	Returns true if everything went as expected, false otherwise.
 */
 BOOL EasyAvatar_SetAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
 /*
-	Deletes your avatar in case something went wrong while setting it.
+	Everything of EasyAvatar_SetAvatar that doesn't need a server: fetches, resizes and encodes the image content refers to into image.
+	An avatar made from the same source bytes before comes out of the avatar cache instead.
+	Returns the heap allocated MD5 hash of image, NULL if anything fails or the job got cancelled, in which case image is released.
+*/
+char* EasyAvatar_PrepareAvatar(struct EasyAvatar_ClipboardContent* content, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+/*
+	Deletes your avatar in case something went wrong while setting it, on the client's main thread like the upload.
 */
 BOOL EasyAvatar_DeleteAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
 
@@ -24,36 +83,84 @@ BOOL EasyAvatar_DeleteAvatar(uint64 serverConnectionHandlerID, struct TS3Functio
 BOOL EasyAvatar_CreateDirectory(struct TS3Functions* ts3Functions, char* pluginID);
 
 /*
-	Returns a heap allocated string of the base64 encoded version of data.
-	Returns NULL if anything fails.
+	Reads the switch key from EASYAVATAR_SETTINGS_FILE, defaultValue if it isn't there. Only valid after EasyAvatar_CreateDirectory.
 */
-char* EasyAvatar_b64encode(const unsigned char* data, size_t input_length);
+BOOL EasyAvatar_GetSetting(const char* key, BOOL defaultValue);
 
-BYTE* EasyAvatar_b64decode(const char* data, size_t input_length, size_t* output_length);
+/*
+	Remembers the switch key in EASYAVATAR_SETTINGS_FILE for the next start. Returns FALSE if it couldn't be written.
+*/
+BOOL EasyAvatar_StoreSetting(const char* key, BOOL value);
 
 /*
-	Retrieves the data stored in the user's clipboard, returns a heap allocated string.
-	Returns NULL if anything fails.
+	Reads the text or image in the user's clipboard into content, holding the clipboard only while doing so.
+	A data URI is decoded in a single pass straight out of the clipboard's memory, an URL is the only text that gets copied.
+	Local paths and file:// URLs are only remembered, so is a file copied in Explorer.
+	Without text or file, a copied PNG is taken as it is and a bitmap is converted without touching the disk.
+	Returns FALSE if anything fails, on success content has to be released with EasyAvatar_ReleaseClipboardContent.
 */
-char* EasyAvatar_GetStringFromClipboard(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+BOOL EasyAvatar_GetClipboardContent(struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
 
-BOOL EasyAvatar_HandleClipboardContent(char* clipboardData, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+void EasyAvatar_ReleaseClipboardContent(struct EasyAvatar_ClipboardContent* content);
 
-int EasyAvatar_GetFileFromClipboard(uint64 serverConnectionHandlerID);
+/*
+	Turns the clipboard content into a source the pipeline can read the original image from.
+	Downloads URLs and maps local files, a decoded data URI, PNG or bitmap is moved into the source.
+	On success source has to be closed with EasyAvatar_CloseSource.
+*/
+BOOL EasyAvatar_HandleClipboardContent(struct EasyAvatar_ClipboardContent* content, struct EasyAvatar_Source* source, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+
+/*
+	Releases everything source owns.
+*/
+void EasyAvatar_CloseSource(struct EasyAvatar_Source* source);
 
 /*
-	Returns a heap allocated MD5 Hash of the given file.
+	Stores the original, unmodified bytes of source in image, for images we can't or don't need to re-encode.
+*/
+BOOL EasyAvatar_CopySource(struct EasyAvatar_Source* source, struct EasyAvatar_Image* image);
+
+/*
+	Downloads the resource at url straight into memory, see EasyAvatar_Download for the limits that apply.
+	Returns FALSE and logs why if the download failed, was too large, timed out or the job got cancelled.
+*/
+BOOL EasyAvatar_DownloadImage(const char* url, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+
+/*
+	Returns a heap allocated MD5 Hash of the given buffer, computed in-process without CryptoAPI.
 	Returns NULL if anything fails.
 */
-char* EasyAvatar_CreateMD5Hash(const char* filePath, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+char* EasyAvatar_CreateMD5Hash(const BYTE* data, size_t size, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
 
 /*
-	Resizes our avatar file on disk before we upload it to the server.
-	Will only fail if the file isn't an image
+	Returns the heap allocated MD5 Hash of image, reusing the digest the encoder computed if there is one.
+	Returns NULL if anything fails.
 */
-BOOL EasyAvatar_ResizeAvatar(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+char* EasyAvatar_GetAvatarHash(const struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
 
-BOOL EasyAvatar_CheckFileSize(uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+/*
+	Computes the size an image of width x height gets resized to, keeping its aspect ratio within EASYAVATAR_MAX_DIMENSION.
+*/
+void EasyAvatar_GetTargetSize(unsigned int width, unsigned int height, unsigned int* targetW, unsigned int* targetH);
+
+/*
+	Decodes the image behind source, resizes it and stores the encoded result in image.
+	Images we can't resize are stored unmodified. Will only fail if the data isn't an image
+	or has more pixels than EASYAVATAR_MAX_PIXELS allows to decode
+*/
+BOOL EasyAvatar_ResizeAvatar(struct EasyAvatar_Source* source, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+
+BOOL EasyAvatar_CheckFileSize(const struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+
+/*
+	Writes the final avatar to EASYAVATAR_IMAGEPATH so sendFile can pick it up.
+*/
+BOOL EasyAvatar_WriteAvatarFile(const struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+
+/*
+	Frees the buffer owned by image and resets it.
+*/
+void EasyAvatar_ReleaseImage(struct EasyAvatar_Image* image);
 
 
 /* Other stuff */
@@ -61,38 +168,20 @@ BOOL EasyAvatar_CheckFileSize(uint64 serverConnectionHandlerID, struct TS3Functi
 #define EASYAVATAR_NAME "EasyAvatar"
 #define EASYAVATAR_LOGCHANNEL "EasyAvatar"
 #define EASYAVATAR_DIR "easy_avatar"
+// User settings inside EASYAVATAR_FILEPATH, an ini file with a single [EasyAvatar] section
+#define EASYAVATAR_SETTINGS_FILE "settings.ini"
 #define BUFSIZE 1024
-#define MD5LEN  16
+// Longest "image/...;base64" header of a data URI we look for the comma in
+#define EASYAVATAR_DATA_URI_MAX_HEADER 256
+// Teamspeak only accepts avatars under 200KB
+#define EASYAVATAR_MAX_FILESIZE 200000
+#define EASYAVATAR_MAX_DIMENSION 300
+// Triggers for the same clipboard content within this window are treated as duplicates
+#define EASYAVATAR_COALESCE_WINDOW_MS 2000
+// Servers we remember the last uploaded avatar for, the least recently set one makes room
+#define EASYAVATAR_LAST_AVATAR_SLOTS 16
 #define PLUGIN_VERSION "1.3.1"
 // Path to our plugin's directory
 char EASYAVATAR_FILEPATH[PATH_BUFSIZE];
 // Absolute file path to our image file
 char EASYAVATAR_IMAGEPATH[PATH_BUFSIZE];
-
-static const char encoding_table[] = {
-			'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
-			'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
-			'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
-			'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
-			'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
-			'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
-			'w', 'x', 'y', 'z', '0', '1', '2', '3',
-			'4', '5', '6', '7', '8', '9', '+', '/' };
-
-static const unsigned char decoding_table[256] = {
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x3e, 0x00, 0x00, 0x00, 0x3f,
-			0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
-			0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
-			0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-			0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
\ No newline at end of file
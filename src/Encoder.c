@@ -0,0 +1,487 @@
+#include "Encoder.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ImageIO.h"
+#include "ThreadPool.h"
+
+// JPEG qualities tried when the speculative candidates don't fit
+#define EASYAVATAR_JPEG_MIN_QUALITY 10
+#define EASYAVATAR_JPEG_MAX_QUALITY (EASYAVATAR_JPEG_QUALITY - 1)
+// Palette sizes tried when the speculative candidates don't fit
+#define EASYAVATAR_PNG_MIN_COLORS 2
+#define EASYAVATAR_PNG_MAX_COLORS 256
+// One of them is the transparent index, the quantizer needs at least two colors besides it
+#define EASYAVATAR_PNG_MIN_TRANSPARENT_COLORS 3
+// Pixels with less alpha than this become the transparent palette index, the others turn opaque
+#define EASYAVATAR_PALETTE_ALPHA_THRESHOLD 128
+
+enum EasyAvatar_EncodeMode
+{
+	EASYAVATAR_ENCODE_PNG,
+	// The searched value is the number of palette colors of a PNG
+	EASYAVATAR_ENCODE_PNG_PALETTE,
+	// The searched value is the JPEG quality
+	EASYAVATAR_ENCODE_JPEG
+};
+
+struct EasyAvatar_EncodeResult
+{
+	BYTE* data;
+	size_t size;
+	BYTE digest[16];
+	// Only set for lossy candidates, 0 if the quality wasn't measured
+	double psnr;
+};
+
+struct EasyAvatar_EncodeTrial
+{
+	enum EasyAvatar_EncodeMode mode;
+	// Palette colors or JPEG quality
+	int value;
+	// Whether the result has to reach EASYAVATAR_MIN_PSNR
+	BOOL checkQuality;
+	struct EasyAvatar_EncodeResult result;
+};
+
+struct EasyAvatar_EncodeSearch
+{
+	// The image lossless candidates encode
+	FIBITMAP* original;
+	// The image lossy candidates encode and get compared to, 24 bit unless it is transparent
+	FIBITMAP* dib;
+	// At least one pixel has an alpha below 255, dib is 32 bit then
+	BOOL transparent;
+	size_t budget;
+	// Set while racing candidates against each other, the smallest acceptable one wins
+	BOOL smallestWins;
+	// Size of the smallest result known to win so far, every encode that grows past it gets aborted
+	volatile LONG cutoff;
+	unsigned int trialCount;
+	struct EasyAvatar_EncodeTrial trials[EASYAVATAR_MAX_PARALLEL_TRIALS];
+};
+
+static BOOL EasyAvatar_EncodeOnce(FIBITMAP* dib, FREE_IMAGE_FORMAT format, int flags, struct EasyAvatar_EncodeSearch* search, struct EasyAvatar_EncodeResult* result)
+{
+	FreeImageIO io;
+	struct EasyAvatar_EncodeSink sink;
+	EasyAvatar_OpenEncodeSink(&sink, &io, search->budget);
+	sink.cutoff = &search->cutoff;
+	BOOL saved = FreeImage_SaveToHandle(format, dib, &io, &sink, flags);
+
+	result->data = EasyAvatar_CloseEncodeSink(&sink, &result->size, result->digest);
+	if (saved && result->data)
+		return TRUE;
+
+	free(result->data);
+	result->data = NULL;
+	return FALSE;
+}
+
+static FIBITMAP* EasyAvatar_ConvertTo24Bits(FIBITMAP* dib)
+{
+	return FreeImage_GetBPP(dib) == 24 && FreeImage_GetImageType(dib) == FIT_BITMAP ? dib : FreeImage_ConvertTo24Bits(dib);
+}
+
+static FIBITMAP* EasyAvatar_ConvertTo32Bits(FIBITMAP* dib)
+{
+	return FreeImage_GetBPP(dib) == 32 && FreeImage_GetImageType(dib) == FIT_BITMAP ? dib : FreeImage_ConvertTo32Bits(dib);
+}
+
+/*
+	FreeImage_IsTransparent is true for every 32 bit bitmap, e.g. a copied CF_DIBV5 screenshot whose alpha is opaque everywhere.
+	Only pixels that actually let something shine through make an image transparent.
+*/
+static BOOL EasyAvatar_HasTransparentPixels(FIBITMAP* dib)
+{
+	if (!FreeImage_IsTransparent(dib))
+		return FALSE;
+	if (FreeImage_GetBPP(dib) != 32 || FreeImage_GetImageType(dib) != FIT_BITMAP)
+		return TRUE;
+
+	unsigned int width = FreeImage_GetWidth(dib);
+	unsigned int height = FreeImage_GetHeight(dib);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const BYTE* line = FreeImage_GetScanLine(dib, y);
+		for (unsigned int x = 0; x < width; x++)
+		{
+			if (line[x * 4 + FI_RGBA_ALPHA] != 0xFF)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+static double EasyAvatar_GetPSNR(double squaredError, double samples)
+{
+	if (squaredError < 0.0)
+		return 0.0;
+	if (squaredError == 0.0)
+		return INFINITY;
+
+	double meanSquaredError = squaredError / samples;
+	return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
+
+static double EasyAvatar_MeasurePSNR(FIBITMAP* original, FIBITMAP* candidate)
+{
+	FIBITMAP* pixels = EasyAvatar_ConvertTo24Bits(candidate);
+	if (!pixels)
+		return 0.0;
+
+	unsigned int width = FreeImage_GetWidth(original);
+	unsigned int height = FreeImage_GetHeight(original);
+	double squaredError = 0.0;
+	if (FreeImage_GetWidth(pixels) == width && FreeImage_GetHeight(pixels) == height)
+	{
+		for (unsigned int y = 0; y < height; y++)
+		{
+			const BYTE* a = FreeImage_GetScanLine(original, y);
+			const BYTE* b = FreeImage_GetScanLine(pixels, y);
+			UINT64 rowError = 0;
+			for (unsigned int x = 0; x < width * 3; x++)
+			{
+				int difference = (int)a[x] - (int)b[x];
+				rowError += (UINT64)(difference * difference);
+			}
+			squaredError += (double)rowError;
+		}
+	}
+	else
+	{
+		squaredError = -1.0;
+	}
+
+	if (pixels != candidate)
+		FreeImage_Unload(pixels);
+
+	return EasyAvatar_GetPSNR(squaredError, (double)width * height * 3);
+}
+
+/*
+	Compares the 32 bit original to a palettized candidate with a transparency table.
+	Colors are compared premultiplied, so whatever color invisible pixels have doesn't count.
+*/
+static double EasyAvatar_MeasureTransparentPSNR(FIBITMAP* original, FIBITMAP* candidate)
+{
+	unsigned int width = FreeImage_GetWidth(original);
+	unsigned int height = FreeImage_GetHeight(original);
+	if (FreeImage_GetBPP(candidate) != 8 || FreeImage_GetWidth(candidate) != width || FreeImage_GetHeight(candidate) != height)
+		return 0.0;
+
+	const RGBQUAD* palette = FreeImage_GetPalette(candidate);
+	const BYTE* table = FreeImage_GetTransparencyTable(candidate);
+	unsigned int tableSize = FreeImage_GetTransparencyCount(candidate);
+	double squaredError = 0.0;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const BYTE* a = FreeImage_GetScanLine(original, y);
+		const BYTE* indices = FreeImage_GetScanLine(candidate, y);
+		UINT64 rowError = 0;
+		for (unsigned int x = 0; x < width; x++, a += 4)
+		{
+			const RGBQUAD* color = &palette[indices[x]];
+			int alpha = a[FI_RGBA_ALPHA];
+			int candidateAlpha = table && indices[x] < tableSize ? table[indices[x]] : 0xFF;
+			int difference[4] =
+			{
+				a[FI_RGBA_RED] * alpha / 255 - color->rgbRed * candidateAlpha / 255,
+				a[FI_RGBA_GREEN] * alpha / 255 - color->rgbGreen * candidateAlpha / 255,
+				a[FI_RGBA_BLUE] * alpha / 255 - color->rgbBlue * candidateAlpha / 255,
+				alpha - candidateAlpha
+			};
+			for (unsigned int channel = 0; channel < 4; channel++)
+				rowError += (UINT64)(difference[channel] * difference[channel]);
+		}
+		squaredError += (double)rowError;
+	}
+
+	return EasyAvatar_GetPSNR(squaredError, (double)width * height * 4);
+}
+
+/*
+	Quantizes the 32 bit dib to colors - 1 colors plus one fully transparent index, alpha becomes binary.
+*/
+static FIBITMAP* EasyAvatar_QuantizeTransparent(FIBITMAP* dib, int colors)
+{
+	unsigned int width = FreeImage_GetWidth(dib);
+	unsigned int height = FreeImage_GetHeight(dib);
+	FIBITMAP* rgb = FreeImage_Allocate(width, height, 24, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+	if (!rgb)
+		return NULL;
+
+	// Invisible pixels repeat the last visible color so they don't claim palette entries of their own
+	BYTE fill[4] = { 0, 0, 0, 0 };
+	for (unsigned int y = 0; y < height && !fill[FI_RGBA_ALPHA]; y++)
+	{
+		const BYTE* line = FreeImage_GetScanLine(dib, y);
+		for (unsigned int x = 0; x < width && !fill[FI_RGBA_ALPHA]; x++)
+		{
+			if (line[x * 4 + FI_RGBA_ALPHA] >= EASYAVATAR_PALETTE_ALPHA_THRESHOLD)
+				memcpy(fill, line + x * 4, 4);
+		}
+	}
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const BYTE* line = FreeImage_GetScanLine(dib, y);
+		BYTE* output = FreeImage_GetScanLine(rgb, y);
+		for (unsigned int x = 0; x < width; x++)
+		{
+			if (line[x * 4 + FI_RGBA_ALPHA] >= EASYAVATAR_PALETTE_ALPHA_THRESHOLD)
+				memcpy(fill, line + x * 4, 3);
+			memcpy(output + x * 3, fill, 3);
+		}
+	}
+
+	FIBITMAP* palettized = FreeImage_ColorQuantizeEx(rgb, FIQ_WUQUANT, colors - 1, 0, NULL);
+	FreeImage_Unload(rgb);
+	if (!palettized)
+		return NULL;
+
+	BYTE transparentIndex = (BYTE)(colors - 1);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const BYTE* line = FreeImage_GetScanLine(dib, y);
+		BYTE* indices = FreeImage_GetScanLine(palettized, y);
+		for (unsigned int x = 0; x < width; x++)
+		{
+			if (line[x * 4 + FI_RGBA_ALPHA] < EASYAVATAR_PALETTE_ALPHA_THRESHOLD)
+				indices[x] = transparentIndex;
+		}
+	}
+
+	memset(&FreeImage_GetPalette(palettized)[transparentIndex], 0, sizeof(RGBQUAD));
+	FreeImage_SetTransparentIndex(palettized, transparentIndex);
+	return palettized;
+}
+
+static double EasyAvatar_MeasureJPEG(FIBITMAP* original, const struct EasyAvatar_EncodeResult* result)
+{
+	FIMEMORY* memory = FreeImage_OpenMemory(result->data, (DWORD)result->size);
+	if (!memory)
+		return 0.0;
+
+	FIBITMAP* decoded = FreeImage_LoadFromMemory(FIF_JPEG, memory, 0);
+	FreeImage_CloseMemory(memory);
+	if (!decoded)
+		return 0.0;
+
+	double psnr = EasyAvatar_MeasurePSNR(original, decoded);
+	FreeImage_Unload(decoded);
+	return psnr;
+}
+
+static void EasyAvatar_LowerCutoff(volatile LONG* cutoff, size_t size)
+{
+	LONG current = *cutoff;
+	while ((LONG)size < current)
+	{
+		LONG previous = InterlockedCompareExchange(cutoff, (LONG)size, current);
+		if (previous == current)
+			break;
+		current = previous;
+	}
+}
+
+static void EasyAvatar_RunEncodeTrial(unsigned int index, void* context)
+{
+	struct EasyAvatar_EncodeSearch* search = (struct EasyAvatar_EncodeSearch*)context;
+	struct EasyAvatar_EncodeTrial* trial = &search->trials[index];
+	struct EasyAvatar_EncodeResult* result = &trial->result;
+	BOOL encoded = FALSE;
+
+	switch (trial->mode)
+	{
+	case EASYAVATAR_ENCODE_PNG:
+		encoded = EasyAvatar_EncodeOnce(search->original, FIF_PNG, PNG_Z_BEST_COMPRESSION, search, result);
+		break;
+	case EASYAVATAR_ENCODE_PNG_PALETTE:
+	{
+		FIBITMAP* palettized = search->transparent ? EasyAvatar_QuantizeTransparent(search->dib, trial->value)
+			: FreeImage_ColorQuantizeEx(search->dib, FIQ_WUQUANT, trial->value, 0, NULL);
+		if (!palettized)
+			break;
+
+		// Quantizing tells us the quality before encoding, no need to encode something that can't win
+		if (trial->checkQuality)
+			result->psnr = search->transparent ? EasyAvatar_MeasureTransparentPSNR(search->dib, palettized) : EasyAvatar_MeasurePSNR(search->dib, palettized);
+		if (!trial->checkQuality || result->psnr >= EASYAVATAR_MIN_PSNR)
+			encoded = EasyAvatar_EncodeOnce(palettized, FIF_PNG, PNG_Z_BEST_COMPRESSION, search, result);
+		FreeImage_Unload(palettized);
+		break;
+	}
+	case EASYAVATAR_ENCODE_JPEG:
+		encoded = EasyAvatar_EncodeOnce(search->dib, FIF_JPEG, trial->value | JPEG_OPTIMIZE, search, result);
+		if (encoded && trial->checkQuality)
+			result->psnr = EasyAvatar_MeasureJPEG(search->dib, result);
+		break;
+	}
+
+	if (!encoded)
+		return;
+
+	if (trial->checkQuality && result->psnr < EASYAVATAR_MIN_PSNR)
+	{
+		free(result->data);
+		result->data = NULL;
+		return;
+	}
+
+	// This result is certain to be acceptable, anything larger can't win anymore
+	if (search->smallestWins)
+		EasyAvatar_LowerCutoff(&search->cutoff, result->size);
+}
+
+static void EasyAvatar_RunTrials(struct EasyAvatar_EncodeSearch* search)
+{
+	search->cutoff = (LONG)search->budget;
+	EasyAvatar_ParallelFor(search->trialCount, EasyAvatar_RunEncodeTrial, search);
+}
+
+static void EasyAvatar_KeepBest(struct EasyAvatar_EncodeResult* best, struct EasyAvatar_EncodeResult* candidate)
+{
+	free(best->data);
+	*best = *candidate;
+	candidate->data = NULL;
+}
+
+static void EasyAvatar_FreeTrials(struct EasyAvatar_EncodeSearch* search)
+{
+	for (unsigned int i = 0; i < search->trialCount; i++)
+	{
+		free(search->trials[i].result.data);
+		search->trials[i].result.data = NULL;
+	}
+}
+
+/*
+	Bisects value in [low, high] for the largest one that still fits, assuming the size grows with value.
+	Every round tests several evenly spaced values in parallel, which narrows the range a lot faster than plain bisection.
+*/
+static BOOL EasyAvatar_SearchBudget(struct EasyAvatar_EncodeSearch* search, enum EasyAvatar_EncodeMode mode, int low, int high, struct EasyAvatar_EncodeResult* best)
+{
+	size_t goodEnough = search->budget - search->budget * EASYAVATAR_BUDGET_TOLERANCE / 100;
+	unsigned int parallelism = EasyAvatar_GetParallelism();
+	if (parallelism > EASYAVATAR_MAX_PARALLEL_TRIALS)
+		parallelism = EASYAVATAR_MAX_PARALLEL_TRIALS;
+
+	while (low <= high && !(best->data && best->size >= goodEnough))
+	{
+		unsigned int range = (unsigned int)(high - low + 1);
+		search->trialCount = range < parallelism ? range : parallelism;
+		for (unsigned int i = 0; i < search->trialCount; i++)
+		{
+			struct EasyAvatar_EncodeTrial* trial = &search->trials[i];
+			memset(trial, 0, sizeof(*trial));
+			trial->mode = mode;
+			// With fewer values than trials every value gets tested, otherwise they are spread over the range
+			trial->value = range <= search->trialCount ? low + (int)i : low + (int)(range * (i + 1) / (search->trialCount + 1));
+		}
+
+		// Every trial is allowed to use the full budget here, we want the largest one that fits
+		search->smallestWins = FALSE;
+		EasyAvatar_RunTrials(search);
+
+		int newLow = low;
+		int newHigh = high;
+		for (unsigned int i = 0; i < search->trialCount; i++)
+		{
+			if (search->trials[i].result.data)
+			{
+				EasyAvatar_KeepBest(best, &search->trials[i].result);
+				newLow = search->trials[i].value + 1;
+			}
+			else
+			{
+				// Everything above the first value that doesn't fit is too large as well
+				newHigh = search->trials[i].value - 1;
+				break;
+			}
+		}
+
+		EasyAvatar_FreeTrials(search);
+		low = newLow;
+		high = newHigh;
+	}
+
+	return best->data != NULL;
+}
+
+static void EasyAvatar_AddTrial(struct EasyAvatar_EncodeSearch* search, enum EasyAvatar_EncodeMode mode, int value, BOOL checkQuality)
+{
+	struct EasyAvatar_EncodeTrial* trial = &search->trials[search->trialCount++];
+	memset(trial, 0, sizeof(*trial));
+	trial->mode = mode;
+	trial->value = value;
+	trial->checkQuality = checkQuality;
+}
+
+static BYTE* EasyAvatar_FinishEncode(struct EasyAvatar_EncodeResult* result, size_t* size, BYTE digest[16])
+{
+	*size = result->size;
+	memcpy(digest, result->digest, sizeof(result->digest));
+	return result->data;
+}
+
+BYTE* EasyAvatar_EncodeWithinBudget(FIBITMAP* dib, size_t budget, size_t* size, BYTE digest[16])
+{
+	struct EasyAvatar_EncodeSearch search;
+	struct EasyAvatar_EncodeResult best = { NULL, 0 };
+	memset(&search, 0, sizeof(search));
+	search.original = dib;
+	search.budget = budget;
+	search.smallestWins = TRUE;
+
+	// JPEG would throw away the alpha channel, palettes keep it with a transparent index
+	BOOL transparent = EasyAvatar_HasTransparentPixels(dib);
+	search.transparent = transparent;
+	search.dib = transparent ? EasyAvatar_ConvertTo32Bits(dib) : EasyAvatar_ConvertTo24Bits(dib);
+	if (!search.dib)
+		return NULL;
+	// An alpha channel that's opaque everywhere would only cost bytes
+	if (!transparent && FreeImage_GetBPP(dib) == 32)
+		search.original = search.dib;
+
+	EasyAvatar_AddTrial(&search, EASYAVATAR_ENCODE_PNG, 0, FALSE);
+	EasyAvatar_AddTrial(&search, EASYAVATAR_ENCODE_PNG_PALETTE, EASYAVATAR_PNG_MAX_COLORS, TRUE);
+	if (!transparent)
+		EasyAvatar_AddTrial(&search, EASYAVATAR_ENCODE_JPEG, EASYAVATAR_JPEG_QUALITY, TRUE);
+	EasyAvatar_RunTrials(&search);
+
+	// The smallest acceptable candidate wins, lossless comes first so it wins ties
+	for (unsigned int i = 0; i < search.trialCount; i++)
+	{
+		struct EasyAvatar_EncodeResult* result = &search.trials[i].result;
+		if (result->data && (!best.data || result->size < best.size))
+			EasyAvatar_KeepBest(&best, result);
+	}
+
+	// Nothing fit, keep lowering the quality of the kind of image that looked fine
+	if (!best.data)
+	{
+		BOOL paletteLooksFine = search.trials[1].result.psnr >= EASYAVATAR_MIN_PSNR;
+		EasyAvatar_FreeTrials(&search);
+
+		// Only a palette keeps transparency, so transparent images search it no matter how it looked
+		if (transparent || paletteLooksFine)
+		{
+			int minColors = transparent ? EASYAVATAR_PNG_MIN_TRANSPARENT_COLORS : EASYAVATAR_PNG_MIN_COLORS;
+			EasyAvatar_SearchBudget(&search, EASYAVATAR_ENCODE_PNG_PALETTE, minColors, EASYAVATAR_PNG_MAX_COLORS - 1, &best);
+		}
+
+		// Not even the fewest colors fit, JPEG still might
+		if (!best.data && !transparent)
+			EasyAvatar_SearchBudget(&search, EASYAVATAR_ENCODE_JPEG, EASYAVATAR_JPEG_MIN_QUALITY, EASYAVATAR_JPEG_MAX_QUALITY, &best);
+	}
+
+	EasyAvatar_FreeTrials(&search);
+	if (search.dib != dib)
+		FreeImage_Unload(search.dib);
+
+	return best.data ? EasyAvatar_FinishEncode(&best, size, digest) : NULL;
+}
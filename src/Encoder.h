@@ -0,0 +1,25 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+// Stop searching once a candidate is no more than this many percent below the budget
+#define EASYAVATAR_BUDGET_TOLERANCE 5
+// Upper limit of trial encodes that run at the same time
+#define EASYAVATAR_MAX_PARALLEL_TRIALS 8
+// Lossy candidates have to reach this peak signal to noise ratio (dB) compared to the resized image
+#define EASYAVATAR_MIN_PSNR 35.0
+// Quality of the speculative JPEG candidate
+#define EASYAVATAR_JPEG_QUALITY 85
+
+/*
+	Encodes dib into a heap allocated buffer no larger than budget and writes the 16 byte MD5 of it to digest.
+	A lossless PNG, a palettized PNG and a JPEG get encoded in parallel, the smallest one that looks good enough wins
+	and encodes that can't beat an already certain winner are aborted. Images with an alpha below 255 anywhere are only encoded
+	as PNG, their palette candidate reserves an index for pixels that are mostly transparent and makes the others opaque.
+	If no candidate fits, JPEG quality or the number of palette colors is lowered, searching for the best looking result
+	that still fits. Opaque images fall back to JPEG if even the fewest palette colors don't fit, transparent ones only lower
+	their palette.
+	The caller owns the returned buffer. Returns NULL if nothing fits or anything fails.
+*/
+BYTE* EasyAvatar_EncodeWithinBudget(FIBITMAP* dib, size_t budget, size_t* size, BYTE digest[16]);
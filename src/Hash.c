@@ -0,0 +1,293 @@
+#include "Hash.h"
+
+#include <string.h>
+
+// Constants and structure follow the reference XXH64 implementation
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static UINT64 EasyAvatar_Read64(const BYTE* p)
+{
+	// memcpy keeps unaligned reads legal, compilers turn it into a single load
+	UINT64 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static UINT32 EasyAvatar_Read32(const BYTE* p)
+{
+	UINT32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static UINT64 EasyAvatar_XXH64Round(UINT64 acc, UINT64 input)
+{
+	acc += input * PRIME64_2;
+	acc = ROTL64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static UINT64 EasyAvatar_XXH64Merge(UINT64 acc, UINT64 value)
+{
+	acc ^= EasyAvatar_XXH64Round(0, value);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+UINT64 EasyAvatar_Fingerprint(const void* data, size_t size)
+{
+	const BYTE* p = (const BYTE*)data;
+	const BYTE* end = p + size;
+	UINT64 hash;
+
+	if (size >= 32)
+	{
+		// Four independent lanes keep the multiplier pipelines busy on large data URIs
+		UINT64 v1 = PRIME64_1 + PRIME64_2;
+		UINT64 v2 = PRIME64_2;
+		UINT64 v3 = 0;
+		UINT64 v4 = 0 - PRIME64_1;
+		const BYTE* limit = end - 32;
+
+		do
+		{
+			v1 = EasyAvatar_XXH64Round(v1, EasyAvatar_Read64(p));
+			v2 = EasyAvatar_XXH64Round(v2, EasyAvatar_Read64(p + 8));
+			v3 = EasyAvatar_XXH64Round(v3, EasyAvatar_Read64(p + 16));
+			v4 = EasyAvatar_XXH64Round(v4, EasyAvatar_Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		hash = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+		hash = EasyAvatar_XXH64Merge(hash, v1);
+		hash = EasyAvatar_XXH64Merge(hash, v2);
+		hash = EasyAvatar_XXH64Merge(hash, v3);
+		hash = EasyAvatar_XXH64Merge(hash, v4);
+	}
+	else
+	{
+		hash = PRIME64_5;
+	}
+
+	hash += (UINT64)size;
+
+	while (p + 8 <= end)
+	{
+		hash ^= EasyAvatar_XXH64Round(0, EasyAvatar_Read64(p));
+		hash = ROTL64(hash, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end)
+	{
+		hash ^= (UINT64)EasyAvatar_Read32(p) * PRIME64_1;
+		hash = ROTL64(hash, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end)
+	{
+		hash ^= (*p) * PRIME64_5;
+		hash = ROTL64(hash, 11) * PRIME64_1;
+		p++;
+	}
+
+	// Final avalanche
+	hash ^= hash >> 33;
+	hash *= PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= PRIME64_3;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+// MD5 as specified by RFC 1321, with the rounds unrolled
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define MD5_STEP(f, a, b, c, d, x, t, s) \
+	(a) += f((b), (c), (d)) + (x) + (t); \
+	(a) = (((a) << (s)) | ((a) >> (32 - (s)))); \
+	(a) += (b);
+
+static const BYTE* EasyAvatar_MD5Transform(UINT32 state[4], const BYTE* data, size_t blocks)
+{
+	UINT32 a = state[0];
+	UINT32 b = state[1];
+	UINT32 c = state[2];
+	UINT32 d = state[3];
+	UINT32 x[16];
+
+	while (blocks--)
+	{
+		UINT32 savedA = a, savedB = b, savedC = c, savedD = d;
+		// MD5 is little endian just like every platform we run on
+		memcpy(x, data, sizeof(x));
+
+		MD5_STEP(MD5_F, a, b, c, d, x[0], 0xd76aa478, 7)
+		MD5_STEP(MD5_F, d, a, b, c, x[1], 0xe8c7b756, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[2], 0x242070db, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[3], 0xc1bdceee, 22)
+		MD5_STEP(MD5_F, a, b, c, d, x[4], 0xf57c0faf, 7)
+		MD5_STEP(MD5_F, d, a, b, c, x[5], 0x4787c62a, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[6], 0xa8304613, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[7], 0xfd469501, 22)
+		MD5_STEP(MD5_F, a, b, c, d, x[8], 0x698098d8, 7)
+		MD5_STEP(MD5_F, d, a, b, c, x[9], 0x8b44f7af, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22)
+		MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7)
+		MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12)
+		MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17)
+		MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22)
+
+		MD5_STEP(MD5_G, a, b, c, d, x[1], 0xf61e2562, 5)
+		MD5_STEP(MD5_G, d, a, b, c, x[6], 0xc040b340, 9)
+		MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[0], 0xe9b6c7aa, 20)
+		MD5_STEP(MD5_G, a, b, c, d, x[5], 0xd62f105d, 5)
+		MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9)
+		MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[4], 0xe7d3fbc8, 20)
+		MD5_STEP(MD5_G, a, b, c, d, x[9], 0x21e1cde6, 5)
+		MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9)
+		MD5_STEP(MD5_G, c, d, a, b, x[3], 0xf4d50d87, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[8], 0x455a14ed, 20)
+		MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5)
+		MD5_STEP(MD5_G, d, a, b, c, x[2], 0xfcefa3f8, 9)
+		MD5_STEP(MD5_G, c, d, a, b, x[7], 0x676f02d9, 14)
+		MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20)
+
+		MD5_STEP(MD5_H, a, b, c, d, x[5], 0xfffa3942, 4)
+		MD5_STEP(MD5_H, d, a, b, c, x[8], 0x8771f681, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23)
+		MD5_STEP(MD5_H, a, b, c, d, x[1], 0xa4beea44, 4)
+		MD5_STEP(MD5_H, d, a, b, c, x[4], 0x4bdecfa9, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[7], 0xf6bb4b60, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23)
+		MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4)
+		MD5_STEP(MD5_H, d, a, b, c, x[0], 0xeaa127fa, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[3], 0xd4ef3085, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[6], 0x04881d05, 23)
+		MD5_STEP(MD5_H, a, b, c, d, x[9], 0xd9d4d039, 4)
+		MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11)
+		MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16)
+		MD5_STEP(MD5_H, b, c, d, a, x[2], 0xc4ac5665, 23)
+
+		MD5_STEP(MD5_I, a, b, c, d, x[0], 0xf4292244, 6)
+		MD5_STEP(MD5_I, d, a, b, c, x[7], 0x432aff97, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[5], 0xfc93a039, 21)
+		MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6)
+		MD5_STEP(MD5_I, d, a, b, c, x[3], 0x8f0ccc92, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[1], 0x85845dd1, 21)
+		MD5_STEP(MD5_I, a, b, c, d, x[8], 0x6fa87e4f, 6)
+		MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[6], 0xa3014314, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21)
+		MD5_STEP(MD5_I, a, b, c, d, x[4], 0xf7537e82, 6)
+		MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10)
+		MD5_STEP(MD5_I, c, d, a, b, x[2], 0x2ad7d2bb, 15)
+		MD5_STEP(MD5_I, b, c, d, a, x[9], 0xeb86d391, 21)
+
+		a += savedA;
+		b += savedB;
+		c += savedC;
+		d += savedD;
+		data += 64;
+	}
+
+	state[0] = a;
+	state[1] = b;
+	state[2] = c;
+	state[3] = d;
+	return data;
+}
+
+void EasyAvatar_MD5Init(struct EasyAvatar_MD5Context* context)
+{
+	context->state[0] = 0x67452301;
+	context->state[1] = 0xefcdab89;
+	context->state[2] = 0x98badcfe;
+	context->state[3] = 0x10325476;
+	context->length = 0;
+}
+
+void EasyAvatar_MD5Update(struct EasyAvatar_MD5Context* context, const void* data, size_t size)
+{
+	const BYTE* p = (const BYTE*)data;
+	size_t buffered = (size_t)(context->length & 63);
+	context->length += size;
+
+	// Complete a block left over from the previous call first
+	if (buffered)
+	{
+		size_t missing = 64 - buffered;
+		if (size < missing)
+		{
+			memcpy(context->buffer + buffered, p, size);
+			return;
+		}
+		memcpy(context->buffer + buffered, p, missing);
+		EasyAvatar_MD5Transform(context->state, context->buffer, 1);
+		p += missing;
+		size -= missing;
+	}
+
+	// Hash whole blocks straight from the caller's memory
+	if (size >= 64)
+	{
+		p = EasyAvatar_MD5Transform(context->state, p, size / 64);
+		size &= 63;
+	}
+
+	if (size)
+		memcpy(context->buffer, p, size);
+}
+
+void EasyAvatar_MD5Final(struct EasyAvatar_MD5Context* context, BYTE digest[16])
+{
+	static const BYTE padding[64] = { 0x80 };
+	UINT64 bitLength = context->length * 8;
+	size_t buffered = (size_t)(context->length & 63);
+
+	// Pad to 56 mod 64, then append the message length in bits
+	EasyAvatar_MD5Update(context, padding, buffered < 56 ? 56 - buffered : 120 - buffered);
+
+	BYTE lengthBytes[8];
+	for (int i = 0; i < 8; i++)
+		lengthBytes[i] = (BYTE)(bitLength >> (8 * i));
+	EasyAvatar_MD5Update(context, lengthBytes, sizeof(lengthBytes));
+
+	for (int i = 0; i < 4; i++)
+	{
+		digest[i * 4] = (BYTE)context->state[i];
+		digest[i * 4 + 1] = (BYTE)(context->state[i] >> 8);
+		digest[i * 4 + 2] = (BYTE)(context->state[i] >> 16);
+		digest[i * 4 + 3] = (BYTE)(context->state[i] >> 24);
+	}
+}
+
+void EasyAvatar_MD5ToHex(const BYTE digest[16], char* hex)
+{
+	const char digits[] = "0123456789abcdef";
+
+	for (int i = 0; i < 16; i++)
+	{
+		hex[i * 2] = digits[digest[i] >> 4];
+		hex[i * 2 + 1] = digits[digest[i] & 0xf];
+	}
+	// Null terminate
+	hex[32] = 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <Windows.h>
+
+/*
+	Fast non-cryptographic 64 bit hash (XXH64 with seed 0) used to fingerprint clipboard contents and source images.
+	Not suitable for anything the server has to trust, use MD5 for that.
+*/
+UINT64 EasyAvatar_Fingerprint(const void* data, size_t size);
+
+/*
+	Incremental MD5, TeamSpeak identifies avatars by the MD5 of the uploaded file.
+	Call EasyAvatar_MD5Init once, EasyAvatar_MD5Update for every piece of data and EasyAvatar_MD5Final to get the 16 byte digest.
+*/
+struct EasyAvatar_MD5Context
+{
+	UINT32 state[4];
+	UINT64 length;
+	BYTE buffer[64];
+};
+
+void EasyAvatar_MD5Init(struct EasyAvatar_MD5Context* context);
+
+void EasyAvatar_MD5Update(struct EasyAvatar_MD5Context* context, const void* data, size_t size);
+
+void EasyAvatar_MD5Final(struct EasyAvatar_MD5Context* context, BYTE digest[16]);
+
+/*
+	Writes the lowercase hex representation of digest into hex, which must have room for 33 characters.
+*/
+void EasyAvatar_MD5ToHex(const BYTE digest[16], char* hex);
@@ -0,0 +1,330 @@
+#include "HttpCache.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EasyAvatar.h"
+#include "Hash.h"
+
+// "EAHC" in a little endian file
+#define EASYAVATAR_HTTP_CACHE_MAGIC 0x43484145
+// Bump whenever the layout of an entry changes, old entries are then ignored and overwritten
+#define EASYAVATAR_HTTP_CACHE_VERSION 2
+
+/*
+	Start of every cache entry, followed by the normalized URL (not terminated) and the body.
+*/
+struct EasyAvatar_CacheHeader
+{
+	UINT32 magic;
+	UINT32 version;
+	UINT32 urlLength;
+	UINT32 bodySize;
+	struct EasyAvatar_DownloadInfo info;
+};
+
+struct EasyAvatar_CacheFile
+{
+	char name[MAX_PATH];
+	UINT64 size;
+	UINT64 lastUsed;
+};
+
+static volatile LONG EasyAvatar_CacheHits = 0;
+static volatile LONG EasyAvatar_CacheMisses = 0;
+
+BOOL EasyAvatar_NormalizeURL(const char* url, char* normalized, size_t size)
+{
+	while (isspace((unsigned char)*url))
+		url++;
+
+	// The fragment is never sent to the server
+	size_t length = strcspn(url, "#");
+	while (length > 0 && isspace((unsigned char)url[length - 1]))
+		length--;
+
+	size_t schemeLength;
+	const char* defaultPort;
+	if (length >= 7 && _strnicmp(url, "http://", 7) == 0)
+	{
+		schemeLength = 7;
+		defaultPort = ":80";
+	}
+	else if (length >= 8 && _strnicmp(url, "https://", 8) == 0)
+	{
+		schemeLength = 8;
+		defaultPort = ":443";
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	const char* authority = url + schemeLength;
+	size_t authorityLength = strcspn(authority, "/?");
+	if (authorityLength > length - schemeLength)
+		authorityLength = length - schemeLength;
+
+	// User info is case sensitive, only the host isn't
+	size_t hostStart = 0;
+	for (size_t i = 0; i < authorityLength; i++)
+	{
+		if (authority[i] == '@')
+			hostStart = i + 1;
+	}
+
+	size_t portLength = strlen(defaultPort);
+	if (authorityLength - hostStart > portLength && memcmp(authority + authorityLength - portLength, defaultPort, portLength) == 0)
+		authorityLength -= portLength;
+
+	const char* path = url + schemeLength + strcspn(authority, "/?");
+	size_t pathLength = url + length > path ? (size_t)(url + length - path) : 0;
+	BOOL addSlash = pathLength == 0 || path[0] == '?';
+	if (schemeLength + authorityLength + addSlash + pathLength + 1 > size)
+		return FALSE;
+
+	char* out = normalized;
+	for (size_t i = 0; i < schemeLength; i++)
+		*out++ = (char)tolower((unsigned char)url[i]);
+	for (size_t i = 0; i < authorityLength; i++)
+		*out++ = i < hostStart ? authority[i] : (char)tolower((unsigned char)authority[i]);
+	if (addSlash)
+		*out++ = '/';
+	memcpy(out, path, pathLength);
+	out[pathLength] = '\0';
+	return TRUE;
+}
+
+/*
+	Entries are named after the MD5 of the normalized URL so any URL maps to a valid file name.
+*/
+static BOOL EasyAvatar_GetCachePath(const char* normalized, char* path, size_t size)
+{
+	struct EasyAvatar_MD5Context context;
+	BYTE digest[16];
+	char hex[33];
+
+	EasyAvatar_MD5Init(&context);
+	EasyAvatar_MD5Update(&context, normalized, strlen(normalized));
+	EasyAvatar_MD5Final(&context, digest);
+	EasyAvatar_MD5ToHex(digest, hex);
+
+	int length = snprintf(path, size, "%s\\%s\\%s.entry", EASYAVATAR_FILEPATH, EASYAVATAR_HTTP_CACHE_DIR, hex);
+	return length > 0 && (size_t)length < size;
+}
+
+/*
+	Returns the heap allocated body of the entry at path, NULL if there is none or it belongs to another URL.
+*/
+static BYTE* EasyAvatar_ReadCacheEntry(const char* path, const char* normalized, struct EasyAvatar_DownloadInfo* info, size_t* size)
+{
+	FILE* fp = NULL;
+	if (fopen_s(&fp, path, "rb") != 0 || !fp)
+		return NULL;
+
+	struct EasyAvatar_CacheHeader header;
+	char url[EASYAVATAR_URL_SIZE];
+	size_t urlLength = strlen(normalized);
+	BYTE* body = NULL;
+
+	// The name is only a hash, make sure the entry really is for this URL
+	if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == EASYAVATAR_HTTP_CACHE_MAGIC && header.version == EASYAVATAR_HTTP_CACHE_VERSION
+		&& header.urlLength == urlLength && urlLength < sizeof(url) && header.bodySize > 0 && header.bodySize <= EASYAVATAR_DOWNLOAD_MAX_SIZE
+		&& fread(url, 1, urlLength, fp) == urlLength && memcmp(url, normalized, urlLength) == 0)
+	{
+		body = (BYTE*)malloc(header.bodySize);
+		if (body && fread(body, 1, header.bodySize, fp) != header.bodySize)
+		{
+			free(body);
+			body = NULL;
+		}
+	}
+	fclose(fp);
+
+	if (!body)
+		return NULL;
+
+	*info = header.info;
+	info->etag[sizeof(info->etag) - 1] = '\0';
+	info->lastModified[sizeof(info->lastModified) - 1] = '\0';
+	info->finalUrl[sizeof(info->finalUrl) - 1] = '\0';
+	*size = header.bodySize;
+	return body;
+}
+
+static void EasyAvatar_WriteCacheEntry(const char* path, const char* normalized, const struct EasyAvatar_DownloadInfo* info, const BYTE* body, size_t size)
+{
+	char directory[PATH_BUFSIZE];
+	char temporary[PATH_BUFSIZE];
+	int length = snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+	if (length <= 0 || (size_t)length >= sizeof(temporary))
+		return;
+
+	// Fails harmlessly if the directory already exists
+	snprintf(directory, sizeof(directory), "%s\\%s", EASYAVATAR_FILEPATH, EASYAVATAR_HTTP_CACHE_DIR);
+	CreateDirectoryA(directory, NULL);
+
+	struct EasyAvatar_CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = EASYAVATAR_HTTP_CACHE_MAGIC;
+	header.version = EASYAVATAR_HTTP_CACHE_VERSION;
+	header.urlLength = (UINT32)strlen(normalized);
+	header.bodySize = (UINT32)size;
+	header.info = *info;
+
+	FILE* fp = NULL;
+	if (fopen_s(&fp, temporary, "wb") != 0 || !fp)
+		return;
+
+	BOOL written = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(normalized, 1, header.urlLength, fp) == header.urlLength
+		&& fwrite(body, 1, size, fp) == size;
+	if (fclose(fp) != 0)
+		written = FALSE;
+
+	// Readers never see a half written entry
+	if (!written || !MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING))
+		DeleteFileA(temporary);
+}
+
+/*
+	The last write time of an entry doubles as its LRU timestamp.
+*/
+static void EasyAvatar_TouchCacheEntry(const char* path)
+{
+	HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	FILETIME now;
+	GetSystemTimeAsFileTime(&now);
+	SetFileTime(file, NULL, NULL, &now);
+	CloseHandle(file);
+}
+
+static int EasyAvatar_CompareLastUsed(const void* a, const void* b)
+{
+	UINT64 left = ((const struct EasyAvatar_CacheFile*)a)->lastUsed;
+	UINT64 right = ((const struct EasyAvatar_CacheFile*)b)->lastUsed;
+	return left < right ? -1 : left > right;
+}
+
+/*
+	Deletes the least recently used entries until the cache fits into EASYAVATAR_HTTP_CACHE_MAX_SIZE.
+*/
+static void EasyAvatar_EvictCacheEntries(void)
+{
+	char path[PATH_BUFSIZE];
+	snprintf(path, sizeof(path), "%s\\%s\\*.entry", EASYAVATAR_FILEPATH, EASYAVATAR_HTTP_CACHE_DIR);
+
+	WIN32_FIND_DATAA found;
+	HANDLE search = FindFirstFileA(path, &found);
+	if (search == INVALID_HANDLE_VALUE)
+		return;
+
+	struct EasyAvatar_CacheFile* files = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	UINT64 total = 0;
+	do
+	{
+		if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			continue;
+
+		if (count == capacity)
+		{
+			size_t grownCapacity = capacity ? capacity * 2 : 64;
+			struct EasyAvatar_CacheFile* grown = (struct EasyAvatar_CacheFile*)realloc(files, grownCapacity * sizeof(*files));
+			if (!grown)
+				break;
+			files = grown;
+			capacity = grownCapacity;
+		}
+
+		struct EasyAvatar_CacheFile* file = &files[count++];
+		snprintf(file->name, sizeof(file->name), "%s", found.cFileName);
+		file->size = ((UINT64)found.nFileSizeHigh << 32) | found.nFileSizeLow;
+		file->lastUsed = ((UINT64)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+		total += file->size;
+	} while (FindNextFileA(search, &found));
+	FindClose(search);
+
+	if (total > EASYAVATAR_HTTP_CACHE_MAX_SIZE)
+	{
+		qsort(files, count, sizeof(*files), EasyAvatar_CompareLastUsed);
+		for (size_t i = 0; i < count && total > EASYAVATAR_HTTP_CACHE_MAX_SIZE; i++)
+		{
+			snprintf(path, sizeof(path), "%s\\%s\\%s", EASYAVATAR_FILEPATH, EASYAVATAR_HTTP_CACHE_DIR, files[i].name);
+			if (DeleteFileA(path))
+				total -= files[i].size;
+		}
+	}
+
+	free(files);
+}
+
+enum EasyAvatar_DownloadResult EasyAvatar_CachedDownload(const char* url, BYTE** data, size_t* size)
+{
+	char normalized[EASYAVATAR_URL_SIZE];
+	char path[PATH_BUFSIZE];
+	if (!EasyAvatar_NormalizeURL(url, normalized, sizeof(normalized)) || !EasyAvatar_GetCachePath(normalized, path, sizeof(path)))
+		return EasyAvatar_Download(url, NULL, NULL, data, size);
+
+	struct EasyAvatar_DownloadInfo cached;
+	struct EasyAvatar_DownloadInfo response;
+	size_t cachedSize = 0;
+	BYTE* cachedBody = EasyAvatar_ReadCacheEntry(path, normalized, &cached, &cachedSize);
+
+	enum EasyAvatar_DownloadResult result;
+	if (cachedBody)
+	{
+		// Go straight to where the redirects took us last time
+		const char* target = cached.finalUrl[0] ? cached.finalUrl : normalized;
+		result = EasyAvatar_Download(target, &cached, &response, data, size);
+		if (result == EASYAVATAR_DOWNLOAD_NOT_MODIFIED)
+		{
+			InterlockedIncrement(&EasyAvatar_CacheHits);
+			EasyAvatar_TouchCacheEntry(path);
+			*data = cachedBody;
+			*size = cachedSize;
+			return EASYAVATAR_DOWNLOAD_OK;
+		}
+		free(cachedBody);
+
+		// The redirect target may have moved on, start over from the URL we were given
+		if (result == EASYAVATAR_DOWNLOAD_HTTP_ERROR && target != normalized)
+		{
+			DeleteFileA(path);
+			result = EasyAvatar_Download(normalized, NULL, &response, data, size);
+		}
+	}
+	else
+	{
+		result = EasyAvatar_Download(normalized, NULL, &response, data, size);
+	}
+
+	if (result != EASYAVATAR_DOWNLOAD_OK)
+		return result;
+
+	InterlockedIncrement(&EasyAvatar_CacheMisses);
+
+	// Without validators we could never tell whether a cached copy is still current, and no-store rules out keeping one at all
+	if (!response.noStore && (response.etag[0] || response.lastModified[0]) && *size <= EASYAVATAR_HTTP_CACHE_MAX_SIZE)
+	{
+		EasyAvatar_WriteCacheEntry(path, normalized, &response, *data, *size);
+		EasyAvatar_EvictCacheEntries();
+	}
+	else
+	{
+		DeleteFileA(path);
+	}
+
+	return result;
+}
+
+void EasyAvatar_GetHttpCacheStats(LONG* hits, LONG* misses)
+{
+	*hits = EasyAvatar_CacheHits;
+	*misses = EasyAvatar_CacheMisses;
+}
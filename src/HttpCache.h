@@ -0,0 +1,28 @@
+#pragma once
+#include <Windows.h>
+
+#include "Download.h"
+
+// Sub-directory of EASYAVATAR_FILEPATH holding the cached downloads
+#define EASYAVATAR_HTTP_CACHE_DIR "http_cache"
+// Least recently used entries are evicted once the cache grows beyond this
+#ifndef EASYAVATAR_HTTP_CACHE_MAX_SIZE
+#define EASYAVATAR_HTTP_CACHE_MAX_SIZE (64u * 1024u * 1024u)
+#endif
+
+/*
+	Writes a canonical form of url into normalized: scheme and host lowercased, default ports and the fragment dropped, an empty path turned into "/".
+	Returns FALSE if url isn't http(s) or doesn't fit into size.
+*/
+BOOL EasyAvatar_NormalizeURL(const char* url, char* normalized, size_t size);
+
+/*
+	Same as EasyAvatar_Download, but keeps bodies that come with an ETag or Last-Modified and without Cache-Control: no-store in an on-disk cache keyed by the normalized URL.
+	A cached body is revalidated against the final URL it was redirected to, a 304 answer skips the transfer.
+*/
+enum EasyAvatar_DownloadResult EasyAvatar_CachedDownload(const char* url, BYTE** data, size_t* size);
+
+/*
+	Number of downloads answered from the cache and downloads that had to transfer the body since the plugin was loaded.
+*/
+void EasyAvatar_GetHttpCacheStats(LONG* hits, LONG* misses);
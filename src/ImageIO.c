@@ -0,0 +1,282 @@
+#include "ImageIO.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned DLL_CALLCONV EasyAvatar_MemoryRead(void* buffer, unsigned size, unsigned count, fi_handle handle)
+{
+	struct EasyAvatar_MemoryReader* reader = (struct EasyAvatar_MemoryReader*)handle;
+	if (size == 0)
+		return 0;
+
+	size_t available = reader->size - reader->position;
+	size_t items = available / size;
+	if (items > count)
+		items = count;
+
+	memcpy(buffer, reader->data + reader->position, items * size);
+	reader->position += items * size;
+	return (unsigned)items;
+}
+
+static unsigned DLL_CALLCONV EasyAvatar_NoWrite(void* buffer, unsigned size, unsigned count, fi_handle handle)
+{
+	return 0;
+}
+
+static int DLL_CALLCONV EasyAvatar_MemorySeek(fi_handle handle, long offset, int origin)
+{
+	struct EasyAvatar_MemoryReader* reader = (struct EasyAvatar_MemoryReader*)handle;
+	long long target;
+
+	switch (origin)
+	{
+	case SEEK_SET: target = offset; break;
+	case SEEK_CUR: target = (long long)reader->position + offset; break;
+	case SEEK_END: target = (long long)reader->size + offset; break;
+	default: return -1;
+	}
+
+	if (target < 0 || target > (long long)reader->size)
+		return -1;
+
+	reader->position = (size_t)target;
+	return 0;
+}
+
+static long DLL_CALLCONV EasyAvatar_MemoryTell(fi_handle handle)
+{
+	return (long)((struct EasyAvatar_MemoryReader*)handle)->position;
+}
+
+void EasyAvatar_OpenMemoryReader(struct EasyAvatar_MemoryReader* reader, FreeImageIO* io, const BYTE* data, size_t size)
+{
+	reader->data = data;
+	reader->size = size;
+	reader->position = 0;
+
+	io->read_proc = EasyAvatar_MemoryRead;
+	io->write_proc = EasyAvatar_NoWrite;
+	io->seek_proc = EasyAvatar_MemorySeek;
+	io->tell_proc = EasyAvatar_MemoryTell;
+}
+
+static unsigned DLL_CALLCONV EasyAvatar_SliceRead(void* buffer, unsigned size, unsigned count, fi_handle handle)
+{
+	struct EasyAvatar_SliceReader* reader = (struct EasyAvatar_SliceReader*)handle;
+	if (size == 0)
+		return 0;
+
+	size_t available = (size_t)(reader->size - reader->position);
+	size_t wanted = (size_t)size * count;
+	if (wanted > available)
+		wanted = available / size * size;
+
+	if (wanted == 0 || reader->io->seek_proc(reader->handle, reader->start + reader->position, SEEK_SET) != 0)
+		return 0;
+
+	unsigned read = reader->io->read_proc(buffer, 1, (unsigned)wanted, reader->handle);
+	reader->position += read;
+	return read / size;
+}
+
+static int DLL_CALLCONV EasyAvatar_SliceSeek(fi_handle handle, long offset, int origin)
+{
+	struct EasyAvatar_SliceReader* reader = (struct EasyAvatar_SliceReader*)handle;
+	long long target;
+
+	switch (origin)
+	{
+	case SEEK_SET: target = offset; break;
+	case SEEK_CUR: target = (long long)reader->position + offset; break;
+	case SEEK_END: target = (long long)reader->size + offset; break;
+	default: return -1;
+	}
+
+	if (target < 0 || target > reader->size)
+		return -1;
+
+	reader->position = (long)target;
+	return 0;
+}
+
+static long DLL_CALLCONV EasyAvatar_SliceTell(fi_handle handle)
+{
+	return ((struct EasyAvatar_SliceReader*)handle)->position;
+}
+
+void EasyAvatar_OpenSliceReader(struct EasyAvatar_SliceReader* reader, FreeImageIO* io, FreeImageIO* sourceIO, fi_handle handle, long start, long size)
+{
+	reader->io = sourceIO;
+	reader->handle = handle;
+	reader->start = start;
+	reader->size = size;
+	reader->position = 0;
+
+	io->read_proc = EasyAvatar_SliceRead;
+	io->write_proc = EasyAvatar_NoWrite;
+	io->seek_proc = EasyAvatar_SliceSeek;
+	io->tell_proc = EasyAvatar_SliceTell;
+}
+
+static unsigned DLL_CALLCONV EasyAvatar_SinkWrite(void* buffer, unsigned size, unsigned count, fi_handle handle)
+{
+	struct EasyAvatar_EncodeSink* sink = (struct EasyAvatar_EncodeSink*)handle;
+	size_t bytes = (size_t)size * count;
+	if (bytes == 0 || sink->failed)
+		return 0;
+
+	size_t end = sink->position + bytes;
+	if ((sink->budget && end > sink->budget) || (sink->cutoff && end > (size_t)*sink->cutoff))
+	{
+		// Returning a short count makes the codec give up instead of finishing a doomed encode
+		sink->overBudget = TRUE;
+		sink->failed = TRUE;
+		return 0;
+	}
+
+	if (end > sink->capacity)
+	{
+		size_t capacity = sink->capacity ? sink->capacity : 64 * 1024;
+		while (capacity < end)
+			capacity *= 2;
+		BYTE* grown = (BYTE*)realloc(sink->data, capacity);
+		if (!grown)
+		{
+			sink->failed = TRUE;
+			return 0;
+		}
+		sink->data = grown;
+		sink->capacity = capacity;
+	}
+
+	// Hash while the bytes are hot, unless the encoder is rewriting something we've already seen
+	if (sink->position == sink->size && !sink->rehash)
+		EasyAvatar_MD5Update(&sink->md5, buffer, bytes);
+	else
+		sink->rehash = TRUE;
+
+	memcpy(sink->data + sink->position, buffer, bytes);
+	sink->position = end;
+	if (end > sink->size)
+		sink->size = end;
+
+	return count;
+}
+
+static int DLL_CALLCONV EasyAvatar_SinkSeek(fi_handle handle, long offset, int origin)
+{
+	struct EasyAvatar_EncodeSink* sink = (struct EasyAvatar_EncodeSink*)handle;
+	long long target;
+
+	switch (origin)
+	{
+	case SEEK_SET: target = offset; break;
+	case SEEK_CUR: target = (long long)sink->position + offset; break;
+	case SEEK_END: target = (long long)sink->size + offset; break;
+	default: return -1;
+	}
+
+	// Seeking past the end would leave a hole we never hashed
+	if (target < 0 || target > (long long)sink->size)
+		return -1;
+
+	sink->position = (size_t)target;
+	return 0;
+}
+
+static long DLL_CALLCONV EasyAvatar_SinkTell(fi_handle handle)
+{
+	return (long)((struct EasyAvatar_EncodeSink*)handle)->position;
+}
+
+static unsigned DLL_CALLCONV EasyAvatar_SinkRead(void* buffer, unsigned size, unsigned count, fi_handle handle)
+{
+	struct EasyAvatar_EncodeSink* sink = (struct EasyAvatar_EncodeSink*)handle;
+	if (size == 0)
+		return 0;
+
+	size_t items = (sink->size - sink->position) / size;
+	if (items > count)
+		items = count;
+
+	memcpy(buffer, sink->data + sink->position, items * size);
+	sink->position += items * size;
+	return (unsigned)items;
+}
+
+void EasyAvatar_OpenEncodeSink(struct EasyAvatar_EncodeSink* sink, FreeImageIO* io, size_t budget)
+{
+	memset(sink, 0, sizeof(*sink));
+	sink->budget = budget;
+	EasyAvatar_MD5Init(&sink->md5);
+
+	io->read_proc = EasyAvatar_SinkRead;
+	io->write_proc = EasyAvatar_SinkWrite;
+	io->seek_proc = EasyAvatar_SinkSeek;
+	io->tell_proc = EasyAvatar_SinkTell;
+}
+
+BYTE* EasyAvatar_CloseEncodeSink(struct EasyAvatar_EncodeSink* sink, size_t* size, BYTE digest[16])
+{
+	BYTE* data = sink->data;
+	sink->data = NULL;
+
+	if (sink->failed || sink->size == 0)
+	{
+		free(data);
+		return NULL;
+	}
+
+	if (sink->rehash)
+	{
+		EasyAvatar_MD5Init(&sink->md5);
+		EasyAvatar_MD5Update(&sink->md5, data, sink->size);
+	}
+	EasyAvatar_MD5Final(&sink->md5, digest);
+
+	*size = sink->size;
+	return data;
+}
+
+BYTE* EasyAvatar_ReadAll(FreeImageIO* io, fi_handle handle, size_t* size)
+{
+	if (io->seek_proc(handle, 0, SEEK_SET) != 0)
+		return NULL;
+
+	// FreeImageIO has no way to ask a handle for its size, so read until it runs dry
+	size_t capacity = 64 * 1024;
+	size_t total = 0;
+	BYTE* data = (BYTE*)malloc(capacity);
+	if (!data)
+		return NULL;
+
+	for (;;)
+	{
+		if (total == capacity)
+		{
+			BYTE* grown = (BYTE*)realloc(data, capacity * 2);
+			if (!grown)
+			{
+				free(data);
+				return NULL;
+			}
+			data = grown;
+			capacity *= 2;
+		}
+
+		unsigned bytesRead = io->read_proc(data + total, 1, (unsigned)(capacity - total), handle);
+		if (bytesRead == 0)
+			break;
+		total += bytesRead;
+	}
+
+	if (total == 0)
+	{
+		free(data);
+		return NULL;
+	}
+
+	*size = total;
+	return data;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+#include "Hash.h"
+
+/*
+	FreeImageIO handle over a buffer we already have in memory, e.g. a finished download.
+	The buffer is not copied and has to outlive the reader.
+*/
+struct EasyAvatar_MemoryReader
+{
+	const BYTE* data;
+	size_t size;
+	size_t position;
+};
+
+/*
+	FreeImageIO handle over a byte range of another handle, e.g. a preview image embedded in a JPEG.
+	Nothing is copied, the underlying handle has to outlive the reader and is seeked on every read.
+*/
+struct EasyAvatar_SliceReader
+{
+	FreeImageIO* io;
+	fi_handle handle;
+	long start;
+	long size;
+	long position;
+};
+
+/*
+	FreeImageIO write handle the encoder saves into. Hashes, counts and stages the bytes in a single pass
+	and fails the write as soon as the output grows past budget, which makes FreeImage abort the encode.
+*/
+struct EasyAvatar_EncodeSink
+{
+	BYTE* data;
+	size_t size;
+	size_t capacity;
+	size_t position;
+	// Maximum number of bytes we accept, 0 for no limit
+	size_t budget;
+	// Optional limit shared with concurrent encodes that may shrink while we write, NULL if unused
+	volatile LONG* cutoff;
+	struct EasyAvatar_MD5Context md5;
+	// The encoder went back and patched bytes we already hashed, the hash has to be redone at the end
+	BOOL rehash;
+	BOOL overBudget;
+	BOOL failed;
+};
+
+/*
+	Sets up reader and io to read from data.
+*/
+void EasyAvatar_OpenMemoryReader(struct EasyAvatar_MemoryReader* reader, FreeImageIO* io, const BYTE* data, size_t size);
+
+/*
+	Sets up reader and io to read the size bytes starting at start of the handle behind sourceIO.
+*/
+void EasyAvatar_OpenSliceReader(struct EasyAvatar_SliceReader* reader, FreeImageIO* io, FreeImageIO* sourceIO, fi_handle handle, long start, long size);
+
+/*
+	Sets up sink and io for a new encode limited to budget bytes (0 for no limit).
+*/
+void EasyAvatar_OpenEncodeSink(struct EasyAvatar_EncodeSink* sink, FreeImageIO* io, size_t budget);
+
+/*
+	Finishes the encode, hands the encoded bytes to the caller and writes the 16 byte MD5 of them to digest.
+	The caller owns the returned buffer. Returns NULL if the encode failed or went over budget.
+*/
+BYTE* EasyAvatar_CloseEncodeSink(struct EasyAvatar_EncodeSink* sink, size_t* size, BYTE digest[16]);
+
+/*
+	Reads everything behind handle, starting from the beginning, into a heap allocated buffer.
+	Returns NULL if anything fails.
+*/
+BYTE* EasyAvatar_ReadAll(FreeImageIO* io, fi_handle handle, size_t* size);
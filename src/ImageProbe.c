@@ -0,0 +1,635 @@
+#include "ImageProbe.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EasyAvatar.h"
+
+// Bytes read from the source at once, headers are parsed out of this window
+#define EASYAVATAR_PROBE_WINDOW 4096
+
+/*
+	Forward only reader over a FreeImageIO handle, small reads are served from a window and skips turn into seeks.
+*/
+struct EasyAvatar_ProbeReader
+{
+	FreeImageIO* io;
+	fi_handle handle;
+	BYTE window[EASYAVATAR_PROBE_WINDOW];
+	size_t windowSize;
+	size_t windowPosition;
+	// Offset in the file of the next byte we hand out
+	UINT64 position;
+	BOOL failed;
+};
+
+static void EasyAvatar_FillProbeWindow(struct EasyAvatar_ProbeReader* reader)
+{
+	size_t remaining = reader->windowSize - reader->windowPosition;
+	memmove(reader->window, reader->window + reader->windowPosition, remaining);
+	reader->windowSize = remaining + reader->io->read_proc(reader->window + remaining, 1, (unsigned)(EASYAVATAR_PROBE_WINDOW - remaining), reader->handle);
+	reader->windowPosition = 0;
+}
+
+static BOOL EasyAvatar_ProbeRead(struct EasyAvatar_ProbeReader* reader, void* buffer, size_t size)
+{
+	BYTE* output = (BYTE*)buffer;
+	while (size > 0 && !reader->failed)
+	{
+		if (reader->windowPosition == reader->windowSize || (size <= EASYAVATAR_PROBE_WINDOW && reader->windowSize - reader->windowPosition < size))
+		{
+			EasyAvatar_FillProbeWindow(reader);
+			if (reader->windowSize == 0)
+				reader->failed = TRUE;
+		}
+
+		size_t available = reader->windowSize - reader->windowPosition;
+		size_t step = size < available ? size : available;
+		memcpy(output, reader->window + reader->windowPosition, step);
+		reader->windowPosition += step;
+		reader->position += step;
+		output += step;
+		size -= step;
+	}
+
+	return !reader->failed;
+}
+
+static BOOL EasyAvatar_ProbeSkip(struct EasyAvatar_ProbeReader* reader, size_t size)
+{
+	size_t available = reader->windowSize - reader->windowPosition;
+	reader->position += size;
+	if (size <= available)
+	{
+		reader->windowPosition += size;
+		return !reader->failed;
+	}
+
+	// The handle is at the end of the window, seek from there
+	if (size - available > LONG_MAX || reader->io->seek_proc(reader->handle, (long)(size - available), SEEK_CUR) != 0)
+		reader->failed = TRUE;
+	reader->windowSize = 0;
+	reader->windowPosition = 0;
+	return !reader->failed;
+}
+
+static BOOL EasyAvatar_ProbeByte(struct EasyAvatar_ProbeReader* reader, BYTE* value)
+{
+	return EasyAvatar_ProbeRead(reader, value, 1);
+}
+
+static DWORD EasyAvatar_ReadBig32(const BYTE* data)
+{
+	return ((DWORD)data[0] << 24) | ((DWORD)data[1] << 16) | ((DWORD)data[2] << 8) | data[3];
+}
+
+static DWORD EasyAvatar_ReadLittle32(const BYTE* data)
+{
+	return ((DWORD)data[3] << 24) | ((DWORD)data[2] << 16) | ((DWORD)data[1] << 8) | data[0];
+}
+
+static DWORD EasyAvatar_ReadExif(const BYTE* data, unsigned int bytes, BOOL bigEndian)
+{
+	DWORD value = 0;
+	for (unsigned int i = 0; i < bytes; i++)
+		value |= (DWORD)data[bigEndian ? i : bytes - 1 - i] << (8 * (bytes - 1 - i));
+	return value;
+}
+
+/*
+	Checks the TIFF header at the start of tiff and returns the offset of its first IFD, 0 if it's invalid.
+*/
+static DWORD EasyAvatar_ReadTIFFHeader(const BYTE* tiff, size_t size, BOOL* bigEndian)
+{
+	if (size < 8 || (memcmp(tiff, "II*\0", 4) != 0 && memcmp(tiff, "MM\0*", 4) != 0))
+		return 0;
+
+	*bigEndian = tiff[0] == 'M';
+	DWORD ifd = EasyAvatar_ReadExif(tiff + 4, 4, *bigEndian);
+	return ifd >= 8 && ifd <= size - 2 ? ifd : 0;
+}
+
+/*
+	Returns the offset of the 12 byte entry for tag in the IFD at ifd, 0 if there is none.
+	If next isn't NULL it receives the offset of the following IFD.
+*/
+static size_t EasyAvatar_FindTIFFTag(const BYTE* tiff, size_t size, BOOL bigEndian, DWORD ifd, WORD tag, DWORD* next)
+{
+	if (next)
+		*next = 0;
+	if (ifd == 0 || ifd > size - 2)
+		return 0;
+
+	unsigned int entries = EasyAvatar_ReadExif(tiff + ifd, 2, bigEndian);
+	size_t found = 0;
+	for (unsigned int i = 0; i < entries; i++)
+	{
+		size_t entry = ifd + 2 + (size_t)i * 12;
+		if (entry + 12 > size)
+			return found;
+		if (!found && EasyAvatar_ReadExif(tiff + entry, 2, bigEndian) == tag)
+			found = entry;
+	}
+
+	size_t link = ifd + 2 + (size_t)entries * 12;
+	if (next && link + 4 <= size)
+		*next = EasyAvatar_ReadExif(tiff + link, 4, bigEndian);
+	return found;
+}
+
+/*
+	Reads the value of a SHORT or LONG entry, fallback for anything else.
+*/
+static DWORD EasyAvatar_GetTIFFValue(const BYTE* tiff, size_t entry, BOOL bigEndian, DWORD fallback)
+{
+	if (!entry)
+		return fallback;
+
+	switch (EasyAvatar_ReadExif(tiff + entry + 2, 2, bigEndian))
+	{
+	case 3: return EasyAvatar_ReadExif(tiff + entry + 8, 2, bigEndian);
+	case 4: return EasyAvatar_ReadExif(tiff + entry + 8, 4, bigEndian);
+	default: return fallback;
+	}
+}
+
+static void EasyAvatar_AddPreview(struct EasyAvatar_ImageInfo* info, UINT64 offset, DWORD size)
+{
+	if (info->previewCount == EASYAVATAR_MAX_PREVIEWS || size == 0 || offset + size > LONG_MAX)
+		return;
+
+	info->previews[info->previewCount].offset = (long)offset;
+	info->previews[info->previewCount].size = (long)size;
+	info->previewCount++;
+}
+
+unsigned int EasyAvatar_ParseExifOrientation(const BYTE* exif, size_t size)
+{
+	// Some writers keep the APP1 identifier in front of the TIFF header
+	if (size >= 6 && memcmp(exif, "Exif\0\0", 6) == 0)
+	{
+		exif += 6;
+		size -= 6;
+	}
+
+	BOOL bigEndian = FALSE;
+	DWORD ifd = EasyAvatar_ReadTIFFHeader(exif, size, &bigEndian);
+	unsigned int orientation = EasyAvatar_GetTIFFValue(exif, EasyAvatar_FindTIFFTag(exif, size, bigEndian, ifd, 0x0112, NULL), bigEndian, 1);
+	return orientation >= 1 && orientation <= 8 ? orientation : 1;
+}
+
+/*
+	Reads the orientation from EXIF data starting at position in the file,
+	remembering the JPEG thumbnail IFD1 points at as a preview.
+*/
+static void EasyAvatar_ParseExif(const BYTE* exif, size_t size, UINT64 position, struct EasyAvatar_ImageInfo* info)
+{
+	info->orientation = EasyAvatar_ParseExifOrientation(exif, size);
+	if (size >= 6 && memcmp(exif, "Exif\0\0", 6) == 0)
+	{
+		exif += 6;
+		size -= 6;
+		position += 6;
+	}
+
+	BOOL bigEndian = FALSE;
+	DWORD next;
+	DWORD ifd = EasyAvatar_ReadTIFFHeader(exif, size, &bigEndian);
+	EasyAvatar_FindTIFFTag(exif, size, bigEndian, ifd, 0, &next);
+
+	// JPEGInterchangeFormat and JPEGInterchangeFormatLength, relative to the TIFF header
+	DWORD offset = EasyAvatar_GetTIFFValue(exif, EasyAvatar_FindTIFFTag(exif, size, bigEndian, next, 0x0201, NULL), bigEndian, 0);
+	DWORD length = EasyAvatar_GetTIFFValue(exif, EasyAvatar_FindTIFFTag(exif, size, bigEndian, next, 0x0202, NULL), bigEndian, 0);
+	if (next && offset)
+		EasyAvatar_AddPreview(info, position + offset, length);
+}
+
+/*
+	Reads the MP index of a Multi-Picture Format segment starting at position in the file.
+	Every image but the first, which is the primary one, is remembered as a preview.
+*/
+static void EasyAvatar_ParseMPF(const BYTE* mpf, size_t size, UINT64 position, struct EasyAvatar_ImageInfo* info)
+{
+	BOOL bigEndian = FALSE;
+	DWORD ifd = EasyAvatar_ReadTIFFHeader(mpf, size, &bigEndian);
+	size_t entry = EasyAvatar_FindTIFFTag(mpf, size, bigEndian, ifd, 0xB002, NULL);
+	if (!entry)
+		return;
+
+	// MPEntry is UNDEFINED data made of 16 bytes per image
+	DWORD length = EasyAvatar_ReadExif(mpf + entry + 4, 4, bigEndian);
+	DWORD entries = EasyAvatar_ReadExif(mpf + entry + 8, 4, bigEndian);
+	if (length < 32 || entries > size || length > size - entries)
+		return;
+
+	for (DWORD i = 16; i + 16 <= length; i += 16)
+	{
+		DWORD imageSize = EasyAvatar_ReadExif(mpf + entries + i + 4, 4, bigEndian);
+		DWORD imageOffset = EasyAvatar_ReadExif(mpf + entries + i + 8, 4, bigEndian);
+		if (imageOffset)
+			EasyAvatar_AddPreview(info, position + imageOffset, imageSize);
+	}
+}
+
+/*
+	Reads size bytes of the segment at the current position and hands them to parse.
+*/
+static void EasyAvatar_ProbeSegment(struct EasyAvatar_ProbeReader* reader, size_t size, struct EasyAvatar_ImageInfo* info,
+	void (*parse)(const BYTE*, size_t, UINT64, struct EasyAvatar_ImageInfo*))
+{
+	UINT64 position = reader->position;
+	size_t kept = size < EASYAVATAR_PROBE_MAX_EXIF ? size : EASYAVATAR_PROBE_MAX_EXIF;
+	BYTE* segment = (BYTE*)malloc(kept);
+	if (!segment)
+	{
+		EasyAvatar_ProbeSkip(reader, size);
+		return;
+	}
+
+	if (EasyAvatar_ProbeRead(reader, segment, kept))
+		parse(segment, kept, position, info);
+	free(segment);
+	EasyAvatar_ProbeSkip(reader, size - kept);
+}
+
+static void EasyAvatar_ProbeExif(struct EasyAvatar_ProbeReader* reader, size_t size, struct EasyAvatar_ImageInfo* info)
+{
+	EasyAvatar_ProbeSegment(reader, size, info, EasyAvatar_ParseExif);
+}
+
+BOOL EasyAvatar_IsValidPNGDepth(unsigned int colorType, unsigned int depth)
+{
+	switch (colorType)
+	{
+	case 0: return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+	case 3: return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+	case 2:
+	case 4:
+	case 6: return depth == 8 || depth == 16;
+	default: return FALSE;
+	}
+}
+
+static BOOL EasyAvatar_ProbePNG(struct EasyAvatar_ProbeReader* reader, struct EasyAvatar_ImageInfo* info)
+{
+	static const BYTE channels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	BYTE chunk[8];
+	BYTE header[13];
+
+	if (!EasyAvatar_ProbeRead(reader, chunk, sizeof(chunk)) || EasyAvatar_ReadBig32(chunk) != 13 || memcmp(chunk + 4, "IHDR", 4) != 0
+		|| !EasyAvatar_ProbeRead(reader, header, sizeof(header)) || !EasyAvatar_ProbeSkip(reader, 4) || !EasyAvatar_IsValidPNGDepth(header[9], header[8]))
+	{
+		return FALSE;
+	}
+
+	info->format = FIF_PNG;
+	info->width = EasyAvatar_ReadBig32(header);
+	info->height = EasyAvatar_ReadBig32(header + 4);
+	info->bitDepth = header[8] * channels[header[9]];
+	info->interlaced = header[12] != 0;
+
+	// acTL has to come before the image data, eXIf usually does
+	while (EasyAvatar_ProbeRead(reader, chunk, sizeof(chunk)) && memcmp(chunk + 4, "IDAT", 4) != 0 && memcmp(chunk + 4, "IEND", 4) != 0)
+	{
+		DWORD length = EasyAvatar_ReadBig32(chunk);
+		if (memcmp(chunk + 4, "acTL", 4) == 0 && length >= 4)
+		{
+			BYTE frames[4];
+			if (!EasyAvatar_ProbeRead(reader, frames, sizeof(frames)))
+				break;
+			info->frameCount = EasyAvatar_ReadBig32(frames) ? EasyAvatar_ReadBig32(frames) : 1;
+			length -= 4;
+		}
+		else if (memcmp(chunk + 4, "eXIf", 4) == 0)
+		{
+			EasyAvatar_ProbeExif(reader, length, info);
+			length = 0;
+		}
+
+		if (!EasyAvatar_ProbeSkip(reader, (size_t)length + 4))
+			break;
+	}
+
+	return info->width > 0 && info->height > 0;
+}
+
+static BOOL EasyAvatar_ProbeJPEG(struct EasyAvatar_ProbeReader* reader, struct EasyAvatar_ImageInfo* info)
+{
+	info->format = FIF_JPEG;
+
+	for (;;)
+	{
+		BYTE marker = 0;
+		BYTE length[2];
+
+		// Markers may be padded with any number of 0xFF
+		if (!EasyAvatar_ProbeByte(reader, &marker) || marker != 0xFF)
+			return FALSE;
+		while (marker == 0xFF)
+		{
+			if (!EasyAvatar_ProbeByte(reader, &marker))
+				return FALSE;
+		}
+
+		// Markers without a payload
+		if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01)
+			continue;
+		// Start of scan or end of image before any frame header
+		if (marker == 0xDA || marker == 0xD9 || !EasyAvatar_ProbeRead(reader, length, sizeof(length)))
+			return FALSE;
+
+		size_t payload = (size_t)((length[0] << 8) | length[1]);
+		if (payload < 2)
+			return FALSE;
+		payload -= 2;
+
+		// SOF0-SOF15, except DHT, JPG and DAC which share the range
+		if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC)
+		{
+			BYTE frame[6];
+			if (payload < sizeof(frame) || !EasyAvatar_ProbeRead(reader, frame, sizeof(frame)))
+				return FALSE;
+
+			info->height = (frame[1] << 8) | frame[2];
+			info->width = (frame[3] << 8) | frame[4];
+			info->bitDepth = frame[0] * frame[5];
+			return info->width > 0 && info->height > 0;
+		}
+
+		// EXIF lives in APP1, the Multi-Picture Format index in APP2
+		BYTE identifier[6];
+		if ((marker == 0xE1 || marker == 0xE2) && payload > sizeof(identifier))
+		{
+			if (!EasyAvatar_ProbeRead(reader, identifier, 4))
+				return FALSE;
+			payload -= 4;
+
+			if (marker == 0xE1 && memcmp(identifier, "Exif", 4) == 0)
+			{
+				if (!EasyAvatar_ProbeRead(reader, identifier + 4, 2))
+					return FALSE;
+				EasyAvatar_ProbeExif(reader, payload - 2, info);
+				payload = 0;
+			}
+			else if (marker == 0xE2 && memcmp(identifier, "MPF\0", 4) == 0)
+			{
+				EasyAvatar_ProbeSegment(reader, payload, info, EasyAvatar_ParseMPF);
+				payload = 0;
+			}
+		}
+
+		if (!EasyAvatar_ProbeSkip(reader, payload))
+			return FALSE;
+	}
+}
+
+static BOOL EasyAvatar_SkipGIFBlocks(struct EasyAvatar_ProbeReader* reader)
+{
+	BYTE size;
+	while (EasyAvatar_ProbeByte(reader, &size) && size > 0)
+	{
+		if (!EasyAvatar_ProbeSkip(reader, size))
+			return FALSE;
+	}
+
+	return !reader->failed;
+}
+
+static BOOL EasyAvatar_ProbeGIF(struct EasyAvatar_ProbeReader* reader, struct EasyAvatar_ImageInfo* info)
+{
+	BYTE screen[7];
+	if (!EasyAvatar_ProbeRead(reader, screen, sizeof(screen)))
+		return FALSE;
+
+	info->format = FIF_GIF;
+	info->width = screen[0] | (screen[1] << 8);
+	info->height = screen[2] | (screen[3] << 8);
+	info->bitDepth = 8;
+	info->frameCount = 0;
+	if (screen[4] & 0x80)
+		EasyAvatar_ProbeSkip(reader, (size_t)3 << ((screen[4] & 0x07) + 1));
+
+	// Walk the blocks, skipping every pixel, to count the frames
+	BYTE block;
+	while (EasyAvatar_ProbeByte(reader, &block) && block != 0x3B)
+	{
+		if (block == 0x21)
+		{
+			if (!EasyAvatar_ProbeSkip(reader, 1) || !EasyAvatar_SkipGIFBlocks(reader))
+				break;
+		}
+		else if (block == 0x2C)
+		{
+			BYTE descriptor[9];
+			if (!EasyAvatar_ProbeRead(reader, descriptor, sizeof(descriptor)))
+				break;
+			if (descriptor[8] & 0x80)
+				EasyAvatar_ProbeSkip(reader, (size_t)3 << ((descriptor[8] & 0x07) + 1));
+
+			// Minimum LZW code size, then the image data
+			if (!EasyAvatar_ProbeSkip(reader, 1) || !EasyAvatar_SkipGIFBlocks(reader))
+				break;
+			info->frameCount++;
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	// A truncated GIF still shows the frames before the damage
+	if (info->frameCount == 0)
+		info->frameCount = 1;
+	return info->width > 0 && info->height > 0;
+}
+
+static BOOL EasyAvatar_ProbeBMP(struct EasyAvatar_ProbeReader* reader, struct EasyAvatar_ImageInfo* info)
+{
+	BYTE header[28];
+	if (!EasyAvatar_ProbeRead(reader, header, sizeof(header)))
+		return FALSE;
+
+	// header starts after the "BM" signature, so the info header begins at offset 12
+	DWORD infoSize = EasyAvatar_ReadLittle32(header + 12);
+	info->format = FIF_BMP;
+	if (infoSize == 12)
+	{
+		// OS/2 core header with 16 bit dimensions
+		info->width = header[16] | (header[17] << 8);
+		info->height = header[18] | (header[19] << 8);
+		info->bitDepth = header[22] | (header[23] << 8);
+	}
+	else if (infoSize >= 40)
+	{
+		// Negative heights mark top down bitmaps
+		LONG width = (LONG)EasyAvatar_ReadLittle32(header + 16);
+		LONG height = (LONG)EasyAvatar_ReadLittle32(header + 20);
+		info->width = width > 0 ? (unsigned int)width : 0;
+		info->height = height < 0 ? (unsigned int)-height : (unsigned int)height;
+		info->bitDepth = header[26] | (header[27] << 8);
+	}
+
+	return info->width > 0 && info->height > 0;
+}
+
+static BOOL EasyAvatar_ProbeWebP(struct EasyAvatar_ProbeReader* reader, struct EasyAvatar_ImageInfo* info)
+{
+	BYTE chunk[8];
+	BOOL extended = FALSE;
+	info->format = FIF_WEBP;
+	info->frameCount = 0;
+
+	while (EasyAvatar_ProbeRead(reader, chunk, sizeof(chunk)))
+	{
+		DWORD size = EasyAvatar_ReadLittle32(chunk + 4);
+		// Chunks are padded to an even size
+		size_t remaining = (size_t)size + (size & 1);
+		BYTE data[10];
+
+		if (memcmp(chunk, "VP8X", 4) == 0 && size >= 10)
+		{
+			if (!EasyAvatar_ProbeRead(reader, data, 10))
+				break;
+			info->width = (data[4] | (data[5] << 8) | (data[6] << 16)) + 1;
+			info->height = (data[7] | (data[8] << 8) | (data[9] << 16)) + 1;
+			info->bitDepth = (data[0] & 0x10) ? 32 : 24;
+			extended = TRUE;
+			remaining -= 10;
+		}
+		else if (memcmp(chunk, "VP8 ", 4) == 0 && size >= 10 && !info->width)
+		{
+			// Frame tag, start code and the 14 bit dimensions of the key frame
+			if (!EasyAvatar_ProbeRead(reader, data, 10) || data[3] != 0x9D || data[4] != 0x01 || data[5] != 0x2A)
+				return FALSE;
+			info->width = (data[6] | (data[7] << 8)) & 0x3FFF;
+			info->height = (data[8] | (data[9] << 8)) & 0x3FFF;
+			info->bitDepth = 24;
+			remaining -= 10;
+		}
+		else if (memcmp(chunk, "VP8L", 4) == 0 && size >= 5 && !info->width)
+		{
+			if (!EasyAvatar_ProbeRead(reader, data, 5) || data[0] != 0x2F)
+				return FALSE;
+			DWORD bits = EasyAvatar_ReadLittle32(data + 1);
+			info->width = (bits & 0x3FFF) + 1;
+			info->height = ((bits >> 14) & 0x3FFF) + 1;
+			info->bitDepth = (bits >> 28) & 1 ? 32 : 24;
+			remaining -= 5;
+		}
+		else if (memcmp(chunk, "ANMF", 4) == 0)
+		{
+			info->frameCount++;
+		}
+		else if (memcmp(chunk, "EXIF", 4) == 0)
+		{
+			EasyAvatar_ProbeExif(reader, size, info);
+			remaining -= size;
+		}
+
+		// Simple files end with their bitstream, extended ones may have frames and EXIF after it
+		if (!extended && info->width)
+			break;
+		if (!EasyAvatar_ProbeSkip(reader, remaining))
+			break;
+	}
+
+	if (info->frameCount == 0)
+		info->frameCount = 1;
+	return info->width > 0 && info->height > 0;
+}
+
+BOOL EasyAvatar_ProbeImage(FreeImageIO* io, fi_handle handle, struct EasyAvatar_ImageInfo* info)
+{
+	memset(info, 0, sizeof(*info));
+	info->format = FIF_UNKNOWN;
+	info->frameCount = 1;
+	info->orientation = 1;
+
+	struct EasyAvatar_ProbeReader* reader = (struct EasyAvatar_ProbeReader*)malloc(sizeof(struct EasyAvatar_ProbeReader));
+	if (!reader)
+		return FALSE;
+
+	reader->io = io;
+	reader->handle = handle;
+	reader->windowSize = 0;
+	reader->windowPosition = 0;
+	reader->position = 0;
+	reader->failed = io->seek_proc(handle, 0, SEEK_SET) != 0;
+
+	BOOL probed = FALSE;
+	BYTE signature[12];
+	if (EasyAvatar_ProbeRead(reader, signature, 2))
+	{
+		if (signature[0] == 0xFF && signature[1] == 0xD8)
+		{
+			probed = EasyAvatar_ProbeJPEG(reader, info);
+		}
+		else if (signature[0] == 'B' && signature[1] == 'M')
+		{
+			probed = EasyAvatar_ProbeBMP(reader, info);
+		}
+		else if (EasyAvatar_ProbeRead(reader, signature + 2, 4))
+		{
+			if (memcmp(signature, "\x89PNG\r\n", 6) == 0)
+				probed = EasyAvatar_ProbeRead(reader, signature + 6, 2) && memcmp(signature + 6, "\x1A\n", 2) == 0 && EasyAvatar_ProbePNG(reader, info);
+			else if (memcmp(signature, "GIF87a", 6) == 0 || memcmp(signature, "GIF89a", 6) == 0)
+				probed = EasyAvatar_ProbeGIF(reader, info);
+			else if (memcmp(signature, "RIFF", 4) == 0)
+				probed = EasyAvatar_ProbeRead(reader, signature + 6, 6) && memcmp(signature + 8, "WEBP", 4) == 0 && EasyAvatar_ProbeWebP(reader, info);
+		}
+	}
+
+	free(reader);
+	if (probed && io->seek_proc(handle, 0, SEEK_END) == 0 && io->tell_proc(handle) > 0)
+		info->fileSize = (size_t)io->tell_proc(handle);
+
+	// Leave the handle where the decoders expect it
+	io->seek_proc(handle, 0, SEEK_SET);
+	return probed;
+}
+
+unsigned int EasyAvatar_GetJPEGScale(unsigned int width, unsigned int height, unsigned int targetW, unsigned int targetH)
+{
+	// libjpeg can decode at 1/2, 1/4 and 1/8 scale, pick the smallest one that still covers the target
+	unsigned int denominator = 8;
+	while (denominator > 1 && (width / denominator < targetW || height / denominator < targetH))
+		denominator /= 2;
+
+	return denominator;
+}
+
+enum EasyAvatar_DecodeStrategy EasyAvatar_ChooseDecodeStrategy(const struct EasyAvatar_ImageInfo* info, unsigned int targetW, unsigned int targetH)
+{
+	UINT64 pixels = (UINT64)info->width * info->height;
+	unsigned int scale = info->format == FIF_JPEG ? EasyAvatar_GetJPEGScale(info->width, info->height, targetW, targetH) : 1;
+
+	// Streaming only keeps a couple of rows around, no matter how many there are
+	if (info->format == FIF_PNG && !info->interlaced && pixels > EASYAVATAR_STREAM_PIXELS && info->width <= EASYAVATAR_MAX_STREAM_WIDTH)
+		return EASYAVATAR_DECODE_STREAM;
+
+	// What counts is what actually gets decoded, JPEGs at 1/8 scale stay cheap even if they are huge
+	if (pixels / ((UINT64)scale * scale) > EASYAVATAR_MAX_PIXELS)
+		return EASYAVATAR_DECODE_REJECT;
+
+	if (scale > 1)
+		return EASYAVATAR_DECODE_SCALED;
+
+	// Teamspeak displays these formats as they are, an EXIF orientation would get lost though
+	BOOL displayable = info->format == FIF_PNG || info->format == FIF_JPEG || info->format == FIF_GIF;
+	if (displayable && info->orientation == 1 && info->width == targetW && info->height == targetH
+		&& info->fileSize > 0 && info->fileSize <= EASYAVATAR_MAX_FILESIZE)
+	{
+		return EASYAVATAR_DECODE_PASSTHROUGH;
+	}
+
+	if (info->format == FIF_GIF)
+	{
+		// Playback decodes every frame at full size, an original that passes through is never played back
+		if (pixels * info->frameCount > EASYAVATAR_MAX_ANIMATION_PIXELS)
+			return EASYAVATAR_DECODE_REJECT;
+		return EASYAVATAR_DECODE_ANIMATION;
+	}
+
+	return EASYAVATAR_DECODE_FULL;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+// Images with more pixels than this are never decoded at full size, override it at build time if needed
+#ifndef EASYAVATAR_MAX_PIXELS
+#define EASYAVATAR_MAX_PIXELS (64u * 1000u * 1000u)
+#endif
+// Animations whose frames together have more pixels than this are never played back, every frame has to be decoded at full size
+#ifndef EASYAVATAR_MAX_ANIMATION_PIXELS
+#define EASYAVATAR_MAX_ANIMATION_PIXELS (64u * 1000u * 1000u)
+#endif
+// Non-interlaced PNGs with more pixels than this are decoded row by row instead of all at once
+#define EASYAVATAR_STREAM_PIXELS (4u * 1000u * 1000u)
+// Widest PNG we stream, its rows are still kept in memory
+#define EASYAVATAR_MAX_STREAM_WIDTH (1u << 20)
+// Largest EXIF block we read while probing, APP1 segments can't be larger anyway
+#define EASYAVATAR_PROBE_MAX_EXIF 65536
+// Embedded previews remembered per image, the EXIF thumbnail and the images of a Multi-Picture Format index
+#define EASYAVATAR_MAX_PREVIEWS 4
+
+/*
+	Byte range of a JPEG embedded in another image.
+*/
+struct EasyAvatar_EmbeddedImage
+{
+	long offset;
+	long size;
+};
+
+/*
+	What the header of an image tells us before any pixels get decoded.
+*/
+struct EasyAvatar_ImageInfo
+{
+	FREE_IMAGE_FORMAT format;
+	unsigned int width;
+	unsigned int height;
+	// Bits per pixel summed over all channels
+	unsigned int bitDepth;
+	// 1 for still images, the number of frames for GIF, APNG and WebP animations
+	unsigned int frameCount;
+	// EXIF orientation 1-8, 1 if the image has none
+	unsigned int orientation;
+	// Size of the encoded file in bytes
+	size_t fileSize;
+	// Adam7 interlaced PNG
+	BOOL interlaced;
+	// EXIF thumbnail and MPF previews, they share the orientation of the image
+	struct EasyAvatar_EmbeddedImage previews[EASYAVATAR_MAX_PREVIEWS];
+	unsigned int previewCount;
+};
+
+enum EasyAvatar_DecodeStrategy
+{
+	// Already a valid avatar, upload the original bytes without decoding them
+	EASYAVATAR_DECODE_PASSTHROUGH,
+	// Decode the whole image, then resize it
+	EASYAVATAR_DECODE_FULL,
+	// Let libjpeg decode at 1/2, 1/4 or 1/8 scale
+	EASYAVATAR_DECODE_SCALED,
+	// Decode a PNG row by row, averaging the rows down as they arrive
+	EASYAVATAR_DECODE_STREAM,
+	// Play back and resize every frame of the GIF
+	EASYAVATAR_DECODE_ANIMATION,
+	// Decode only the page of an ICO, TIFF or ICNS that suits an avatar best
+	EASYAVATAR_DECODE_PAGE,
+	// Too large to decode within EASYAVATAR_MAX_PIXELS, or an animation beyond EASYAVATAR_MAX_ANIMATION_PIXELS
+	EASYAVATAR_DECODE_REJECT
+};
+
+/*
+	Parses the header of the PNG, JPEG, GIF, BMP or WebP image behind handle without decoding any pixels.
+	Only headers get read, everything else is skipped using seek_proc. GIFs are walked block by block to count their frames.
+	Returns FALSE if the format isn't one of those or the header is broken, info is left incomplete then.
+*/
+BOOL EasyAvatar_ProbeImage(FreeImageIO* io, fi_handle handle, struct EasyAvatar_ImageInfo* info);
+
+/*
+	Returns TRUE if depth is a bit depth the PNG colorType allows: 1, 2, 4, 8 or 16 for greyscale, 1, 2, 4 or 8 for palettes
+	and 8 or 16 for everything else.
+*/
+BOOL EasyAvatar_IsValidPNGDepth(unsigned int colorType, unsigned int depth);
+
+/*
+	Returns the orientation tag (1-8) of the TIFF structured EXIF data in exif, 1 if it has none.
+*/
+unsigned int EasyAvatar_ParseExifOrientation(const BYTE* exif, size_t size);
+
+/*
+	Returns the denominator (1, 2, 4 or 8) libjpeg should decode a width x height JPEG with so it still covers targetW x targetH.
+*/
+unsigned int EasyAvatar_GetJPEGScale(unsigned int width, unsigned int height, unsigned int targetW, unsigned int targetH);
+
+/*
+	Picks how the image described by info gets decoded, targetW x targetH being the size it gets resized to.
+*/
+enum EasyAvatar_DecodeStrategy EasyAvatar_ChooseDecodeStrategy(const struct EasyAvatar_ImageInfo* info, unsigned int targetW, unsigned int targetH);
@@ -0,0 +1,353 @@
+#include "Inflate.h"
+
+#include <string.h>
+
+#define EASYAVATAR_WINDOW_MASK 32767
+// Made up bytes we tolerate past the end of the input, the bit buffer may look ahead of what a stream really uses
+#define EASYAVATAR_MAX_OVERRUN 8
+
+static const WORD EASYAVATAR_LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE EASYAVATAR_LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const WORD EASYAVATAR_DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE EASYAVATAR_DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// Order in which the code length code lengths are stored
+static const BYTE EASYAVATAR_CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static BYTE EasyAvatar_NextInputByte(struct EasyAvatar_Inflater* inflater)
+{
+	if (inflater->bufferPosition == inflater->bufferSize)
+	{
+		inflater->bufferSize = inflater->input(inflater->context, inflater->buffer, sizeof(inflater->buffer));
+		inflater->bufferPosition = 0;
+		if (inflater->bufferSize == 0)
+		{
+			if (++inflater->overrun > EASYAVATAR_MAX_OVERRUN)
+				inflater->failed = TRUE;
+			return 0;
+		}
+	}
+
+	return inflater->buffer[inflater->bufferPosition++];
+}
+
+static void EasyAvatar_NeedBits(struct EasyAvatar_Inflater* inflater, unsigned int count)
+{
+	while (inflater->bitCount < count)
+	{
+		inflater->bits |= (UINT64)EasyAvatar_NextInputByte(inflater) << inflater->bitCount;
+		inflater->bitCount += 8;
+	}
+}
+
+static unsigned int EasyAvatar_GetBits(struct EasyAvatar_Inflater* inflater, unsigned int count)
+{
+	if (count == 0)
+		return 0;
+
+	EasyAvatar_NeedBits(inflater, count);
+	unsigned int value = (unsigned int)(inflater->bits & ((1u << count) - 1));
+	inflater->bits >>= count;
+	inflater->bitCount -= count;
+	return value;
+}
+
+/*
+	Builds the canonical Huffman code for the given code lengths.
+	Returns FALSE if the lengths describe an oversubscribed code.
+*/
+static BOOL EasyAvatar_BuildHuffman(struct EasyAvatar_Huffman* huffman, const BYTE* lengths, unsigned int count)
+{
+	WORD offsets[16];
+	memset(huffman->counts, 0, sizeof(huffman->counts));
+	memset(huffman->fast, 0, sizeof(huffman->fast));
+
+	for (unsigned int i = 0; i < count; i++)
+		huffman->counts[lengths[i]]++;
+	huffman->counts[0] = 0;
+
+	int left = 1;
+	for (unsigned int length = 1; length < 16; length++)
+	{
+		left = (left << 1) - huffman->counts[length];
+		if (left < 0)
+			return FALSE;
+	}
+
+	offsets[1] = 0;
+	for (unsigned int length = 1; length < 15; length++)
+		offsets[length + 1] = offsets[length] + huffman->counts[length];
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (lengths[i])
+			huffman->symbols[offsets[lengths[i]]++] = (WORD)i;
+	}
+
+	// Codes are stored most significant bit first, so the table gets indexed with the reversed code
+	unsigned int code = 0;
+	unsigned int index = 0;
+	for (unsigned int length = 1; length <= EASYAVATAR_HUFFMAN_FAST_BITS; length++)
+	{
+		for (unsigned int i = 0; i < huffman->counts[length]; i++, code++, index++)
+		{
+			unsigned int reversed = 0;
+			for (unsigned int bit = 0; bit < length; bit++)
+				reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+
+			WORD entry = (WORD)((huffman->symbols[index] << 4) | length);
+			for (unsigned int fill = reversed; fill < (1u << EASYAVATAR_HUFFMAN_FAST_BITS); fill += 1u << length)
+				huffman->fast[fill] = entry;
+		}
+		code <<= 1;
+	}
+
+	return TRUE;
+}
+
+static int EasyAvatar_DecodeSymbol(struct EasyAvatar_Inflater* inflater, const struct EasyAvatar_Huffman* huffman)
+{
+	EasyAvatar_NeedBits(inflater, 15);
+
+	WORD entry = huffman->fast[inflater->bits & ((1u << EASYAVATAR_HUFFMAN_FAST_BITS) - 1)];
+	if (entry)
+	{
+		inflater->bits >>= entry & 15;
+		inflater->bitCount -= entry & 15;
+		return entry >> 4;
+	}
+
+	// Long codes are walked bit by bit
+	int code = 0;
+	int first = 0;
+	int index = 0;
+	for (unsigned int length = 1; length < 16; length++)
+	{
+		code |= (int)((inflater->bits >> (length - 1)) & 1);
+		int count = huffman->counts[length];
+		if (code - first < count)
+		{
+			inflater->bits >>= length;
+			inflater->bitCount -= length;
+			return huffman->symbols[index + code - first];
+		}
+
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static BOOL EasyAvatar_ReadFixedTables(struct EasyAvatar_Inflater* inflater)
+{
+	BYTE lengths[288 + 30];
+	memset(lengths, 8, 144);
+	memset(lengths + 144, 9, 112);
+	memset(lengths + 256, 7, 24);
+	memset(lengths + 280, 8, 8);
+	memset(lengths + 288, 5, 30);
+
+	return EasyAvatar_BuildHuffman(&inflater->literals, lengths, 288) && EasyAvatar_BuildHuffman(&inflater->distances, lengths + 288, 30);
+}
+
+static BOOL EasyAvatar_ReadDynamicTables(struct EasyAvatar_Inflater* inflater)
+{
+	BYTE lengths[286 + 30];
+	BYTE codeLengths[19];
+	struct EasyAvatar_Huffman codeLengthCode;
+
+	unsigned int literalCount = EasyAvatar_GetBits(inflater, 5) + 257;
+	unsigned int distanceCount = EasyAvatar_GetBits(inflater, 5) + 1;
+	unsigned int codeLengthCount = EasyAvatar_GetBits(inflater, 4) + 4;
+	if (literalCount > 286 || distanceCount > 30)
+		return FALSE;
+
+	memset(codeLengths, 0, sizeof(codeLengths));
+	for (unsigned int i = 0; i < codeLengthCount; i++)
+		codeLengths[EASYAVATAR_CODE_LENGTH_ORDER[i]] = (BYTE)EasyAvatar_GetBits(inflater, 3);
+	if (!EasyAvatar_BuildHuffman(&codeLengthCode, codeLengths, 19))
+		return FALSE;
+
+	for (unsigned int i = 0; i < literalCount + distanceCount;)
+	{
+		int symbol = EasyAvatar_DecodeSymbol(inflater, &codeLengthCode);
+		if (symbol < 0)
+			return FALSE;
+
+		if (symbol < 16)
+		{
+			lengths[i++] = (BYTE)symbol;
+			continue;
+		}
+
+		// 16 repeats the previous length, 17 and 18 repeat zero
+		BYTE value = 0;
+		unsigned int repeat;
+		if (symbol == 16)
+		{
+			if (i == 0)
+				return FALSE;
+			value = lengths[i - 1];
+			repeat = 3 + EasyAvatar_GetBits(inflater, 2);
+		}
+		else if (symbol == 17)
+		{
+			repeat = 3 + EasyAvatar_GetBits(inflater, 3);
+		}
+		else
+		{
+			repeat = 11 + EasyAvatar_GetBits(inflater, 7);
+		}
+
+		if (i + repeat > literalCount + distanceCount)
+			return FALSE;
+		memset(lengths + i, value, repeat);
+		i += repeat;
+	}
+
+	// Without an end of block code the block could never end
+	if (lengths[256] == 0)
+		return FALSE;
+
+	return EasyAvatar_BuildHuffman(&inflater->literals, lengths, literalCount)
+		&& EasyAvatar_BuildHuffman(&inflater->distances, lengths + literalCount, distanceCount);
+}
+
+static BOOL EasyAvatar_ReadBlockHeader(struct EasyAvatar_Inflater* inflater)
+{
+	if (inflater->lastBlock)
+	{
+		inflater->finished = TRUE;
+		return FALSE;
+	}
+
+	inflater->lastBlock = EasyAvatar_GetBits(inflater, 1);
+	inflater->blockType = (int)EasyAvatar_GetBits(inflater, 2);
+
+	switch (inflater->blockType)
+	{
+	case 0:
+	{
+		// Stored blocks start at the next byte boundary
+		EasyAvatar_GetBits(inflater, inflater->bitCount & 7);
+		unsigned int length = EasyAvatar_GetBits(inflater, 16);
+		unsigned int complement = EasyAvatar_GetBits(inflater, 16);
+		if ((length ^ 0xFFFF) != complement)
+			return FALSE;
+		inflater->storedRemaining = length;
+		return TRUE;
+	}
+	case 1:
+		return EasyAvatar_ReadFixedTables(inflater);
+	case 2:
+		return EasyAvatar_ReadDynamicTables(inflater);
+	default:
+		return FALSE;
+	}
+}
+
+BOOL EasyAvatar_InitInflater(struct EasyAvatar_Inflater* inflater, EasyAvatar_InflateInput input, void* context)
+{
+	inflater->input = input;
+	inflater->context = context;
+	inflater->bufferSize = 0;
+	inflater->bufferPosition = 0;
+	inflater->overrun = 0;
+	inflater->bits = 0;
+	inflater->bitCount = 0;
+	inflater->total = 0;
+	inflater->lastBlock = FALSE;
+	inflater->blockType = -1;
+	inflater->storedRemaining = 0;
+	inflater->matchLength = 0;
+	inflater->matchDistance = 0;
+	inflater->finished = FALSE;
+	inflater->failed = FALSE;
+
+	// Deflate with a window of at most 32KB and no preset dictionary
+	unsigned int method = EasyAvatar_GetBits(inflater, 8);
+	unsigned int flags = EasyAvatar_GetBits(inflater, 8);
+	return !inflater->failed && (method & 0x0F) == 8 && (method >> 4) <= 7 && !(flags & 0x20) && ((method << 8) | flags) % 31 == 0;
+}
+
+BOOL EasyAvatar_Inflate(struct EasyAvatar_Inflater* inflater, BYTE* output, size_t size)
+{
+	size_t produced = 0;
+
+	while (produced < size && !inflater->failed)
+	{
+		if (inflater->matchLength > 0)
+		{
+			// Matches may overlap the bytes they produce, so they are copied byte by byte
+			size_t count = size - produced < inflater->matchLength ? size - produced : inflater->matchLength;
+			for (size_t i = 0; i < count; i++)
+			{
+				BYTE value = inflater->window[(inflater->total - inflater->matchDistance) & EASYAVATAR_WINDOW_MASK];
+				inflater->window[inflater->total++ & EASYAVATAR_WINDOW_MASK] = value;
+				output[produced++] = value;
+			}
+			inflater->matchLength -= (unsigned int)count;
+			continue;
+		}
+
+		if (inflater->blockType < 0)
+		{
+			if (!EasyAvatar_ReadBlockHeader(inflater))
+				inflater->failed = TRUE;
+			continue;
+		}
+
+		if (inflater->blockType == 0)
+		{
+			if (inflater->storedRemaining == 0)
+			{
+				inflater->blockType = -1;
+				continue;
+			}
+
+			BYTE value = (BYTE)EasyAvatar_GetBits(inflater, 8);
+			inflater->window[inflater->total++ & EASYAVATAR_WINDOW_MASK] = value;
+			output[produced++] = value;
+			inflater->storedRemaining--;
+			continue;
+		}
+
+		int symbol = EasyAvatar_DecodeSymbol(inflater, &inflater->literals);
+		if (symbol < 0 || symbol > 285)
+		{
+			inflater->failed = TRUE;
+		}
+		else if (symbol < 256)
+		{
+			inflater->window[inflater->total++ & EASYAVATAR_WINDOW_MASK] = (BYTE)symbol;
+			output[produced++] = (BYTE)symbol;
+		}
+		else if (symbol == 256)
+		{
+			inflater->blockType = -1;
+		}
+		else
+		{
+			symbol -= 257;
+			unsigned int length = EASYAVATAR_LENGTH_BASE[symbol] + EasyAvatar_GetBits(inflater, EASYAVATAR_LENGTH_EXTRA[symbol]);
+			int distanceSymbol = EasyAvatar_DecodeSymbol(inflater, &inflater->distances);
+			if (distanceSymbol < 0 || distanceSymbol > 29)
+			{
+				inflater->failed = TRUE;
+				continue;
+			}
+
+			unsigned int distance = EASYAVATAR_DISTANCE_BASE[distanceSymbol] + EasyAvatar_GetBits(inflater, EASYAVATAR_DISTANCE_EXTRA[distanceSymbol]);
+			if (distance > inflater->total)
+			{
+				inflater->failed = TRUE;
+				continue;
+			}
+
+			inflater->matchLength = length;
+			inflater->matchDistance = distance;
+		}
+	}
+
+	return !inflater->failed;
+}
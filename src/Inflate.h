@@ -0,0 +1,66 @@
+#pragma once
+#include <Windows.h>
+
+// Codes up to this length are decoded with a single table lookup
+#define EASYAVATAR_HUFFMAN_FAST_BITS 10
+// Bytes of compressed input buffered at once
+#define EASYAVATAR_INFLATE_INPUT 4096
+
+/*
+	Called whenever the inflater needs more compressed bytes.
+	Returns the number of bytes written to buffer, 0 once the input has ended.
+*/
+typedef size_t(*EasyAvatar_InflateInput)(void* context, BYTE* buffer, size_t size);
+
+struct EasyAvatar_Huffman
+{
+	// Symbol << 4 | code length, 0 for codes longer than EASYAVATAR_HUFFMAN_FAST_BITS
+	WORD fast[1 << EASYAVATAR_HUFFMAN_FAST_BITS];
+	WORD counts[16];
+	WORD symbols[288];
+};
+
+/*
+	Streaming zlib decoder that hands out the decompressed data in pieces of any size, only the 32KB window is kept.
+	The Adler-32 checksum isn't verified.
+*/
+struct EasyAvatar_Inflater
+{
+	EasyAvatar_InflateInput input;
+	void* context;
+	BYTE buffer[EASYAVATAR_INFLATE_INPUT];
+	size_t bufferSize;
+	size_t bufferPosition;
+	// Bytes that had to be made up after the input ended
+	unsigned int overrun;
+
+	UINT64 bits;
+	unsigned int bitCount;
+
+	BYTE window[32768];
+	UINT64 total;
+
+	BOOL lastBlock;
+	// -1 while the next block header has to be read, otherwise the BTYPE of the current block
+	int blockType;
+	size_t storedRemaining;
+	unsigned int matchLength;
+	unsigned int matchDistance;
+	struct EasyAvatar_Huffman literals;
+	struct EasyAvatar_Huffman distances;
+
+	BOOL finished;
+	BOOL failed;
+};
+
+/*
+	Prepares inflater for a new zlib stream that is read through input, reading and checking its header.
+	Returns FALSE if the header isn't a deflate stream we can decode.
+*/
+BOOL EasyAvatar_InitInflater(struct EasyAvatar_Inflater* inflater, EasyAvatar_InflateInput input, void* context);
+
+/*
+	Decompresses exactly size bytes into output.
+	Returns FALSE if the data is broken or ends early.
+*/
+BOOL EasyAvatar_Inflate(struct EasyAvatar_Inflater* inflater, BYTE* output, size_t size);
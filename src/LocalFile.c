@@ -0,0 +1,307 @@
+#include "LocalFile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "EasyAvatar.h"
+#include "Hash.h"
+#include "ImageIO.h"
+#include "ImageProbe.h"
+
+static BOOL EasyAvatar_IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int EasyAvatar_HexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static BOOL EasyAvatar_IsAbsolutePath(const char* path, size_t length)
+{
+	BOOL drive = length >= 3 && ((path[0] >= 'a' && path[0] <= 'z') || (path[0] >= 'A' && path[0] <= 'Z'))
+		&& path[1] == ':' && (path[2] == '\\' || path[2] == '/');
+	BOOL share = length >= 3 && path[0] == '\\' && path[1] == '\\' && path[2] != '\\';
+	return drive || share;
+}
+
+BOOL EasyAvatar_GetLocalPath(const char* text, size_t length, char* path)
+{
+	while (length > 0 && EasyAvatar_IsSpace(text[0]))
+	{
+		text++;
+		length--;
+	}
+	while (length > 0 && EasyAvatar_IsSpace(text[length - 1]))
+		length--;
+
+	// Explorer's "Copy as path" quotes the path
+	if (length >= 2 && text[0] == '"' && text[length - 1] == '"')
+	{
+		text++;
+		length -= 2;
+	}
+
+	if (length < 5 || _strnicmp(text, "file:", 5) != 0)
+	{
+		if (!EasyAvatar_IsAbsolutePath(text, length))
+			return FALSE;
+
+		memcpy(path, text, length);
+		path[length] = '\0';
+		return TRUE;
+	}
+
+	// file:///C:/... and file://localhost/C:/... are local, file://server/share/... is a share
+	size_t position = 5;
+	size_t written = 0;
+	if (length - position >= 3 && strncmp(text + position, "///", 3) == 0)
+	{
+		position += 3;
+	}
+	else if (length - position >= 12 && _strnicmp(text + position, "//localhost/", 12) == 0)
+	{
+		position += 12;
+	}
+	else if (length - position >= 2 && strncmp(text + position, "//", 2) == 0)
+	{
+		position += 2;
+		path[written++] = '\\';
+		path[written++] = '\\';
+	}
+	else
+	{
+		return FALSE;
+	}
+
+	for (; position < length; position++)
+	{
+		char c = text[position];
+		if (c == '%' && position + 2 < length)
+		{
+			int high = EasyAvatar_HexValue(text[position + 1]);
+			int low = EasyAvatar_HexValue(text[position + 2]);
+			if (high >= 0 && low >= 0)
+			{
+				c = (char)(high * 16 + low);
+				position += 2;
+			}
+		}
+		// Neither a query nor a fragment belong to the file
+		else if (c == '?' || c == '#')
+		{
+			break;
+		}
+
+		if (c == '\0')
+			return FALSE;
+		path[written++] = c == '/' ? '\\' : c;
+	}
+	path[written] = '\0';
+
+	return EasyAvatar_IsAbsolutePath(path, written);
+}
+
+UINT64 EasyAvatar_FingerprintFile(const char* path)
+{
+	// Identical files copied from different places still count as different content, which only costs a prefetch
+	struct
+	{
+		UINT64 path;
+		FILETIME lastWrite;
+		DWORD sizeHigh;
+		DWORD sizeLow;
+	} key;
+	memset(&key, 0, sizeof(key));
+	key.path = EasyAvatar_Fingerprint(path, strlen(path));
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (GetFileAttributesExA(path, GetFileExInfoStandard, &attributes))
+	{
+		key.lastWrite = attributes.ftLastWriteTime;
+		key.sizeHigh = attributes.nFileSizeHigh;
+		key.sizeLow = attributes.nFileSizeLow;
+	}
+
+	return EasyAvatar_Fingerprint(&key, sizeof(key));
+}
+
+/*
+	Probes the header at data, returns FALSE if the image is known to be too large to decode.
+	Headers the probe can't parse within the first bytes are given the benefit of the doubt.
+*/
+static BOOL EasyAvatar_CheckHeader(const BYTE* data, size_t size)
+{
+	FreeImageIO io;
+	struct EasyAvatar_MemoryReader reader;
+	EasyAvatar_OpenMemoryReader(&reader, &io, data, size);
+
+	struct EasyAvatar_ImageInfo info;
+	if (!EasyAvatar_ProbeImage(&io, &reader, &info) || info.width == 0 || info.height == 0)
+		return TRUE;
+
+	unsigned int targetW;
+	unsigned int targetH;
+	EasyAvatar_GetTargetSize(info.width, info.height, &targetW, &targetH);
+	return EasyAvatar_ChooseDecodeStrategy(&info, targetW, targetH) != EASYAVATAR_DECODE_REJECT;
+}
+
+/*
+	Whether path is on a local fixed disk, whose views can't fail underneath us.
+*/
+static BOOL EasyAvatar_IsOnFixedDrive(const char* path)
+{
+	char volume[MAX_PATH];
+	if (!GetVolumePathNameA(path, volume, sizeof(volume)))
+		return FALSE;
+
+	UINT type = GetDriveTypeA(volume);
+	return type == DRIVE_FIXED || type == DRIVE_RAMDISK;
+}
+
+static BOOL EasyAvatar_ReadFully(HANDLE file, BYTE* buffer, size_t size)
+{
+	while (size > 0)
+	{
+		DWORD wanted = size < 0x40000000 ? (DWORD)size : 0x40000000;
+		DWORD read = 0;
+		if (!ReadFile(file, buffer, wanted, &read, NULL) || read == 0)
+			return FALSE;
+		buffer += read;
+		size -= read;
+	}
+	return TRUE;
+}
+
+/*
+	Reads the open file into a heap buffer, probing its header before the rest is read.
+*/
+static enum EasyAvatar_MapResult EasyAvatar_BufferImageFile(struct EasyAvatar_MappedFile* file, size_t size)
+{
+	size_t probeSize = size < EASYAVATAR_LOCAL_PROBE_SIZE ? size : EASYAVATAR_LOCAL_PROBE_SIZE;
+	BYTE* data = (BYTE*)malloc(probeSize);
+	if (!data || !EasyAvatar_ReadFully(file->file, data, probeSize))
+	{
+		free(data);
+		return EASYAVATAR_MAP_FAILED;
+	}
+
+	if (!EasyAvatar_CheckHeader(data, probeSize))
+	{
+		free(data);
+		return EASYAVATAR_MAP_TOO_MANY_PIXELS;
+	}
+
+	if (probeSize < size)
+	{
+		BYTE* grown = (BYTE*)realloc(data, size);
+		if (!grown || !EasyAvatar_ReadFully(file->file, grown + probeSize, size - probeSize))
+		{
+			free(grown ? grown : data);
+			return EASYAVATAR_MAP_FAILED;
+		}
+		data = grown;
+	}
+
+	file->data = data;
+	file->size = size;
+	file->buffered = TRUE;
+	return EASYAVATAR_MAP_OK;
+}
+
+enum EasyAvatar_MapResult EasyAvatar_MapImageFile(const char* path, struct EasyAvatar_MappedFile* file)
+{
+	memset(file, 0, sizeof(*file));
+
+	// Others may read the file, but nobody gets to truncate or rewrite it underneath the view
+	BOOL fixed = EasyAvatar_IsOnFixedDrive(path);
+	file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, fixed ? FILE_ATTRIBUTE_NORMAL : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file->file == INVALID_HANDLE_VALUE)
+	{
+		file->file = NULL;
+		return EASYAVATAR_MAP_FAILED;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file->file, &fileSize) || fileSize.QuadPart <= 0)
+	{
+		EasyAvatar_UnmapFile(file);
+		return EASYAVATAR_MAP_FAILED;
+	}
+	if ((UINT64)fileSize.QuadPart > EASYAVATAR_LOCAL_FILE_MAX_SIZE)
+	{
+		EasyAvatar_UnmapFile(file);
+		return EASYAVATAR_MAP_TOO_LARGE;
+	}
+
+	if (!fixed)
+	{
+		enum EasyAvatar_MapResult result = EasyAvatar_BufferImageFile(file, (size_t)fileSize.QuadPart);
+		if (result != EASYAVATAR_MAP_OK)
+			EasyAvatar_UnmapFile(file);
+		return result;
+	}
+
+	file->mapping = CreateFileMappingA(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!file->mapping)
+	{
+		EasyAvatar_UnmapFile(file);
+		return EASYAVATAR_MAP_FAILED;
+	}
+
+	size_t size = (size_t)fileSize.QuadPart;
+	size_t probeSize = size < EASYAVATAR_LOCAL_PROBE_SIZE ? size : EASYAVATAR_LOCAL_PROBE_SIZE;
+	const BYTE* header = (const BYTE*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, probeSize);
+	if (!header)
+	{
+		EasyAvatar_UnmapFile(file);
+		return EASYAVATAR_MAP_FAILED;
+	}
+
+	BOOL decodable = EasyAvatar_CheckHeader(header, probeSize);
+	if (probeSize == size && decodable)
+	{
+		// Small files fit into the probe view, no need to map them again
+		file->data = header;
+		file->size = size;
+		return EASYAVATAR_MAP_OK;
+	}
+
+	UnmapViewOfFile(header);
+	if (!decodable)
+	{
+		EasyAvatar_UnmapFile(file);
+		return EASYAVATAR_MAP_TOO_MANY_PIXELS;
+	}
+
+	file->data = (const BYTE*)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, size);
+	if (!file->data)
+	{
+		EasyAvatar_UnmapFile(file);
+		return EASYAVATAR_MAP_FAILED;
+	}
+
+	file->size = size;
+	return EASYAVATAR_MAP_OK;
+}
+
+void EasyAvatar_UnmapFile(struct EasyAvatar_MappedFile* file)
+{
+	if (file->buffered)
+		free((void*)file->data);
+	else if (file->data)
+		UnmapViewOfFile(file->data);
+	if (file->mapping)
+		CloseHandle(file->mapping);
+	if (file->file)
+		CloseHandle(file->file);
+
+	memset(file, 0, sizeof(*file));
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <Windows.h>
+
+// Local files larger than this are never mapped, override it at build time if needed
+#ifndef EASYAVATAR_LOCAL_FILE_MAX_SIZE
+#define EASYAVATAR_LOCAL_FILE_MAX_SIZE (256u * 1024u * 1024u)
+#endif
+// Bytes mapped to probe the header before the whole file gets mapped
+#define EASYAVATAR_LOCAL_PROBE_SIZE (256u * 1024u)
+
+enum EasyAvatar_MapResult
+{
+	EASYAVATAR_MAP_OK,
+	EASYAVATAR_MAP_FAILED,
+	// Larger than EASYAVATAR_LOCAL_FILE_MAX_SIZE
+	EASYAVATAR_MAP_TOO_LARGE,
+	// The header says decoding it would exceed EASYAVATAR_MAX_PIXELS
+	EASYAVATAR_MAP_TOO_MANY_PIXELS
+};
+
+/*
+	Read-only view of a whole file, the pages are only read from disk once something touches them.
+	Files on shares and removable drives are read into a heap buffer instead, see EasyAvatar_MapImageFile.
+*/
+struct EasyAvatar_MappedFile
+{
+	HANDLE file;
+	HANDLE mapping;
+	const BYTE* data;
+	size_t size;
+	// data is a heap buffer rather than a view
+	BOOL buffered;
+};
+
+/*
+	Turns clipboard text naming a local file into a path: an absolute path like C:\... or \\server\share\..., optionally in quotes
+	as Explorer's "Copy as path" puts it, or a file:// URL. Only length bytes of text are looked at, path needs length + 1 bytes.
+	Returns FALSE for anything else, e.g. http(s) URLs.
+*/
+BOOL EasyAvatar_GetLocalPath(const char* text, size_t length, char* path);
+
+/*
+	Cheap identity of the file at path made of the path, its size and last write time, the content isn't read.
+	Falls back to the path alone if the file can't be queried.
+*/
+UINT64 EasyAvatar_FingerprintFile(const char* path);
+
+/*
+	Maps the image file at path read-only, nothing gets copied. Others may read the file meanwhile but not change it.
+	Reading a view faults with EXCEPTION_IN_PAGE_ERROR if the network or the medium goes away, so files that aren't
+	on a fixed drive are read into a buffer instead.
+	Only the first EASYAVATAR_LOCAL_PROBE_SIZE bytes are mapped or read at first, so images whose header
+	says they are too large to decode are rejected before the rest of the file is touched.
+	On EASYAVATAR_MAP_OK file has to be released with EasyAvatar_UnmapFile.
+*/
+enum EasyAvatar_MapResult EasyAvatar_MapImageFile(const char* path, struct EasyAvatar_MappedFile* file);
+
+void EasyAvatar_UnmapFile(struct EasyAvatar_MappedFile* file);
@@ -0,0 +1,433 @@
+#include "PNGStream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ImageProbe.h"
+#include "Inflate.h"
+#include "Worker.h"
+
+// Rows decoded between two checks whether the job got cancelled
+#define EASYAVATAR_STREAM_CANCEL_ROWS 64
+
+struct EasyAvatar_PNGStream
+{
+	FreeImageIO* io;
+	fi_handle handle;
+	// Bytes left in the current IDAT chunk
+	DWORD chunkRemaining;
+	BOOL ended;
+
+	unsigned int width;
+	unsigned int height;
+	unsigned int depth;
+	unsigned int colorType;
+	// Samples per pixel as stored in the file
+	unsigned int samples;
+	RGBQUAD palette[256];
+	BYTE paletteAlpha[256];
+	// Entries in PLTE, indices past them are clamped to the last one
+	unsigned int paletteCount;
+	// tRNS, either alpha values for the palette or the one grey or RGB value that is transparent
+	BOOL hasTransparency;
+	unsigned int key[3];
+};
+
+/*
+	Running box filter, every source row is added to the sums of the target row it falls into.
+*/
+struct EasyAvatar_BoxAccumulator
+{
+	unsigned int width;
+	unsigned int channels;
+	// Target column of every source column
+	unsigned int* column;
+	// Number of source columns per target column
+	unsigned int* columnCount;
+	// channels sums per target column, colors are premultiplied with alpha
+	UINT64* sums;
+};
+
+static DWORD EasyAvatar_ReadBig32(const BYTE* data)
+{
+	return ((DWORD)data[0] << 24) | ((DWORD)data[1] << 16) | ((DWORD)data[2] << 8) | data[3];
+}
+
+static BOOL EasyAvatar_ReadChunkHeader(struct EasyAvatar_PNGStream* stream, DWORD* length, BYTE type[4])
+{
+	BYTE header[8];
+	if (stream->io->read_proc(header, 1, sizeof(header), stream->handle) != sizeof(header))
+		return FALSE;
+
+	*length = EasyAvatar_ReadBig32(header);
+	memcpy(type, header + 4, 4);
+	return *length <= 0x7FFFFFFF;
+}
+
+static size_t EasyAvatar_ReadImageData(void* context, BYTE* buffer, size_t size)
+{
+	struct EasyAvatar_PNGStream* stream = (struct EasyAvatar_PNGStream*)context;
+
+	// Image data may be split over any number of consecutive IDAT chunks
+	while (stream->chunkRemaining == 0)
+	{
+		DWORD length;
+		BYTE type[4];
+		if (stream->ended || stream->io->seek_proc(stream->handle, 4, SEEK_CUR) != 0
+			|| !EasyAvatar_ReadChunkHeader(stream, &length, type) || memcmp(type, "IDAT", 4) != 0)
+		{
+			stream->ended = TRUE;
+			return 0;
+		}
+		stream->chunkRemaining = length;
+	}
+
+	unsigned int wanted = (unsigned int)(size < stream->chunkRemaining ? size : stream->chunkRemaining);
+	unsigned int read = stream->io->read_proc(buffer, 1, wanted, stream->handle);
+	if (read == 0)
+		stream->ended = TRUE;
+	stream->chunkRemaining -= read;
+	return read;
+}
+
+/*
+	Reads every chunk up to the first IDAT and leaves the handle at the start of its data.
+*/
+static BOOL EasyAvatar_ReadPNGHeader(struct EasyAvatar_PNGStream* stream)
+{
+	static const BYTE signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	static const BYTE samples[7] = { 1, 0, 3, 1, 2, 0, 4 };
+	BYTE buffer[768];
+	DWORD length;
+	BYTE type[4];
+
+	if (stream->io->seek_proc(stream->handle, 0, SEEK_SET) != 0 || stream->io->read_proc(buffer, 1, 8, stream->handle) != 8 || memcmp(buffer, signature, 8) != 0)
+		return FALSE;
+
+	if (!EasyAvatar_ReadChunkHeader(stream, &length, type) || memcmp(type, "IHDR", 4) != 0 || length != 13
+		|| stream->io->read_proc(buffer, 1, 13, stream->handle) != 13)
+	{
+		return FALSE;
+	}
+
+	stream->width = EasyAvatar_ReadBig32(buffer);
+	stream->height = EasyAvatar_ReadBig32(buffer + 4);
+	stream->depth = buffer[8];
+	stream->colorType = buffer[9];
+	// Adam7 rows come in seven passes, which can't be averaged as they arrive
+	if (stream->width == 0 || stream->height == 0 || !EasyAvatar_IsValidPNGDepth(stream->colorType, stream->depth) || buffer[12] != 0)
+		return FALSE;
+	stream->samples = samples[stream->colorType];
+
+	memset(stream->paletteAlpha, 0xFF, sizeof(stream->paletteAlpha));
+	for (;;)
+	{
+		if (stream->io->seek_proc(stream->handle, 4, SEEK_CUR) != 0 || !EasyAvatar_ReadChunkHeader(stream, &length, type))
+			return FALSE;
+
+		if (memcmp(type, "IDAT", 4) == 0)
+		{
+			stream->chunkRemaining = length;
+			return stream->colorType != 3 || stream->paletteCount > 0;
+		}
+
+		if (memcmp(type, "IEND", 4) == 0)
+			return FALSE;
+
+		BOOL palette = memcmp(type, "PLTE", 4) == 0;
+		BOOL transparency = memcmp(type, "tRNS", 4) == 0;
+		if ((!palette && !transparency) || length > sizeof(buffer))
+		{
+			if (stream->io->seek_proc(stream->handle, (long)length, SEEK_CUR) != 0)
+				return FALSE;
+			continue;
+		}
+
+		if (stream->io->read_proc(buffer, 1, length, stream->handle) != length)
+			return FALSE;
+
+		if (palette)
+		{
+			stream->paletteCount = length / 3;
+			for (DWORD i = 0; i < stream->paletteCount; i++)
+			{
+				stream->palette[i].rgbRed = buffer[3 * i];
+				stream->palette[i].rgbGreen = buffer[3 * i + 1];
+				stream->palette[i].rgbBlue = buffer[3 * i + 2];
+			}
+		}
+		else if (stream->colorType == 3)
+		{
+			memcpy(stream->paletteAlpha, buffer, length < 256 ? length : 256);
+			stream->hasTransparency = TRUE;
+		}
+		else if ((stream->colorType == 0 && length >= 2) || (stream->colorType == 2 && length >= 6))
+		{
+			for (DWORD i = 0; i < length / 2 && i < 3; i++)
+				stream->key[i] = (buffer[2 * i] << 8) | buffer[2 * i + 1];
+			stream->hasTransparency = TRUE;
+		}
+	}
+}
+
+static void EasyAvatar_Unfilter(BYTE filter, BYTE* row, const BYTE* prior, size_t length, size_t bytesPerPixel)
+{
+	switch (filter)
+	{
+	case 1:
+		for (size_t i = bytesPerPixel; i < length; i++)
+			row[i] += row[i - bytesPerPixel];
+		break;
+	case 2:
+		for (size_t i = 0; i < length; i++)
+			row[i] += prior[i];
+		break;
+	case 3:
+		for (size_t i = 0; i < length; i++)
+			row[i] += (BYTE)(((i >= bytesPerPixel ? row[i - bytesPerPixel] : 0) + prior[i]) >> 1);
+		break;
+	case 4:
+		for (size_t i = 0; i < length; i++)
+		{
+			int a = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+			int b = prior[i];
+			int c = i >= bytesPerPixel ? prior[i - bytesPerPixel] : 0;
+			int pa = abs(b - c);
+			int pb = abs(a - c);
+			int pc = abs(a + b - 2 * c);
+			row[i] += (BYTE)(pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static unsigned int EasyAvatar_GetSample(const BYTE* row, size_t index, unsigned int depth)
+{
+	switch (depth)
+	{
+	case 8: return row[index];
+	case 16: return (row[2 * index] << 8) | row[2 * index + 1];
+	default:
+	{
+		// Samples below 8 bits are packed starting with the most significant bit
+		size_t bit = index * depth;
+		return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+	}
+	}
+}
+
+static BYTE EasyAvatar_ScaleSample(unsigned int sample, unsigned int depth)
+{
+	if (depth == 16)
+		return (BYTE)(sample >> 8);
+	if (depth == 8)
+		return (BYTE)sample;
+	return (BYTE)(sample * 255 / ((1u << depth) - 1));
+}
+
+/*
+	Converts a row of unfiltered samples to 8 bit pixels with the channel order FreeImage uses.
+*/
+static void EasyAvatar_ConvertRow(const struct EasyAvatar_PNGStream* stream, const BYTE* row, BYTE* pixels, unsigned int channels)
+{
+	for (unsigned int x = 0; x < stream->width; x++, pixels += channels)
+	{
+		size_t index = (size_t)x * stream->samples;
+		BYTE red;
+		BYTE green;
+		BYTE blue;
+		BYTE alpha = 0xFF;
+
+		switch (stream->colorType)
+		{
+		case 0:
+		case 4:
+		{
+			unsigned int grey = EasyAvatar_GetSample(row, index, stream->depth);
+			red = green = blue = EasyAvatar_ScaleSample(grey, stream->depth);
+			if (stream->colorType == 4)
+				alpha = EasyAvatar_ScaleSample(EasyAvatar_GetSample(row, index + 1, stream->depth), stream->depth);
+			else if (stream->hasTransparency && grey == stream->key[0])
+				alpha = 0;
+			break;
+		}
+		case 3:
+		{
+			unsigned int entry = EasyAvatar_GetSample(row, index, stream->depth);
+			if (entry >= stream->paletteCount)
+				entry = stream->paletteCount - 1;
+			red = stream->palette[entry].rgbRed;
+			green = stream->palette[entry].rgbGreen;
+			blue = stream->palette[entry].rgbBlue;
+			alpha = stream->paletteAlpha[entry];
+			break;
+		}
+		default:
+		{
+			unsigned int r = EasyAvatar_GetSample(row, index, stream->depth);
+			unsigned int g = EasyAvatar_GetSample(row, index + 1, stream->depth);
+			unsigned int b = EasyAvatar_GetSample(row, index + 2, stream->depth);
+			red = EasyAvatar_ScaleSample(r, stream->depth);
+			green = EasyAvatar_ScaleSample(g, stream->depth);
+			blue = EasyAvatar_ScaleSample(b, stream->depth);
+			if (stream->colorType == 6)
+				alpha = EasyAvatar_ScaleSample(EasyAvatar_GetSample(row, index + 3, stream->depth), stream->depth);
+			else if (stream->hasTransparency && r == stream->key[0] && g == stream->key[1] && b == stream->key[2])
+				alpha = 0;
+			break;
+		}
+		}
+
+		if (channels == 1)
+		{
+			pixels[0] = red;
+			continue;
+		}
+
+		pixels[FI_RGBA_RED] = red;
+		pixels[FI_RGBA_GREEN] = green;
+		pixels[FI_RGBA_BLUE] = blue;
+		if (channels == 4)
+			pixels[FI_RGBA_ALPHA] = alpha;
+	}
+}
+
+static void EasyAvatar_AccumulateRow(struct EasyAvatar_BoxAccumulator* accumulator, const BYTE* pixels, unsigned int sourceWidth)
+{
+	unsigned int channels = accumulator->channels;
+	for (unsigned int x = 0; x < sourceWidth; x++, pixels += channels)
+	{
+		UINT64* sums = accumulator->sums + (size_t)accumulator->column[x] * channels;
+		if (channels == 4)
+		{
+			// Premultiplied, so fully transparent pixels don't bleed their color into the average
+			unsigned int alpha = pixels[FI_RGBA_ALPHA];
+			sums[FI_RGBA_RED] += pixels[FI_RGBA_RED] * alpha;
+			sums[FI_RGBA_GREEN] += pixels[FI_RGBA_GREEN] * alpha;
+			sums[FI_RGBA_BLUE] += pixels[FI_RGBA_BLUE] * alpha;
+			sums[FI_RGBA_ALPHA] += alpha;
+			continue;
+		}
+
+		for (unsigned int c = 0; c < channels; c++)
+			sums[c] += pixels[c];
+	}
+}
+
+static void EasyAvatar_FlushRow(struct EasyAvatar_BoxAccumulator* accumulator, BYTE* target, unsigned int rows)
+{
+	unsigned int channels = accumulator->channels;
+	for (unsigned int x = 0; x < accumulator->width; x++, target += channels)
+	{
+		UINT64* sums = accumulator->sums + (size_t)x * channels;
+		UINT64 count = (UINT64)accumulator->columnCount[x] * rows;
+		if (channels == 4)
+		{
+			UINT64 alpha = sums[FI_RGBA_ALPHA];
+			target[FI_RGBA_RED] = (BYTE)(alpha ? (sums[FI_RGBA_RED] + alpha / 2) / alpha : 0);
+			target[FI_RGBA_GREEN] = (BYTE)(alpha ? (sums[FI_RGBA_GREEN] + alpha / 2) / alpha : 0);
+			target[FI_RGBA_BLUE] = (BYTE)(alpha ? (sums[FI_RGBA_BLUE] + alpha / 2) / alpha : 0);
+			target[FI_RGBA_ALPHA] = (BYTE)((alpha + count / 2) / count);
+		}
+		else
+		{
+			for (unsigned int c = 0; c < channels; c++)
+				target[c] = (BYTE)((sums[c] + count / 2) / count);
+		}
+	}
+
+	memset(accumulator->sums, 0, (size_t)accumulator->width * channels * sizeof(UINT64));
+}
+
+FIBITMAP* EasyAvatar_DecodePNGStream(FreeImageIO* io, fi_handle handle, unsigned int width, unsigned int height)
+{
+	struct EasyAvatar_PNGStream stream = { 0 };
+	stream.io = io;
+	stream.handle = handle;
+	if (width == 0 || height == 0 || !EasyAvatar_ReadPNGHeader(&stream) || width > stream.width || height > stream.height)
+		return NULL;
+
+	unsigned int channels = stream.colorType == 4 || stream.colorType == 6 || stream.hasTransparency ? 4 : (stream.colorType == 0 ? 1 : 3);
+	size_t bitsPerPixel = (size_t)stream.depth * stream.samples;
+	size_t rowBytes = (bitsPerPixel * stream.width + 7) / 8;
+	size_t bytesPerPixel = bitsPerPixel >= 8 ? bitsPerPixel / 8 : 1;
+
+	struct EasyAvatar_Inflater* inflater = (struct EasyAvatar_Inflater*)malloc(sizeof(struct EasyAvatar_Inflater));
+	struct EasyAvatar_BoxAccumulator accumulator = { width, channels, NULL, NULL, NULL };
+	accumulator.column = (unsigned int*)malloc(stream.width * sizeof(unsigned int));
+	accumulator.columnCount = (unsigned int*)calloc(width, sizeof(unsigned int));
+	accumulator.sums = (UINT64*)calloc((size_t)width * channels, sizeof(UINT64));
+	// The current and the previous row, both with room for the filter byte in front
+	BYTE* rows = (BYTE*)calloc(2, rowBytes + 1);
+	BYTE* pixels = (BYTE*)malloc((size_t)stream.width * channels);
+	FIBITMAP* dib = FreeImage_Allocate(width, height, channels * 8, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+
+	BOOL decoded = inflater && accumulator.column && accumulator.columnCount && accumulator.sums && rows && pixels && dib
+		&& EasyAvatar_InitInflater(inflater, EasyAvatar_ReadImageData, &stream);
+	if (decoded)
+	{
+		if (channels == 1)
+		{
+			RGBQUAD* palette = FreeImage_GetPalette(dib);
+			for (unsigned int i = 0; i < 256; i++)
+				palette[i].rgbRed = palette[i].rgbGreen = palette[i].rgbBlue = (BYTE)i;
+		}
+
+		for (unsigned int x = 0; x < stream.width; x++)
+		{
+			accumulator.column[x] = (unsigned int)((UINT64)x * width / stream.width);
+			accumulator.columnCount[accumulator.column[x]]++;
+		}
+	}
+
+	BYTE* row = rows;
+	BYTE* prior = rows + rowBytes + 1;
+	unsigned int rowsInCell = 0;
+	for (unsigned int y = 0; decoded && y < stream.height; y++)
+	{
+		if (y % EASYAVATAR_STREAM_CANCEL_ROWS == 0 && EasyAvatar_IsJobCancelled())
+		{
+			decoded = FALSE;
+			break;
+		}
+
+		if (!EasyAvatar_Inflate(inflater, row, rowBytes + 1) || row[0] > 4)
+		{
+			decoded = FALSE;
+			break;
+		}
+
+		EasyAvatar_Unfilter(row[0], row + 1, prior + 1, rowBytes, bytesPerPixel);
+		EasyAvatar_ConvertRow(&stream, row + 1, pixels, channels);
+		EasyAvatar_AccumulateRow(&accumulator, pixels, stream.width);
+		rowsInCell++;
+
+		// Write the target row out once the next source row belongs to the one below it
+		unsigned int targetRow = (unsigned int)((UINT64)y * height / stream.height);
+		if (y + 1 == stream.height || (unsigned int)((UINT64)(y + 1) * height / stream.height) != targetRow)
+		{
+			EasyAvatar_FlushRow(&accumulator, FreeImage_GetScanLine(dib, height - 1 - targetRow), rowsInCell);
+			rowsInCell = 0;
+		}
+
+		BYTE* swap = row;
+		row = prior;
+		prior = swap;
+	}
+
+	free(inflater);
+	free(accumulator.column);
+	free(accumulator.columnCount);
+	free(accumulator.sums);
+	free(rows);
+	free(pixels);
+	if (!decoded && dib)
+	{
+		FreeImage_Unload(dib);
+		dib = NULL;
+	}
+
+	return dib;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+// Streamed images are box filtered down to this multiple of the target size, the final resize starts from there
+#define EASYAVATAR_STREAM_OVERSAMPLING 2
+
+/*
+	Decodes the non-interlaced PNG behind handle row by row, averaging the rows straight into a width x height bitmap.
+	Only two source rows and one row of sums are kept, so memory doesn't grow with the size of the source.
+	The result has 8 bits per channel: greyscale, 24 bit or 32 bit if the PNG has any kind of transparency.
+	Returns NULL if the PNG is interlaced, broken, the job got cancelled or memory runs out.
+*/
+FIBITMAP* EasyAvatar_DecodePNGStream(FreeImageIO* io, fi_handle handle, unsigned int width, unsigned int height);
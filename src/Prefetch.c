@@ -0,0 +1,173 @@
+#include "Prefetch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "Hash.h"
+#include "Worker.h"
+#include "../TeamSpeakSDK/teamspeak/public_errors.h"
+#include "../TeamSpeakSDK/ts3_functions.h"
+
+static const char* const EASYAVATAR_IMAGE_EXTENSIONS[] =
+{
+	".png", ".jpg", ".jpeg", ".jfif", ".gif", ".webp", ".bmp", ".ico", ".tif", ".tiff", ".icns"
+};
+
+// The avatar prepared from the last clipboard content, only touched by the worker thread
+static struct EasyAvatar_Image prefetchedImage = { 0 };
+static char prefetchedHash[MD5LEN * 2 + 1];
+static UINT64 prefetchedFingerprint = 0;
+static BOOL prefetchedUsed = FALSE;
+
+// Only touched by the worker thread as well
+static LONG prefetchHits = 0;
+static LONG prefetchMisses = 0;
+static LONG prefetchDiscarded = 0;
+
+// Set once on initialization, the listener is only started and stopped by the main thread
+static const struct EasyAvatar_ClipboardProvider* clipboardProvider = NULL;
+static BOOL listenerRunning = FALSE;
+
+static BOOL EasyAvatar_HasImageExtension(const char* name, size_t length)
+{
+	for (size_t i = 0; i < sizeof(EASYAVATAR_IMAGE_EXTENSIONS) / sizeof(EASYAVATAR_IMAGE_EXTENSIONS[0]); i++)
+	{
+		size_t extensionLength = strlen(EASYAVATAR_IMAGE_EXTENSIONS[i]);
+		if (length > extensionLength && _strnicmp(name + length - extensionLength, EASYAVATAR_IMAGE_EXTENSIONS[i], extensionLength) == 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL EasyAvatar_IsPrefetchCandidate(const struct EasyAvatar_ClipboardContent* content)
+{
+	// Local files are only mapped, but Explorer puts anything in the clipboard, not just images
+	if (content->path)
+		return EasyAvatar_HasImageExtension(content->path, strlen(content->path));
+
+	// Data URIs, PNGs and bitmaps are already in memory, the rest is cheap
+	if (!content->url)
+		return TRUE;
+
+	const char* url = content->url;
+	if (_strnicmp(url, "http://", 7) != 0 && _strnicmp(url, "https://", 8) != 0)
+		return FALSE;
+
+	// Only the path says anything about the content, ignore query and fragment
+	return EasyAvatar_HasImageExtension(url, strcspn(url, "?# \t\r\n"));
+}
+
+void EasyAvatar_DiscardPrefetchedAvatar(void)
+{
+	if (prefetchedImage.data && !prefetchedUsed)
+		prefetchDiscarded++;
+
+	EasyAvatar_ReleaseImage(&prefetchedImage);
+	prefetchedFingerprint = 0;
+	prefetchedUsed = FALSE;
+}
+
+void EasyAvatar_PrefetchAvatar(struct TS3Functions* ts3Functions)
+{
+	struct EasyAvatar_ClipboardContent content;
+	if (!clipboardProvider || !clipboardProvider->getContent(&content, 0, ts3Functions))
+		return;
+
+	// Clipboard updates come in bursts, and copying the same thing again needs no new work either
+	UINT64 clipboardFingerprint = content.fingerprint;
+	if (!EasyAvatar_IsPrefetchCandidate(&content) || (prefetchedImage.data && clipboardFingerprint == prefetchedFingerprint))
+	{
+		EasyAvatar_ReleaseClipboardContent(&content);
+		return;
+	}
+
+	struct EasyAvatar_Image image = { 0 };
+	char* md5Hash = EasyAvatar_PrepareAvatar(&content, &image, 0, ts3Functions);
+	EasyAvatar_ReleaseClipboardContent(&content);
+	if (!md5Hash)
+		return;
+
+	EasyAvatar_DiscardPrefetchedAvatar();
+	prefetchedImage = image;
+	prefetchedFingerprint = clipboardFingerprint;
+	memcpy(prefetchedHash, md5Hash, sizeof(prefetchedHash));
+	ts3Functions->freeMemory(md5Hash);
+
+	ts3Functions->logMessage("Prefetched avatar from clipboard", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, 0);
+}
+
+BOOL EasyAvatar_TakePrefetchedAvatar(UINT64 clipboardFingerprint, struct EasyAvatar_Image* image, char** md5Hash)
+{
+	if (!prefetchedImage.data || clipboardFingerprint != prefetchedFingerprint)
+	{
+		prefetchMisses++;
+		return FALSE;
+	}
+
+	BYTE* data = (BYTE*)malloc(prefetchedImage.size);
+	char* hash = (char*)malloc(sizeof(prefetchedHash));
+	if (!data || !hash)
+	{
+		free(data);
+		free(hash);
+		prefetchMisses++;
+		return FALSE;
+	}
+
+	memcpy(data, prefetchedImage.data, prefetchedImage.size);
+	memcpy(hash, prefetchedHash, sizeof(prefetchedHash));
+	*image = prefetchedImage;
+	image->data = data;
+	*md5Hash = hash;
+
+	prefetchedUsed = TRUE;
+	prefetchHits++;
+	return TRUE;
+}
+
+void EasyAvatar_GetPrefetchStats(LONG* hits, LONG* misses, LONG* discarded)
+{
+	*hits = prefetchHits;
+	*misses = prefetchMisses;
+	*discarded = prefetchDiscarded;
+}
+
+void EasyAvatar_SetClipboardProvider(const struct EasyAvatar_ClipboardProvider* provider)
+{
+	clipboardProvider = provider;
+}
+
+static void EasyAvatar_OnClipboardChanged(void)
+{
+	EasyAvatar_QueuePrefetch();
+}
+
+BOOL EasyAvatar_StartClipboardListener(struct TS3Functions* ts3Functions)
+{
+	if (listenerRunning)
+		return TRUE;
+
+	listenerRunning = clipboardProvider && clipboardProvider->start(EasyAvatar_OnClipboardChanged);
+	if (!listenerRunning)
+	{
+		ts3Functions->logMessage("Failed to start clipboard listener, avatars won't be prefetched", LogLevel_WARNING, EASYAVATAR_LOGCHANNEL, 0);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void EasyAvatar_StopClipboardListener(void)
+{
+	if (!listenerRunning)
+		return;
+
+	clipboardProvider->stop();
+	listenerRunning = FALSE;
+}
+
+BOOL EasyAvatar_IsClipboardListenerRunning(void)
+{
+	return listenerRunning;
+}
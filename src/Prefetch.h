@@ -0,0 +1,67 @@
+#pragma once
+#include <Windows.h>
+
+#include "EasyAvatar.h"
+
+// Key of the runtime switch in EASYAVATAR_SETTINGS_FILE, prefetching is off unless the user turned it on
+#define EASYAVATAR_SETTING_PREFETCH "prefetch"
+
+/*
+	Where clipboard changes and content come from, the Windows clipboard in the plugin and a fake in the tests.
+*/
+struct EasyAvatar_ClipboardProvider
+{
+	// Starts calling onChange, from any thread, whenever the clipboard changes. Returns FALSE if it can't
+	BOOL (*start)(void (*onChange)(void));
+	// onChange isn't called anymore once this returns
+	void (*stop)(void);
+	// Same contract as EasyAvatar_GetClipboardContent
+	BOOL (*getContent)(struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions);
+};
+
+/*
+	Called once on initialization, before the listener is started for the first time.
+*/
+void EasyAvatar_SetClipboardProvider(const struct EasyAvatar_ClipboardProvider* provider);
+
+/*
+	Called on initialization if the user turned prefetching on and whenever they turn it on, after the worker has been started.
+	Queues a prefetch job whenever the clipboard changes, failing to start only costs us the head start and is logged.
+*/
+BOOL EasyAvatar_StartClipboardListener(struct TS3Functions* ts3Functions);
+
+/*
+	Called when the user turns prefetching off and on shutdown, before the worker is stopped.
+*/
+void EasyAvatar_StopClipboardListener(void);
+
+BOOL EasyAvatar_IsClipboardListenerRunning(void);
+
+/*
+	Returns TRUE for clipboard content worth preparing speculatively: copied images, data URIs, and local files or http(s) URLs whose path ends in an image extension.
+	Anything else is only fetched once the user asks for it.
+*/
+BOOL EasyAvatar_IsPrefetchCandidate(const struct EasyAvatar_ClipboardContent* content);
+
+/*
+	Runs on the worker thread as a prefetch job.
+	Prepares the avatar for the current clipboard content and keeps it until the hotkey asks for it or newer content replaces it.
+*/
+void EasyAvatar_PrefetchAvatar(struct TS3Functions* ts3Functions);
+
+/*
+	Worker thread only.
+	If the prefetched avatar was made from clipboard content with the given fingerprint, copies it into image and md5Hash and returns TRUE.
+	The prefetched avatar stays around, so applying it on several servers only prepares it once.
+*/
+BOOL EasyAvatar_TakePrefetchedAvatar(UINT64 clipboardFingerprint, struct EasyAvatar_Image* image, char** md5Hash);
+
+/*
+	Frees the prefetched avatar, called on shutdown after the worker has stopped.
+*/
+void EasyAvatar_DiscardPrefetchedAvatar(void);
+
+/*
+	Hotkey presses served by a prefetched avatar, presses that had to do the work themselves and prefetched avatars replaced without being used.
+*/
+void EasyAvatar_GetPrefetchStats(LONG* hits, LONG* misses, LONG* discarded);
@@ -0,0 +1,55 @@
+#include "Preview.h"
+
+#include "EasyAvatar.h"
+#include "ImageIO.h"
+
+int EasyAvatar_GetJPEGScaleFlags(unsigned int width, unsigned int height)
+{
+	unsigned int targetW;
+	unsigned int targetH;
+	EasyAvatar_GetTargetSize(width, height, &targetW, &targetH);
+
+	unsigned int denominator = EasyAvatar_GetJPEGScale(width, height, targetW, targetH);
+	if (denominator == 1)
+		return 0;
+
+	// FreeImage picks the scale from max(width, height) / hint, which lands exactly on our denominator
+	unsigned int longest = width > height ? width : height;
+	return (int)((longest / denominator) << 16);
+}
+
+FIBITMAP* EasyAvatar_LoadPreview(FreeImageIO* sourceIO, fi_handle handle, const struct EasyAvatar_ImageInfo* info, unsigned int targetW, unsigned int targetH,
+	unsigned int* width, unsigned int* height)
+{
+	struct EasyAvatar_SliceReader reader;
+	FreeImageIO io;
+	struct EasyAvatar_ImageInfo best = { 0 };
+	long bestIndex = -1;
+
+	for (unsigned int i = 0; i < info->previewCount; i++)
+	{
+		struct EasyAvatar_ImageInfo preview;
+		EasyAvatar_OpenSliceReader(&reader, &io, sourceIO, handle, info->previews[i].offset, info->previews[i].size);
+		if (!EasyAvatar_ProbeImage(&io, &reader, &preview) || preview.format != FIF_JPEG || preview.width < targetW || preview.height < targetH)
+			continue;
+
+		if (bestIndex < 0 || (UINT64)preview.width * preview.height < (UINT64)best.width * best.height)
+		{
+			best = preview;
+			bestIndex = (long)i;
+		}
+	}
+
+	if (bestIndex < 0)
+		return NULL;
+
+	EasyAvatar_OpenSliceReader(&reader, &io, sourceIO, handle, info->previews[bestIndex].offset, info->previews[bestIndex].size);
+	FIBITMAP* dib = FreeImage_LoadFromHandle(FIF_JPEG, &io, &reader, EasyAvatar_GetJPEGScaleFlags(best.width, best.height));
+	if (dib)
+	{
+		*width = best.width;
+		*height = best.height;
+	}
+
+	return dib;
+}
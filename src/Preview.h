@@ -0,0 +1,18 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+#include "ImageProbe.h"
+
+/*
+	Returns the FreeImage load flags that make libjpeg decode a width x height JPEG at the smallest scale still covering the avatar size,
+	0 to decode it at full size.
+*/
+int EasyAvatar_GetJPEGScaleFlags(unsigned int width, unsigned int height);
+
+/*
+	Decodes the smallest preview listed in info that still covers targetW x targetH, instead of the image behind handle.
+	width and height receive the size of the preview. Returns NULL if there is none.
+*/
+FIBITMAP* EasyAvatar_LoadPreview(FreeImageIO* io, fi_handle handle, const struct EasyAvatar_ImageInfo* info, unsigned int targetW, unsigned int targetH,
+	unsigned int* width, unsigned int* height);
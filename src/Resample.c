@@ -0,0 +1,658 @@
+#include "Resample.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CPU.h"
+#include "ThreadPool.h"
+
+// Fractional bits of the fixed point coefficients, small enough that two of them fit a 16 bit multiply-add
+#define EASYAVATAR_RESAMPLE_PRECISION 14
+#define EASYAVATAR_RESAMPLE_ONE (1 << EASYAVATAR_RESAMPLE_PRECISION)
+#define EASYAVATAR_RESAMPLE_ROUNDING (1 << (EASYAVATAR_RESAMPLE_PRECISION - 1))
+// Below this many rows per strip handing work to the thread pool costs more than it saves
+#define EASYAVATAR_RESAMPLE_MIN_STRIP 16
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+	Which source pixels contribute to each target pixel along one axis and how much.
+*/
+struct EasyAvatar_Contributions
+{
+	unsigned int* start;
+	unsigned int* count;
+	// maxTaps fixed point coefficients per target pixel, each set sums up to exactly EASYAVATAR_RESAMPLE_ONE
+	INT16* coefficients;
+	unsigned int maxTaps;
+};
+
+typedef void(*EasyAvatar_ResampleRowFunc)(const BYTE* src, size_t srcRowBytes, BYTE* dst, unsigned int dstWidth,
+	unsigned int channels, const struct EasyAvatar_Contributions* contributions);
+
+typedef void(*EasyAvatar_ResampleColumnsFunc)(const BYTE* src, size_t srcPitch, const INT16* coefficients, unsigned int taps,
+	BYTE* dst, size_t rowBytes);
+
+struct EasyAvatar_ResampleJob
+{
+	const BYTE* src;
+	size_t srcPitch;
+	unsigned int srcWidth;
+	// Horizontally resampled copy of the source rows the vertical pass needs, starting at source row firstRow
+	BYTE* intermediate;
+	size_t intermediatePitch;
+	unsigned int firstRow;
+	unsigned int intermediateRows;
+	BYTE* dst;
+	size_t dstPitch;
+	unsigned int dstWidth;
+	unsigned int dstHeight;
+	unsigned int channels;
+	struct EasyAvatar_Contributions horizontal;
+	struct EasyAvatar_Contributions vertical;
+	unsigned int horizontalStrips;
+	unsigned int verticalStrips;
+	EasyAvatar_ResampleRowFunc resampleRow;
+	EasyAvatar_ResampleColumnsFunc resampleColumns;
+};
+
+static double EasyAvatar_Sinc(double x)
+{
+	if (x == 0.0)
+		return 1.0;
+
+	x *= M_PI;
+	return sin(x) / x;
+}
+
+static double EasyAvatar_FilterSupport(enum EasyAvatar_ResampleFilter filter)
+{
+	switch (filter)
+	{
+	case EASYAVATAR_FILTER_CATMULLROM: return 2.0;
+	case EASYAVATAR_FILTER_LANCZOS3: return 3.0;
+	default: return 0.5;
+	}
+}
+
+static double EasyAvatar_FilterWeight(enum EasyAvatar_ResampleFilter filter, double x)
+{
+	switch (filter)
+	{
+	case EASYAVATAR_FILTER_CATMULLROM:
+		// Keys cubic with a = -0.5
+		if (x < 0.0)
+			x = -x;
+		if (x < 1.0)
+			return (1.5 * x - 2.5) * x * x + 1.0;
+		if (x < 2.0)
+			return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+		return 0.0;
+	case EASYAVATAR_FILTER_LANCZOS3:
+		if (x <= -3.0 || x >= 3.0)
+			return 0.0;
+		return EasyAvatar_Sinc(x) * EasyAvatar_Sinc(x / 3.0);
+	default:
+		// Half open so a sample exactly between two pixels only counts once
+		return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+	}
+}
+
+static void EasyAvatar_FreeContributions(struct EasyAvatar_Contributions* contributions)
+{
+	free(contributions->start);
+	free(contributions->count);
+	free(contributions->coefficients);
+	memset(contributions, 0, sizeof(*contributions));
+}
+
+static BOOL EasyAvatar_ComputeContributions(struct EasyAvatar_Contributions* contributions, unsigned int srcSize, unsigned int dstSize,
+	enum EasyAvatar_ResampleFilter filter)
+{
+	double scale = (double)srcSize / (double)dstSize;
+	// When downscaling the kernel gets stretched so every source pixel is covered
+	double filterScale = scale < 1.0 ? 1.0 : scale;
+	double support = EasyAvatar_FilterSupport(filter) * filterScale;
+	unsigned int maxTaps = (unsigned int)ceil(support) * 2 + 1;
+
+	memset(contributions, 0, sizeof(*contributions));
+	contributions->maxTaps = maxTaps;
+	contributions->start = (unsigned int*)malloc(dstSize * sizeof(unsigned int));
+	contributions->count = (unsigned int*)malloc(dstSize * sizeof(unsigned int));
+	contributions->coefficients = (INT16*)calloc((size_t)dstSize * maxTaps, sizeof(INT16));
+	double* weights = (double*)malloc(maxTaps * sizeof(double));
+	int* fixed = (int*)malloc(maxTaps * sizeof(int));
+	if (!contributions->start || !contributions->count || !contributions->coefficients || !weights || !fixed)
+	{
+		free(weights);
+		free(fixed);
+		EasyAvatar_FreeContributions(contributions);
+		return FALSE;
+	}
+
+	for (unsigned int i = 0; i < dstSize; i++)
+	{
+		double center = (i + 0.5) * scale;
+		int first = (int)(center - support + 0.5);
+		int last = (int)(center + support + 0.5);
+		if (first < 0)
+			first = 0;
+		if (last > (int)srcSize)
+			last = (int)srcSize;
+		if (last - first > (int)maxTaps)
+			last = first + (int)maxTaps;
+
+		unsigned int taps = last > first ? (unsigned int)(last - first) : 0;
+		double total = 0.0;
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			weights[k] = EasyAvatar_FilterWeight(filter, (first + (int)k - center + 0.5) / filterScale);
+			total += weights[k];
+		}
+
+		INT16* coefficients = contributions->coefficients + (size_t)i * maxTaps;
+		if (taps == 0 || total == 0.0)
+		{
+			// Can't happen with our kernels, but nearest neighbour beats a black pixel
+			unsigned int nearest = (unsigned int)center;
+			contributions->start[i] = nearest < srcSize ? nearest : srcSize - 1;
+			contributions->count[i] = 1;
+			coefficients[0] = EASYAVATAR_RESAMPLE_ONE;
+			continue;
+		}
+
+		// The rounding error goes to the largest tap so flat areas keep their exact value
+		int sum = 0;
+		unsigned int largest = 0;
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			fixed[k] = (int)floor(weights[k] / total * EASYAVATAR_RESAMPLE_ONE + 0.5);
+			sum += fixed[k];
+			if (abs(fixed[k]) > abs(fixed[largest]))
+				largest = k;
+		}
+		fixed[largest] += EASYAVATAR_RESAMPLE_ONE - sum;
+
+		// Drop taps that ended up as zero at both ends, the box filter has a lot of them
+		unsigned int skip = 0;
+		while (skip + 1 < taps && fixed[skip] == 0)
+			skip++;
+		while (taps > skip + 1 && fixed[taps - 1] == 0)
+			taps--;
+
+		contributions->start[i] = (unsigned int)first + skip;
+		contributions->count[i] = taps - skip;
+		for (unsigned int k = skip; k < taps; k++)
+			coefficients[k - skip] = (INT16)fixed[k];
+	}
+
+	free(weights);
+	free(fixed);
+	return TRUE;
+}
+
+static BYTE EasyAvatar_ClampPixel(int value)
+{
+	value >>= EASYAVATAR_RESAMPLE_PRECISION;
+	if (value < 0)
+		return 0;
+	if (value > 255)
+		return 255;
+	return (BYTE)value;
+}
+
+static void EasyAvatar_ResampleRowScalar(const BYTE* src, size_t srcRowBytes, BYTE* dst, unsigned int dstWidth,
+	unsigned int channels, const struct EasyAvatar_Contributions* contributions)
+{
+	(void)srcRowBytes;
+
+	for (unsigned int x = 0; x < dstWidth; x++)
+	{
+		const BYTE* pixels = src + (size_t)contributions->start[x] * channels;
+		const INT16* coefficients = contributions->coefficients + (size_t)x * contributions->maxTaps;
+		unsigned int taps = contributions->count[x];
+
+		for (unsigned int channel = 0; channel < channels; channel++)
+		{
+			int sum = EASYAVATAR_RESAMPLE_ROUNDING;
+			for (unsigned int k = 0; k < taps; k++)
+				sum += coefficients[k] * pixels[k * channels + channel];
+
+			*dst++ = EasyAvatar_ClampPixel(sum);
+		}
+	}
+}
+
+static void EasyAvatar_ResampleColumnsScalar(const BYTE* src, size_t srcPitch, const INT16* coefficients, unsigned int taps,
+	BYTE* dst, size_t rowBytes)
+{
+	for (size_t i = 0; i < rowBytes; i++)
+	{
+		int sum = EASYAVATAR_RESAMPLE_ROUNDING;
+		for (unsigned int k = 0; k < taps; k++)
+			sum += coefficients[k] * src[k * srcPitch + i];
+
+		dst[i] = EasyAvatar_ClampPixel(sum);
+	}
+}
+
+#ifdef EASYAVATAR_X86
+
+// Two neighbouring taps packed into one 32 bit lane, multiplied with interleaved 16 bit pixels by madd
+static int EasyAvatar_PackTaps(INT16 first, INT16 second)
+{
+	return (int)(((UINT32)(UINT16)second << 16) | (UINT16)first);
+}
+
+EASYAVATAR_TARGET("sse4.1")
+static void EasyAvatar_ResampleRowSSE41(const BYTE* src, size_t srcRowBytes, BYTE* dst, unsigned int dstWidth,
+	unsigned int channels, const struct EasyAvatar_Contributions* contributions)
+{
+	// Interleaving pixels channel by channel only pays off with at least 3 channels
+	if (channels < 3)
+	{
+		EasyAvatar_ResampleRowScalar(src, srcRowBytes, dst, dstWidth, channels, contributions);
+		return;
+	}
+
+	// Turns two neighbouring pixels into r0 r1 g0 g1 b0 b1 (a0 a1) 16 bit values, madd then yields one sum per channel
+	const __m128i firstPair = channels == 4
+		? _mm_setr_epi8(0, -1, 4, -1, 1, -1, 5, -1, 2, -1, 6, -1, 3, -1, 7, -1)
+		: _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1, -1, -1, -1, -1);
+	const __m128i secondPair = channels == 4
+		? _mm_setr_epi8(8, -1, 12, -1, 9, -1, 13, -1, 10, -1, 14, -1, 11, -1, 15, -1)
+		: _mm_setr_epi8(6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1, -1, -1, -1, -1);
+	const BYTE* rowEnd = src + srcRowBytes;
+
+	for (unsigned int x = 0; x < dstWidth; x++)
+	{
+		const BYTE* pixels = src + (size_t)contributions->start[x] * channels;
+		const INT16* coefficients = contributions->coefficients + (size_t)x * contributions->maxTaps;
+		unsigned int taps = contributions->count[x];
+		__m128i sum = _mm_set1_epi32(EASYAVATAR_RESAMPLE_ROUNDING);
+		unsigned int k = 0;
+
+		// Four taps per step as long as a 16 byte load stays inside the row
+		for (; k + 4 <= taps && pixels + k * channels + 16 <= rowEnd; k += 4)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i*)(pixels + k * channels));
+			__m128i factors = _mm_loadl_epi64((const __m128i*)(coefficients + k));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_shuffle_epi8(block, firstPair), _mm_shuffle_epi32(factors, 0x00)));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_shuffle_epi8(block, secondPair), _mm_shuffle_epi32(factors, 0x55)));
+		}
+
+		// The last few pixels of the row get copied so we never read past it
+		for (; k < taps; k += 2)
+		{
+			BYTE block[8] = { 0 };
+			unsigned int pair = k + 1 < taps ? 2 : 1;
+			memcpy(block, pixels + k * channels, pair * channels);
+			__m128i factors = _mm_set1_epi32(EasyAvatar_PackTaps(coefficients[k], pair == 2 ? coefficients[k + 1] : 0));
+			sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_shuffle_epi8(_mm_loadl_epi64((const __m128i*)block), firstPair), factors));
+		}
+
+		__m128i words = _mm_packs_epi32(_mm_srai_epi32(sum, EASYAVATAR_RESAMPLE_PRECISION), _mm_setzero_si128());
+		int pixel = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+		memcpy(dst, &pixel, channels);
+		dst += channels;
+	}
+}
+
+EASYAVATAR_TARGET("sse4.1")
+static void EasyAvatar_ResampleColumnsSSE41(const BYTE* src, size_t srcPitch, const INT16* coefficients, unsigned int taps,
+	BYTE* dst, size_t rowBytes)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= rowBytes; i += 8)
+	{
+		const BYTE* column = src + i;
+		__m128i low = _mm_set1_epi32(EASYAVATAR_RESAMPLE_ROUNDING);
+		__m128i high = low;
+		unsigned int k = 0;
+
+		// Two rows per step, interleaved bytes of both rows share one madd
+		for (; k + 1 < taps; k += 2)
+		{
+			__m128i first = _mm_loadl_epi64((const __m128i*)(column + k * srcPitch));
+			__m128i second = _mm_loadl_epi64((const __m128i*)(column + (k + 1) * srcPitch));
+			__m128i interleaved = _mm_unpacklo_epi8(first, second);
+			__m128i factors = _mm_set1_epi32(EasyAvatar_PackTaps(coefficients[k], coefficients[k + 1]));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_cvtepu8_epi16(interleaved), factors));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(interleaved, 8)), factors));
+		}
+		if (k < taps)
+		{
+			__m128i interleaved = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(column + k * srcPitch)), _mm_setzero_si128());
+			__m128i factors = _mm_set1_epi32(EasyAvatar_PackTaps(coefficients[k], 0));
+			low = _mm_add_epi32(low, _mm_madd_epi16(_mm_cvtepu8_epi16(interleaved), factors));
+			high = _mm_add_epi32(high, _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(interleaved, 8)), factors));
+		}
+
+		__m128i words = _mm_packs_epi32(_mm_srai_epi32(low, EASYAVATAR_RESAMPLE_PRECISION), _mm_srai_epi32(high, EASYAVATAR_RESAMPLE_PRECISION));
+		_mm_storel_epi64((__m128i*)(dst + i), _mm_packus_epi16(words, words));
+	}
+
+	EasyAvatar_ResampleColumnsScalar(src + i, srcPitch, coefficients, taps, dst + i, rowBytes - i);
+}
+
+EASYAVATAR_TARGET("avx2")
+static void EasyAvatar_ResampleColumnsAVX2(const BYTE* src, size_t srcPitch, const INT16* coefficients, unsigned int taps,
+	BYTE* dst, size_t rowBytes)
+{
+	size_t i = 0;
+
+	for (; i + 16 <= rowBytes; i += 16)
+	{
+		const BYTE* column = src + i;
+		__m256i low = _mm256_set1_epi32(EASYAVATAR_RESAMPLE_ROUNDING);
+		__m256i high = low;
+		unsigned int k = 0;
+
+		// Unpacking works per 128 bit lane, low ends up with bytes 0-3 and 8-11, high with 4-7 and 12-15
+		for (; k + 1 < taps; k += 2)
+		{
+			__m256i first = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(column + k * srcPitch)));
+			__m256i second = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(column + (k + 1) * srcPitch)));
+			__m256i factors = _mm256_set1_epi32(EasyAvatar_PackTaps(coefficients[k], coefficients[k + 1]));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(first, second), factors));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(first, second), factors));
+		}
+		if (k < taps)
+		{
+			__m256i first = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(column + k * srcPitch)));
+			__m256i factors = _mm256_set1_epi32(EasyAvatar_PackTaps(coefficients[k], 0));
+			low = _mm256_add_epi32(low, _mm256_madd_epi16(_mm256_unpacklo_epi16(first, _mm256_setzero_si256()), factors));
+			high = _mm256_add_epi32(high, _mm256_madd_epi16(_mm256_unpackhi_epi16(first, _mm256_setzero_si256()), factors));
+		}
+
+		// Packing is per lane as well, which puts the bytes back in order, then both lanes' low halves are joined
+		__m256i words = _mm256_packs_epi32(_mm256_srai_epi32(low, EASYAVATAR_RESAMPLE_PRECISION), _mm256_srai_epi32(high, EASYAVATAR_RESAMPLE_PRECISION));
+		__m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+		_mm_storeu_si128((__m128i*)(dst + i), _mm256_castsi256_si128(bytes));
+	}
+
+	EasyAvatar_ResampleColumnsSSE41(src + i, srcPitch, coefficients, taps, dst + i, rowBytes - i);
+}
+
+#endif // EASYAVATAR_X86
+
+#ifdef EASYAVATAR_NEON
+
+static void EasyAvatar_ResampleColumnsNEON(const BYTE* src, size_t srcPitch, const INT16* coefficients, unsigned int taps,
+	BYTE* dst, size_t rowBytes)
+{
+	size_t i = 0;
+
+	for (; i + 8 <= rowBytes; i += 8)
+	{
+		const BYTE* column = src + i;
+		int32x4_t low = vdupq_n_s32(EASYAVATAR_RESAMPLE_ROUNDING);
+		int32x4_t high = low;
+
+		for (unsigned int k = 0; k < taps; k++)
+		{
+			int16x8_t pixels = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(column + k * srcPitch)));
+			low = vmlal_n_s16(low, vget_low_s16(pixels), coefficients[k]);
+			high = vmlal_n_s16(high, vget_high_s16(pixels), coefficients[k]);
+		}
+
+		int16x8_t words = vcombine_s16(vqshrn_n_s32(low, EASYAVATAR_RESAMPLE_PRECISION), vqshrn_n_s32(high, EASYAVATAR_RESAMPLE_PRECISION));
+		vst1_u8(dst + i, vqmovun_s16(words));
+	}
+
+	EasyAvatar_ResampleColumnsScalar(src + i, srcPitch, coefficients, taps, dst + i, rowBytes - i);
+}
+
+#endif // EASYAVATAR_NEON
+
+// Picked on first use, every thread computes the same value so the race is harmless
+static EasyAvatar_ResampleRowFunc resampleRowImpl = NULL;
+static EasyAvatar_ResampleColumnsFunc resampleColumnsImpl = NULL;
+
+static void EasyAvatar_SelectResamplers(void)
+{
+	EasyAvatar_ResampleRowFunc row = EasyAvatar_ResampleRowScalar;
+	EasyAvatar_ResampleColumnsFunc columns = EasyAvatar_ResampleColumnsScalar;
+#if defined(EASYAVATAR_X86)
+	if (EasyAvatar_CPUHasSSE41())
+	{
+		row = EasyAvatar_ResampleRowSSE41;
+		columns = EasyAvatar_CPUHasAVX2() ? EasyAvatar_ResampleColumnsAVX2 : EasyAvatar_ResampleColumnsSSE41;
+	}
+#elif defined(EASYAVATAR_NEON)
+	columns = EasyAvatar_ResampleColumnsNEON;
+#endif
+	resampleColumnsImpl = columns;
+	resampleRowImpl = row;
+}
+
+static unsigned int EasyAvatar_GetStripCount(unsigned int rows)
+{
+	unsigned int strips = rows / EASYAVATAR_RESAMPLE_MIN_STRIP;
+	// A few more strips than threads evens out strips that finish early
+	unsigned int limit = EasyAvatar_GetParallelism() * 2;
+	if (strips > limit)
+		strips = limit;
+
+	return strips ? strips : 1;
+}
+
+static void EasyAvatar_ResampleHorizontalStrip(unsigned int index, void* context)
+{
+	struct EasyAvatar_ResampleJob* job = (struct EasyAvatar_ResampleJob*)context;
+	unsigned int first = (unsigned int)((UINT64)job->intermediateRows * index / job->horizontalStrips);
+	unsigned int last = (unsigned int)((UINT64)job->intermediateRows * (index + 1) / job->horizontalStrips);
+
+	for (unsigned int y = first; y < last; y++)
+	{
+		job->resampleRow(job->src + (size_t)(job->firstRow + y) * job->srcPitch, (size_t)job->srcWidth * job->channels,
+			job->intermediate + y * job->intermediatePitch, job->dstWidth, job->channels, &job->horizontal);
+	}
+}
+
+static void EasyAvatar_ResampleVerticalStrip(unsigned int index, void* context)
+{
+	struct EasyAvatar_ResampleJob* job = (struct EasyAvatar_ResampleJob*)context;
+	unsigned int first = (unsigned int)((UINT64)job->dstHeight * index / job->verticalStrips);
+	unsigned int last = (unsigned int)((UINT64)job->dstHeight * (index + 1) / job->verticalStrips);
+
+	for (unsigned int y = first; y < last; y++)
+	{
+		job->resampleColumns(job->intermediate + (job->vertical.start[y] - job->firstRow) * job->intermediatePitch, job->intermediatePitch,
+			job->vertical.coefficients + (size_t)y * job->vertical.maxTaps, job->vertical.count[y],
+			job->dst + y * job->dstPitch, job->intermediatePitch);
+	}
+}
+
+BOOL EasyAvatar_ResamplePixels(const BYTE* src, unsigned int srcWidth, unsigned int srcHeight, size_t srcPitch,
+	BYTE* dst, unsigned int dstWidth, unsigned int dstHeight, size_t dstPitch,
+	unsigned int channels, enum EasyAvatar_ResampleFilter filter)
+{
+	if (!src || !dst || !srcWidth || !srcHeight || !dstWidth || !dstHeight)
+		return FALSE;
+	if (channels != 1 && channels != 3 && channels != 4)
+		return FALSE;
+
+	if (!resampleRowImpl || !resampleColumnsImpl)
+		EasyAvatar_SelectResamplers();
+
+	struct EasyAvatar_ResampleJob job;
+	memset(&job, 0, sizeof(job));
+	job.src = src;
+	job.srcPitch = srcPitch;
+	job.srcWidth = srcWidth;
+	job.dst = dst;
+	job.dstPitch = dstPitch;
+	job.dstWidth = dstWidth;
+	job.dstHeight = dstHeight;
+	job.channels = channels;
+	job.resampleRow = resampleRowImpl;
+	job.resampleColumns = resampleColumnsImpl;
+
+	if (!EasyAvatar_ComputeContributions(&job.horizontal, srcWidth, dstWidth, filter))
+		return FALSE;
+	if (!EasyAvatar_ComputeContributions(&job.vertical, srcHeight, dstHeight, filter))
+	{
+		EasyAvatar_FreeContributions(&job.horizontal);
+		return FALSE;
+	}
+
+	// Only the source rows the vertical pass reads get resampled horizontally
+	unsigned int firstRow = job.vertical.start[0];
+	unsigned int lastRow = 0;
+	for (unsigned int y = 0; y < dstHeight; y++)
+	{
+		if (job.vertical.start[y] < firstRow)
+			firstRow = job.vertical.start[y];
+		if (job.vertical.start[y] + job.vertical.count[y] > lastRow)
+			lastRow = job.vertical.start[y] + job.vertical.count[y];
+	}
+
+	job.firstRow = firstRow;
+	job.intermediateRows = lastRow - firstRow;
+	job.intermediatePitch = (size_t)dstWidth * channels;
+	job.intermediate = (BYTE*)malloc(job.intermediatePitch * job.intermediateRows);
+	if (!job.intermediate)
+	{
+		EasyAvatar_FreeContributions(&job.horizontal);
+		EasyAvatar_FreeContributions(&job.vertical);
+		return FALSE;
+	}
+
+	job.horizontalStrips = EasyAvatar_GetStripCount(job.intermediateRows);
+	job.verticalStrips = EasyAvatar_GetStripCount(dstHeight);
+	EasyAvatar_ParallelFor(job.horizontalStrips, EasyAvatar_ResampleHorizontalStrip, &job);
+	EasyAvatar_ParallelFor(job.verticalStrips, EasyAvatar_ResampleVerticalStrip, &job);
+
+	free(job.intermediate);
+	EasyAvatar_FreeContributions(&job.horizontal);
+	EasyAvatar_FreeContributions(&job.vertical);
+	return TRUE;
+}
+
+/*
+	Rows of 32 bit pixels that get converted between straight and premultiplied alpha.
+*/
+struct EasyAvatar_AlphaJob
+{
+	const BYTE* src;
+	size_t srcPitch;
+	BYTE* dst;
+	size_t dstPitch;
+	unsigned int width;
+	unsigned int height;
+	unsigned int strips;
+};
+
+static void EasyAvatar_PremultiplyStrip(unsigned int index, void* context)
+{
+	struct EasyAvatar_AlphaJob* job = (struct EasyAvatar_AlphaJob*)context;
+	unsigned int first = (unsigned int)((UINT64)job->height * index / job->strips);
+	unsigned int last = (unsigned int)((UINT64)job->height * (index + 1) / job->strips);
+
+	for (unsigned int y = first; y < last; y++)
+	{
+		const BYTE* source = job->src + y * job->srcPitch;
+		BYTE* target = job->dst + y * job->dstPitch;
+		for (unsigned int x = 0; x < job->width; x++, source += 4, target += 4)
+		{
+			unsigned int alpha = source[FI_RGBA_ALPHA];
+			target[FI_RGBA_RED] = (BYTE)((source[FI_RGBA_RED] * alpha + 127) / 255);
+			target[FI_RGBA_GREEN] = (BYTE)((source[FI_RGBA_GREEN] * alpha + 127) / 255);
+			target[FI_RGBA_BLUE] = (BYTE)((source[FI_RGBA_BLUE] * alpha + 127) / 255);
+			target[FI_RGBA_ALPHA] = (BYTE)alpha;
+		}
+	}
+}
+
+static void EasyAvatar_UnpremultiplyStrip(unsigned int index, void* context)
+{
+	struct EasyAvatar_AlphaJob* job = (struct EasyAvatar_AlphaJob*)context;
+	unsigned int first = (unsigned int)((UINT64)job->height * index / job->strips);
+	unsigned int last = (unsigned int)((UINT64)job->height * (index + 1) / job->strips);
+
+	for (unsigned int y = first; y < last; y++)
+	{
+		BYTE* pixel = job->dst + y * job->dstPitch;
+		for (unsigned int x = 0; x < job->width; x++, pixel += 4)
+		{
+			unsigned int alpha = pixel[FI_RGBA_ALPHA];
+			if (alpha == 255)
+				continue;
+			if (alpha == 0)
+			{
+				memset(pixel, 0, 4);
+				continue;
+			}
+
+			// Filters that ring can push a color past its alpha, which would overflow here
+			for (unsigned int channel = 0; channel < 4; channel++)
+			{
+				if (channel == FI_RGBA_ALPHA)
+					continue;
+				unsigned int value = (pixel[channel] * 255 + alpha / 2) / alpha;
+				pixel[channel] = (BYTE)(value > 255 ? 255 : value);
+			}
+		}
+	}
+}
+
+FIBITMAP* EasyAvatar_Resample(FIBITMAP* dib, unsigned int width, unsigned int height, enum EasyAvatar_ResampleFilter filter)
+{
+	if (!dib || !FreeImage_HasPixels(dib) || FreeImage_GetImageType(dib) != FIT_BITMAP)
+		return NULL;
+
+	unsigned int bpp = FreeImage_GetBPP(dib);
+	if (bpp != 8 && bpp != 24 && bpp != 32)
+		return NULL;
+	// Palette indices can't be blended
+	if (bpp == 8 && FreeImage_GetColorType(dib) != FIC_MINISBLACK)
+		return NULL;
+
+	FIBITMAP* resized = FreeImage_Allocate(width, height, bpp, FreeImage_GetRedMask(dib), FreeImage_GetGreenMask(dib), FreeImage_GetBlueMask(dib));
+	if (!resized)
+		return NULL;
+
+	const BYTE* src = FreeImage_GetBits(dib);
+	size_t srcPitch = FreeImage_GetPitch(dib);
+	BYTE* premultiplied = NULL;
+	if (bpp == 32)
+	{
+		// Filter premultiplied colors like PNGStream's box filter does, or invisible pixels bleed their color into the edges
+		struct EasyAvatar_AlphaJob job = { src, srcPitch, NULL, srcPitch, FreeImage_GetWidth(dib), FreeImage_GetHeight(dib), 0 };
+		premultiplied = (BYTE*)malloc(srcPitch * job.height);
+		if (!premultiplied)
+		{
+			FreeImage_Unload(resized);
+			return NULL;
+		}
+
+		job.dst = premultiplied;
+		job.strips = EasyAvatar_GetStripCount(job.height);
+		EasyAvatar_ParallelFor(job.strips, EasyAvatar_PremultiplyStrip, &job);
+		src = premultiplied;
+	}
+
+	// FreeImage stores rows bottom up in both bitmaps, which doesn't matter for resampling
+	BOOL resampled = EasyAvatar_ResamplePixels(src, FreeImage_GetWidth(dib), FreeImage_GetHeight(dib), srcPitch,
+		FreeImage_GetBits(resized), width, height, FreeImage_GetPitch(resized), bpp / 8, filter);
+	free(premultiplied);
+	if (!resampled)
+	{
+		FreeImage_Unload(resized);
+		return NULL;
+	}
+
+	if (bpp == 32)
+	{
+		struct EasyAvatar_AlphaJob job = { NULL, 0, FreeImage_GetBits(resized), FreeImage_GetPitch(resized), width, height, EasyAvatar_GetStripCount(height) };
+		EasyAvatar_ParallelFor(job.strips, EasyAvatar_UnpremultiplyStrip, &job);
+	}
+
+	FreeImage_CloneMetadata(resized, dib);
+	return resized;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+enum EasyAvatar_ResampleFilter
+{
+	// Averages every source pixel that falls into the target pixel, fastest but blurry
+	EASYAVATAR_FILTER_BOX,
+	// Bicubic, sharper than box with little ringing
+	EASYAVATAR_FILTER_CATMULLROM,
+	// Sharpest, the best choice for downscaling photos
+	EASYAVATAR_FILTER_LANCZOS3
+};
+
+/*
+	Resamples 8 bit per channel pixels with 1, 3 or 4 interleaved channels from src into dst using a separable filter.
+	Rows are split into strips that run on the thread pool, the inner loops use AVX2, SSE4.1 or NEON when available.
+	Returns FALSE if the arguments are invalid or memory runs out.
+*/
+BOOL EasyAvatar_ResamplePixels(const BYTE* src, unsigned int srcWidth, unsigned int srcHeight, size_t srcPitch,
+	BYTE* dst, unsigned int dstWidth, unsigned int dstHeight, size_t dstPitch,
+	unsigned int channels, enum EasyAvatar_ResampleFilter filter);
+
+/*
+	Returns a new bitmap with dib resampled to width x height, metadata is copied over.
+	Only 8 bit greyscale, 24 bit and 32 bit bitmaps are supported, anything else returns NULL just like any failure.
+	32 bit bitmaps are filtered with premultiplied alpha, so transparent pixels don't tint the edges around them.
+*/
+FIBITMAP* EasyAvatar_Resample(FIBITMAP* dib, unsigned int width, unsigned int height, enum EasyAvatar_ResampleFilter filter);
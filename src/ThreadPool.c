@@ -0,0 +1,71 @@
+#include "ThreadPool.h"
+
+struct EasyAvatar_ParallelState
+{
+	EasyAvatar_ParallelTask task;
+	void* context;
+	unsigned int count;
+	// Next index to hand out, every participant keeps taking indices until they run out
+	volatile LONG next;
+};
+
+static void EasyAvatar_RunParallelTasks(struct EasyAvatar_ParallelState* state)
+{
+	for (;;)
+	{
+		LONG index = InterlockedIncrement(&state->next) - 1;
+		if ((unsigned int)index >= state->count)
+			break;
+
+		state->task((unsigned int)index, state->context);
+	}
+}
+
+static VOID CALLBACK EasyAvatar_ParallelWork(PTP_CALLBACK_INSTANCE instance, PVOID parameter, PTP_WORK work)
+{
+	(void)instance;
+	(void)work;
+	EasyAvatar_RunParallelTasks((struct EasyAvatar_ParallelState*)parameter);
+}
+
+unsigned int EasyAvatar_GetParallelism(void)
+{
+	static volatile LONG processors = 0;
+	if (!processors)
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		processors = info.dwNumberOfProcessors ? (LONG)info.dwNumberOfProcessors : 1;
+	}
+
+	return (unsigned int)processors;
+}
+
+void EasyAvatar_ParallelFor(unsigned int count, EasyAvatar_ParallelTask task, void* context)
+{
+	struct EasyAvatar_ParallelState state = { task, context, count, 0 };
+	if (count == 0)
+		return;
+
+	// The calling thread takes part as well, so one task never leaves the thread
+	unsigned int helpers = EasyAvatar_GetParallelism() - 1;
+	if (helpers > count - 1)
+		helpers = count - 1;
+
+	PTP_WORK work = helpers ? CreateThreadpoolWork(EasyAvatar_ParallelWork, &state, NULL) : NULL;
+	if (work)
+	{
+		for (unsigned int i = 0; i < helpers; i++)
+			SubmitThreadpoolWork(work);
+	}
+
+	EasyAvatar_RunParallelTasks(&state);
+
+	if (work)
+	{
+		// Every index has been taken at this point, callbacks that haven't started yet have nothing left to do.
+		// Cancelling them also keeps nested calls from waiting on a busy pool
+		WaitForThreadpoolWorkCallbacks(work, TRUE);
+		CloseThreadpoolWork(work);
+	}
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <Windows.h>
+
+typedef void(*EasyAvatar_ParallelTask)(unsigned int index, void* context);
+
+/*
+	Calls task once for every index in [0, count) spread over the Windows thread pool and the calling thread.
+	Returns once every call has finished, calls may be nested. Falls back to running everything on the calling thread if no work can be queued.
+*/
+void EasyAvatar_ParallelFor(unsigned int count, EasyAvatar_ParallelTask task, void* context);
+
+/*
+	Returns the number of logical processors, useful to decide how many pieces to split work into.
+*/
+unsigned int EasyAvatar_GetParallelism(void);
@@ -0,0 +1,380 @@
+#include "Worker.h"
+
+#include <stdlib.h>
+
+#include "EasyAvatar.h"
+#include "Prefetch.h"
+#include "../TeamSpeakSDK/teamspeak/public_errors.h"
+#include "../TeamSpeakSDK/ts3_functions.h"
+
+#define EASYAVATAR_MAIN_THREAD_CLASS "EasyAvatarMainThread"
+// Sent to the main thread window, lParam points to a struct EasyAvatar_MainThreadCall
+#define EASYAVATAR_WM_RUN (WM_APP + 1)
+
+enum EasyAvatar_JobType
+{
+	EASYAVATAR_JOB_SET_AVATAR,
+	// Speculative work for freshly copied clipboard content, never touches a server
+	EASYAVATAR_JOB_PREFETCH
+};
+
+struct EasyAvatar_Job
+{
+	enum EasyAvatar_JobType type;
+	uint64 serverConnectionHandlerID;
+	// Clipboard state when the job was queued, used to coalesce repeated triggers
+	DWORD clipboardSequence;
+	ULONGLONG queuedTick;
+	// Set from any thread, read by the worker between pipeline stages
+	volatile LONG cancelled;
+	struct EasyAvatar_Job* next;
+};
+
+static struct TS3Functions* workerTs3Functions = NULL;
+static HANDLE workerThread = NULL;
+static SRWLOCK queueLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE queueCondition = CONDITION_VARIABLE_INIT;
+// Jobs are processed in FIFO order, protected by queueLock
+static struct EasyAvatar_Job* queueHead = NULL;
+static struct EasyAvatar_Job* queueTail = NULL;
+// The job the worker is processing right now, protected by queueLock
+static struct EasyAvatar_Job* runningJob = NULL;
+static BOOL stopRequested = FALSE;
+// Message-only window owned by the client's main thread, where everything talking to a server runs
+static HWND mainThreadWindow = NULL;
+// Our DLL, the window class belongs to it rather than to the client's executable
+static HINSTANCE moduleInstance = NULL;
+
+struct EasyAvatar_MainThreadCall
+{
+	BOOL (*function)(void* context);
+	void* context;
+};
+
+static LRESULT CALLBACK EasyAvatar_MainThreadProc(HWND window, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	if (message == EASYAVATAR_WM_RUN)
+	{
+		struct EasyAvatar_MainThreadCall* call = (struct EasyAvatar_MainThreadCall*)lParam;
+		return call->function(call->context);
+	}
+
+	return DefWindowProcA(window, message, wParam, lParam);
+}
+
+BOOL EasyAvatar_RunOnMainThread(BOOL (*function)(void* context), void* context)
+{
+	if (!mainThreadWindow)
+		return FALSE;
+
+	// Blocks until the main thread ran it, so context may live on the caller's stack
+	struct EasyAvatar_MainThreadCall call = { function, context };
+	return (BOOL)SendMessageA(mainThreadWindow, EASYAVATAR_WM_RUN, 0, (LPARAM)&call);
+}
+
+static void EasyAvatar_RunJob(struct EasyAvatar_Job* job)
+{
+	struct TS3Functions* ts3Functions = workerTs3Functions;
+	uint64 serverConnectionHandlerID = job->serverConnectionHandlerID;
+
+	switch (job->type)
+	{
+	case EASYAVATAR_JOB_SET_AVATAR:
+		// If we fail setting the avatar, your Avatar becomes a 404 red image
+		// and subsequent attempts at setting a new image may have no effects, so we reset it
+		if (EasyAvatar_SetAvatar(serverConnectionHandlerID, ts3Functions))
+		{
+			ts3Functions->logMessage("Avatar job finished", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		}
+		else if (job->cancelled)
+		{
+			// A newer job replaces this one, don't touch the avatar
+			ts3Functions->logMessage("Avatar job cancelled", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		}
+		else
+		{
+			EasyAvatar_DeleteAvatar(serverConnectionHandlerID, ts3Functions);
+		}
+		break;
+	case EASYAVATAR_JOB_PREFETCH:
+		EasyAvatar_PrefetchAvatar(ts3Functions);
+		break;
+	}
+}
+
+static DWORD WINAPI EasyAvatar_WorkerMain(LPVOID parameter)
+{
+	(void)parameter;
+
+	for (;;)
+	{
+		AcquireSRWLockExclusive(&queueLock);
+		while (!queueHead && !stopRequested)
+			SleepConditionVariableSRW(&queueCondition, &queueLock, INFINITE, 0);
+
+		if (stopRequested)
+		{
+			ReleaseSRWLockExclusive(&queueLock);
+			break;
+		}
+
+		struct EasyAvatar_Job* job = queueHead;
+		queueHead = job->next;
+		if (!queueHead)
+			queueTail = NULL;
+		runningJob = job;
+		ReleaseSRWLockExclusive(&queueLock);
+
+		if (!job->cancelled)
+			EasyAvatar_RunJob(job);
+
+		AcquireSRWLockExclusive(&queueLock);
+		runningJob = NULL;
+		ReleaseSRWLockExclusive(&queueLock);
+
+		free(job);
+	}
+
+	return 0;
+}
+
+BOOL EasyAvatar_StartWorker(struct TS3Functions* ts3Functions)
+{
+	workerTs3Functions = ts3Functions;
+	stopRequested = FALSE;
+
+	// Doesn't take a reference, the DLL can't be unloaded while its own code is running
+	if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		(LPCSTR)EasyAvatar_StartWorker, &moduleInstance))
+	{
+		ts3Functions->logMessage("Failed to get the plugin's module handle", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, 0);
+		return FALSE;
+	}
+
+	HINSTANCE instance = moduleInstance;
+	WNDCLASSEXA windowClass = { 0 };
+	windowClass.cbSize = sizeof(windowClass);
+	windowClass.lpfnWndProc = EasyAvatar_MainThreadProc;
+	windowClass.hInstance = instance;
+	windowClass.lpszClassName = EASYAVATAR_MAIN_THREAD_CLASS;
+	RegisterClassExA(&windowClass);
+	mainThreadWindow = CreateWindowExA(0, EASYAVATAR_MAIN_THREAD_CLASS, NULL, 0, 0, 0, 0, 0, HWND_MESSAGE, NULL, instance, NULL);
+	if (!mainThreadWindow)
+	{
+		UnregisterClassA(EASYAVATAR_MAIN_THREAD_CLASS, instance);
+		ts3Functions->logMessage("Failed to create main thread window", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, 0);
+		return FALSE;
+	}
+
+	workerThread = CreateThread(NULL, 0, EasyAvatar_WorkerMain, NULL, 0, NULL);
+	if (!workerThread)
+	{
+		DestroyWindow(mainThreadWindow);
+		mainThreadWindow = NULL;
+		UnregisterClassA(EASYAVATAR_MAIN_THREAD_CLASS, instance);
+		ts3Functions->logMessage("Failed to start worker thread", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, 0);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void EasyAvatar_StopWorker(void)
+{
+	if (!workerThread)
+		return;
+
+	AcquireSRWLockExclusive(&queueLock);
+	stopRequested = TRUE;
+	ReleaseSRWLockExclusive(&queueLock);
+
+	// Make sure a running job bails out at its next checkpoint
+	EasyAvatar_CancelJobs();
+	WakeAllConditionVariable(&queueCondition);
+
+	// The job may be in the middle of an upload, which needs us to run it. Serve only those calls, nothing else of the client's
+	while (MsgWaitForMultipleObjects(1, &workerThread, FALSE, INFINITE, QS_SENDMESSAGE) == WAIT_OBJECT_0 + 1)
+	{
+		MSG message;
+		PeekMessageA(&message, NULL, 0, 0, PM_NOREMOVE | PM_QS_SENDMESSAGE);
+	}
+	CloseHandle(workerThread);
+	workerThread = NULL;
+
+	DestroyWindow(mainThreadWindow);
+	mainThreadWindow = NULL;
+	UnregisterClassA(EASYAVATAR_MAIN_THREAD_CLASS, moduleInstance);
+}
+
+// Caller must hold queueLock
+static BOOL EasyAvatar_IsDuplicateJob(const struct EasyAvatar_Job* existing, const struct EasyAvatar_Job* job)
+{
+	return existing && !existing->cancelled
+		&& existing->type == job->type
+		&& existing->serverConnectionHandlerID == job->serverConnectionHandlerID
+		&& existing->clipboardSequence == job->clipboardSequence
+		&& job->queuedTick - existing->queuedTick < EASYAVATAR_COALESCE_WINDOW_MS;
+}
+
+// Caller must hold queueLock
+static void EasyAvatar_DropQueuedJobsLocked(void)
+{
+	struct EasyAvatar_Job* job = queueHead;
+	while (job)
+	{
+		struct EasyAvatar_Job* next = job->next;
+		free(job);
+		job = next;
+	}
+	queueHead = NULL;
+	queueTail = NULL;
+}
+
+// Caller must hold queueLock
+static BOOL EasyAvatar_IsSupersededBy(const struct EasyAvatar_Job* existing, const struct EasyAvatar_Job* job)
+{
+	// Prefetches are all about the clipboard we are now about to use, avatar jobs on other servers go on undisturbed
+	if (existing->type == EASYAVATAR_JOB_PREFETCH)
+		return TRUE;
+	return existing->serverConnectionHandlerID == job->serverConnectionHandlerID;
+}
+
+// Caller must hold queueLock
+static void EasyAvatar_CancelSupersededJobsLocked(const struct EasyAvatar_Job* job)
+{
+	// Except a prefetch of the very clipboard content we want, it has a head start and we pick up its result once it's done
+	BOOL headStart = runningJob && runningJob->type == EASYAVATAR_JOB_PREFETCH && runningJob->clipboardSequence == job->clipboardSequence;
+	if (runningJob && !headStart && EasyAvatar_IsSupersededBy(runningJob, job))
+		InterlockedExchange(&runningJob->cancelled, TRUE);
+
+	struct EasyAvatar_Job** link = &queueHead;
+	queueTail = NULL;
+	while (*link)
+	{
+		struct EasyAvatar_Job* queued = *link;
+		if (EasyAvatar_IsSupersededBy(queued, job))
+		{
+			*link = queued->next;
+			free(queued);
+		}
+		else
+		{
+			queueTail = queued;
+			link = &queued->next;
+		}
+	}
+}
+
+// Caller must hold queueLock
+static void EasyAvatar_CancelJobsLocked(void)
+{
+	if (runningJob)
+		InterlockedExchange(&runningJob->cancelled, TRUE);
+
+	EasyAvatar_DropQueuedJobsLocked();
+}
+
+BOOL EasyAvatar_QueueSetAvatar(uint64 serverConnectionHandlerID)
+{
+	struct EasyAvatar_Job* job = (struct EasyAvatar_Job*)calloc(1, sizeof(struct EasyAvatar_Job));
+	if (!job)
+		return FALSE;
+
+	job->type = EASYAVATAR_JOB_SET_AVATAR;
+	job->serverConnectionHandlerID = serverConnectionHandlerID;
+	// Cheap way to tell whether the clipboard changed without opening it on the UI thread
+	job->clipboardSequence = GetClipboardSequenceNumber();
+	job->queuedTick = GetTickCount64();
+
+	AcquireSRWLockExclusive(&queueLock);
+	if (stopRequested)
+	{
+		ReleaseSRWLockExclusive(&queueLock);
+		free(job);
+		return FALSE;
+	}
+
+	// The hotkey callback fires twice, the second trigger must not restart the work of the first one
+	BOOL duplicate = EasyAvatar_IsDuplicateJob(runningJob, job);
+	for (struct EasyAvatar_Job* queued = queueHead; queued && !duplicate; queued = queued->next)
+		duplicate = EasyAvatar_IsDuplicateJob(queued, job);
+
+	if (duplicate)
+	{
+		ReleaseSRWLockExclusive(&queueLock);
+		workerTs3Functions->logMessage("Coalesced repeated avatar trigger", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		free(job);
+		return TRUE;
+	}
+
+	// The newest request for a server wins, whatever is still pending for it is outdated
+	EasyAvatar_CancelSupersededJobsLocked(job);
+
+	if (queueTail)
+		queueTail->next = job;
+	else
+		queueHead = job;
+	queueTail = job;
+	ReleaseSRWLockExclusive(&queueLock);
+
+	WakeConditionVariable(&queueCondition);
+	return TRUE;
+}
+
+// Caller must hold queueLock
+static BOOL EasyAvatar_HasAvatarJobLocked(void)
+{
+	if (runningJob && runningJob->type == EASYAVATAR_JOB_SET_AVATAR && !runningJob->cancelled)
+		return TRUE;
+
+	for (struct EasyAvatar_Job* queued = queueHead; queued; queued = queued->next)
+	{
+		if (queued->type == EASYAVATAR_JOB_SET_AVATAR)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+BOOL EasyAvatar_QueuePrefetch(void)
+{
+	struct EasyAvatar_Job* job = (struct EasyAvatar_Job*)calloc(1, sizeof(struct EasyAvatar_Job));
+	if (!job)
+		return FALSE;
+
+	job->type = EASYAVATAR_JOB_PREFETCH;
+	job->clipboardSequence = GetClipboardSequenceNumber();
+	job->queuedTick = GetTickCount64();
+
+	AcquireSRWLockExclusive(&queueLock);
+	// Speculation never gets in the way of an avatar the user actually asked for
+	if (stopRequested || EasyAvatar_HasAvatarJobLocked())
+	{
+		ReleaseSRWLockExclusive(&queueLock);
+		free(job);
+		return FALSE;
+	}
+
+	// At most one prefetch is in flight, the newest clipboard content wins
+	EasyAvatar_CancelJobsLocked();
+
+	queueHead = job;
+	queueTail = job;
+	ReleaseSRWLockExclusive(&queueLock);
+
+	WakeConditionVariable(&queueCondition);
+	return TRUE;
+}
+
+void EasyAvatar_CancelJobs(void)
+{
+	AcquireSRWLockExclusive(&queueLock);
+	EasyAvatar_CancelJobsLocked();
+	ReleaseSRWLockExclusive(&queueLock);
+}
+
+BOOL EasyAvatar_IsJobCancelled(void)
+{
+	// Only the worker thread calls this, so runningJob can't be freed underneath us
+	return runningJob && runningJob->cancelled;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <Windows.h>
+
+#include "../TeamSpeakSDK/teamspeak/public_definitions.h"
+
+struct TS3Functions;
+
+/*
+	Called once on initialization, on the client's main thread.
+	Starts the background thread that downloads, resizes and uploads avatars so the client's UI thread never blocks on it.
+*/
+BOOL EasyAvatar_StartWorker(struct TS3Functions* ts3Functions);
+
+/*
+	Called on shutdown, on the client's main thread.
+	Cancels all outstanding jobs and waits for the background thread to exit, still serving its EasyAvatar_RunOnMainThread calls meanwhile.
+*/
+void EasyAvatar_StopWorker(void);
+
+/*
+	Queues setting the avatar on the given server and returns immediately.
+	A newer request for the same server supersedes older ones, so its queued and running jobs get cancelled along with any prefetch.
+	Jobs for other servers are left alone and run in order.
+	A repeated trigger for the same server and unchanged clipboard is coalesced into the pending job instead.
+	Returns FALSE if the job could not be queued.
+*/
+BOOL EasyAvatar_QueueSetAvatar(uint64 serverConnectionHandlerID);
+
+/*
+	Queues preparing the avatar for the current clipboard content ahead of the hotkey and returns immediately.
+	Only one prefetch is in flight at a time, a newer one cancels it. Never interrupts a queued or running avatar job.
+	Returns FALSE if the job was not queued.
+*/
+BOOL EasyAvatar_QueuePrefetch(void);
+
+/*
+	Cancels the running job and drops every queued one.
+*/
+void EasyAvatar_CancelJobs(void);
+
+/*
+	Polled by the pipeline between its stages.
+	Returns TRUE if the job currently running on the worker thread has been cancelled.
+*/
+BOOL EasyAvatar_IsJobCancelled(void);
+
+/*
+	Worker thread only.
+	Runs function on the client's main thread, where the TeamSpeak functions changing our client on a server have to be called.
+	Blocks until it returned and returns its result, FALSE if the worker isn't running.
+*/
+BOOL EasyAvatar_RunOnMainThread(BOOL (*function)(void* context), void* context);
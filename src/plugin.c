@@ -9,18 +9,22 @@
 #include <Windows.h>
 #endif
 
-#pragma comment(lib, "Urlmon.lib")
+#pragma comment(lib, "Winhttp.lib")
+#pragma comment(lib, "Shell32.lib")
 #pragma comment(lib, "FreeImageLib.lib")
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <urlmon.h>
 #include "../TeamSpeakSDK/teamspeak/public_definitions.h"
 #include "../TeamSpeakSDK/ts3_functions.h"
 #include "plugin.h"
 #include "EasyAvatar.h"
+#include "AvatarCache.h"
+#include "ClipboardListener.h"
+#include "Prefetch.h"
+#include "Worker.h"
 
 #include "FreeImage.h"
 
@@ -120,6 +124,18 @@ int ts3plugin_init() {
 
 	FreeImage_Initialise(TRUE);
 
+	EasyAvatar_SetClipboardProvider(&EasyAvatar_WindowsClipboard);
+	if (!EasyAvatar_StartWorker(&ts3Functions))
+	{
+		// The client won't call ts3plugin_shutdown for a plugin that failed to load
+		FreeImage_DeInitialise();
+		return 1;
+	}
+
+	// Opt-in, it reads whatever gets copied. Without it everything simply starts when the hotkey is pressed
+	if (EasyAvatar_GetSetting(EASYAVATAR_SETTING_PREFETCH, FALSE))
+		EasyAvatar_StartClipboardListener(&ts3Functions);
+
 	ts3Functions.logMessage("Init successfull", LogLevel_INFO, EASYAVATAR_LOGCHANNEL, 0);
 
 	return 0;  /* 0 = success, 1 = failure, -2 = failure but client will not show a "failed to load" warning */
@@ -131,7 +147,13 @@ int ts3plugin_init() {
 /* Custom code called right before the plugin is unloaded */
 void ts3plugin_shutdown() {
 	/* Your plugin cleanup code here */
-	
+
+	// No new prefetch jobs while the worker shuts down
+	EasyAvatar_StopClipboardListener();
+	// Jobs may still be using FreeImage, wait for them before tearing it down
+	EasyAvatar_StopWorker();
+	EasyAvatar_DiscardPrefetchedAvatar();
+	EasyAvatar_CloseAvatarCache();
 	FreeImage_DeInitialise();
 
 	/*
@@ -273,6 +295,13 @@ enum {
 	MENU_ID_GLOBAL_2
 };
 
+/* Only offers the prefetch switch that changes something */
+static void EasyAvatar_UpdatePrefetchMenus(void) {
+	BOOL running = EasyAvatar_IsClipboardListenerRunning();
+	ts3Functions.setPluginMenuEnabled(pluginID, MENU_ID_GLOBAL_1, !running);
+	ts3Functions.setPluginMenuEnabled(pluginID, MENU_ID_GLOBAL_2, running);
+}
+
 /*
  * Initialize plugin menus.
  * This function is called after ts3plugin_init and ts3plugin_registerPluginID. A pluginID is required for plugin menus to work.
@@ -297,8 +326,10 @@ void ts3plugin_initMenus(struct PluginMenuItem*** menuItems, char** menuIcon) {
 	 * e.g. for "test_plugin.dll", icon "1.png" is loaded from <TeamSpeak 3 Client install dir>\plugins\test_plugin\1.png
 	 */
 
-	BEGIN_CREATE_MENUS(1);  /* IMPORTANT: Number of menu items must be correct! */
+	BEGIN_CREATE_MENUS(3);  /* IMPORTANT: Number of menu items must be correct! */
 	CREATE_MENU_ITEM(PLUGIN_MENU_TYPE_CLIENT,  MENU_ID_CLIENT_1,  "Set Image",  "1.png");
+	CREATE_MENU_ITEM(PLUGIN_MENU_TYPE_GLOBAL,  MENU_ID_GLOBAL_1,  "Prepare avatars when copying images",  "");
+	CREATE_MENU_ITEM(PLUGIN_MENU_TYPE_GLOBAL,  MENU_ID_GLOBAL_2,  "Stop preparing avatars when copying images",  "");
 	END_CREATE_MENUS;  /* Includes an assert checking if the number of menu items matched */
 
 	/*
@@ -317,6 +348,7 @@ void ts3plugin_initMenus(struct PluginMenuItem*** menuItems, char** menuIcon) {
 	 */
 	/* For example, this would disable MENU_ID_GLOBAL_2: */
 	/* ts3Functions.setPluginMenuEnabled(pluginID, MENU_ID_GLOBAL_2, 0); */
+	EasyAvatar_UpdatePrefetchMenus();
 
 	/* All memory allocated in this function will be automatically released by the TeamSpeak client later by calling ts3plugin_freeMemory */
 }
@@ -675,13 +707,25 @@ void ts3plugin_onMenuItemEvent(uint64 serverConnectionHandlerID, enum PluginMenu
 	if (type == PLUGIN_MENU_TYPE_CLIENT && menuItemID == MENU_ID_CLIENT_1)
 	{
 		ts3Functions.logMessage("Context Menu Callback", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, ts3Functions.getCurrentServerConnectionHandlerID());
-		// If we fail setting the avatar, your Avatar becomse a 404 red image
-		// and subsequent attempts at setting a new image may have no effects, so we reset it
-		if (!EasyAvatar_SetAvatar(serverConnectionHandlerID, &ts3Functions))
+		// The actual work happens on our worker thread so the client's UI doesn't freeze
+		if (!EasyAvatar_QueueSetAvatar(serverConnectionHandlerID))
 		{
-			EasyAvatar_DeleteAvatar(serverConnectionHandlerID, &ts3Functions);
+			ts3Functions.logMessage("Failed to queue avatar job", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		}
 	}
+	else if (type == PLUGIN_MENU_TYPE_GLOBAL && (menuItemID == MENU_ID_GLOBAL_1 || menuItemID == MENU_ID_GLOBAL_2))
+	{
+		BOOL enable = menuItemID == MENU_ID_GLOBAL_1;
+		if (enable)
+			EasyAvatar_StartClipboardListener(&ts3Functions);
+		else
+			EasyAvatar_StopClipboardListener();
+
+		// Remembered even if the listener failed to start, so it is tried again next time
+		if (!EasyAvatar_StoreSetting(EASYAVATAR_SETTING_PREFETCH, enable))
+			ts3Functions.logMessage("Failed to save settings", LogLevel_WARNING, EASYAVATAR_LOGCHANNEL, 0);
+		EasyAvatar_UpdatePrefetchMenus();
+	}
 }
 
 /* This function is called if a plugin hotkey was pressed. Omit if hotkeys are unused. */
@@ -689,12 +733,12 @@ void ts3plugin_onHotkeyEvent(const char* keyword)
 {
 	if (strncmp(keyword, "ez_set_avatar", 13) == 0)
 	{
-		ts3Functions.logMessage("Plugin Hotkey Callback", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, ts3Functions.getCurrentServerConnectionHandlerID());
-		// If we fail setting the avatar, your Avatar becomse a 404 red image
-		// and subsequent attempts at setting a new image may have no effects, so we reset it
-		if (!EasyAvatar_SetAvatar(ts3Functions.getCurrentServerConnectionHandlerID(), &ts3Functions))
+		uint64 serverConnectionHandlerID = ts3Functions.getCurrentServerConnectionHandlerID();
+		ts3Functions.logMessage("Plugin Hotkey Callback", LogLevel_DEBUG, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
+		// The actual work happens on our worker thread so the client's UI doesn't freeze
+		if (!EasyAvatar_QueueSetAvatar(serverConnectionHandlerID))
 		{
-			EasyAvatar_DeleteAvatar(ts3Functions.getCurrentServerConnectionHandlerID(), &ts3Functions);
+			ts3Functions.logMessage("Failed to queue avatar job", LogLevel_ERROR, EASYAVATAR_LOGCHANNEL, serverConnectionHandlerID);
 		}
 	}
 }
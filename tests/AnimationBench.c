@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Animation.h"
+#include "Bench.h"
+#include "EasyAvatar.h"
+#include "Hash.h"
+#include "ImageIO.h"
+#include "ImageProbe.h"
+
+// The synthetic animation: a square sliding over a still background, like most reaction GIFs
+#define EASYAVATAR_BENCH_FRAMES 120
+#define EASYAVATAR_BENCH_WIDTH 480
+#define EASYAVATAR_BENCH_HEIGHT 360
+#define EASYAVATAR_BENCH_SQUARE 48
+
+static FIBITMAP* EasyAvatar_BuildBenchFrame(unsigned int frame)
+{
+	FIBITMAP* dib = FreeImage_Allocate(EASYAVATAR_BENCH_WIDTH, EASYAVATAR_BENCH_HEIGHT, 8, 0, 0, 0);
+	if (!dib)
+		return NULL;
+
+	// Index 255 is the square, everything below a blue to green background
+	RGBQUAD* palette = FreeImage_GetPalette(dib);
+	for (unsigned int i = 0; i < 255; i++)
+	{
+		palette[i].rgbRed = 32;
+		palette[i].rgbGreen = (BYTE)i;
+		palette[i].rgbBlue = (BYTE)(255 - i);
+	}
+	palette[255].rgbRed = 255;
+	palette[255].rgbGreen = palette[255].rgbBlue = 0;
+
+	unsigned int left = frame * (EASYAVATAR_BENCH_WIDTH - EASYAVATAR_BENCH_SQUARE) / (EASYAVATAR_BENCH_FRAMES - 1);
+	unsigned int top = (EASYAVATAR_BENCH_HEIGHT - EASYAVATAR_BENCH_SQUARE) / 2;
+	for (unsigned int y = 0; y < EASYAVATAR_BENCH_HEIGHT; y++)
+	{
+		BYTE* row = FreeImage_GetScanLine(dib, y);
+		for (unsigned int x = 0; x < EASYAVATAR_BENCH_WIDTH; x++)
+		{
+			BOOL square = x >= left && x < left + EASYAVATAR_BENCH_SQUARE && y >= top && y < top + EASYAVATAR_BENCH_SQUARE;
+			row[x] = square ? 255 : (BYTE)((x + y) * 254 / (EASYAVATAR_BENCH_WIDTH + EASYAVATAR_BENCH_HEIGHT - 2));
+		}
+	}
+	return dib;
+}
+
+/*
+	Encodes the synthetic animation as a GIF in memory. FreeImage can only append pages to an existing multipage bitmap,
+	so the first frame is saved on its own and loaded back as one. The caller owns the returned buffer.
+*/
+static BYTE* EasyAvatar_BuildBenchGIF(size_t* size)
+{
+	BYTE* result = NULL;
+	FIMEMORY* first = FreeImage_OpenMemory(NULL, 0);
+	FIMEMORY* output = FreeImage_OpenMemory(NULL, 0);
+	FIBITMAP* frame = EasyAvatar_BuildBenchFrame(0);
+	FIMULTIBITMAP* multiBitmap = NULL;
+	if (first && output && frame && FreeImage_SaveToMemory(FIF_GIF, frame, first, 0))
+	{
+		FreeImage_SeekMemory(first, 0, SEEK_SET);
+		multiBitmap = FreeImage_LoadMultiBitmapFromMemory(FIF_GIF, first, 0);
+	}
+	if (frame)
+		FreeImage_Unload(frame);
+
+	if (multiBitmap)
+	{
+		BOOL complete = TRUE;
+		for (unsigned int i = 1; complete && i < EASYAVATAR_BENCH_FRAMES; i++)
+		{
+			frame = EasyAvatar_BuildBenchFrame(i);
+			complete = frame != NULL;
+			if (frame)
+			{
+				FreeImage_AppendPage(multiBitmap, frame);
+				FreeImage_Unload(frame);
+			}
+		}
+
+		BYTE* data = NULL;
+		DWORD dataSize = 0;
+		if (complete && FreeImage_SaveMultiBitmapToMemory(FIF_GIF, multiBitmap, output, 0)
+			&& FreeImage_AcquireMemory(output, &data, &dataSize) && dataSize > 0)
+		{
+			result = (BYTE*)malloc(dataSize);
+			if (result)
+			{
+				memcpy(result, data, dataSize);
+				*size = dataSize;
+			}
+		}
+		FreeImage_CloseMultiBitmap(multiBitmap, 0);
+	}
+
+	if (output)
+		FreeImage_CloseMemory(output);
+	if (first)
+		FreeImage_CloseMemory(first);
+	return result;
+}
+
+/*
+	Resizes the GIF in data to an avatar, checks the result is a GIF within the avatar size and budget whose digest matches,
+	and prints the time per resize. Returns the number of rounds that failed.
+*/
+static int EasyAvatar_BenchAnimation(const char* name, BYTE* data, size_t size, int rounds)
+{
+	FreeImageIO io;
+	struct EasyAvatar_MemoryReader reader;
+	struct EasyAvatar_ImageInfo info;
+	EasyAvatar_OpenMemoryReader(&reader, &io, data, size);
+	if (!EasyAvatar_ProbeImage(&io, &reader, &info) || info.format != FIF_GIF)
+	{
+		fprintf(stderr, "%s is not a GIF\n", name);
+		return 1;
+	}
+
+	int failures = 0;
+	double seconds = 0.0;
+	size_t resultSize = 0;
+	struct EasyAvatar_ImageInfo resultInfo = { 0 };
+	for (int round = 0; round < rounds; round++)
+	{
+		BYTE digest[MD5LEN];
+		double start = EasyAvatar_BenchSeconds();
+		BYTE* result = EasyAvatar_ResizeAnimation(data, size, EASYAVATAR_MAX_FILESIZE, &resultSize, digest);
+		seconds += EasyAvatar_BenchSeconds() - start;
+		if (!result)
+		{
+			failures++;
+			continue;
+		}
+
+		BYTE expected[MD5LEN];
+		struct EasyAvatar_MD5Context context;
+		EasyAvatar_MD5Init(&context);
+		EasyAvatar_MD5Update(&context, result, resultSize);
+		EasyAvatar_MD5Final(&context, expected);
+
+		EasyAvatar_OpenMemoryReader(&reader, &io, result, resultSize);
+		if (resultSize > EASYAVATAR_MAX_FILESIZE || memcmp(digest, expected, MD5LEN) != 0 || !EasyAvatar_ProbeImage(&io, &reader, &resultInfo)
+			|| resultInfo.format != FIF_GIF || resultInfo.width > EASYAVATAR_MAX_DIMENSION || resultInfo.height > EASYAVATAR_MAX_DIMENSION)
+			failures++;
+		free(result);
+	}
+
+	printf("%s, %ux%u %u frames %zu KB to %ux%u %u frames %zu KB: %8.2f ms\n", name, info.width, info.height, info.frameCount, size / 1024,
+		resultInfo.width, resultInfo.height, resultInfo.frameCount, resultSize / 1024, seconds * 1000.0 / rounds);
+	return failures;
+}
+
+/*
+	Usage: AnimationBench [rounds] [gif...]
+	Resizes every GIF to an avatar within 200KB with EasyAvatar_ResizeAnimation, checks the result and prints the time per GIF.
+	Without GIFs a synthetic 120 frame 480x360 animation is used.
+*/
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 5;
+	if (rounds <= 0)
+		return 1;
+
+	FreeImage_Initialise(FALSE);
+	int failures = 0;
+	if (argc > 2)
+	{
+		for (int i = 2; i < argc; i++)
+		{
+			size_t size = 0;
+			BYTE* data = EasyAvatar_ReadBenchFile(argv[i], &size);
+			if (!data)
+			{
+				fprintf(stderr, "Could not load %s\n", argv[i]);
+				failures++;
+				continue;
+			}
+			failures += EasyAvatar_BenchAnimation(argv[i], data, size, rounds);
+			free(data);
+		}
+	}
+	else
+	{
+		size_t size = 0;
+		BYTE* data = EasyAvatar_BuildBenchGIF(&size);
+		failures += data ? EasyAvatar_BenchAnimation("synthetic animation", data, size, rounds) : 1;
+		free(data);
+	}
+	FreeImage_DeInitialise();
+
+	if (failures)
+		fprintf(stderr, "%d resizes failed\n", failures);
+	return failures ? 1 : 0;
+}
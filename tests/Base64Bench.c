@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Base64.h"
+#include "Bench.h"
+
+/*
+	The decoder the plugin shipped with before the SIMD one, kept as the baseline.
+	Characters outside the alphabet silently decode to zero.
+*/
+static const unsigned char baseline_decoding_table[256] = {
+	['A'] = 0x00, ['B'] = 0x01, ['C'] = 0x02, ['D'] = 0x03, ['E'] = 0x04, ['F'] = 0x05, ['G'] = 0x06, ['H'] = 0x07,
+	['I'] = 0x08, ['J'] = 0x09, ['K'] = 0x0a, ['L'] = 0x0b, ['M'] = 0x0c, ['N'] = 0x0d, ['O'] = 0x0e, ['P'] = 0x0f,
+	['Q'] = 0x10, ['R'] = 0x11, ['S'] = 0x12, ['T'] = 0x13, ['U'] = 0x14, ['V'] = 0x15, ['W'] = 0x16, ['X'] = 0x17,
+	['Y'] = 0x18, ['Z'] = 0x19, ['a'] = 0x1a, ['b'] = 0x1b, ['c'] = 0x1c, ['d'] = 0x1d, ['e'] = 0x1e, ['f'] = 0x1f,
+	['g'] = 0x20, ['h'] = 0x21, ['i'] = 0x22, ['j'] = 0x23, ['k'] = 0x24, ['l'] = 0x25, ['m'] = 0x26, ['n'] = 0x27,
+	['o'] = 0x28, ['p'] = 0x29, ['q'] = 0x2a, ['r'] = 0x2b, ['s'] = 0x2c, ['t'] = 0x2d, ['u'] = 0x2e, ['v'] = 0x2f,
+	['w'] = 0x30, ['x'] = 0x31, ['y'] = 0x32, ['z'] = 0x33, ['0'] = 0x34, ['1'] = 0x35, ['2'] = 0x36, ['3'] = 0x37,
+	['4'] = 0x38, ['5'] = 0x39, ['6'] = 0x3a, ['7'] = 0x3b, ['8'] = 0x3c, ['9'] = 0x3d, ['+'] = 0x3e, ['/'] = 0x3f };
+
+static BYTE* EasyAvatar_b64decodeBaseline(const char* data, size_t input_length, size_t* output_length)
+{
+	if (input_length % 4 != 0)
+		return NULL;
+
+	*output_length = input_length / 4 * 3;
+
+	if (data[input_length - 1] == '=') (*output_length)--;
+	if (data[input_length - 2] == '=') (*output_length)--;
+
+	unsigned char* decoded_data = (unsigned char*)malloc(*output_length);
+
+	if (decoded_data == NULL)
+		return NULL;
+
+	for (size_t i = 0, j = 0; i < input_length;) {
+
+		unsigned int sextet_a = data[i] == '=' ? 0 & i++ : baseline_decoding_table[(unsigned char)data[i++]];
+		unsigned int sextet_b = data[i] == '=' ? 0 & i++ : baseline_decoding_table[(unsigned char)data[i++]];
+		unsigned int sextet_c = data[i] == '=' ? 0 & i++ : baseline_decoding_table[(unsigned char)data[i++]];
+		unsigned int sextet_d = data[i] == '=' ? 0 & i++ : baseline_decoding_table[(unsigned char)data[i++]];
+
+		unsigned int triple = (sextet_a << 3 * 6)
+			+ (sextet_b << 2 * 6)
+			+ (sextet_c << 1 * 6)
+			+ (sextet_d << 0 * 6);
+
+		if (j < *output_length) decoded_data[j++] = (triple >> 2 * 8) & 0xFF;
+		if (j < *output_length) decoded_data[j++] = (triple >> 1 * 8) & 0xFF;
+		if (j < *output_length) decoded_data[j++] = (triple >> 0 * 8) & 0xFF;
+
+	}
+
+	return decoded_data;
+}
+
+/*
+	Usage: Base64Bench [megabytes] [rounds]
+	Decodes the same random payload with the baseline decoder, the block decoder and the text decoder data URIs go through,
+	checks that all of them agree and prints the throughput in GB/s of base64 text.
+*/
+int main(int argc, char** argv)
+{
+	size_t megabytes = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 16;
+	int rounds = argc > 2 ? atoi(argv[2]) : 5;
+	if (megabytes == 0 || rounds <= 0)
+		return 1;
+
+	// An odd size leaves padding in the last group
+	size_t size = megabytes * 1024 * 1024 + 1;
+	BYTE* payload = (BYTE*)malloc(size);
+	if (!payload)
+		return 1;
+
+	unsigned int state = 12345;
+	for (size_t i = 0; i < size; i++)
+	{
+		state = state * 1103515245u + 12345u;
+		payload[i] = (BYTE)(state >> 16);
+	}
+
+	char* text = EasyAvatar_b64encode(payload, size);
+	size_t textLength = text ? strlen(text) : 0;
+	BYTE* output = (BYTE*)malloc(textLength / 4 * 3 + 3);
+	if (!text || !output)
+		return 1;
+
+	double baseline = 0.0;
+	double blocks = 0.0;
+	double decodeText = 0.0;
+	int failures = 0;
+	for (int round = 0; round < rounds; round++)
+	{
+		double start = EasyAvatar_BenchSeconds();
+		size_t baselineSize = 0;
+		BYTE* baselineData = EasyAvatar_b64decodeBaseline(text, textLength, &baselineSize);
+		baseline += EasyAvatar_BenchSeconds() - start;
+		failures += !baselineData || baselineSize != size || memcmp(baselineData, payload, size) != 0;
+		free(baselineData);
+
+		// Everything but the padded last group
+		memset(output, 0, size);
+		start = EasyAvatar_BenchSeconds();
+		size_t consumed = EasyAvatar_b64decodeBlocks(text, textLength, output);
+		blocks += EasyAvatar_BenchSeconds() - start;
+		failures += consumed != textLength - 4 || memcmp(output, payload, consumed / 4 * 3) != 0;
+
+		memset(output, 0, size);
+		start = EasyAvatar_BenchSeconds();
+		size_t decoded = EasyAvatar_b64decodeText(text, textLength, output);
+		decodeText += EasyAvatar_BenchSeconds() - start;
+		failures += decoded != size || memcmp(output, payload, size) != 0;
+	}
+
+	double gigabytes = (double)textLength * rounds / 1e9;
+	printf("%zu MB of base64 text, %d rounds\n", textLength / (1024 * 1024), rounds);
+	printf("baseline decoder      %6.2f GB/s\n", gigabytes / baseline);
+	printf("b64decodeBlocks       %6.2f GB/s\n", gigabytes / blocks);
+	printf("b64decodeText         %6.2f GB/s\n", gigabytes / decodeText);
+
+	free(output);
+	free(text);
+	free(payload);
+	if (failures)
+		fprintf(stderr, "decoders disagree in %d cases\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+/*
+	Monotonic time in seconds for the benchmarks.
+*/
+static inline double EasyAvatar_BenchSeconds(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+#endif
+}
+
+/*
+	Reads the whole file at path into a new buffer the caller frees, NULL if it can't be read or is empty.
+*/
+static inline unsigned char* EasyAvatar_ReadBenchFile(const char* path, size_t* size)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return NULL;
+
+	unsigned char* data = NULL;
+	long length = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+	if (length > 0 && fseek(file, 0, SEEK_SET) == 0)
+	{
+		data = (unsigned char*)malloc((size_t)length);
+		if (data && fread(data, 1, (size_t)length, file) != (size_t)length)
+		{
+			free(data);
+			data = NULL;
+		}
+		*size = (size_t)length;
+	}
+	fclose(file);
+	return data;
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdio.h>
+
+/*
+	Minimal test helpers, a failed check is reported and counted but the test keeps going.
+	main returns EASYAVATAR_TEST_RESULT so CTest sees the failure.
+*/
+static int EasyAvatar_TestFailures = 0;
+
+#define EASYAVATAR_CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			EasyAvatar_TestFailures++; \
+		} \
+	} while (0)
+
+#define EASYAVATAR_TEST_RESULT (EasyAvatar_TestFailures == 0 ? 0 : 1)
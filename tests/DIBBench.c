@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Bench.h"
+#include "DIB.h"
+#include "TestDIB.h"
+
+/*
+	Fills rows of the given bit count with a pattern the pixel at x, y can be recomputed from.
+	32 bit pixels get a varying alpha, 8 bit pixels index a grey palette.
+*/
+static BYTE* EasyAvatar_BuildBenchPixels(int width, int height, unsigned int bitCount, size_t* size)
+{
+	size_t pitch = ((size_t)width * bitCount + 31) / 32 * 4;
+	*size = pitch * (size_t)height;
+	BYTE* pixels = (BYTE*)calloc(*size, 1);
+	if (!pixels)
+		return NULL;
+
+	for (int y = 0; y < height; y++)
+	{
+		BYTE* row = pixels + (size_t)y * pitch;
+		for (int x = 0; x < width; x++)
+		{
+			if (bitCount == 8)
+			{
+				row[x] = (BYTE)(x + y);
+				continue;
+			}
+
+			BYTE* pixel = row + (size_t)x * (bitCount / 8);
+			pixel[0] = (BYTE)x;
+			pixel[1] = (BYTE)y;
+			pixel[2] = (BYTE)(x ^ y);
+			if (bitCount == 32)
+				pixel[3] = (BYTE)(x + y) | 1;
+		}
+	}
+	return pixels;
+}
+
+/*
+	Checks a few pixels, y counts rows in the order the DIB stores them.
+*/
+static BOOL EasyAvatar_CheckBenchBitmap(FIBITMAP* dib, int width, int height, unsigned int bitCount, BOOL topDown)
+{
+	if (!dib || FreeImage_GetWidth(dib) != (unsigned int)width || FreeImage_GetHeight(dib) != (unsigned int)height)
+		return FALSE;
+
+	unsigned int bytesPerPixel = FreeImage_GetBPP(dib) / 8;
+	for (int y = 0; y < height; y += height / 7 + 1)
+	{
+		const BYTE* row = FreeImage_GetScanLine(dib, topDown ? height - 1 - y : y);
+		for (int x = 0; x < width; x += width / 7 + 1)
+		{
+			const BYTE* pixel = row + (size_t)x * bytesPerPixel;
+			BYTE grey = (BYTE)(x + y);
+			BYTE blue = bitCount == 8 ? grey : (BYTE)x;
+			BYTE green = bitCount == 8 ? grey : (BYTE)y;
+			BYTE red = bitCount == 8 ? grey : (BYTE)(x ^ y);
+			if (pixel[FI_RGBA_BLUE] != blue || pixel[FI_RGBA_GREEN] != green || pixel[FI_RGBA_RED] != red)
+				return FALSE;
+			if (bitCount == 32 && (bytesPerPixel != 4 || pixel[FI_RGBA_ALPHA] != (BYTE)(grey | 1)))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+static int EasyAvatar_BenchDIB(const char* name, unsigned int headerSize, int width, int height, unsigned int bitCount, BOOL topDown, int rounds)
+{
+	size_t pixelBytes = 0;
+	BYTE* pixels = EasyAvatar_BuildBenchPixels(width, height, bitCount, &pixelBytes);
+	RGBQUAD palette[256];
+	for (unsigned int i = 0; i < 256; i++)
+	{
+		palette[i].rgbBlue = palette[i].rgbGreen = palette[i].rgbRed = (BYTE)i;
+		palette[i].rgbReserved = 0;
+	}
+
+	// 32 bit DIBs carry their alpha mask in a BITMAPV5HEADER like the ones browsers put on the clipboard
+	struct EasyAvatar_TestDIB dib = { headerSize, width, topDown ? -height : height, bitCount, bitCount == 32 ? 3u : 0u,
+		bitCount == 32 ? 4u : 0u, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 },
+		bitCount == 8 ? 256u : 0u, palette, pixels, pixelBytes };
+	size_t size = 0;
+	BYTE* data = pixels ? EasyAvatar_BuildDIB(&dib, &size) : NULL;
+	free(pixels);
+	if (!data)
+		return 1;
+
+	int failures = 0;
+	double seconds = 0.0;
+	for (int round = 0; round < rounds; round++)
+	{
+		double start = EasyAvatar_BenchSeconds();
+		FIBITMAP* bitmap = EasyAvatar_LoadDIB(data, size);
+		seconds += EasyAvatar_BenchSeconds() - start;
+		failures += !EasyAvatar_CheckBenchBitmap(bitmap, width, height, bitCount, topDown);
+		if (bitmap)
+			FreeImage_Unload(bitmap);
+	}
+	free(data);
+
+	double megapixels = (double)width * height * rounds / 1e6;
+	printf("%-28s %8.2f ms %8.1f MP/s\n", name, seconds * 1000.0 / rounds, megapixels / seconds);
+	return failures;
+}
+
+/*
+	Usage: DIBBench [width] [height] [rounds]
+	Converts synthetic clipboard DIBs of the given size with EasyAvatar_LoadDIB, checks the result and prints the time per image.
+	The default is a 4032x3024 phone photo pasted from a screenshot tool or browser.
+*/
+int main(int argc, char** argv)
+{
+	int width = argc > 1 ? atoi(argv[1]) : 4032;
+	int height = argc > 2 ? atoi(argv[2]) : 3024;
+	int rounds = argc > 3 ? atoi(argv[3]) : 5;
+	if (width <= 0 || height <= 0 || rounds <= 0)
+		return 1;
+
+	printf("%dx%d, %d rounds\n", width, height, rounds);
+	int failures = 0;
+	failures += EasyAvatar_BenchDIB("24 bit bottom-up", EASYAVATAR_TEST_INFO_HEADER, width, height, 24, FALSE, rounds);
+	failures += EasyAvatar_BenchDIB("24 bit top-down", EASYAVATAR_TEST_INFO_HEADER, width, height, 24, TRUE, rounds);
+	failures += EasyAvatar_BenchDIB("32 bit V5 alpha bitfields", EASYAVATAR_TEST_V5_HEADER, width, height, 32, FALSE, rounds);
+	failures += EasyAvatar_BenchDIB("8 bit palette", EASYAVATAR_TEST_INFO_HEADER, width, height, 8, FALSE, rounds);
+
+	if (failures)
+		fprintf(stderr, "%d conversions gave the wrong pixels\n", failures);
+	return failures ? 1 : 0;
+}
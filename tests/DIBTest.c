@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Check.h"
+#include "DIB.h"
+#include "TestDIB.h"
+
+static FIBITMAP* EasyAvatar_LoadTestDIB(const struct EasyAvatar_TestDIB* dib)
+{
+	size_t size = 0;
+	BYTE* data = EasyAvatar_BuildDIB(dib, &size);
+	FIBITMAP* bitmap = data ? EasyAvatar_LoadDIB(data, size) : NULL;
+	free(data);
+	return bitmap;
+}
+
+/*
+	Checks the pixel x, y counted from the top of the image, FreeImage keeps its rows bottom-up.
+*/
+static BOOL EasyAvatar_HasPixel(FIBITMAP* dib, unsigned int x, unsigned int y, BYTE red, BYTE green, BYTE blue, int alpha)
+{
+	unsigned int bytesPerPixel = FreeImage_GetBPP(dib) / 8;
+	const BYTE* pixel = FreeImage_GetScanLine(dib, (int)(FreeImage_GetHeight(dib) - 1 - y)) + x * bytesPerPixel;
+	if (pixel[FI_RGBA_RED] != red || pixel[FI_RGBA_GREEN] != green || pixel[FI_RGBA_BLUE] != blue)
+		return FALSE;
+	return alpha < 0 || (bytesPerPixel == 4 && pixel[FI_RGBA_ALPHA] == alpha);
+}
+
+// 2x2 image, top row red and green, bottom row blue and white, stored as BGR rows padded to 8 bytes
+static const BYTE EASYAVATAR_TEST_TOP_ROW_24[8] = { 0, 0, 255, 0, 255, 0, 0, 0 };
+static const BYTE EASYAVATAR_TEST_BOTTOM_ROW_24[8] = { 255, 0, 0, 255, 255, 255, 0, 0 };
+
+static void EasyAvatar_CheckTestImage(FIBITMAP* dib, int alpha)
+{
+	EASYAVATAR_CHECK(dib != NULL);
+	if (!dib)
+		return;
+
+	EASYAVATAR_CHECK(FreeImage_GetWidth(dib) == 2 && FreeImage_GetHeight(dib) == 2);
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 0, 0, 255, 0, 0, alpha));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 1, 0, 0, 255, 0, alpha));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 0, 1, 0, 0, 255, alpha));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 1, 1, 255, 255, 255, alpha));
+	FreeImage_Unload(dib);
+}
+
+static void EasyAvatar_TestBottomUp(void)
+{
+	BYTE pixels[16];
+	memcpy(pixels, EASYAVATAR_TEST_BOTTOM_ROW_24, 8);
+	memcpy(pixels + 8, EASYAVATAR_TEST_TOP_ROW_24, 8);
+	struct EasyAvatar_TestDIB dib = { EASYAVATAR_TEST_INFO_HEADER, 2, 2, 24, 0, 0, { 0 }, 0, NULL, pixels, sizeof(pixels) };
+
+	FIBITMAP* bitmap = EasyAvatar_LoadTestDIB(&dib);
+	EASYAVATAR_CHECK(bitmap && FreeImage_GetBPP(bitmap) == 24);
+	EasyAvatar_CheckTestImage(bitmap, -1);
+}
+
+static void EasyAvatar_TestTopDown(void)
+{
+	// A negative height stores the top row first
+	BYTE pixels[16];
+	memcpy(pixels, EASYAVATAR_TEST_TOP_ROW_24, 8);
+	memcpy(pixels + 8, EASYAVATAR_TEST_BOTTOM_ROW_24, 8);
+	struct EasyAvatar_TestDIB dib = { EASYAVATAR_TEST_INFO_HEADER, 2, -2, 24, 0, 0, { 0 }, 0, NULL, pixels, sizeof(pixels) };
+
+	EasyAvatar_CheckTestImage(EasyAvatar_LoadTestDIB(&dib), -1);
+}
+
+static void EasyAvatar_TestBitfields565(void)
+{
+	// BI_BITFIELDS with 5-6-5 masks behind a BITMAPINFOHEADER, rows of two pixels need no padding
+	const WORD red = 0xF800;
+	const WORD green = 0x07E0;
+	const WORD blue = 0x001F;
+	const WORD white = 0xFFFF;
+	BYTE pixels[8];
+	EasyAvatar_Write16(pixels, blue);
+	EasyAvatar_Write16(pixels + 2, white);
+	EasyAvatar_Write16(pixels + 4, red);
+	EasyAvatar_Write16(pixels + 6, green);
+	struct EasyAvatar_TestDIB dib = { EASYAVATAR_TEST_INFO_HEADER, 2, 2, 16, 3, 3, { red, green, blue, 0 }, 0, NULL, pixels, sizeof(pixels) };
+
+	EasyAvatar_CheckTestImage(EasyAvatar_LoadTestDIB(&dib), -1);
+}
+
+static void EasyAvatar_TestBitfieldsV5Alpha(void)
+{
+	// BITMAPV5HEADER with RGBA byte order masks, the way some browsers put images on the clipboard
+	BYTE pixels[16] =
+	{
+		0, 0, 255, 255, 255, 255, 255, 255,
+		255, 0, 0, 128, 0, 255, 0, 255
+	};
+	struct EasyAvatar_TestDIB dib = { EASYAVATAR_TEST_V5_HEADER, 2, 2, 32, 3, 4,
+		{ 0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000 }, 0, NULL, pixels, sizeof(pixels) };
+
+	FIBITMAP* bitmap = EasyAvatar_LoadTestDIB(&dib);
+	EASYAVATAR_CHECK(bitmap && FreeImage_GetBPP(bitmap) == 32);
+	if (!bitmap)
+		return;
+
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 0, 0, 255, 0, 0, 128));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 1, 0, 0, 255, 0, 255));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 0, 1, 0, 0, 255, 255));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 1, 1, 255, 255, 255, 255));
+	FreeImage_Unload(bitmap);
+}
+
+static void EasyAvatar_TestUnsetAlpha(void)
+{
+	// Plain 32 bit BI_RGB where nobody filled in the fourth byte has to come out opaque, not invisible
+	BYTE pixels[16] =
+	{
+		255, 0, 0, 0, 255, 255, 255, 0,
+		0, 0, 255, 0, 0, 255, 0, 0
+	};
+	struct EasyAvatar_TestDIB dib = { EASYAVATAR_TEST_V5_HEADER, 2, 2, 32, 0, 0, { 0 }, 0, NULL, pixels, sizeof(pixels) };
+
+	EasyAvatar_CheckTestImage(EasyAvatar_LoadTestDIB(&dib), 255);
+}
+
+static void EasyAvatar_TestPalettes(void)
+{
+	const RGBQUAD palette[4] =
+	{
+		{ 0, 0, 255, 0 },
+		{ 0, 255, 0, 0 },
+		{ 255, 0, 0, 0 },
+		{ 255, 255, 255, 0 }
+	};
+
+	// 8 bit, one index per byte, bottom row first
+	const BYTE pixels8[8] = { 2, 3, 0, 0, 0, 1, 0, 0 };
+	struct EasyAvatar_TestDIB dib8 = { EASYAVATAR_TEST_INFO_HEADER, 2, 2, 8, 0, 0, { 0 }, 4, palette, pixels8, sizeof(pixels8) };
+	EasyAvatar_CheckTestImage(EasyAvatar_LoadTestDIB(&dib8), -1);
+
+	// 4 bit, the first pixel sits in the high nibble
+	const BYTE pixels4[8] = { 0x23, 0, 0, 0, 0x01, 0, 0, 0 };
+	struct EasyAvatar_TestDIB dib4 = { EASYAVATAR_TEST_INFO_HEADER, 2, 2, 4, 0, 0, { 0 }, 4, palette, pixels4, sizeof(pixels4) };
+	EasyAvatar_CheckTestImage(EasyAvatar_LoadTestDIB(&dib4), -1);
+
+	// 1 bit, the first pixel sits in the highest bit
+	const RGBQUAD blackAndWhite[2] = { { 0, 0, 0, 0 }, { 255, 255, 255, 0 } };
+	const BYTE pixels1[8] = { 0x80, 0, 0, 0, 0x40, 0, 0, 0 };
+	struct EasyAvatar_TestDIB dib1 = { EASYAVATAR_TEST_INFO_HEADER, 2, 2, 1, 0, 0, { 0 }, 2, blackAndWhite, pixels1, sizeof(pixels1) };
+	size_t size = 0;
+	BYTE* data = EasyAvatar_BuildDIB(&dib1, &size);
+	EASYAVATAR_CHECK(data != NULL);
+	if (!data)
+		return;
+
+	// A biClrUsed of 0 means the full palette of 2 entries
+	EasyAvatar_Write32(data + 32, 0);
+	FIBITMAP* bitmap = EasyAvatar_LoadDIB(data, size);
+	free(data);
+	EASYAVATAR_CHECK(bitmap != NULL);
+	if (!bitmap)
+		return;
+
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 0, 0, 0, 0, 0, -1));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 1, 0, 255, 255, 255, -1));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 0, 1, 255, 255, 255, -1));
+	EASYAVATAR_CHECK(EasyAvatar_HasPixel(bitmap, 1, 1, 0, 0, 0, -1));
+	FreeImage_Unload(bitmap);
+}
+
+static void EasyAvatar_TestMalformed(void)
+{
+	BYTE pixels[16];
+	memcpy(pixels, EASYAVATAR_TEST_BOTTOM_ROW_24, 8);
+	memcpy(pixels + 8, EASYAVATAR_TEST_TOP_ROW_24, 8);
+	struct EasyAvatar_TestDIB dib = { EASYAVATAR_TEST_INFO_HEADER, 2, 2, 24, 0, 0, { 0 }, 0, NULL, pixels, sizeof(pixels) };
+
+	size_t size = 0;
+	BYTE* data = EasyAvatar_BuildDIB(&dib, &size);
+	EASYAVATAR_CHECK(data != NULL);
+	if (!data)
+		return;
+
+	// Missing the last byte of the pixels
+	EASYAVATAR_CHECK(EasyAvatar_LoadDIB(data, size - 1) == NULL);
+	// Shorter than the header
+	EASYAVATAR_CHECK(EasyAvatar_LoadDIB(data, EASYAVATAR_TEST_INFO_HEADER - 1) == NULL);
+
+	// RLE8 is compressed
+	EasyAvatar_Write32(data + 16, 1);
+	EASYAVATAR_CHECK(EasyAvatar_LoadDIB(data, size) == NULL);
+	EasyAvatar_Write32(data + 16, 0);
+
+	// Claims more pixels than we ever decode
+	EasyAvatar_Write32(data + 4, 100000);
+	EasyAvatar_Write32(data + 8, 100000);
+	EASYAVATAR_CHECK(EasyAvatar_LoadDIB(data, size) == NULL);
+
+	// Zero width
+	EasyAvatar_Write32(data + 4, 0);
+	EASYAVATAR_CHECK(EasyAvatar_LoadDIB(data, size) == NULL);
+	free(data);
+}
+
+int main(void)
+{
+	EasyAvatar_TestBottomUp();
+	EasyAvatar_TestTopDown();
+	EasyAvatar_TestBitfields565();
+	EasyAvatar_TestBitfieldsV5Alpha();
+	EasyAvatar_TestUnsetAlpha();
+	EasyAvatar_TestPalettes();
+	EasyAvatar_TestMalformed();
+	return EASYAVATAR_TEST_RESULT;
+}
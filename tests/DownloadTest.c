@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Check.h"
+#include "DownloadResponse.h"
+
+/*
+	Response served from memory in chunks of at most chunk bytes, every call into it advances the clock by tick milliseconds.
+*/
+struct EasyAvatar_FakeResponse
+{
+	DWORD status;
+	BOOL hasContentLength;
+	DWORD contentLength;
+	const BYTE* body;
+	size_t bodySize;
+	size_t position;
+	DWORD chunk;
+	// Fails the read with this result once that many bytes were served, EASYAVATAR_DOWNLOAD_OK never fails
+	enum EasyAvatar_DownloadResult failure;
+	size_t failAfter;
+	int reads;
+};
+
+static ULONGLONG EasyAvatar_FakeClock = 0;
+static ULONGLONG EasyAvatar_FakeTick = 0;
+static int EasyAvatar_CancelAfterReads = -1;
+static struct EasyAvatar_FakeResponse* EasyAvatar_CurrentResponse = NULL;
+
+static BOOL EasyAvatar_FakeGetStatus(void* context, DWORD* status)
+{
+	*status = ((struct EasyAvatar_FakeResponse*)context)->status;
+	return TRUE;
+}
+
+static BOOL EasyAvatar_FakeGetContentLength(void* context, DWORD* length)
+{
+	struct EasyAvatar_FakeResponse* response = (struct EasyAvatar_FakeResponse*)context;
+	*length = response->contentLength;
+	return response->hasContentLength;
+}
+
+static enum EasyAvatar_DownloadResult EasyAvatar_FakeQueryAvailable(void* context, DWORD* available)
+{
+	struct EasyAvatar_FakeResponse* response = (struct EasyAvatar_FakeResponse*)context;
+	EasyAvatar_FakeClock += EasyAvatar_FakeTick;
+	size_t left = response->bodySize - response->position;
+	*available = left < response->chunk ? (DWORD)left : response->chunk;
+	return EASYAVATAR_DOWNLOAD_OK;
+}
+
+static enum EasyAvatar_DownloadResult EasyAvatar_FakeRead(void* context, BYTE* target, DWORD size, DWORD* read)
+{
+	struct EasyAvatar_FakeResponse* response = (struct EasyAvatar_FakeResponse*)context;
+	EasyAvatar_FakeClock += EasyAvatar_FakeTick;
+	response->reads++;
+	if (response->failure != EASYAVATAR_DOWNLOAD_OK && response->position >= response->failAfter)
+		return response->failure;
+
+	size_t left = response->bodySize - response->position;
+	*read = left < size ? (DWORD)left : size;
+	memcpy(target, response->body + response->position, *read);
+	response->position += *read;
+	return EASYAVATAR_DOWNLOAD_OK;
+}
+
+static ULONGLONG EasyAvatar_FakeNow(void)
+{
+	return EasyAvatar_FakeClock;
+}
+
+static BOOL EasyAvatar_FakeIsCancelled(void)
+{
+	return EasyAvatar_CancelAfterReads >= 0 && EasyAvatar_CurrentResponse->reads >= EasyAvatar_CancelAfterReads;
+}
+
+static BYTE* EasyAvatar_MakeBody(size_t size)
+{
+	BYTE* body = (BYTE*)malloc(size);
+	for (size_t i = 0; body && i < size; i++)
+		body[i] = (BYTE)(i * 7 + (i >> 8));
+	return body;
+}
+
+/*
+	Reads response into a fresh buffer capped at limit, with a deadline 1000 ms from now.
+*/
+static enum EasyAvatar_DownloadResult EasyAvatar_ReadFake(struct EasyAvatar_FakeResponse* response, BOOL conditional, size_t limit, struct EasyAvatar_DownloadBuffer* buffer)
+{
+	struct EasyAvatar_DownloadTransport transport = { response, EasyAvatar_FakeGetStatus, EasyAvatar_FakeGetContentLength,
+		EasyAvatar_FakeQueryAvailable, EasyAvatar_FakeRead, EasyAvatar_FakeNow, EasyAvatar_FakeIsCancelled };
+	memset(buffer, 0, sizeof(*buffer));
+	buffer->limit = limit;
+	EasyAvatar_CurrentResponse = response;
+	return EasyAvatar_ReadDownloadResponse(&transport, EasyAvatar_FakeClock + 1000, conditional, buffer);
+}
+
+static void EasyAvatar_TestReserve(void)
+{
+	struct EasyAvatar_DownloadBuffer buffer = { NULL, 0, 0, 1000 * 1000 };
+
+	// Small reservations start with one 64 KB block and keep using it
+	BYTE* first = EasyAvatar_ReserveDownload(&buffer, 100);
+	EASYAVATAR_CHECK(first == buffer.data && buffer.capacity == 64 * 1024);
+	buffer.size = 100;
+	EASYAVATAR_CHECK(EasyAvatar_ReserveDownload(&buffer, 1000) == buffer.data + 100 && buffer.capacity == 64 * 1024);
+
+	// Growing doubles until it fits but never goes past the limit
+	buffer.size = 64 * 1024;
+	EASYAVATAR_CHECK(EasyAvatar_ReserveDownload(&buffer, 1) != NULL && buffer.capacity == 128 * 1024);
+	buffer.size = 128 * 1024;
+	EASYAVATAR_CHECK(EasyAvatar_ReserveDownload(&buffer, 1000 * 1000 - 128 * 1024) != NULL && buffer.capacity == 1000 * 1000);
+	EASYAVATAR_CHECK(EasyAvatar_ReserveDownload(&buffer, 1000 * 1000 - 128 * 1024 + 1) == NULL);
+	free(buffer.data);
+
+	// A Content-Length reservation allocates exactly once
+	struct EasyAvatar_DownloadBuffer exact = { NULL, 0, 0, 1000 * 1000 };
+	EASYAVATAR_CHECK(EasyAvatar_ReserveDownload(&exact, 200 * 1000) != NULL && exact.capacity == 256 * 1024);
+	free(exact.data);
+}
+
+static void EasyAvatar_TestBody(void)
+{
+	size_t size = 300 * 1000;
+	BYTE* body = EasyAvatar_MakeBody(size);
+	EASYAVATAR_CHECK(body != NULL);
+	if (!body)
+		return;
+
+	// Without a Content-Length the buffer grows as the chunks come in
+	struct EasyAvatar_FakeResponse unsized = { 200, FALSE, 0, body, size, 0, 10000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	struct EasyAvatar_DownloadBuffer buffer;
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&unsized, FALSE, 1000 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_OK);
+	EASYAVATAR_CHECK(buffer.size == size && memcmp(buffer.data, body, size) == 0);
+	free(buffer.data);
+
+	// With one the buffer is allocated once up front and never grows
+	struct EasyAvatar_FakeResponse sized = { 200, TRUE, (DWORD)size, body, size, 0, 200 * 1000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&sized, FALSE, 1000 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_OK);
+	EASYAVATAR_CHECK(buffer.size == size && buffer.capacity == 512 * 1024 && memcmp(buffer.data, body, size) == 0);
+	// Reads are capped at 64 KB even though the server has more at hand
+	EASYAVATAR_CHECK(sized.reads == (int)((size + 64 * 1024 - 1) / (64 * 1024)));
+	free(buffer.data);
+
+	// An empty body is no image
+	struct EasyAvatar_FakeResponse empty = { 200, TRUE, 0, body, 0, 0, 10000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&empty, FALSE, 1000 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_FAILED);
+	free(buffer.data);
+	free(body);
+}
+
+static void EasyAvatar_TestStatus(void)
+{
+	BYTE body[16] = { 0 };
+	struct EasyAvatar_DownloadBuffer buffer;
+
+	struct EasyAvatar_FakeResponse notModified = { 304, FALSE, 0, body, sizeof(body), 0, 16, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&notModified, TRUE, 1000, &buffer) == EASYAVATAR_DOWNLOAD_NOT_MODIFIED);
+	EASYAVATAR_CHECK(notModified.reads == 0 && buffer.data == NULL);
+
+	// Without validators a 304 makes no sense
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&notModified, FALSE, 1000, &buffer) == EASYAVATAR_DOWNLOAD_HTTP_ERROR);
+
+	struct EasyAvatar_FakeResponse notFound = { 404, FALSE, 0, body, sizeof(body), 0, 16, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&notFound, TRUE, 1000, &buffer) == EASYAVATAR_DOWNLOAD_HTTP_ERROR);
+	EASYAVATAR_CHECK(notFound.reads == 0 && buffer.data == NULL);
+}
+
+static void EasyAvatar_TestSizeCap(void)
+{
+	size_t size = 200 * 1000;
+	BYTE* body = EasyAvatar_MakeBody(size);
+	EASYAVATAR_CHECK(body != NULL);
+	if (!body)
+		return;
+
+	// An announced size over the cap is refused before anything is read or allocated
+	struct EasyAvatar_FakeResponse announced = { 200, TRUE, (DWORD)size, body, size, 0, 10000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	struct EasyAvatar_DownloadBuffer buffer;
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&announced, FALSE, 100 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_TOO_LARGE);
+	EASYAVATAR_CHECK(announced.reads == 0 && buffer.data == NULL);
+
+	// So is a body that turns out larger than the cap, the buffer never grows past it
+	struct EasyAvatar_FakeResponse unsized = { 200, FALSE, 0, body, size, 0, 10000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&unsized, FALSE, 100 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_TOO_LARGE);
+	EASYAVATAR_CHECK(buffer.capacity <= 100 * 1000 && buffer.size <= 100 * 1000);
+	free(buffer.data);
+
+	// And a server sending more than it announced
+	struct EasyAvatar_FakeResponse lying = { 200, TRUE, 1000, body, size, 0, 10000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&lying, FALSE, 100 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_TOO_LARGE);
+	EASYAVATAR_CHECK(buffer.capacity <= 100 * 1000);
+	free(buffer.data);
+
+	// Exactly at the cap is fine
+	struct EasyAvatar_FakeResponse exact = { 200, FALSE, 0, body, 100 * 1000, 0, 10000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&exact, FALSE, 100 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_OK);
+	EASYAVATAR_CHECK(buffer.size == 100 * 1000 && memcmp(buffer.data, body, buffer.size) == 0);
+	free(buffer.data);
+	free(body);
+}
+
+static void EasyAvatar_TestTimeoutAndCancel(void)
+{
+	size_t size = 100 * 1000;
+	BYTE* body = EasyAvatar_MakeBody(size);
+	EASYAVATAR_CHECK(body != NULL);
+	if (!body)
+		return;
+
+	// A server trickling 1 KB every 100 ms runs into the deadline after about a second
+	struct EasyAvatar_FakeResponse slow = { 200, FALSE, 0, body, size, 0, 1000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	struct EasyAvatar_DownloadBuffer buffer;
+	EasyAvatar_FakeTick = 50;
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&slow, FALSE, 1000 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_TIMEOUT);
+	EASYAVATAR_CHECK(slow.reads >= 9 && slow.reads <= 11);
+	free(buffer.data);
+	EasyAvatar_FakeTick = 0;
+
+	// A timeout of a single blocking read is passed on as well
+	struct EasyAvatar_FakeResponse stalled = { 200, FALSE, 0, body, size, 0, 1000, EASYAVATAR_DOWNLOAD_TIMEOUT, 5000, 0 };
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&stalled, FALSE, 1000 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_TIMEOUT);
+	EASYAVATAR_CHECK(stalled.position == 5000);
+	free(buffer.data);
+
+	// Cancelling the job stops the download between two reads
+	struct EasyAvatar_FakeResponse cancelled = { 200, FALSE, 0, body, size, 0, 1000, EASYAVATAR_DOWNLOAD_OK, 0, 0 };
+	EasyAvatar_CancelAfterReads = 3;
+	EASYAVATAR_CHECK(EasyAvatar_ReadFake(&cancelled, FALSE, 1000 * 1000, &buffer) == EASYAVATAR_DOWNLOAD_CANCELLED);
+	EASYAVATAR_CHECK(cancelled.reads == 3);
+	free(buffer.data);
+	EasyAvatar_CancelAfterReads = -1;
+	free(body);
+}
+
+static void EasyAvatar_TestNoStore(void)
+{
+	EASYAVATAR_CHECK(EasyAvatar_HasNoStore("no-store"));
+	EASYAVATAR_CHECK(EasyAvatar_HasNoStore("private, No-Store"));
+	EASYAVATAR_CHECK(EasyAvatar_HasNoStore("max-age=0,no-store ,must-revalidate"));
+	EASYAVATAR_CHECK(!EasyAvatar_HasNoStore(""));
+	EASYAVATAR_CHECK(!EasyAvatar_HasNoStore("private, max-age=3600"));
+	EASYAVATAR_CHECK(!EasyAvatar_HasNoStore("no-store-ish, x-no-store"));
+	// Only directive names count, not their arguments
+	EASYAVATAR_CHECK(!EasyAvatar_HasNoStore("no-cache=\"no-store, x\""));
+	EASYAVATAR_CHECK(EasyAvatar_HasNoStore("no-cache=\"a, b\", no-store"));
+}
+
+int main(void)
+{
+	EasyAvatar_TestReserve();
+	EasyAvatar_TestBody();
+	EasyAvatar_TestStatus();
+	EasyAvatar_TestSizeCap();
+	EasyAvatar_TestTimeoutAndCancel();
+	EasyAvatar_TestNoStore();
+	return EASYAVATAR_TEST_RESULT;
+}
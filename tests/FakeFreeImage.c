@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <Windows.h>
+
+#include "FreeImage.h"
+
+/*
+	Test double for the handful of FreeImage functions the bitmap readers call, so they can be tested without the library.
+	Bitmaps are plain bottom-up pixel buffers with rows padded to 4 bytes, like FreeImage's own.
+*/
+struct EasyAvatar_FakeBitmap
+{
+	unsigned int width;
+	unsigned int height;
+	unsigned int bpp;
+	unsigned int pitch;
+	BYTE* bits;
+	// Only 8 bit bitmaps have one
+	RGBQUAD palette[256];
+};
+
+static struct EasyAvatar_FakeBitmap* EasyAvatar_GetFakeBitmap(FIBITMAP* dib)
+{
+	return dib ? (struct EasyAvatar_FakeBitmap*)dib->data : NULL;
+}
+
+FIBITMAP* DLL_CALLCONV FreeImage_Allocate(int width, int height, int bpp, unsigned red_mask, unsigned green_mask, unsigned blue_mask)
+{
+	(void)red_mask;
+	(void)green_mask;
+	(void)blue_mask;
+	if (width <= 0 || height <= 0 || (bpp != 8 && bpp != 24 && bpp != 32))
+		return NULL;
+
+	FIBITMAP* dib = (FIBITMAP*)malloc(sizeof(FIBITMAP));
+	struct EasyAvatar_FakeBitmap* bitmap = (struct EasyAvatar_FakeBitmap*)calloc(1, sizeof(struct EasyAvatar_FakeBitmap));
+	if (!dib || !bitmap)
+	{
+		free(dib);
+		free(bitmap);
+		return NULL;
+	}
+
+	bitmap->width = (unsigned int)width;
+	bitmap->height = (unsigned int)height;
+	bitmap->bpp = (unsigned int)bpp;
+	bitmap->pitch = ((unsigned int)width * (unsigned int)bpp + 31) / 32 * 4;
+	bitmap->bits = (BYTE*)calloc((size_t)bitmap->pitch * bitmap->height, 1);
+	if (!bitmap->bits)
+	{
+		free(dib);
+		free(bitmap);
+		return NULL;
+	}
+
+	dib->data = bitmap;
+	return dib;
+}
+
+void DLL_CALLCONV FreeImage_Unload(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	if (bitmap)
+		free(bitmap->bits);
+	free(bitmap);
+	free(dib);
+}
+
+BYTE* DLL_CALLCONV FreeImage_GetScanLine(FIBITMAP* dib, int scanline)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	if (!bitmap || scanline < 0 || (unsigned int)scanline >= bitmap->height)
+		return NULL;
+	return bitmap->bits + (size_t)scanline * bitmap->pitch;
+}
+
+BYTE* DLL_CALLCONV FreeImage_GetBits(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	return bitmap ? bitmap->bits : NULL;
+}
+
+unsigned DLL_CALLCONV FreeImage_GetWidth(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	return bitmap ? bitmap->width : 0;
+}
+
+unsigned DLL_CALLCONV FreeImage_GetHeight(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	return bitmap ? bitmap->height : 0;
+}
+
+unsigned DLL_CALLCONV FreeImage_GetBPP(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	return bitmap ? bitmap->bpp : 0;
+}
+
+unsigned DLL_CALLCONV FreeImage_GetPitch(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	return bitmap ? bitmap->pitch : 0;
+}
+
+RGBQUAD* DLL_CALLCONV FreeImage_GetPalette(FIBITMAP* dib)
+{
+	struct EasyAvatar_FakeBitmap* bitmap = EasyAvatar_GetFakeBitmap(dib);
+	return bitmap && bitmap->bpp == 8 ? bitmap->palette : NULL;
+}
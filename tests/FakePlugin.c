@@ -0,0 +1,29 @@
+#include "EasyAvatar.h"
+#include "Worker.h"
+
+/*
+	Stand-ins for the parts of EasyAvatar.c and Worker.c the image code calls into, which can't be linked without the TeamSpeak client.
+	The target size follows the same rule as the plugin, nothing ever gets cancelled.
+*/
+void EasyAvatar_GetTargetSize(unsigned int width, unsigned int height, unsigned int* targetW, unsigned int* targetH)
+{
+	float aspectRatio = (float)width / (float)height;
+	*targetW = width;
+	*targetH = height;
+
+	if (width > EASYAVATAR_MAX_DIMENSION)
+	{
+		*targetW = EASYAVATAR_MAX_DIMENSION;
+		*targetH = (unsigned int)(*targetW / aspectRatio);
+	}
+	else if (height > EASYAVATAR_MAX_DIMENSION)
+	{
+		*targetH = EASYAVATAR_MAX_DIMENSION;
+		*targetW = (unsigned int)(*targetH * aspectRatio);
+	}
+}
+
+BOOL EasyAvatar_IsJobCancelled(void)
+{
+	return FALSE;
+}
@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Check.h"
+#include "ImageIO.h"
+#include "ImageProbe.h"
+#include "PNGStream.h"
+#include "Worker.h"
+
+BOOL EasyAvatar_IsJobCancelled(void)
+{
+	return FALSE;
+}
+
+/*
+	A PNG assembled in memory, the image data goes into a single stored deflate block.
+	CRCs are left zero, neither the probe nor the stream check them.
+*/
+struct EasyAvatar_TestPNG
+{
+	BYTE data[4096];
+	size_t size;
+};
+
+static void EasyAvatar_PutBig32(BYTE* out, DWORD value)
+{
+	out[0] = (BYTE)(value >> 24);
+	out[1] = (BYTE)(value >> 16);
+	out[2] = (BYTE)(value >> 8);
+	out[3] = (BYTE)value;
+}
+
+static void EasyAvatar_AddTestChunk(struct EasyAvatar_TestPNG* png, const char* type, const BYTE* data, DWORD length)
+{
+	EasyAvatar_PutBig32(png->data + png->size, length);
+	memcpy(png->data + png->size + 4, type, 4);
+	if (length)
+		memcpy(png->data + png->size + 8, data, length);
+	memset(png->data + png->size + 8 + length, 0, 4);
+	png->size += 12 + (size_t)length;
+}
+
+/*
+	Builds a non-interlaced PNG from rowCount rows of rowBytes unfiltered bytes each,
+	with a PLTE of paletteCount entries if paletteCount isn't 0.
+*/
+static void EasyAvatar_BuildTestPNG(struct EasyAvatar_TestPNG* png, DWORD width, DWORD height, BYTE depth, BYTE colorType,
+	const RGBTRIPLE* palette, unsigned int paletteCount, const BYTE* rows, unsigned int rowCount, size_t rowBytes)
+{
+	static const BYTE signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	BYTE header[13] = { 0 };
+	BYTE buffer[1024];
+
+	memcpy(png->data, signature, sizeof(signature));
+	png->size = sizeof(signature);
+
+	EasyAvatar_PutBig32(header, width);
+	EasyAvatar_PutBig32(header + 4, height);
+	header[8] = depth;
+	header[9] = colorType;
+	EasyAvatar_AddTestChunk(png, "IHDR", header, sizeof(header));
+
+	if (paletteCount)
+	{
+		for (unsigned int i = 0; i < paletteCount; i++)
+		{
+			buffer[3 * i] = palette[i].rgbtRed;
+			buffer[3 * i + 1] = palette[i].rgbtGreen;
+			buffer[3 * i + 2] = palette[i].rgbtBlue;
+		}
+		EasyAvatar_AddTestChunk(png, "PLTE", buffer, paletteCount * 3);
+	}
+
+	// zlib header, then one final stored block holding every row behind a None filter byte
+	size_t length = rowCount * (rowBytes + 1);
+	BYTE* out = buffer;
+	*out++ = 0x78;
+	*out++ = 0x01;
+	*out++ = 0x01;
+	*out++ = (BYTE)length;
+	*out++ = (BYTE)(length >> 8);
+	*out++ = (BYTE)~length;
+	*out++ = (BYTE)(~length >> 8);
+	DWORD a = 1;
+	DWORD b = 0;
+	for (unsigned int y = 0; y < rowCount; y++)
+	{
+		*out = 0;
+		memcpy(out + 1, rows + y * rowBytes, rowBytes);
+		for (size_t i = 0; i <= rowBytes; i++)
+		{
+			a = (a + out[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		out += rowBytes + 1;
+	}
+	EasyAvatar_PutBig32(out, (b << 16) | a);
+	out += 4;
+	EasyAvatar_AddTestChunk(png, "IDAT", buffer, (DWORD)(out - buffer));
+	EasyAvatar_AddTestChunk(png, "IEND", NULL, 0);
+}
+
+static BOOL EasyAvatar_ProbeTestPNG(const struct EasyAvatar_TestPNG* png, struct EasyAvatar_ImageInfo* info)
+{
+	FreeImageIO io;
+	struct EasyAvatar_MemoryReader reader;
+	EasyAvatar_OpenMemoryReader(&reader, &io, png->data, png->size);
+	return EasyAvatar_ProbeImage(&io, &reader, info);
+}
+
+static FIBITMAP* EasyAvatar_DecodeTestPNG(const struct EasyAvatar_TestPNG* png, unsigned int width, unsigned int height)
+{
+	FreeImageIO io;
+	struct EasyAvatar_MemoryReader reader;
+	EasyAvatar_OpenMemoryReader(&reader, &io, png->data, png->size);
+	return EasyAvatar_DecodePNGStream(&io, &reader, width, height);
+}
+
+/*
+	Checks the pixel x, y counted from the top of the image, FreeImage keeps its rows bottom-up.
+*/
+static BOOL EasyAvatar_HasPixel(FIBITMAP* dib, unsigned int x, unsigned int y, BYTE red, BYTE green, BYTE blue)
+{
+	unsigned int bytesPerPixel = FreeImage_GetBPP(dib) / 8;
+	const BYTE* pixel = FreeImage_GetScanLine(dib, (int)(FreeImage_GetHeight(dib) - 1 - y)) + x * bytesPerPixel;
+	return pixel[FI_RGBA_RED] == red && pixel[FI_RGBA_GREEN] == green && pixel[FI_RGBA_BLUE] == blue;
+}
+
+static void EasyAvatar_TestIllegalDepths(void)
+{
+	// Depths PNG doesn't allow for the color type, in a header large enough to be streamed
+	static const BYTE headers[][2] =
+	{
+		{ 0, 0 },
+		{ 16, 3 },
+		{ 3, 0 },
+		{ 4, 2 },
+		{ 1, 6 },
+		{ 8, 5 }
+	};
+	static const RGBTRIPLE palette[1] = { { 0, 0, 255 } };
+	static const BYTE row[8] = { 0 };
+
+	for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i++)
+	{
+		struct EasyAvatar_TestPNG png;
+		struct EasyAvatar_ImageInfo info;
+		BYTE depth = headers[i][0];
+		BYTE colorType = headers[i][1];
+		EasyAvatar_BuildTestPNG(&png, 3000, 2000, depth, colorType, palette, colorType == 3 ? 1 : 0, row, 1, sizeof(row));
+
+		EASYAVATAR_CHECK(!EasyAvatar_ProbeTestPNG(&png, &info));
+		FIBITMAP* dib = EasyAvatar_DecodeTestPNG(&png, 300, 200);
+		EASYAVATAR_CHECK(dib == NULL);
+		if (dib)
+			FreeImage_Unload(dib);
+	}
+}
+
+static void EasyAvatar_TestPalette(void)
+{
+	static const RGBTRIPLE palette[2] = { { 0, 0, 255 }, { 0, 255, 0 } };
+	// Indices 5 and 255 point past the two PLTE entries
+	static const BYTE rows[2][4] = { { 0, 1, 5, 255 }, { 1, 0, 1, 0 } };
+	struct EasyAvatar_TestPNG png;
+	struct EasyAvatar_ImageInfo info;
+
+	EasyAvatar_BuildTestPNG(&png, 4, 2, 8, 3, palette, 2, &rows[0][0], 2, 4);
+	EASYAVATAR_CHECK(EasyAvatar_ProbeTestPNG(&png, &info));
+	EASYAVATAR_CHECK(info.format == FIF_PNG && info.width == 4 && info.height == 2);
+
+	FIBITMAP* dib = EasyAvatar_DecodeTestPNG(&png, 4, 2);
+	EASYAVATAR_CHECK(dib != NULL);
+	if (dib)
+	{
+		EASYAVATAR_CHECK(FreeImage_GetWidth(dib) == 4 && FreeImage_GetHeight(dib) == 2 && FreeImage_GetBPP(dib) == 24);
+		EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 0, 0, 255, 0, 0));
+		EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 1, 0, 0, 255, 0));
+		// Out of range indices get the last entry
+		EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 2, 0, 0, 255, 0));
+		EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 3, 0, 0, 255, 0));
+		EASYAVATAR_CHECK(EasyAvatar_HasPixel(dib, 1, 1, 255, 0, 0));
+		FreeImage_Unload(dib);
+	}
+
+	// A palette image has to come with a palette
+	EasyAvatar_BuildTestPNG(&png, 4, 2, 8, 3, palette, 0, &rows[0][0], 2, 4);
+	dib = EasyAvatar_DecodeTestPNG(&png, 4, 2);
+	EASYAVATAR_CHECK(dib == NULL);
+	if (dib)
+		FreeImage_Unload(dib);
+}
+
+static void EasyAvatar_TestGreyscale(void)
+{
+	// 2 bit greyscale, four samples per byte from the most significant bits down
+	static const BYTE rows[2][1] = { { 0x1B }, { 0xE4 } };
+	struct EasyAvatar_TestPNG png;
+
+	EasyAvatar_BuildTestPNG(&png, 4, 2, 2, 0, NULL, 0, &rows[0][0], 2, 1);
+	FIBITMAP* dib = EasyAvatar_DecodeTestPNG(&png, 4, 2);
+	EASYAVATAR_CHECK(dib != NULL);
+	if (dib)
+	{
+		EASYAVATAR_CHECK(FreeImage_GetBPP(dib) == 8);
+		const BYTE* top = FreeImage_GetScanLine(dib, 1);
+		const BYTE* bottom = FreeImage_GetScanLine(dib, 0);
+		EASYAVATAR_CHECK(top[0] == 0 && top[1] == 85 && top[2] == 170 && top[3] == 255);
+		EASYAVATAR_CHECK(bottom[0] == 255 && bottom[1] == 170 && bottom[2] == 85 && bottom[3] == 0);
+		FreeImage_Unload(dib);
+	}
+}
+
+int main(void)
+{
+	EasyAvatar_TestIllegalDepths();
+	EasyAvatar_TestPalette();
+	EasyAvatar_TestGreyscale();
+	return EASYAVATAR_TEST_RESULT;
+}
@@ -0,0 +1,252 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Check.h"
+#include "Prefetch.h"
+#include "../TeamSpeakSDK/teamspeak/public_errors.h"
+#include "../TeamSpeakSDK/ts3_functions.h"
+
+/*
+	Stand-ins for the clipboard, the worker and the pipeline Prefetch.c talks to.
+	The clipboard holds a single URL, fingerprinted with a simple string hash.
+*/
+static const char* fakeClipboardText = NULL;
+static void (*fakeOnChange)(void) = NULL;
+static BOOL fakeStartFails = FALSE;
+static int fakeStarts = 0;
+static int fakeStops = 0;
+static int queuedPrefetches = 0;
+static int preparedAvatars = 0;
+
+static UINT64 EasyAvatar_FakeFingerprint(const char* text)
+{
+	UINT64 hash = 5381;
+	for (; *text; text++)
+		hash = hash * 33 + (unsigned char)*text;
+	return hash;
+}
+
+static BOOL EasyAvatar_FakeStart(void (*onChange)(void))
+{
+	fakeStarts++;
+	if (fakeStartFails)
+		return FALSE;
+	fakeOnChange = onChange;
+	return TRUE;
+}
+
+static void EasyAvatar_FakeStop(void)
+{
+	fakeStops++;
+	fakeOnChange = NULL;
+}
+
+static BOOL EasyAvatar_FakeGetContent(struct EasyAvatar_ClipboardContent* content, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	(void)serverConnectionHandlerID;
+	(void)ts3Functions;
+	memset(content, 0, sizeof(*content));
+	if (!fakeClipboardText)
+		return FALSE;
+
+	size_t length = strlen(fakeClipboardText);
+	content->url = (char*)malloc(length + 1);
+	if (!content->url)
+		return FALSE;
+	memcpy(content->url, fakeClipboardText, length + 1);
+	content->fingerprint = EasyAvatar_FakeFingerprint(fakeClipboardText);
+	return TRUE;
+}
+
+static const struct EasyAvatar_ClipboardProvider EasyAvatar_FakeClipboard =
+{
+	EasyAvatar_FakeStart,
+	EasyAvatar_FakeStop,
+	EasyAvatar_FakeGetContent
+};
+
+BOOL EasyAvatar_QueuePrefetch(void)
+{
+	queuedPrefetches++;
+	return TRUE;
+}
+
+void EasyAvatar_ReleaseImage(struct EasyAvatar_Image* image)
+{
+	free(image->data);
+	memset(image, 0, sizeof(*image));
+}
+
+void EasyAvatar_ReleaseClipboardContent(struct EasyAvatar_ClipboardContent* content)
+{
+	free(content->url);
+	free(content->path);
+	memset(content, 0, sizeof(*content));
+}
+
+// The "avatar" is the URL itself, its hash a fixed string
+char* EasyAvatar_PrepareAvatar(struct EasyAvatar_ClipboardContent* content, struct EasyAvatar_Image* image, uint64 serverConnectionHandlerID, struct TS3Functions* ts3Functions)
+{
+	(void)serverConnectionHandlerID;
+	(void)ts3Functions;
+	preparedAvatars++;
+	size_t length = strlen(content->url);
+	char* hash = (char*)calloc(MD5LEN * 2 + 1, 1);
+	image->data = (BYTE*)malloc(length);
+	image->size = length;
+	if (!hash || !image->data)
+	{
+		free(hash);
+		EasyAvatar_ReleaseImage(image);
+		return NULL;
+	}
+
+	memcpy(image->data, content->url, length);
+	memset(hash, 'a', MD5LEN * 2);
+	return hash;
+}
+
+static unsigned int EasyAvatar_FakeLogMessage(const char* logMessage, enum LogLevel severity, const char* channel, uint64 logID)
+{
+	(void)logMessage;
+	(void)severity;
+	(void)channel;
+	(void)logID;
+	return ERROR_ok;
+}
+
+static unsigned int EasyAvatar_FakeFreeMemory(void* pointer)
+{
+	free(pointer);
+	return ERROR_ok;
+}
+
+static struct TS3Functions ts3Functions;
+
+static void EasyAvatar_TestListener(void)
+{
+	// Nothing listens to the clipboard until it is started
+	EASYAVATAR_CHECK(!EasyAvatar_IsClipboardListenerRunning());
+	EASYAVATAR_CHECK(fakeStarts == 0);
+
+	// Without a provider there is nothing to start
+	EASYAVATAR_CHECK(!EasyAvatar_StartClipboardListener(&ts3Functions));
+
+	EasyAvatar_SetClipboardProvider(&EasyAvatar_FakeClipboard);
+	EASYAVATAR_CHECK(EasyAvatar_StartClipboardListener(&ts3Functions));
+	EASYAVATAR_CHECK(EasyAvatar_IsClipboardListenerRunning() && fakeStarts == 1);
+
+	// Starting twice keeps the one listener
+	EASYAVATAR_CHECK(EasyAvatar_StartClipboardListener(&ts3Functions));
+	EASYAVATAR_CHECK(fakeStarts == 1);
+
+	// Every change queues a prefetch
+	EASYAVATAR_CHECK(fakeOnChange != NULL);
+	if (fakeOnChange)
+	{
+		fakeOnChange();
+		fakeOnChange();
+	}
+	EASYAVATAR_CHECK(queuedPrefetches == 2);
+
+	EasyAvatar_StopClipboardListener();
+	EASYAVATAR_CHECK(!EasyAvatar_IsClipboardListenerRunning() && fakeStops == 1 && fakeOnChange == NULL);
+	EasyAvatar_StopClipboardListener();
+	EASYAVATAR_CHECK(fakeStops == 1);
+
+	// A provider that can't listen leaves the listener off
+	fakeStartFails = TRUE;
+	EASYAVATAR_CHECK(!EasyAvatar_StartClipboardListener(&ts3Functions));
+	EASYAVATAR_CHECK(!EasyAvatar_IsClipboardListenerRunning());
+	fakeStartFails = FALSE;
+}
+
+static void EasyAvatar_TestCandidates(void)
+{
+	struct EasyAvatar_ClipboardContent content;
+	memset(&content, 0, sizeof(content));
+
+	// Copied images and data URIs
+	EASYAVATAR_CHECK(EasyAvatar_IsPrefetchCandidate(&content));
+
+	content.url = "https://example.com/cat.PNG?size=large#top";
+	EASYAVATAR_CHECK(EasyAvatar_IsPrefetchCandidate(&content));
+	content.url = "https://example.com/page.html";
+	EASYAVATAR_CHECK(!EasyAvatar_IsPrefetchCandidate(&content));
+	content.url = "ftp://example.com/cat.png";
+	EASYAVATAR_CHECK(!EasyAvatar_IsPrefetchCandidate(&content));
+	content.url = "just some text.png";
+	EASYAVATAR_CHECK(!EasyAvatar_IsPrefetchCandidate(&content));
+
+	content.url = NULL;
+	content.path = "C:\\Users\\me\\Pictures\\cat.jpeg";
+	EASYAVATAR_CHECK(EasyAvatar_IsPrefetchCandidate(&content));
+	content.path = "C:\\Users\\me\\notes.txt";
+	EASYAVATAR_CHECK(!EasyAvatar_IsPrefetchCandidate(&content));
+}
+
+static void EasyAvatar_TestPrefetch(void)
+{
+	EasyAvatar_SetClipboardProvider(&EasyAvatar_FakeClipboard);
+
+	// Text that isn't an image is left alone
+	fakeClipboardText = "https://example.com/page.html";
+	EasyAvatar_PrefetchAvatar(&ts3Functions);
+	EASYAVATAR_CHECK(preparedAvatars == 0);
+
+	const char* url = "https://example.com/cat.png";
+	fakeClipboardText = url;
+	EasyAvatar_PrefetchAvatar(&ts3Functions);
+	EASYAVATAR_CHECK(preparedAvatars == 1);
+
+	// Copying the same thing again needs no new work
+	EasyAvatar_PrefetchAvatar(&ts3Functions);
+	EASYAVATAR_CHECK(preparedAvatars == 1);
+
+	// The hotkey gets its own copy of the avatar, as often as it asks
+	struct EasyAvatar_Image image = { 0 };
+	char* hash = NULL;
+	for (int i = 0; i < 2; i++)
+	{
+		EASYAVATAR_CHECK(EasyAvatar_TakePrefetchedAvatar(EasyAvatar_FakeFingerprint(url), &image, &hash));
+		EASYAVATAR_CHECK(image.size == strlen(url) && image.data && memcmp(image.data, url, image.size) == 0);
+		EASYAVATAR_CHECK(hash && strlen(hash) == MD5LEN * 2);
+		EasyAvatar_ReleaseImage(&image);
+		free(hash);
+		hash = NULL;
+	}
+
+	// Other clipboard content is a miss
+	EASYAVATAR_CHECK(!EasyAvatar_TakePrefetchedAvatar(EasyAvatar_FakeFingerprint(url) + 1, &image, &hash));
+
+	// New content replaces the prefetched avatar, an unused one counts as discarded
+	fakeClipboardText = "https://example.com/dog.gif";
+	EasyAvatar_PrefetchAvatar(&ts3Functions);
+	fakeClipboardText = "https://example.com/bird.webp";
+	EasyAvatar_PrefetchAvatar(&ts3Functions);
+	EASYAVATAR_CHECK(preparedAvatars == 3);
+	EASYAVATAR_CHECK(!EasyAvatar_TakePrefetchedAvatar(EasyAvatar_FakeFingerprint(url), &image, &hash));
+
+	// Nothing on the clipboard, nothing to do
+	fakeClipboardText = NULL;
+	EasyAvatar_PrefetchAvatar(&ts3Functions);
+	EASYAVATAR_CHECK(preparedAvatars == 3);
+
+	LONG hits = 0;
+	LONG misses = 0;
+	LONG discarded = 0;
+	EasyAvatar_DiscardPrefetchedAvatar();
+	EasyAvatar_GetPrefetchStats(&hits, &misses, &discarded);
+	EASYAVATAR_CHECK(hits == 2 && misses == 2 && discarded == 2);
+}
+
+int main(void)
+{
+	ts3Functions.logMessage = EasyAvatar_FakeLogMessage;
+	ts3Functions.freeMemory = EasyAvatar_FakeFreeMemory;
+
+	EasyAvatar_TestListener();
+	EasyAvatar_TestCandidates();
+	EasyAvatar_TestPrefetch();
+	return EASYAVATAR_TEST_RESULT;
+}
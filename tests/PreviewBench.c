@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Bench.h"
+#include "EasyAvatar.h"
+#include "ImageIO.h"
+#include "ImageProbe.h"
+#include "Preview.h"
+#include "Resample.h"
+
+// The synthetic photo and the EXIF thumbnail embedded in it, large enough to cover the avatar size
+#define EASYAVATAR_BENCH_WIDTH 4032
+#define EASYAVATAR_BENCH_HEIGHT 3024
+#define EASYAVATAR_BENCH_THUMB_WIDTH 400
+#define EASYAVATAR_BENCH_THUMB_HEIGHT 300
+// "Exif\0\0" followed by a TIFF header, IFD0 with the orientation and IFD1 pointing at the thumbnail
+#define EASYAVATAR_BENCH_EXIF_HEADER 62
+
+struct EasyAvatar_BenchTotals
+{
+	unsigned int images;
+	unsigned int previews;
+	double fullSeconds;
+	double previewSeconds;
+};
+
+static FIBITMAP* EasyAvatar_BuildBenchPhoto(unsigned int width, unsigned int height)
+{
+	FIBITMAP* dib = FreeImage_Allocate(width, height, 24, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+	if (!dib)
+		return NULL;
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		BYTE* pixel = FreeImage_GetScanLine(dib, y);
+		for (unsigned int x = 0; x < width; x++, pixel += 3)
+		{
+			pixel[FI_RGBA_RED] = (BYTE)(x * 255 / (width - 1));
+			pixel[FI_RGBA_GREEN] = (BYTE)(y * 255 / (height - 1));
+			pixel[FI_RGBA_BLUE] = (BYTE)((x + y) * 255 / (width + height - 2));
+		}
+	}
+	return dib;
+}
+
+/*
+	Encodes a synthetic photo of the given size as a JPEG into a new buffer the caller frees.
+*/
+static BYTE* EasyAvatar_BuildBenchJPEGFile(unsigned int width, unsigned int height, size_t* size)
+{
+	BYTE* result = NULL;
+	FIBITMAP* dib = EasyAvatar_BuildBenchPhoto(width, height);
+	FIMEMORY* memory = FreeImage_OpenMemory(NULL, 0);
+	BYTE* data = NULL;
+	DWORD dataSize = 0;
+	if (dib && memory && FreeImage_SaveToMemory(FIF_JPEG, dib, memory, JPEG_QUALITYGOOD)
+		&& FreeImage_AcquireMemory(memory, &data, &dataSize) && dataSize > 4)
+	{
+		result = (BYTE*)malloc(dataSize);
+		if (result)
+		{
+			memcpy(result, data, dataSize);
+			*size = dataSize;
+		}
+	}
+
+	if (memory)
+		FreeImage_CloseMemory(memory);
+	if (dib)
+		FreeImage_Unload(dib);
+	return result;
+}
+
+static BYTE* EasyAvatar_PutLittle(BYTE* out, DWORD value, unsigned int bytes)
+{
+	for (unsigned int i = 0; i < bytes; i++)
+		*out++ = (BYTE)(value >> (8 * i));
+	return out;
+}
+
+/*
+	Builds a phone photo the way cameras write them: a full size JPEG with a smaller JPEG in its EXIF block.
+	The APP1 segment goes right after the JFIF header. The caller owns the returned buffer.
+*/
+static BYTE* EasyAvatar_BuildBenchJPEG(size_t* size)
+{
+	size_t photoSize = 0;
+	size_t thumbSize = 0;
+	BYTE* photo = EasyAvatar_BuildBenchJPEGFile(EASYAVATAR_BENCH_WIDTH, EASYAVATAR_BENCH_HEIGHT, &photoSize);
+	BYTE* thumb = EasyAvatar_BuildBenchJPEGFile(EASYAVATAR_BENCH_THUMB_WIDTH, EASYAVATAR_BENCH_THUMB_HEIGHT, &thumbSize);
+	size_t segment = 2 + EASYAVATAR_BENCH_EXIF_HEADER + thumbSize;
+	BYTE* result = photo && thumb && segment <= 0xFFFF ? (BYTE*)malloc(photoSize + 2 + segment) : NULL;
+	if (result)
+	{
+		size_t insert = 2;
+		if (photo[2] == 0xFF && photo[3] == 0xE0)
+			insert += 2 + (((size_t)photo[4] << 8) | photo[5]);
+
+		BYTE* out = result;
+		memcpy(out, photo, insert);
+		out += insert;
+		*out++ = 0xFF;
+		*out++ = 0xE1;
+		*out++ = (BYTE)(segment >> 8);
+		*out++ = (BYTE)segment;
+		memcpy(out, "Exif\0\0II*\0", 10);
+		out = EasyAvatar_PutLittle(out + 10, 8, 4);
+
+		// IFD0 at 8 holds the orientation, IFD1 at 26 the thumbnail which follows it at 56
+		out = EasyAvatar_PutLittle(out, 1, 2);
+		out = EasyAvatar_PutLittle(out, 0x0112, 2);
+		out = EasyAvatar_PutLittle(out, 3, 2);
+		out = EasyAvatar_PutLittle(out, 1, 4);
+		out = EasyAvatar_PutLittle(out, 1, 4);
+		out = EasyAvatar_PutLittle(out, 26, 4);
+		out = EasyAvatar_PutLittle(out, 2, 2);
+		out = EasyAvatar_PutLittle(out, 0x0201, 2);
+		out = EasyAvatar_PutLittle(out, 4, 2);
+		out = EasyAvatar_PutLittle(out, 1, 4);
+		out = EasyAvatar_PutLittle(out, EASYAVATAR_BENCH_EXIF_HEADER - 6, 4);
+		out = EasyAvatar_PutLittle(out, 0x0202, 2);
+		out = EasyAvatar_PutLittle(out, 4, 2);
+		out = EasyAvatar_PutLittle(out, 1, 4);
+		out = EasyAvatar_PutLittle(out, (DWORD)thumbSize, 4);
+		out = EasyAvatar_PutLittle(out, 0, 4);
+
+		memcpy(out, thumb, thumbSize);
+		out += thumbSize;
+		memcpy(out, photo + insert, photoSize - insert);
+		*size = photoSize + 2 + segment;
+	}
+
+	free(photo);
+	free(thumb);
+	return result;
+}
+
+/*
+	Turns the JPEG in data into an avatar sized bitmap the way the plugin does, from the best embedded preview if usePreview is set
+	and there is one, otherwise from the image itself. Returns NULL if usePreview is set and no preview covers the avatar size.
+*/
+static FIBITMAP* EasyAvatar_DecodeBenchJPEG(BYTE* data, size_t size, BOOL usePreview)
+{
+	FreeImageIO io;
+	struct EasyAvatar_MemoryReader reader;
+	struct EasyAvatar_ImageInfo info;
+	EasyAvatar_OpenMemoryReader(&reader, &io, data, size);
+	if (!EasyAvatar_ProbeImage(&io, &reader, &info) || info.format != FIF_JPEG)
+		return NULL;
+
+	unsigned int targetW;
+	unsigned int targetH;
+	EasyAvatar_GetTargetSize(info.width, info.height, &targetW, &targetH);
+
+	FIBITMAP* decoded = NULL;
+	if (usePreview)
+	{
+		unsigned int previewW;
+		unsigned int previewH;
+		decoded = EasyAvatar_LoadPreview(&io, &reader, &info, targetW, targetH, &previewW, &previewH);
+	}
+	else
+	{
+		int flags = EasyAvatar_ChooseDecodeStrategy(&info, targetW, targetH) == EASYAVATAR_DECODE_SCALED ? EasyAvatar_GetJPEGScaleFlags(info.width, info.height) : 0;
+		io.seek_proc(&reader, 0, SEEK_SET);
+		decoded = FreeImage_LoadFromHandle(FIF_JPEG, &io, &reader, flags);
+	}
+	if (!decoded)
+		return NULL;
+
+	FIBITMAP* resized = EasyAvatar_Resample(decoded, targetW, targetH, EASYAVATAR_FILTER_LANCZOS3);
+	FreeImage_Unload(decoded);
+	return resized;
+}
+
+/*
+	Times turning one JPEG into an avatar with and without its previews. Returns the number of rounds that failed.
+	requirePreview fails the image if it has no preview covering the avatar size.
+*/
+static int EasyAvatar_BenchPreview(const char* name, BYTE* data, size_t size, int rounds, BOOL requirePreview, struct EasyAvatar_BenchTotals* totals)
+{
+	int failures = 0;
+	BOOL hasPreview = TRUE;
+	double fullSeconds = 0.0;
+	double previewSeconds = 0.0;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	for (int round = 0; round < rounds; round++)
+	{
+		double start = EasyAvatar_BenchSeconds();
+		FIBITMAP* full = EasyAvatar_DecodeBenchJPEG(data, size, FALSE);
+		fullSeconds += EasyAvatar_BenchSeconds() - start;
+
+		start = EasyAvatar_BenchSeconds();
+		FIBITMAP* preview = EasyAvatar_DecodeBenchJPEG(data, size, TRUE);
+		previewSeconds += EasyAvatar_BenchSeconds() - start;
+
+		if (!full)
+			failures++;
+		else
+		{
+			width = FreeImage_GetWidth(full);
+			height = FreeImage_GetHeight(full);
+		}
+
+		// Both ways have to end up with the same avatar size
+		hasPreview = preview != NULL;
+		if (full && preview && (FreeImage_GetWidth(preview) != width || FreeImage_GetHeight(preview) != height))
+			failures++;
+		if (requirePreview && !preview)
+			failures++;
+
+		if (full)
+			FreeImage_Unload(full);
+		if (preview)
+			FreeImage_Unload(preview);
+	}
+
+	fullSeconds /= rounds;
+	previewSeconds /= rounds;
+	if (hasPreview)
+	{
+		printf("%s, %zu KB to %ux%u: full %8.2f ms  preview %8.2f ms  %5.1fx\n", name, size / 1024, width, height,
+			fullSeconds * 1000.0, previewSeconds * 1000.0, fullSeconds / previewSeconds);
+	}
+	else
+	{
+		printf("%s, %zu KB to %ux%u: full %8.2f ms  no usable preview\n", name, size / 1024, width, height, fullSeconds * 1000.0);
+	}
+
+	// Without a preview the plugin falls back to the full decode, which is what it costs then
+	totals->images++;
+	totals->previews += hasPreview;
+	totals->fullSeconds += fullSeconds;
+	totals->previewSeconds += hasPreview ? previewSeconds : fullSeconds;
+	return failures;
+}
+
+static int EasyAvatar_BenchPreviewFile(const char* path, int rounds, struct EasyAvatar_BenchTotals* totals)
+{
+	size_t size = 0;
+	BYTE* data = EasyAvatar_ReadBenchFile(path, &size);
+	if (!data)
+	{
+		fprintf(stderr, "Could not load %s\n", path);
+		return 1;
+	}
+
+	int failures = EasyAvatar_BenchPreview(path, data, size, rounds, FALSE, totals);
+	free(data);
+	return failures;
+}
+
+/*
+	Benchmarks every .jpg and .jpeg file directly inside directory.
+*/
+static int EasyAvatar_BenchPreviewDirectory(const char* directory, int rounds, struct EasyAvatar_BenchTotals* totals)
+{
+	char pattern[MAX_PATH];
+	if (snprintf(pattern, sizeof(pattern), "%s\\*", directory) >= (int)sizeof(pattern))
+		return 1;
+
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA(pattern, &entry);
+	if (find == INVALID_HANDLE_VALUE)
+		return 1;
+
+	int failures = 0;
+	do
+	{
+		const char* extension = strrchr(entry.cFileName, '.');
+		if ((entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || !extension || (_stricmp(extension, ".jpg") != 0 && _stricmp(extension, ".jpeg") != 0))
+			continue;
+
+		char path[MAX_PATH];
+		if (snprintf(path, sizeof(path), "%s\\%s", directory, entry.cFileName) < (int)sizeof(path))
+			failures += EasyAvatar_BenchPreviewFile(path, rounds, totals);
+	} while (FindNextFileA(find, &entry));
+
+	FindClose(find);
+	return failures;
+}
+
+/*
+	Usage: PreviewBench [rounds] [jpeg or directory...]
+	Turns every phone photo into an avatar from its full image and from its EXIF or MPF preview, prints the latency of both
+	and the average over the corpus. Without arguments a synthetic 4032x3024 photo with a 400x300 EXIF thumbnail is used.
+*/
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 5;
+	if (rounds <= 0)
+		return 1;
+
+	FreeImage_Initialise(FALSE);
+	int failures = 0;
+	struct EasyAvatar_BenchTotals totals = { 0 };
+	if (argc > 2)
+	{
+		for (int i = 2; i < argc; i++)
+		{
+			DWORD attributes = GetFileAttributesA(argv[i]);
+			if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
+				failures += EasyAvatar_BenchPreviewDirectory(argv[i], rounds, &totals);
+			else
+				failures += EasyAvatar_BenchPreviewFile(argv[i], rounds, &totals);
+		}
+	}
+	else
+	{
+		size_t size = 0;
+		BYTE* data = EasyAvatar_BuildBenchJPEG(&size);
+		failures += data ? EasyAvatar_BenchPreview("synthetic photo", data, size, rounds, TRUE, &totals) : 1;
+		free(data);
+	}
+	FreeImage_DeInitialise();
+
+	if (totals.images > 0)
+	{
+		printf("%u photos, %u with a usable preview: full %8.2f ms  with previews %8.2f ms on average\n", totals.images, totals.previews,
+			totals.fullSeconds * 1000.0 / totals.images, totals.previewSeconds * 1000.0 / totals.images);
+	}
+
+	if (failures)
+		fprintf(stderr, "%d decodes failed\n", failures);
+	return failures ? 1 : 0;
+}
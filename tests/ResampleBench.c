@@ -0,0 +1,207 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "Bench.h"
+#include "EasyAvatar.h"
+#include "Resample.h"
+
+// Mean difference per channel, out of 255, above which our filter and FreeImage's no longer compute the same thing
+#define EASYAVATAR_BENCH_MAX_DIFFERENCE 8.0
+
+struct EasyAvatar_BenchFilter
+{
+	const char* name;
+	enum EasyAvatar_ResampleFilter ours;
+	FREE_IMAGE_FILTER freeImage;
+};
+
+static const struct EasyAvatar_BenchFilter filters[] =
+{
+	{ "box", EASYAVATAR_FILTER_BOX, FILTER_BOX },
+	{ "catmull-rom", EASYAVATAR_FILTER_CATMULLROM, FILTER_CATMULLROM },
+	{ "lanczos3", EASYAVATAR_FILTER_LANCZOS3, FILTER_LANCZOS3 }
+};
+
+/*
+	A 4032x3024 phone photo stand-in: smooth gradients, 32 bit ones fading out towards the top.
+*/
+static FIBITMAP* EasyAvatar_BuildBenchPhoto(unsigned int bpp)
+{
+	const unsigned int width = 4032;
+	const unsigned int height = 3024;
+	FIBITMAP* dib = FreeImage_Allocate(width, height, bpp, FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+	if (!dib)
+		return NULL;
+
+	for (unsigned int y = 0; y < height; y++)
+	{
+		BYTE* pixel = FreeImage_GetScanLine(dib, y);
+		for (unsigned int x = 0; x < width; x++, pixel += bpp / 8)
+		{
+			pixel[FI_RGBA_RED] = (BYTE)(x * 255 / (width - 1));
+			pixel[FI_RGBA_GREEN] = (BYTE)(y * 255 / (height - 1));
+			pixel[FI_RGBA_BLUE] = (BYTE)((x + y) * 255 / (width + height - 2));
+			if (bpp == 32)
+				pixel[FI_RGBA_ALPHA] = (BYTE)(255 - y * 255 / (height - 1));
+		}
+	}
+	return dib;
+}
+
+/*
+	Loads an image the way the pipeline hands it to the resampler: 8 bit greyscale, 24 bit or 32 bit if it has transparency.
+*/
+static FIBITMAP* EasyAvatar_LoadBenchImage(const char* path)
+{
+	FREE_IMAGE_FORMAT format = FreeImage_GetFileType(path, 0);
+	if (format == FIF_UNKNOWN)
+		format = FreeImage_GetFIFFromFilename(path);
+	FIBITMAP* dib = format == FIF_UNKNOWN ? NULL : FreeImage_Load(format, path, 0);
+	if (!dib)
+		return NULL;
+
+	unsigned int bpp = FreeImage_GetBPP(dib);
+	if (FreeImage_GetImageType(dib) == FIT_BITMAP && (bpp == 24 || bpp == 32 || (bpp == 8 && FreeImage_GetColorType(dib) == FIC_MINISBLACK)))
+		return dib;
+
+	FIBITMAP* converted = FreeImage_IsTransparent(dib) ? FreeImage_ConvertTo32Bits(dib) : FreeImage_ConvertTo24Bits(dib);
+	FreeImage_Unload(dib);
+	return converted;
+}
+
+/*
+	Mean difference per channel between two bitmaps of the same size and depth.
+	32 bit pixels are compared premultiplied, the color under a transparent pixel is never seen.
+*/
+static double EasyAvatar_MeanDifference(FIBITMAP* a, FIBITMAP* b)
+{
+	unsigned int width = FreeImage_GetWidth(a);
+	unsigned int height = FreeImage_GetHeight(a);
+	unsigned int bytesPerPixel = FreeImage_GetBPP(a) / 8;
+	if (width != FreeImage_GetWidth(b) || height != FreeImage_GetHeight(b) || bytesPerPixel != FreeImage_GetBPP(b) / 8)
+		return INFINITY;
+
+	double sum = 0.0;
+	for (unsigned int y = 0; y < height; y++)
+	{
+		const BYTE* rowA = FreeImage_GetScanLine(a, y);
+		const BYTE* rowB = FreeImage_GetScanLine(b, y);
+		for (unsigned int x = 0; x < width * bytesPerPixel; x += bytesPerPixel)
+		{
+			for (unsigned int c = 0; c < bytesPerPixel; c++)
+			{
+				double valueA = rowA[x + c];
+				double valueB = rowB[x + c];
+				if (bytesPerPixel == 4 && c != FI_RGBA_ALPHA)
+				{
+					valueA = valueA * rowA[x + FI_RGBA_ALPHA] / 255.0;
+					valueB = valueB * rowB[x + FI_RGBA_ALPHA] / 255.0;
+				}
+				sum += fabs(valueA - valueB);
+			}
+		}
+	}
+	return sum / ((double)width * height * bytesPerPixel);
+}
+
+/*
+	Resizes dib to the avatar size with every filter, ours against FreeImage_Rescale, and prints the time per resize.
+	Returns the number of filters whose results disagree.
+*/
+static int EasyAvatar_BenchResample(const char* name, FIBITMAP* dib, int rounds)
+{
+	unsigned int width = FreeImage_GetWidth(dib);
+	unsigned int height = FreeImage_GetHeight(dib);
+	unsigned int longest = width > height ? width : height;
+	unsigned int targetW = width;
+	unsigned int targetH = height;
+	if (longest > EASYAVATAR_MAX_DIMENSION)
+	{
+		targetW = (unsigned int)((UINT64)width * EASYAVATAR_MAX_DIMENSION / longest);
+		targetH = (unsigned int)((UINT64)height * EASYAVATAR_MAX_DIMENSION / longest);
+		targetW = targetW ? targetW : 1;
+		targetH = targetH ? targetH : 1;
+	}
+
+	printf("%s, %ux%u %u bit to %ux%u\n", name, width, height, FreeImage_GetBPP(dib), targetW, targetH);
+	int failures = 0;
+	for (size_t f = 0; f < sizeof(filters) / sizeof(filters[0]); f++)
+	{
+		FIBITMAP* ours = NULL;
+		FIBITMAP* theirs = NULL;
+		double oursSeconds = 0.0;
+		double theirsSeconds = 0.0;
+		for (int round = 0; round < rounds; round++)
+		{
+			if (ours)
+				FreeImage_Unload(ours);
+			if (theirs)
+				FreeImage_Unload(theirs);
+
+			double start = EasyAvatar_BenchSeconds();
+			ours = EasyAvatar_Resample(dib, targetW, targetH, filters[f].ours);
+			oursSeconds += EasyAvatar_BenchSeconds() - start;
+
+			start = EasyAvatar_BenchSeconds();
+			theirs = FreeImage_Rescale(dib, (int)targetW, (int)targetH, filters[f].freeImage);
+			theirsSeconds += EasyAvatar_BenchSeconds() - start;
+		}
+
+		double difference = ours && theirs ? EasyAvatar_MeanDifference(ours, theirs) : INFINITY;
+		printf("  %-12s EasyAvatar %8.2f ms  FreeImage %8.2f ms  %5.1fx  difference %.2f\n", filters[f].name,
+			oursSeconds * 1000.0 / rounds, theirsSeconds * 1000.0 / rounds, theirsSeconds / oursSeconds, difference);
+		failures += !(difference <= EASYAVATAR_BENCH_MAX_DIFFERENCE);
+
+		if (ours)
+			FreeImage_Unload(ours);
+		if (theirs)
+			FreeImage_Unload(theirs);
+	}
+	return failures;
+}
+
+/*
+	Usage: ResampleBench [rounds] [image...]
+	Resizes every image to the avatar size with EasyAvatar_Resample and with FreeImage_Rescale using the same filter,
+	prints the time per resize and fails if the two results disagree. Without images a synthetic 24 bit and 32 bit photo are used.
+*/
+int main(int argc, char** argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 5;
+	if (rounds <= 0)
+		return 1;
+
+	FreeImage_Initialise(FALSE);
+	int failures = 0;
+	if (argc > 2)
+	{
+		for (int i = 2; i < argc; i++)
+		{
+			FIBITMAP* dib = EasyAvatar_LoadBenchImage(argv[i]);
+			if (!dib)
+			{
+				fprintf(stderr, "Could not load %s\n", argv[i]);
+				failures++;
+				continue;
+			}
+			failures += EasyAvatar_BenchResample(argv[i], dib, rounds);
+			FreeImage_Unload(dib);
+		}
+	}
+	else
+	{
+		for (unsigned int bpp = 24; bpp <= 32; bpp += 8)
+		{
+			FIBITMAP* dib = EasyAvatar_BuildBenchPhoto(bpp);
+			failures += dib ? EasyAvatar_BenchResample("synthetic photo", dib, rounds) : 1;
+			if (dib)
+				FreeImage_Unload(dib);
+		}
+	}
+	FreeImage_DeInitialise();
+
+	if (failures)
+		fprintf(stderr, "%d resizes failed or disagree with FreeImage\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdlib.h>
+#include <string.h>
+
+#include <Windows.h>
+
+// Header sizes of BITMAPINFOHEADER and BITMAPV5HEADER
+#define EASYAVATAR_TEST_INFO_HEADER 40
+#define EASYAVATAR_TEST_V5_HEADER 124
+
+/*
+	Everything needed to write a packed DIB like the clipboard hands it out.
+*/
+struct EasyAvatar_TestDIB
+{
+	unsigned int headerSize;
+	int width;
+	int height;
+	unsigned int bitCount;
+	unsigned int compression;
+	// Written behind a BITMAPINFOHEADER or into a BITMAPV5HEADER
+	unsigned int maskCount;
+	DWORD masks[4];
+	unsigned int paletteSize;
+	const RGBQUAD* palette;
+	// Rows in the order they are stored, each already padded to 4 bytes
+	const BYTE* pixels;
+	size_t pixelBytes;
+};
+
+static void EasyAvatar_Write16(BYTE* data, unsigned int value)
+{
+	data[0] = (BYTE)value;
+	data[1] = (BYTE)(value >> 8);
+}
+
+static void EasyAvatar_Write32(BYTE* data, DWORD value)
+{
+	data[0] = (BYTE)value;
+	data[1] = (BYTE)(value >> 8);
+	data[2] = (BYTE)(value >> 16);
+	data[3] = (BYTE)(value >> 24);
+}
+
+static BYTE* EasyAvatar_BuildDIB(const struct EasyAvatar_TestDIB* dib, size_t* size)
+{
+	size_t masksBehind = dib->headerSize == EASYAVATAR_TEST_INFO_HEADER ? dib->maskCount * 4 : 0;
+	*size = dib->headerSize + masksBehind + dib->paletteSize * 4 + dib->pixelBytes;
+	BYTE* data = (BYTE*)calloc(*size, 1);
+	if (!data)
+		return NULL;
+
+	EasyAvatar_Write32(data, dib->headerSize);
+	EasyAvatar_Write32(data + 4, (DWORD)dib->width);
+	EasyAvatar_Write32(data + 8, (DWORD)dib->height);
+	EasyAvatar_Write16(data + 12, 1);
+	EasyAvatar_Write16(data + 14, dib->bitCount);
+	EasyAvatar_Write32(data + 16, dib->compression);
+	EasyAvatar_Write32(data + 32, dib->paletteSize);
+	for (unsigned int i = 0; i < dib->maskCount; i++)
+		EasyAvatar_Write32(data + EASYAVATAR_TEST_INFO_HEADER + i * 4, dib->masks[i]);
+
+	BYTE* palette = data + dib->headerSize + masksBehind;
+	for (unsigned int i = 0; i < dib->paletteSize; i++)
+	{
+		palette[i * 4] = dib->palette[i].rgbBlue;
+		palette[i * 4 + 1] = dib->palette[i].rgbGreen;
+		palette[i * 4 + 2] = dib->palette[i].rgbRed;
+	}
+
+	memcpy(palette + dib->paletteSize * 4, dib->pixels, dib->pixelBytes);
+	return data;
+}
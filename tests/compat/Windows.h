@@ -0,0 +1,100 @@
+#pragma once
+/*
+	Just enough of <Windows.h> to build the platform independent parts of the plugin and their tests elsewhere.
+	Only on the include path when not building for Windows, the types match the portable ones in FreeImage.h.
+*/
+
+// Keeps FreeImage.h from defining the same types again
+#define _WINDOWS_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#ifndef FALSE
+#define FALSE 0
+#endif
+#ifndef TRUE
+#define TRUE 1
+#endif
+
+typedef int32_t BOOL;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+typedef uint32_t UINT32;
+typedef unsigned int UINT;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef void* HANDLE;
+
+#define MAXDWORD 0xffffffff
+
+#define _stricmp strcasecmp
+#define _strnicmp strncasecmp
+
+static inline LONG InterlockedExchange(volatile LONG* target, LONG value)
+{
+	return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedIncrement(volatile LONG* target)
+{
+	return __atomic_add_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedDecrement(volatile LONG* target)
+{
+	return __atomic_sub_fetch(target, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline LONG InterlockedCompareExchange(volatile LONG* target, LONG value, LONG comparand)
+{
+	__atomic_compare_exchange_n(target, &comparand, value, FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comparand;
+}
+
+// Same layout as FreeImage.h gives them outside Windows
+#pragma pack(push, 1)
+typedef struct tagRGBQUAD
+{
+	BYTE rgbBlue;
+	BYTE rgbGreen;
+	BYTE rgbRed;
+	BYTE rgbReserved;
+} RGBQUAD;
+
+typedef struct tagRGBTRIPLE
+{
+	BYTE rgbtBlue;
+	BYTE rgbtGreen;
+	BYTE rgbtRed;
+} RGBTRIPLE;
+#pragma pack(pop)
+
+typedef struct tagBITMAPINFOHEADER
+{
+	DWORD biSize;
+	LONG biWidth;
+	LONG biHeight;
+	WORD biPlanes;
+	WORD biBitCount;
+	DWORD biCompression;
+	DWORD biSizeImage;
+	LONG biXPelsPerMeter;
+	LONG biYPelsPerMeter;
+	DWORD biClrUsed;
+	DWORD biClrImportant;
+} BITMAPINFOHEADER;
+
+typedef struct tagBITMAPINFO
+{
+	BITMAPINFOHEADER bmiHeader;
+	RGBQUAD bmiColors[1];
+} BITMAPINFO;